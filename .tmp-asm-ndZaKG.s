@@ -0,0 +1,328 @@
+ .text
+ .globl fibbonacci
+fibbonacci:
+ push	%rbp
+ mov	%rsp, %rbp
+ mov	%rdi, %rax
+ sub	$4, %rsp
+ movl	%eax, (%rsp)
+ mov	$1, %eax
+ push	%rax
+ movl	-4(%rbp), %eax
+ pop	%rcx
+ cmp	%ecx, %eax
+ mov	$0, %eax
+ sete	%al
+ cmp	$0, %eax
+ je	_if_else_end_0
+ mov	$0, %eax
+ mov	%rbp, %rsp
+ pop	%rbp
+ ret
+_if_else_end_0:
+ mov	$3, %eax
+ push	%rax
+ movl	-4(%rbp), %eax
+ pop	%rcx
+ cmp	%ecx, %eax
+ mov	$0, %eax
+ setle	%al
+ cmp	$0, %eax
+ je	_if_else_end_1
+ mov	$1, %eax
+ mov	%rbp, %rsp
+ pop	%rbp
+ ret
+_if_else_end_1:
+ mov	$2, %eax
+ push	%rax
+ movl	-4(%rbp), %eax
+ pop	%rcx
+ sub	%ecx, %eax
+ push	%rax
+ pop	%rdi
+ call	fibbonacci
+ push	%rax
+ mov	$1, %eax
+ push	%rax
+ movl	-4(%rbp), %eax
+ pop	%rcx
+ sub	%ecx, %eax
+ push	%rax
+ pop	%rdi
+ call	fibbonacci
+ pop	%rcx
+ add	%ecx, %eax
+ mov	%rbp, %rsp
+ pop	%rbp
+ ret
+ add	$4, %rsp
+ mov	$0, %eax
+ mov	%rbp, %rsp
+ pop	%rbp
+ ret
+ .text
+ .globl getint
+getint:
+ push	%rbp
+ mov	%rsp, %rbp
+ sub	$4, %rsp
+ mov	$0, %eax
+ movl	%eax, -4(%rbp)
+ sub	$4, %rsp
+ mov	$0, %eax
+ movl	%eax, -8(%rbp)
+ sub	$4, %rsp
+ call	getchar
+ movl	%eax, -12(%rbp)
+_for_decl_condition_0:
+ mov	$0, %eax
+ push	%rax
+ movl	-12(%rbp), %eax
+ pop	%rcx
+ cmp	%ecx, %eax
+ mov	$0, %eax
+ setge	%al
+ cmp	$0, %eax
+ je	_for_decl_end_0
+ mov	$10, %eax
+ push	%rax
+ movl	-12(%rbp), %eax
+ pop	%rcx
+ cmp	%ecx, %eax
+ mov	$0, %eax
+ sete	%al
+ cmp	$0, %eax
+ je	_if_else_end_2
+ jmp  _for_decl_end_0
+_if_else_end_2:
+ mov	$48, %eax
+ push	%rax
+ movl	-12(%rbp), %eax
+ pop	%rcx
+ cmp	%ecx, %eax
+ mov	$0, %eax
+ setl	%al
+ cmp	$0, %eax
+ jne	_or_skip_2nd_clause_0
+ mov	$57, %eax
+ push	%rax
+ movl	-12(%rbp), %eax
+ pop	%rcx
+ cmp	%ecx, %eax
+ mov	$0, %eax
+ setg	%al
+ cmp	$0, %eax
+_or_skip_2nd_clause_0:
+ mov	$0, %eax
+ setne	%al
+ cmp	$0, %eax
+ je	_if_else_end_3
+ mov	$1, %eax
+ neg	%eax
+ mov	%rbp, %rsp
+ pop	%rbp
+ ret
+_if_else_end_3:
+ mov	$48, %eax
+ push	%rax
+ movl	-12(%rbp), %eax
+ pop	%rcx
+ sub	%ecx, %eax
+ movl	%eax, -12(%rbp)
+ mov	$10, %eax
+ push	%rax
+ movl	-4(%rbp), %eax
+ pop	%rcx
+ imul	%ecx, %eax
+ movl	%eax, -4(%rbp)
+ movl	-12(%rbp), %eax
+ push	%rax
+ movl	-4(%rbp), %eax
+ pop	%rcx
+ add	%ecx, %eax
+ movl	%eax, -4(%rbp)
+ mov	$1, %eax
+ movl	%eax, -8(%rbp)
+ add	$0, %rsp
+_for_decl_epilogue_0:
+ call	getchar
+ movl	%eax, -12(%rbp)
+ jmp	_for_decl_condition_0
+_for_decl_end_0:
+ add	$4, %rsp
+ movl	-8(%rbp), %eax
+ cmp	$0, %eax
+ je	_ternary_else_0
+ movl	-4(%rbp), %eax
+ jmp _ternary_end_0
+_ternary_else_0:
+ mov	$1, %eax
+ neg	%eax
+_ternary_end_0:
+ mov	%rbp, %rsp
+ pop	%rbp
+ ret
+ add	$8, %rsp
+ mov	$0, %eax
+ mov	%rbp, %rsp
+ pop	%rbp
+ ret
+ .text
+ .globl putint
+putint:
+ push	%rbp
+ mov	%rsp, %rbp
+ mov	%rdi, %rax
+ sub	$4, %rsp
+ movl	%eax, (%rsp)
+ mov	$0, %eax
+ push	%rax
+ movl	-4(%rbp), %eax
+ pop	%rcx
+ cmp	%ecx, %eax
+ mov	$0, %eax
+ setl	%al
+ cmp	$0, %eax
+ je	_if_else_end_4
+ mov	%rbp, %rsp
+ pop	%rbp
+ ret
+_if_else_end_4:
+ sub	$4, %rsp
+ mov	$1, %eax
+ movl	%eax, -8(%rbp)
+ sub	$4, %rsp
+ movl	-4(%rbp), %eax
+ movl	%eax, -12(%rbp)
+_for_decl_condition_1:
+ mov	$10, %eax
+ push	%rax
+ movl	-12(%rbp), %eax
+ pop	%rcx
+ cdq
+ idiv	%ecx
+ cmp	$0, %eax
+ je	_for_decl_end_1
+ mov	$10, %eax
+ push	%rax
+ movl	-8(%rbp), %eax
+ pop	%rcx
+ imul	%ecx, %eax
+ movl	%eax, -8(%rbp)
+_for_decl_epilogue_1:
+ mov	$10, %eax
+ push	%rax
+ movl	-12(%rbp), %eax
+ pop	%rcx
+ cdq
+ idiv	%ecx
+ movl	%eax, -12(%rbp)
+ jmp	_for_decl_condition_1
+_for_decl_end_1:
+ add	$4, %rsp
+_while_start_0:
+ movl	-8(%rbp), %eax
+ cmp	$0, %eax
+ je	_while_end_0
+ sub	$4, %rsp
+ movl	-8(%rbp), %eax
+ push	%rax
+ movl	-4(%rbp), %eax
+ pop	%rcx
+ cdq
+ idiv	%ecx
+ movl	%eax, -12(%rbp)
+ mov	$48, %eax
+ push	%rax
+ movl	-12(%rbp), %eax
+ pop	%rcx
+ add	%ecx, %eax
+ push	%rax
+ pop	%rdi
+ call	putchar
+ movl	-8(%rbp), %eax
+ push	%rax
+ movl	-12(%rbp), %eax
+ pop	%rcx
+ imul	%ecx, %eax
+ push	%rax
+ movl	-4(%rbp), %eax
+ pop	%rcx
+ sub	%ecx, %eax
+ movl	%eax, -4(%rbp)
+ mov	$10, %eax
+ push	%rax
+ movl	-8(%rbp), %eax
+ pop	%rcx
+ cdq
+ idiv	%ecx
+ movl	%eax, -8(%rbp)
+ add	$4, %rsp
+ jmp _while_start_0
+_while_end_0:
+ mov	$10, %eax
+ push	%rax
+ pop	%rdi
+ call	putchar
+ add	$8, %rsp
+ mov	%rbp, %rsp
+ pop	%rbp
+ ret
+ .text
+ .globl main
+main:
+ push	%rbp
+ mov	%rsp, %rbp
+ sub	$4, %rsp
+ call	getint
+ movl	%eax, -4(%rbp)
+ mov	$0, %eax
+ push	%rax
+ movl	-4(%rbp), %eax
+ pop	%rcx
+ cmp	%ecx, %eax
+ mov	$0, %eax
+ setle	%al
+ cmp	$0, %eax
+ je	_if_else_end_5
+ mov	$1, %eax
+ mov	%rbp, %rsp
+ pop	%rbp
+ ret
+_if_else_end_5:
+ sub	$4, %rsp
+ mov	$1, %eax
+ movl	%eax, -8(%rbp)
+_for_decl_condition_2:
+ movl	-4(%rbp), %eax
+ push	%rax
+ movl	-8(%rbp), %eax
+ pop	%rcx
+ cmp	%ecx, %eax
+ mov	$0, %eax
+ setle	%al
+ cmp	$0, %eax
+ je	_for_decl_end_2
+ movl	-8(%rbp), %eax
+ push	%rax
+ pop	%rdi
+ call	fibbonacci
+ push	%rax
+ pop	%rdi
+ call	putint
+_for_decl_epilogue_2:
+ movl	-8(%rbp), %eax
+ addl	$1, -8(%rbp)
+ jmp	_for_decl_condition_2
+_for_decl_end_2:
+ add	$4, %rsp
+ mov	$0, %eax
+ mov	%rbp, %rsp
+ pop	%rbp
+ ret
+ add	$4, %rsp
+ mov	$0, %eax
+ mov	%rbp, %rsp
+ pop	%rbp
+ ret
@@ -0,0 +1,503 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "util.h"
+#include "ast-cache.h"
+#include "lib/array.h"
+#include "lib/arena.h"
+#include "lib/sha1.h"
+#include "lib/tempfile.h"
+
+/*
+ * The format of a cache entry, in native byte order (entries are not meant to
+ * be shared among machines):
+ *
+ * - A struct cache_header.
+ * - A struct cache_item for each toplevel item.
+ * - The line table: `nr_lines` uint64_t offsets.
+ * - The names of the atoms 1 to `nr_atoms - 1`, each NUL-terminated.
+ * - For each item, its struct ast_node array and its ast_ref extra array.
+ *
+ * The arrays start at 8-byte aligned offsets, so that they can be used right
+ * from the mapped file.
+ */
+
+#define AST_CACHE_MAGIC "cc-ast"
+
+/* Bump it whenever the format, struct ast_node or the parser output changes. */
+#define AST_CACHE_VERSION 1
+
+struct cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t node_size;
+	uint64_t source_len;
+	uint64_t nr_lines;
+	uint64_t nr_atoms; /* Including ATOM_NONE. */
+	uint64_t names_len;
+	uint64_t nr_items;
+};
+
+struct cache_item {
+	uint64_t nodes_offset, extra_offset;
+	uint32_t nr_nodes, nr_extra;
+	uint32_t root, reserved;
+};
+
+static size_t align8(size_t size)
+{
+	return (size + 7) & ~(size_t)7;
+}
+
+static char *entry_path(const char *dir, const struct source_file *sf)
+{
+	struct sha1_ctx ctx;
+	unsigned char sha1[SHA1_RAWSZ];
+	char hex[SHA1_HEXSZ + 1];
+	uint32_t version = AST_CACHE_VERSION;
+
+	/*
+	 * Also hash the version, so that different compiler versions can
+	 * share a cache directory without overwriting each other's entries.
+	 */
+	sha1_init(&ctx);
+	sha1_update(&ctx, AST_CACHE_MAGIC, sizeof(AST_CACHE_MAGIC));
+	sha1_update(&ctx, &version, sizeof(version));
+	sha1_update(&ctx, sf->buf, sf->len);
+	sha1_final(&ctx, sha1);
+	sha1_to_hex(sha1, hex);
+	return xmkstr("%s/%s", dir, hex);
+}
+
+/*******************************************************************************
+ *				    Storing
+*******************************************************************************/
+
+/* Pads `len` bytes of data written to `fp` up to the next 8-byte boundary. */
+static void write_padding(FILE *fp, size_t len)
+{
+	static const char zeros[8];
+	fwrite(zeros, 1, align8(len) - len, fp);
+}
+
+static void write_entry(FILE *fp, const struct source_file *sf,
+			const struct token_source *src,
+			const struct ast_program *prog)
+{
+	struct cache_header hdr = {
+		.magic = AST_CACHE_MAGIC,
+		.version = AST_CACHE_VERSION,
+		.node_size = sizeof(struct ast_node),
+		.source_len = sf->len,
+		.nr_lines = src->nr_lines,
+		.nr_atoms = atom_table_size(&src->atoms),
+		.nr_items = prog->items.nr,
+	};
+	size_t offset;
+
+	for (atom_t atom = 1; atom < hdr.nr_atoms; atom++)
+		hdr.names_len += strlen(atom_name(&src->atoms, atom)) + 1;
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+
+	offset = sizeof(hdr) + st_mult(sizeof(struct cache_item), hdr.nr_items) +
+		 st_mult(sizeof(uint64_t), hdr.nr_lines) + align8(hdr.names_len);
+	for (size_t i = 0; i < prog->items.nr; i++) {
+		const struct ast_tree *tree = &prog->items.arr[i];
+		struct cache_item item = {
+			.nr_nodes = tree->nr_nodes,
+			.nr_extra = tree->nr_extra,
+			.root = tree->root,
+		};
+		item.nodes_offset = offset;
+		offset += align8(st_mult(sizeof(*tree->nodes), tree->nr_nodes));
+		item.extra_offset = offset;
+		offset += align8(st_mult(sizeof(*tree->extra), tree->nr_extra));
+		fwrite(&item, sizeof(item), 1, fp);
+	}
+
+	for (size_t i = 0; i < src->nr_lines; i++) {
+		uint64_t line_offset = src->line_offsets[i];
+		fwrite(&line_offset, sizeof(line_offset), 1, fp);
+	}
+
+	for (atom_t atom = 1; atom < hdr.nr_atoms; atom++) {
+		const char *name = atom_name(&src->atoms, atom);
+		fwrite(name, 1, strlen(name) + 1, fp);
+	}
+	write_padding(fp, hdr.names_len);
+
+	for (size_t i = 0; i < prog->items.nr; i++) {
+		const struct ast_tree *tree = &prog->items.arr[i];
+		size_t nodes_len = st_mult(sizeof(*tree->nodes), tree->nr_nodes);
+		size_t extra_len = st_mult(sizeof(*tree->extra), tree->nr_extra);
+		fwrite(tree->nodes, 1, nodes_len, fp);
+		write_padding(fp, nodes_len);
+		fwrite(tree->extra, 1, extra_len, fp);
+		write_padding(fp, extra_len);
+	}
+}
+
+void ast_cache_store(const char *dir, const struct source_file *sf,
+		     const struct token_source *src,
+		     const struct ast_program *prog)
+{
+	char *path, *tmp_template;
+	struct tempfile *tmp;
+
+	if (mkdir(dir, 0777) && errno != EEXIST) {
+		warning("failed to create AST cache dir '%s': %s", dir,
+			strerror(errno));
+		return;
+	}
+
+	path = entry_path(dir, sf);
+	tmp_template = xmkstr("%s/.tmp-ast-XXXXXX", dir);
+	tmp = mktempfile(tmp_template);
+	if (!tmp) {
+		warning("failed to create temporary AST cache entry '%s': %s",
+			tmp_template, strerror(errno));
+		goto out;
+	}
+	if (!fdopen_tempfile(tmp, "w")) {
+		warning("fdopen error on '%s': %s", get_tempfile_path(tmp),
+			strerror(errno));
+		delete_tempfile(&tmp);
+		goto out;
+	}
+
+	write_entry(get_tempfile_fp(tmp), sf, src, prog);
+
+	if (ferror(get_tempfile_fp(tmp)) || close_tempfile_gently(tmp)) {
+		warning("failed to write AST cache entry '%s'",
+			get_tempfile_path(tmp));
+		delete_tempfile(&tmp);
+		goto out;
+	}
+	/*
+	 * Concurrent compilations of the same source may race here, but
+	 * they all write the same contents, so it doesn't matter who wins.
+	 */
+	if (rename_tempfile(&tmp, path))
+		warning("failed to rename AST cache entry to '%s': %s", path,
+			strerror(errno));
+out:
+	free(tmp_template);
+	free(path);
+}
+
+/*******************************************************************************
+ *				    Loading
+*******************************************************************************/
+
+/* Whether `nr` objects of `size` bytes, at `offset`, are within the map. */
+static int in_map(size_t map_len, uint64_t offset, uint64_t nr, size_t size)
+{
+	return !(offset % 8) && offset <= map_len &&
+	       nr <= (map_len - offset) / size;
+}
+
+/*
+ * Marks `ref` as having a parent. Returns 0 if it is out of bounds, or if it
+ * already had a parent.
+ */
+static int check_child(const struct ast_tree *tree, ast_ref ref,
+		       unsigned char *has_parent)
+{
+	if (ref == AST_NULL)
+		return 1;
+	if (ref >= tree->nr_nodes || has_parent[ref])
+		return 0;
+	has_parent[ref] = 1;
+	return 1;
+}
+
+static int check_list(const struct ast_tree *tree, struct ast_list list,
+		      unsigned char *has_parent)
+{
+	if (list.start > tree->nr_extra || list.nr > tree->nr_extra - list.start)
+		return 0;
+	for (size_t i = 0; i < list.nr; i++)
+		if (tree->extra[list.start + i] == AST_NULL ||
+		    !check_child(tree, tree->extra[list.start + i], has_parent))
+			return 0;
+	return 1;
+}
+
+static int check_atom(atom_t atom, size_t nr_atoms)
+{
+	return atom != ATOM_NONE && atom < nr_atoms;
+}
+
+/*
+ * Checks that following the references from the root of `tree` stays within
+ * its arrays and the token_source, and that it is a tree. (As each node has at
+ * most one parent and the root has none, no cycle is reachable from the root.)
+ * This doesn't make a malicious entry safe, but a corrupted one can't make us
+ * read out of bounds or loop forever.
+ *
+ * `has_parent` must be zeroed, with room for all the nodes.
+ */
+static int check_tree(const struct ast_tree *tree, unsigned char *has_parent)
+{
+	size_t nr_atoms = atom_table_size(&tree->src->atoms);
+	const struct ast_node *root;
+
+	if (!tree->nr_nodes || tree->nodes[AST_NULL].type != AST_NONE ||
+	    tree->root == AST_NULL || tree->root >= tree->nr_nodes)
+		return 0;
+	root = ast_node(tree, tree->root);
+	if (root->type != AST_FUNC_DECL && root->type != AST_ST_VAR_DECL)
+		return 0;
+	has_parent[tree->root] = 1;
+
+	for (ast_ref ref = 1; ref < tree->nr_nodes; ref++) {
+		const struct ast_node *node = ast_node(tree, ref);
+		int ok;
+
+		if (!node->line_no || node->line_no > tree->src->nr_lines)
+			return 0;
+
+		switch (node->type) {
+		case AST_EXP_CONSTANT_INT:
+		case AST_ST_BREAK:
+		case AST_ST_CONTINUE:
+			ok = 1;
+			break;
+		case AST_EXP_UNARY_OP:
+			ok = node->op <= EXP_OP_SUFFIX_DEC &&
+			     check_child(tree, node->u.un_op.exp, has_parent);
+			break;
+		case AST_EXP_BINARY_OP:
+			ok = node->op < EXP_BIN_OP_NR &&
+			     check_child(tree, node->u.bin_op.lexp, has_parent) &&
+			     check_child(tree, node->u.bin_op.rexp, has_parent);
+			break;
+		case AST_EXP_VAR:
+			ok = check_atom(node->u.var.atom, nr_atoms);
+			break;
+		case AST_EXP_TERNARY:
+			ok = check_child(tree, node->u.ternary.condition, has_parent) &&
+			     check_child(tree, node->u.ternary.if_exp, has_parent) &&
+			     check_child(tree, node->u.ternary.else_exp, has_parent);
+			break;
+		case AST_EXP_FUNC_CALL:
+			ok = check_atom(node->u.call.atom, nr_atoms) &&
+			     check_list(tree, node->u.call.args, has_parent);
+			break;
+		case AST_ST_RETURN:
+		case AST_ST_EXPRESSION:
+			ok = check_child(tree, node->u.opt_exp.exp, has_parent);
+			break;
+		case AST_ST_VAR_DECL:
+			ok = check_list(tree, node->u.decl_list, has_parent);
+			break;
+		case AST_ST_IF_ELSE:
+			ok = check_child(tree, node->u.if_else.condition, has_parent) &&
+			     check_child(tree, node->u.if_else.if_st, has_parent) &&
+			     check_child(tree, node->u.if_else.else_st, has_parent);
+			break;
+		case AST_ST_BLOCK:
+			ok = check_list(tree, node->u.block, has_parent);
+			break;
+		case AST_ST_FOR:
+		case AST_ST_FOR_DECL:
+			ok = check_child(tree, node->u._for.prologue, has_parent) &&
+			     check_child(tree, node->u._for.condition, has_parent) &&
+			     check_child(tree, node->u._for.epilogue, has_parent) &&
+			     check_child(tree, node->u._for.body, has_parent);
+			break;
+		case AST_ST_WHILE:
+			ok = check_child(tree, node->u._while.condition, has_parent) &&
+			     check_child(tree, node->u._while.body, has_parent);
+			break;
+		case AST_ST_DO:
+			ok = check_child(tree, node->u._do.body, has_parent) &&
+			     check_child(tree, node->u._do.condition, has_parent);
+			break;
+		case AST_ST_GOTO:
+			ok = check_atom(node->u._goto.label_atom, nr_atoms);
+			break;
+		case AST_ST_LABELED_STATEMENT:
+			ok = check_atom(node->u.labeled_st.label_atom, nr_atoms) &&
+			     check_child(tree, node->u.labeled_st.st, has_parent);
+			break;
+		case AST_VAR_DECL:
+			ok = check_atom(node->u.var_decl.atom, nr_atoms) &&
+			     check_child(tree, node->u.var_decl.value, has_parent);
+			break;
+		case AST_FUNC_DECL:
+			ok = node->op <= RET_VOID &&
+			     check_atom(node->u.func.atom, nr_atoms) &&
+			     check_list(tree, node->u.func.parameters, has_parent) &&
+			     check_child(tree, node->u.func.body, has_parent);
+			break;
+		default:
+			ok = 0;
+		}
+		if (!ok)
+			return 0;
+	}
+	return 1;
+}
+
+/* Interns the names of the atoms, in order, at src->atoms. */
+static int load_names(struct token_source *src, const char *names,
+		      size_t names_len, size_t nr_atoms)
+{
+	const char *end = names + names_len;
+	for (size_t atom = 1; atom < nr_atoms; atom++) {
+		size_t len = strnlen(names, end - names);
+		if (names + len == end ||
+		    atom_intern(&src->atoms, names, len) != atom)
+			return 0;
+		names += len + 1;
+	}
+	return names == end;
+}
+
+static struct ast_program *load_entry(const struct source_file *sf,
+				      void *map, size_t map_len,
+				      struct token_source **src_ret)
+{
+	const struct cache_header *hdr = map;
+	const struct cache_item *items;
+	const uint64_t *line_offsets;
+	const char *names;
+	struct ast_program *prog;
+	struct token_source *src;
+	ARRAY(unsigned char) has_parent = ARRAY_STATIC_INIT;
+	uint64_t offset = sizeof(*hdr);
+
+	if (hdr->source_len != sf->len || !hdr->nr_lines ||
+	    !hdr->nr_atoms || hdr->nr_atoms > UINT32_MAX)
+		return NULL;
+
+	items = (const void *)((const char *)map + offset);
+	if (!in_map(map_len, offset, hdr->nr_items, sizeof(*items)))
+		return NULL;
+	offset += hdr->nr_items * sizeof(*items);
+
+	line_offsets = (const void *)((const char *)map + offset);
+	if (!in_map(map_len, offset, hdr->nr_lines, sizeof(*line_offsets)))
+		return NULL;
+	offset += hdr->nr_lines * sizeof(*line_offsets);
+
+	names = (const char *)map + offset;
+	if (!in_map(map_len, offset, hdr->names_len, 1))
+		return NULL;
+
+	src = xcalloc(1, sizeof(*src));
+	src->buf = sf->buf;
+	atom_table_init(&src->atoms);
+	ALLOC_ARRAY(src->line_offsets, hdr->nr_lines);
+	src->nr_lines = src->alloc_lines = hdr->nr_lines;
+	for (size_t i = 0; i < src->nr_lines; i++) {
+		if (line_offsets[i] > sf->len) {
+			free_token_source(src);
+			return NULL;
+		}
+		src->line_offsets[i] = line_offsets[i];
+	}
+	if (!load_names(src, names, hdr->names_len, hdr->nr_atoms)) {
+		free_token_source(src);
+		return NULL;
+	}
+
+	prog = xmalloc(sizeof(*prog));
+	arena_init(&prog->arena);
+	prog->items.nr = prog->items.alloc = hdr->nr_items;
+	prog->items.arr = arena_alloc(&prog->arena,
+				      st_mult(sizeof(*prog->items.arr),
+					      hdr->nr_items));
+	prog->map = map;
+	prog->map_len = map_len;
+
+	for (size_t i = 0; i < hdr->nr_items; i++) {
+		struct ast_tree *tree = &prog->items.arr[i];
+		const struct cache_item *item = &items[i];
+
+		if (!in_map(map_len, item->nodes_offset, item->nr_nodes,
+			    sizeof(*tree->nodes)) ||
+		    !in_map(map_len, item->extra_offset, item->nr_extra,
+			    sizeof(*tree->extra)))
+			goto invalid;
+
+		/* The nodes are never modified after parsing. */
+		tree->src = src;
+		tree->nodes = (void *)((char *)map + item->nodes_offset);
+		tree->extra = (void *)((char *)map + item->extra_offset);
+		tree->nr_nodes = item->nr_nodes;
+		tree->nr_extra = item->nr_extra;
+		tree->root = item->root;
+
+		ALLOC_GROW(has_parent.arr, tree->nr_nodes, has_parent.alloc);
+		memset(has_parent.arr, 0, tree->nr_nodes);
+		if (!check_tree(tree, has_parent.arr))
+			goto invalid;
+	}
+
+	free(has_parent.arr);
+	*src_ret = src;
+	return prog;
+
+invalid:
+	free(has_parent.arr);
+	prog->map = NULL; /* Unmapped by the caller. */
+	free_ast(prog);
+	free_token_source(src);
+	return NULL;
+}
+
+struct ast_program *ast_cache_load(const char *dir, const struct source_file *sf,
+				   struct token_source **src)
+{
+	char *path = entry_path(dir, sf);
+	struct ast_program *prog = NULL;
+	const struct cache_header *hdr;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			warning("failed to open AST cache entry '%s': %s",
+				path, strerror(errno));
+		goto out;
+	}
+	if (fstat(fd, &st)) {
+		warning("failed to stat '%s': %s", path, strerror(errno));
+		close(fd);
+		goto out;
+	}
+	if (st.st_size < (off_t)sizeof(*hdr)) {
+		warning("ignoring truncated AST cache entry '%s'", path);
+		close(fd);
+		goto out;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		warning("failed to mmap '%s': %s", path, strerror(errno));
+		goto out;
+	}
+
+	hdr = map;
+	/* Entries from other versions are not errors, just misses. */
+	if (memcmp(hdr->magic, AST_CACHE_MAGIC, sizeof(AST_CACHE_MAGIC)) ||
+	    hdr->version != AST_CACHE_VERSION ||
+	    hdr->node_size != sizeof(struct ast_node)) {
+		munmap(map, st.st_size);
+		goto out;
+	}
+
+	prog = load_entry(sf, map, st.st_size, src);
+	if (!prog) {
+		warning("ignoring corrupted AST cache entry '%s'", path);
+		munmap(map, st.st_size);
+	}
+out:
+	free(path);
+	return prog;
+}
@@ -0,0 +1,42 @@
+#ifndef _AST_CACHE_H
+#define _AST_CACHE_H
+
+#include "lexer.h"
+#include "parser.h"
+#include "lib/source-file.h"
+
+/*
+ * An on-disk cache of parsed programs, so that unchanged sources don't have
+ * to be lexed and parsed again.
+ *
+ * Each entry is a file in the cache directory, named after the SHA-1 of the
+ * source contents (and of the cache format version). It holds the flat AST
+ * nodes of each toplevel item exactly as they are in memory, so a loaded
+ * program uses them directly from the mapped file. Besides the nodes, an
+ * entry only has what the AST borrows from the token_source: the identifier
+ * names, in atom order, and the line table.
+ *
+ * Entries are written to a temporary file and then renamed into place, so
+ * concurrent compilations of the same source never see a partial entry.
+ * Entries from a different format version, or that fail the consistency
+ * checks on load, are treated as misses (and overwritten by the next store).
+ */
+
+/*
+ * Returns the cached program for the contents of `sf`, or NULL if there is no
+ * usable entry for it. On success, `*src` is set to a new token_source for
+ * `sf`, which the program refers to (see parse_program()). It must be
+ * released with free_token_source(), after free_ast().
+ */
+struct ast_program *ast_cache_load(const char *dir, const struct source_file *sf,
+				   struct token_source **src);
+
+/*
+ * Stores `prog`, parsed from `sf` with the token_source `src`, in the cache.
+ * Failures are only warned about, as the cache is just an optimization.
+ */
+void ast_cache_store(const char *dir, const struct source_file *sf,
+		     const struct token_source *src,
+		     const struct ast_program *prog);
+
+#endif
@@ -1,60 +1,49 @@
-#include <sys/stat.h>
+#include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
-#include <unistd.h>
+#include <sys/wait.h>
 #include "util.h"
 #include "lexer.h"
 #include "parser.h"
 #include "dot-printer.h"
 #include "x86.h"
+#include "ast-cache.h"
+#include "result-cache.h"
 #include "lib/tempfile.h"
+#include "lib/source-file.h"
+#include "lib/copy.h"
 
 static void usage(const char *progname, int err)
 {
 	fprintf(stderr, "usage: %s [options] <sources>\n", progname);
+	fprintf(stderr, "       (use '-' as a source to read it from stdin)\n");
 	fprintf(stderr, "       -h|--help: this message\n");
 	fprintf(stderr, "       -l|--lex:  print the lex'ed tokens\n");
 	fprintf(stderr, "       -t|--tree: print the parsed tree in dot format\n");
 	fprintf(stderr, "       -c:        do not link, only produce an object file\n");
 	fprintf(stderr, "       -S:        leave the asm file and don't generate the binary\n");
 	fprintf(stderr, "       -o <file>: the pathname for the output file\n");
+	fprintf(stderr, "       -j <n>:    compile up to n sources at once\n");
+	fprintf(stderr, "       --lex-jobs <n>: lex big sources with up to n threads\n");
+	fprintf(stderr, "       --codegen-jobs <n>: generate the functions of each source with up\n");
+	fprintf(stderr, "                           to n threads\n");
+	fprintf(stderr, "       --ast-cache=<dir>: reuse the parsed trees of unchanged sources,\n");
+	fprintf(stderr, "                          caching them at <dir>\n");
+	fprintf(stderr, "       --cache=<dir>: reuse the output of unchanged sources, caching it at <dir>\n");
+	fprintf(stderr, "       --cache-size=<size>[K|M|G]: the limit for the --cache dir (default: 256M)\n");
+	fprintf(stderr, "       --cache-stats: print the hits, misses and size of the --cache dir\n");
 
 	exit(err ? 129 : 0);
 }
 
-static char *read_file(const char *filename)
+static void print_tokens(struct token_stream *ts)
 {
-	char *buf;
-	struct stat st;
-	size_t to_read;
-	int fd;
-
-	fd = open(filename, O_RDONLY);
-	if (fd < 0)
-		die_errno("failed to open '%s'", filename);
-
-	if (fstat(fd, &st))
-		die_errno("fstat failed");
-
-	buf = xmalloc(st.st_size + 1);
-
-	for (to_read = st.st_size; to_read; ) {
-		ssize_t ret = read(fd, buf, to_read);
-		if (ret < 0)
-			die_errno("read error");
-		else if (!ret)
-			die("BUG: premature end of file");
-		to_read -= ret;
+	struct token tok;
+	while (!token_stream_end(ts)) {
+		token_stream_get(ts, 0, &tok);
+		print_token(&tok);
+		token_stream_pop(ts);
 	}
-
-	buf[st.st_size] = '\0';
-	close(fd);
-	return buf;
-}
-
-static void print_tokens(struct token *tokens)
-{
-	for (struct token *tok = tokens; !end_token(tok); tok++)
-		print_token(tok);
 }
 
 static char *asm_filename_from_source(const char *source_filename)
@@ -124,6 +113,313 @@ static void assemble_many(struct tempfile_array *asm_files, char *out_filename)
 	free(files);
 }
 
+/*
+ * Lexing in parallel requires all the tokens in memory at once (instead of
+ * streaming them to the parser), and each thread has some setup costs. So we
+ * only do it for big sources, giving each thread at least this many bytes.
+ */
+#define MIN_LEX_JOB_SIZE (256 * 1024)
+
+static void init_token_stream(struct token_stream *ts,
+			      const struct source_file *sf, int lex_jobs)
+{
+	if (lex_jobs > sf->len / MIN_LEX_JOB_SIZE)
+		lex_jobs = sf->len / MIN_LEX_JOB_SIZE;
+	if (lex_jobs > 1) {
+		struct token_array toks;
+		lex_parallel(sf->buf, &toks, lex_jobs);
+		token_stream_init_array(ts, &toks);
+	} else {
+		token_stream_init(ts, sf->buf);
+	}
+}
+
+/*
+ * Lexes and parses `sf`, or loads its AST from the cache at `ast_cache_dir`,
+ * if given. The AST refers to `*src`, which must only be free'd after it.
+ */
+static struct ast_program *get_ast(const struct source_file *sf, int lex_jobs,
+				   const char *ast_cache_dir,
+				   struct token_source **src)
+{
+	struct ast_program *prog;
+	struct token_stream ts;
+
+	if (ast_cache_dir && (prog = ast_cache_load(ast_cache_dir, sf, src)))
+		return prog;
+
+	init_token_stream(&ts, sf, lex_jobs);
+	prog = parse_program(&ts);
+	*src = ts.toks.src;
+	token_stream_release(&ts);
+	if (ast_cache_dir)
+		ast_cache_store(ast_cache_dir, sf, *src, prog);
+	return prog;
+}
+
+/* Parses sizes like "100", "10K", "5M" and "1G". Returns -1 on error. */
+static int parse_size(const char *str, size_t *size)
+{
+	char *end;
+	unsigned long long val;
+
+	if (!isdigit(*str))
+		return -1;
+	errno = 0;
+	val = strtoull(str, &end, 10);
+	if (errno)
+		return -1;
+	switch (*end) {
+	case 'G': val *= 1024; /* fallthrough */
+	case 'M': val *= 1024; /* fallthrough */
+	case 'K': val *= 1024; end++; /* fallthrough */
+	case '\0': break;
+	default: return -1;
+	}
+	if (*end)
+		return -1;
+	*size = val;
+	return 0;
+}
+
+/* Copies a cached output to `path`, closing `cached_fd`. */
+static void copy_cached_to_file(int cached_fd, const char *path)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0)
+		die_errno("failed to open '%s'", path);
+	if (copy_fd(cached_fd, fd))
+		die_errno("failed to copy cached output to '%s'", path);
+	if (close(fd))
+		die_errno("failed to close '%s'", path);
+	close(cached_fd);
+}
+
+struct compile_options {
+	const char *out_filename;
+	int stop_at_assembly;
+	int make_objs; /* -c: one object per source. */
+	int lex_jobs, codegen_jobs;
+	const char *ast_cache_dir;
+	struct result_cache *result_cache;
+};
+
+static struct tempfile *new_asm_tempfile(void)
+{
+	struct tempfile *asm_file = mktempfile_s(".tmp-asm-XXXXXX.s", 2);
+	if (!asm_file)
+		die("failed to create assembly file");
+	return asm_file;
+}
+
+/*
+ * Compiles `source` to an assembly file (-S) or object (-c), as `opts` say.
+ * Otherwise, to be linked, the assembly is written to `asm_file`, which is
+ * then closed (but kept). Dies on errors.
+ */
+static void compile_source(const struct compile_options *opts,
+			   const char *source, struct tempfile *asm_file)
+{
+	struct result_cache *result_cache = opts->result_cache;
+	struct ast_program *prog = NULL;
+	struct token_source *tok_src = NULL;
+	char *obj_filename = NULL;
+	int cached_fd = -1;
+
+	struct source_file sf;
+	load_source_file(&sf, source);
+
+	/********************** CACHED OBJECT ***********************/
+
+	if (opts->make_objs) {
+		obj_filename = opts->out_filename ? xstrdup(opts->out_filename) :
+				obj_filename_from_source(source);
+		if (result_cache &&
+		    (cached_fd = result_cache_open(result_cache, &sf,
+						   RESULT_OBJ)) >= 0) {
+			copy_cached_to_file(cached_fd, obj_filename);
+			goto clean;
+		}
+	}
+
+	/************************ ASSEMBLY **************************/
+
+	if (opts->stop_at_assembly) {
+		char *asm_filename = opts->out_filename ?
+				     xstrdup(opts->out_filename) :
+				     asm_filename_from_source(source);
+		asm_file = create_tempfile(asm_filename, 1);
+		free(asm_filename);
+		if (!asm_file)
+			die("failed to create assembly file");
+	} else if (opts->make_objs) {
+		asm_file = new_asm_tempfile();
+	}
+
+	if (result_cache && !opts->make_objs)
+		cached_fd = result_cache_open(result_cache, &sf, RESULT_ASM);
+
+	if (cached_fd >= 0) {
+		if (copy_fd(cached_fd, get_tempfile_fd(asm_file)))
+			die_errno("failed to copy cached assembly to '%s'",
+				  get_tempfile_path(asm_file));
+		close(cached_fd);
+	} else {
+		/* LEXER and PARSER */
+		prog = get_ast(&sf, opts->lex_jobs, opts->ast_cache_dir,
+			       &tok_src);
+
+		if (!fdopen_tempfile(asm_file, "w"))
+			die_errno("fdopen error on '%s'",
+				  get_tempfile_path(asm_file));
+
+		generate_x86_asm(prog, get_tempfile_fp(asm_file),
+				 opts->codegen_jobs);
+	}
+
+	if (close_tempfile_gently(asm_file))
+		error_errno("failed to close '%s'", get_tempfile_path(asm_file));
+	else if (result_cache && !opts->make_objs && cached_fd < 0)
+		result_cache_put(result_cache, &sf, RESULT_ASM,
+				 get_tempfile_path(asm_file));
+
+	if (opts->stop_at_assembly) {
+		if (commit_tempfile(&asm_file))
+			die("failed to close assembly file");
+		goto clean;
+	}
+
+	/************************** OBJECT **************************/
+
+	if (opts->make_objs) {
+		assemble(get_tempfile_path(asm_file), obj_filename, 0);
+		if (result_cache)
+			result_cache_put(result_cache, &sf, RESULT_OBJ,
+					 obj_filename);
+		delete_tempfile(&asm_file);
+	}
+
+clean:
+	if (prog)
+		free_ast(prog);
+	if (tok_src)
+		free_token_source(tok_src);
+	free(obj_filename);
+	release_source_file(&sf);
+}
+
+struct compile_job {
+	pid_t pid;
+	struct tempfile *err_file; /* The job's stderr. */
+	int done, status;
+};
+
+static void start_compile_job(const struct compile_options *opts,
+			      const char *source, struct tempfile *asm_file,
+			      struct compile_job *job)
+{
+	job->err_file = mktempfile(".tmp-err-XXXXXX");
+	if (!job->err_file)
+		die_errno("failed to create temporary file");
+
+	/* Don't let the child flush what we have buffered, again. */
+	fflush(stdout);
+	fflush(stderr);
+
+	job->pid = fork();
+	if (job->pid < 0)
+		die_errno("fork failed");
+	if (!job->pid) {
+		if (dup2(get_tempfile_fd(job->err_file), STDERR_FILENO) < 0)
+			die_errno("dup2 failed");
+		compile_source(opts, source, asm_file);
+		if (opts->result_cache)
+			result_cache_release(opts->result_cache);
+		exit(0);
+	}
+
+	/* The child has its own copy of the file descriptor. */
+	if (asm_file && close_tempfile_gently(asm_file))
+		die_errno("failed to close '%s'", get_tempfile_path(asm_file));
+}
+
+/*
+ * Compiles each source in a forked process, running up to `jobs` of them at
+ * once. To keep the output the same as compiling the sources one by one, the
+ * stderr of each job is copied to ours in the order of the sources, and we
+ * stop at the first source (in that order) that fails, exiting with its exit
+ * code. When linking, the assembly files are appended to `asm_files`, in the
+ * order of the sources as well.
+ */
+static void compile_in_parallel(const struct compile_options *opts,
+				const char **sources, size_t nr,
+				struct tempfile_array *asm_files, int jobs)
+{
+	struct compile_job *job_arr;
+	size_t started = 0, reported = 0;
+	int running = 0, exit_code = 0;
+
+	CALLOC_ARRAY(job_arr, nr);
+
+	while (1) {
+		struct compile_job *job = NULL;
+		int status;
+		pid_t pid;
+
+		while (!exit_code && started < nr && running < jobs) {
+			struct tempfile *asm_file = NULL;
+			if (asm_files) {
+				asm_file = new_asm_tempfile();
+				ARRAY_APPEND(asm_files, asm_file);
+			}
+			start_compile_job(opts, sources[started], asm_file,
+					  &job_arr[started]);
+			started++;
+			running++;
+		}
+		if (!running)
+			break;
+
+		pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			die_errno("waitpid failed");
+		}
+		for (size_t i = reported; i < started && !job; i++)
+			if (job_arr[i].pid == pid)
+				job = &job_arr[i];
+		if (!job)
+			continue;
+		job->done = 1;
+		job->status = status;
+		running--;
+
+		for (; !exit_code && reported < started && job_arr[reported].done;
+		     reported++) {
+			struct compile_job *done = &job_arr[reported];
+			int fd = get_tempfile_fd(done->err_file);
+			if (lseek(fd, 0, SEEK_SET) < 0 ||
+			    copy_fd(fd, STDERR_FILENO))
+				die_errno("failed to copy errors of '%s'",
+					  sources[reported]);
+			delete_tempfile(&done->err_file);
+
+			if (WIFSIGNALED(done->status)) {
+				error("compilation of '%s' killed by signal %d",
+				      sources[reported], WTERMSIG(done->status));
+				exit_code = 128 + WTERMSIG(done->status);
+			} else {
+				exit_code = WEXITSTATUS(done->status);
+			}
+		}
+	}
+
+	free(job_arr);
+	if (exit_code)
+		exit(exit_code);
+}
+
 static int has_suffix(const char *filename, const char *expected_suffix)
 {
 	size_t len;
@@ -133,10 +429,17 @@ static int has_suffix(const char *filename, const char *expected_suffix)
 int main(int argc, char **argv)
 {	
 	char **arg_cursor, *out_filename = NULL;
+	const char *ast_cache_dir = NULL, *result_cache_dir = NULL;
+	size_t result_cache_size = RESULT_CACHE_DEFAULT_MAX_SIZE;
 	int print_lex = 0,
 	    print_tree = 0,
 	    stop_at_assembly = 0,
-	    link = 1;
+	    link = 1,
+	    read_stdin = 0,
+	    print_cache_stats = 0,
+	    lex_jobs = 1,
+	    codegen_jobs = 1,
+	    jobs = 1;
 
 	ARRAY(const char *) sources = ARRAY_STATIC_INIT;
 
@@ -146,6 +449,11 @@ int main(int argc, char **argv)
 			if (!has_suffix(*arg_cursor, ".c"))
 				die("can only handle .c sources");
 			ARRAY_APPEND(&sources, *arg_cursor);
+		} else if (!strcmp(*arg_cursor, "-")) {
+			if (read_stdin)
+				die("stdin can only be used once as source");
+			read_stdin = 1;
+			ARRAY_APPEND(&sources, *arg_cursor);
 		} else if (!strcmp(*arg_cursor, "-h") || !strcmp(*arg_cursor, "--help")) {
 			usage(*argv, 0);
 		} else if (!strcmp(*arg_cursor, "-l") || !strcmp(*arg_cursor, "--lex")) {
@@ -162,13 +470,50 @@ int main(int argc, char **argv)
 			if (!value || value[0] == '-')
 				die("-o requires a value");
 			out_filename = xstrdup(value);
+		} else if (skip_prefix(*arg_cursor, "-j", &value)) {
+			if (!*value) {
+				arg_cursor++;
+				value = *arg_cursor;
+			}
+			if (!value || (jobs = atoi(value)) <= 0)
+				die("-j requires a positive number");
 		} else if (!strcmp(*arg_cursor, "-S")) {
 			stop_at_assembly = 1;
+		} else if (!strcmp(*arg_cursor, "--lex-jobs")) {
+			arg_cursor++;
+			if (!*arg_cursor || (lex_jobs = atoi(*arg_cursor)) <= 0)
+				die("--lex-jobs requires a positive number");
+		} else if (!strcmp(*arg_cursor, "--codegen-jobs")) {
+			arg_cursor++;
+			if (!*arg_cursor || (codegen_jobs = atoi(*arg_cursor)) <= 0)
+				die("--codegen-jobs requires a positive number");
+		} else if (skip_prefix(*arg_cursor, "--ast-cache=", &value)) {
+			if (!*value)
+				die("--ast-cache requires a directory");
+			ast_cache_dir = value;
+		} else if (skip_prefix(*arg_cursor, "--cache=", &value)) {
+			if (!*value)
+				die("--cache requires a directory");
+			result_cache_dir = value;
+		} else if (skip_prefix(*arg_cursor, "--cache-size=", &value)) {
+			if (parse_size(value, &result_cache_size))
+				die("invalid --cache-size '%s'", value);
+		} else if (!strcmp(*arg_cursor, "--cache-stats")) {
+			print_cache_stats = 1;
 		} else {
 			die("unknown option '%s'", *arg_cursor);
 		}
 	}
 
+	if (print_cache_stats) {
+		if (!result_cache_dir)
+			die("--cache-stats requires --cache");
+		if (sources.nr)
+			die("--cache-stats doesn't take sources");
+		result_cache_print_stats(result_cache_dir, stdout);
+		return 0;
+	}
+
 	if (!sources.nr) {
 		error("expecting at least one source file");
 		usage(*argv, 1);
@@ -182,78 +527,67 @@ int main(int argc, char **argv)
 		die("-S, -c, and -o are incompatible with --lex and --tree");
 	if ((stop_at_assembly || !link) && out_filename && sources.nr > 1)
 		die("-S and -c can only be used with -o for a single source file");
+	if ((stop_at_assembly || !link) && !out_filename && read_stdin)
+		die("-S and -c require -o when reading the source from stdin");
+
+	if (print_lex) {
+		struct source_file sf;
+		load_source_file(&sf, sources.arr[0]);
+		struct token_stream ts;
+		init_token_stream(&ts, &sf, lex_jobs);
+		print_tokens(&ts);
+		free_token_source(ts.toks.src);
+		token_stream_release(&ts);
+		release_source_file(&sf);
+		return 0;
+	}
 
-	if (print_lex || print_tree) {
-		char *source_buf = read_file(sources.arr[0]);
-		struct token *tokens = lex(source_buf);
-		if (print_lex) {
-			print_tokens(tokens);
-		} else {
-			struct ast_program *prog = parse_program(tokens);
-			print_ast_in_dot(prog);
-			free_ast(prog);
-		}
-		free_tokens(tokens);
-		free(source_buf);
+	if (print_tree) {
+		struct source_file sf;
+		struct token_source *tok_src;
+		load_source_file(&sf, sources.arr[0]);
+		struct ast_program *prog = get_ast(&sf, lex_jobs, ast_cache_dir,
+						   &tok_src);
+		print_ast_in_dot(prog);
+		free_ast(prog);
+		free_token_source(tok_src);
+		release_source_file(&sf);
 		return 0;
 	}
 
 	struct tempfile_array asm_files_to_link = ARRAY_STATIC_INIT;
-
-	for (size_t i = 0; i < sources.nr; i++) {
-		const char *source = sources.arr[i];
-
-		/********************* LEXER and PARSER *********************/
-
-		char *source_buf = read_file(source);
-		struct token *tokens = lex(source_buf);
-		struct ast_program *prog = parse_program(tokens);
-
-		/************************ ASSEMBLY **************************/
-
-		struct tempfile *asm_file;
-		if (stop_at_assembly) {
-			char *asm_filename = out_filename ? xstrdup(out_filename) :
-					     asm_filename_from_source(source);
-			asm_file = create_tempfile(asm_filename, 1);
-			free(asm_filename);
-		} else {
-			asm_file = mktempfile_s(".tmp-asm-XXXXXX.s", 2);
-		}
-		if (!asm_file)
-			die("failed to create assembly file");
-
-		if (!fdopen_tempfile(asm_file, "w"))
-			die_errno("fdopen error on '%s'", get_tempfile_path(asm_file));
-
-		generate_x86_asm(prog, get_tempfile_fp(asm_file));
-
-		if (close_tempfile_gently(asm_file))
-			error_errno("failed to close '%s'", get_tempfile_path(asm_file));
-
-		if (stop_at_assembly) {
-			if (commit_tempfile(&asm_file))
-				die("failed to close assembly file");
-			goto clean;
-		}
-
-		/******************** OBJECT or BINARY **********************/
-
-		if (!link) {
-			char *obj_filename = out_filename ? xstrdup(out_filename) :
-					obj_filename_from_source(source);
-			assemble(get_tempfile_path(asm_file), obj_filename, 0);
-			free(obj_filename);
-		} else {
-			ARRAY_APPEND(&asm_files_to_link, asm_file);
+	int make_binary = link && !stop_at_assembly;
+	struct compile_options opts = {
+		.out_filename = out_filename,
+		.stop_at_assembly = stop_at_assembly,
+		.make_objs = !link && !stop_at_assembly,
+		.lex_jobs = lex_jobs,
+		.codegen_jobs = codegen_jobs,
+		.ast_cache_dir = ast_cache_dir,
+	};
+
+	if (result_cache_dir)
+		opts.result_cache = result_cache_new(result_cache_dir,
+						     result_cache_size);
+
+	if (jobs > 1 && sources.nr > 1) {
+		compile_in_parallel(&opts, sources.arr, sources.nr,
+				    make_binary ? &asm_files_to_link : NULL,
+				    jobs);
+	} else {
+		for (size_t i = 0; i < sources.nr; i++) {
+			struct tempfile *asm_file = NULL;
+			if (make_binary) {
+				asm_file = new_asm_tempfile();
+				ARRAY_APPEND(&asm_files_to_link, asm_file);
+			}
+			compile_source(&opts, sources.arr[i], asm_file);
 		}
-
-	clean:
-		free_ast(prog);
-		free_tokens(tokens);
-		free(source_buf);
 	}
 
+	if (opts.result_cache)
+		result_cache_release(opts.result_cache);
+
 	if (asm_files_to_link.nr)
 		assemble_many(&asm_files_to_link, out_filename ? 
 						  out_filename : "a.out");
@@ -85,54 +85,105 @@ static const char *bin_op_as_str(enum bin_op_type type)
 #define print_arc_label(from, to, label) \
 	printf(" %zu -> %zu [label=\"%s\"];\n", from, to, label)
 
-static size_t print_ast_expression(struct ast_expression *exp, struct label_list *labels)
+/*
+ * Expressions may be nested very deeply, so they are printed iteratively,
+ * with an explicit stack of frames. print_exp_step() takes the node of the
+ * last subexpression printed for `f->exp` (if any), and returns the next one
+ * to be printed, or NULL when `f->exp` is done.
+ */
+struct exp_frame {
+	const struct ast_node *exp;
+	size_t node;
+	size_t step;
+};
+
+static const struct ast_node *print_exp_step(const struct ast_tree *tree,
+					     struct exp_frame *f,
+					     size_t sub_node,
+					     struct label_list *labels)
 {
+	static const char *ternary_arcs[] = { "condition", "then", "else" };
+	const struct ast_node *exp = f->exp;
 	const char *type_str;
-	size_t node, next_node;
 
 	switch (exp->type) {
 	case AST_EXP_BINARY_OP:
-		type_str = bin_op_as_str(exp->u.bin_op.type);
-		node = add_label(labels, xmkstr("Binary op: '%s'", type_str));
-		next_node = print_ast_expression(exp->u.bin_op.lexp, labels);
-		print_arc(node, next_node);
-		next_node = print_ast_expression(exp->u.bin_op.rexp, labels);
-		print_arc(node, next_node);
-		break;
+		if (f->step == 0) {
+			type_str = bin_op_as_str(exp->op);
+			f->node = add_label(labels, xmkstr("Binary op: '%s'", type_str));
+		} else {
+			print_arc(f->node, sub_node);
+		}
+		switch (f->step++) {
+		case 0: return ast_node(tree, exp->u.bin_op.lexp);
+		case 1: return ast_node(tree, exp->u.bin_op.rexp);
+		default: return NULL;
+		}
 	case AST_EXP_TERNARY:
-		node = add_label(labels, xstrdup("Ternary op (?:)"));
-		next_node = print_ast_expression(exp->u.ternary.condition, labels);
-		print_arc_label(node, next_node, "condition");
-		next_node = print_ast_expression(exp->u.ternary.if_exp, labels);
-		print_arc_label(node, next_node, "then");
-		next_node = print_ast_expression(exp->u.ternary.else_exp, labels);
-		print_arc_label(node, next_node, "else");
-		break;
+		if (f->step == 0)
+			f->node = add_label(labels, xstrdup("Ternary op (?:)"));
+		else
+			print_arc_label(f->node, sub_node, ternary_arcs[f->step - 1]);
+		switch (f->step++) {
+		case 0: return ast_node(tree, exp->u.ternary.condition);
+		case 1: return ast_node(tree, exp->u.ternary.if_exp);
+		case 2: return ast_node(tree, exp->u.ternary.else_exp);
+		default: return NULL;
+		}
 	case AST_EXP_UNARY_OP:
-		type_str = un_op_as_str(exp->u.un_op.type);
-		node = add_label(labels, xmkstr("Unary op: '%s'", type_str));
-		next_node = print_ast_expression(exp->u.un_op.exp, labels);
-		print_arc(node, next_node);
-		break;
+		if (f->step++ == 0) {
+			type_str = un_op_as_str(exp->op);
+			f->node = add_label(labels, xmkstr("Unary op: '%s'", type_str));
+			return ast_node(tree, exp->u.un_op.exp);
+		}
+		print_arc(f->node, sub_node);
+		return NULL;
 	case AST_EXP_CONSTANT_INT:
-		node = add_label(labels, xmkstr("Constant int: '%d'", exp->u.ival));
-		break;
+		f->node = add_label(labels, xmkstr("Constant int: '%d'", exp->u.ival));
+		return NULL;
 	case AST_EXP_VAR:
-		node = add_label(labels, xmkstr("Variable '%s'", exp->u.var.name));
-		break;
+		f->node = add_label(labels, xmkstr("Variable '%s'",
+						   ast_name(tree, exp->u.var.atom)));
+		return NULL;
 	case AST_EXP_FUNC_CALL:
-		node = add_label(labels, xmkstr("Call '%s'", exp->u.call.name));
-		for (size_t i = 0; i < exp->u.call.args.nr; i++) {
-			next_node = print_ast_expression(exp->u.call.args.arr[i], labels);
-			char *arg = xmkstr("arg %zu", i);
-			print_arc_label(node, next_node, arg);
+		if (f->step == 0) {
+			f->node = add_label(labels, xmkstr("Call '%s'",
+						ast_name(tree, exp->u.call.atom)));
+		} else {
+			char *arg = xmkstr("arg %zu", f->step - 1);
+			print_arc_label(f->node, sub_node, arg);
 			free(arg);
 		}
-		break;
+		if (f->step < exp->u.call.args.nr)
+			return ast_list_node(tree, exp->u.call.args, f->step++);
+		return NULL;
 	default:
 		die("BUG: unknown ast expression type: %d", exp->type);
 	}
+}
 
+static size_t print_ast_expression(const struct ast_tree *tree,
+				   const struct ast_node *exp,
+				   struct label_list *labels)
+{
+	ARRAY(struct exp_frame) stack = ARRAY_STATIC_INIT;
+	size_t node = 0;
+
+	ALLOC_GROW(stack.arr, 1, stack.alloc);
+	stack.arr[stack.nr++] = (struct exp_frame){ .exp = exp };
+	while (stack.nr) {
+		struct exp_frame *f = &stack.arr[stack.nr - 1];
+		const struct ast_node *sub = print_exp_step(tree, f, node, labels);
+		if (sub) {
+			ALLOC_GROW(stack.arr, stack.nr + 1, stack.alloc);
+			stack.arr[stack.nr++] = (struct exp_frame){ .exp = sub };
+		} else {
+			node = f->node;
+			stack.nr--;
+		}
+	}
+
+	free(stack.arr);
 	return node;
 }
 
@@ -147,105 +198,115 @@ const char *var_scope_str(enum var_scope scope)
 	}
 }
 
-static size_t print_ast_var_decl_list(struct ast_var_decl_list *decl_list,
+static size_t print_ast_var_decl_list(const struct ast_tree *tree,
+				      const struct ast_node *decl_list,
 				      enum var_scope var_scope,
 				      struct label_list *labels)
 {
 	size_t node = add_label(labels, xmkstr("Declare %s\\nvariable",
 				var_scope_str(var_scope)));
 
-	for (size_t i = 0; i < decl_list->nr; i++) {
-		struct ast_var_decl *decl = decl_list->arr[i];
-		size_t name_node = add_label(labels, xmkstr("'%s'", decl->name));
+	for (size_t i = 0; i < decl_list->u.decl_list.nr; i++) {
+		const struct ast_node *decl =
+			ast_list_node(tree, decl_list->u.decl_list, i);
+		size_t name_node = add_label(labels, xmkstr("'%s'",
+					ast_name(tree, decl->u.var_decl.atom)));
 		print_arc(node, name_node);
-		if (decl->value) {
-			size_t value_node = print_ast_expression(decl->value, labels);
+		if (decl->u.var_decl.value) {
+			size_t value_node = print_ast_expression(tree,
+					ast_node(tree, decl->u.var_decl.value),
+					labels);
 			print_arc_label(name_node, value_node, "with\\nvalue");
 		}
 	}
 	return node;
 }
 
-static size_t print_ast_opt_expression(struct ast_opt_expression opt_exp,
+static size_t print_ast_opt_expression(const struct ast_tree *tree,
+				       ast_ref opt_exp,
 				       struct label_list *labels)
 {
-	return opt_exp.exp ? print_ast_expression(opt_exp.exp, labels) :
+	return opt_exp ? print_ast_expression(tree, ast_node(tree, opt_exp), labels) :
 	       add_label(labels, xstrdup("null expression"));
 }
 
-static size_t print_ast_statement(struct ast_statement *st, struct label_list *labels)
+static size_t print_ast_statement(const struct ast_tree *tree,
+				  const struct ast_node *st,
+				  struct label_list *labels)
 {
 	size_t node, next_node;
 	switch (st->type) {
 	case AST_ST_RETURN:
 		node = add_label(labels, xstrdup("Return"));
-		if (st->u._return.opt_exp.exp) {
-			next_node = print_ast_expression(st->u._return.opt_exp.exp,
-							 labels);
+		if (st->u.opt_exp.exp) {
+			next_node = print_ast_expression(tree,
+					ast_node(tree, st->u.opt_exp.exp), labels);
 			print_arc(node, next_node);
 		}
 		break;
 	case AST_ST_VAR_DECL:
-		node = print_ast_var_decl_list(st->u.decl_list, VAR_LOCAL, labels);
+		node = print_ast_var_decl_list(tree, st, VAR_LOCAL, labels);
 		break;
 	case AST_ST_EXPRESSION:
-		node = print_ast_opt_expression(st->u.opt_exp, labels);
+		node = print_ast_opt_expression(tree, st->u.opt_exp.exp, labels);
 		break;
 	case AST_ST_IF_ELSE:
 		node = add_label(labels, xstrdup("if"));
-		next_node = print_ast_expression(st->u.if_else.condition, labels);
+		next_node = print_ast_expression(tree, ast_node(tree, st->u.if_else.condition), labels);
 		print_arc_label(node, next_node, "condition");
-		next_node = print_ast_statement(st->u.if_else.if_st, labels);
+		next_node = print_ast_statement(tree, ast_node(tree, st->u.if_else.if_st), labels);
 		print_arc_label(node, next_node, "then");
 		if (st->u.if_else.else_st) {
-			next_node = print_ast_statement(st->u.if_else.else_st, labels);
+			next_node = print_ast_statement(tree, ast_node(tree, st->u.if_else.else_st), labels);
 			print_arc_label(node, next_node, "else");
 		}
 		break;
 	case AST_ST_BLOCK:
 		node = add_label(labels, xstrdup("Block"));
 		for (size_t i = 0; i < st->u.block.nr; i++) {
-			struct ast_statement *item = st->u.block.items[i];
-			size_t item_node = print_ast_statement(item, labels);
+			const struct ast_node *item =
+				ast_list_node(tree, st->u.block, i);
+			size_t item_node = print_ast_statement(tree, item, labels);
 			print_arc(node, item_node);
 		}
 		break;
 
 	case AST_ST_FOR:
 		node = add_label(labels, xstrdup("for"));
-		next_node = print_ast_opt_expression(st->u._for.prologue, labels);
+		next_node = print_ast_opt_expression(tree, st->u._for.prologue, labels);
 		print_arc_label(node, next_node, "prologue");
-		next_node = print_ast_expression(st->u._for.condition, labels);
+		next_node = print_ast_expression(tree, ast_node(tree, st->u._for.condition), labels);
 		print_arc_label(node, next_node, "condition");
-		next_node = print_ast_opt_expression(st->u._for.epilogue, labels);
+		next_node = print_ast_opt_expression(tree, st->u._for.epilogue, labels);
 		print_arc_label(node, next_node, "epilogue");
-		next_node = print_ast_statement(st->u._for.body, labels);
+		next_node = print_ast_statement(tree, ast_node(tree, st->u._for.body), labels);
 		print_arc_label(node, next_node, "body");
 		break;
 	case AST_ST_FOR_DECL:
 		node = add_label(labels, xstrdup("for"));
-		next_node = print_ast_var_decl_list(st->u.for_decl.decl_list,
-						    VAR_LOCAL, labels);
+		next_node = print_ast_var_decl_list(tree,
+				ast_node(tree, st->u._for.prologue),
+				VAR_LOCAL, labels);
 		print_arc_label(node, next_node, "prologue");
-		next_node = print_ast_expression(st->u.for_decl.condition, labels);
+		next_node = print_ast_expression(tree, ast_node(tree, st->u._for.condition), labels);
 		print_arc_label(node, next_node, "condition");
-		next_node = print_ast_opt_expression(st->u.for_decl.epilogue, labels);
+		next_node = print_ast_opt_expression(tree, st->u._for.epilogue, labels);
 		print_arc_label(node, next_node, "epilogue");
-		next_node = print_ast_statement(st->u.for_decl.body, labels);
+		next_node = print_ast_statement(tree, ast_node(tree, st->u._for.body), labels);
 		print_arc_label(node, next_node, "body");
 		break;
 	case AST_ST_WHILE:
 		node = add_label(labels, xstrdup("while"));
-		next_node = print_ast_expression(st->u._while.condition, labels);
+		next_node = print_ast_expression(tree, ast_node(tree, st->u._while.condition), labels);
 		print_arc_label(node, next_node, "condition");
-		next_node = print_ast_statement(st->u._while.body, labels);
+		next_node = print_ast_statement(tree, ast_node(tree, st->u._while.body), labels);
 		print_arc_label(node, next_node, "body");
 		break;
 	case AST_ST_DO:
 		node = add_label(labels, xstrdup("do"));
-		next_node = print_ast_statement(st->u._do.body, labels);
+		next_node = print_ast_statement(tree, ast_node(tree, st->u._do.body), labels);
 		print_arc_label(node, next_node, "body");
-		next_node = print_ast_expression(st->u._do.condition, labels);
+		next_node = print_ast_expression(tree, ast_node(tree, st->u._do.condition), labels);
 		print_arc_label(node, next_node, "condition");
 		break;
 	case AST_ST_BREAK:
@@ -256,11 +317,13 @@ static size_t print_ast_statement(struct ast_statement *st, struct label_list *l
 		break;
 
 	case AST_ST_GOTO:
-		node = add_label(labels, xmkstr("goto '%s'", st->u._goto.label));
+		node = add_label(labels, xmkstr("goto '%s'",
+				 ast_name(tree, st->u._goto.label_atom)));
 		break;
 	case AST_ST_LABELED_STATEMENT:
-		node = add_label(labels, xmkstr("label '%s'", st->u.labeled_st.label));
-		next_node = print_ast_statement(st->u.labeled_st.st, labels);
+		node = add_label(labels, xmkstr("label '%s'",
+				 ast_name(tree, st->u.labeled_st.label_atom)));
+		next_node = print_ast_statement(tree, ast_node(tree, st->u.labeled_st.st), labels);
 		print_arc_label(node, next_node, "statement");
 		break;
 
@@ -270,19 +333,22 @@ static size_t print_ast_statement(struct ast_statement *st, struct label_list *l
 	return node;
 }
 
-static size_t print_ast_func_decl(struct ast_func_decl *fun, struct label_list *labels)
+static size_t print_ast_func_decl(const struct ast_tree *tree,
+				  const struct ast_node *fun,
+				  struct label_list *labels)
 {
-	size_t node = add_label(labels, xmkstr("Function: %s", fun->name));
+	size_t node = add_label(labels, xmkstr("Function: %s",
+				ast_name(tree, fun->u.func.atom)));
 	size_t ret_node;
 
-	switch (fun->return_type) {
+	switch (fun->op) {
 	case RET_INT:
 		ret_node = add_label(labels, xstrdup("<int>"));
 		break;
 	case RET_VOID:
 		ret_node = add_label(labels, xstrdup("<void>"));
 		break;
-	default: BUG("unknown return type: %d", fun->return_type);
+	default: BUG("unknown return type: %d", fun->op);
 	}
 	print_arc_label(node, ret_node, "return\\ntype");
 
@@ -290,30 +356,35 @@ static size_t print_ast_func_decl(struct ast_func_decl *fun, struct label_list *
 		size_t next_node = add_label(labels, xstrdup("<empty\\nparameter\\nlist>"));
 		print_arc_label(node, next_node, "parameters");
 	} else {
-		for (size_t i = 0; i < fun->parameters.nr; i++) {
-			size_t next_node = add_label(labels, xstrdup(fun->parameters.arr[i]->name));
+		for (size_t i = 0; i < fun->u.func.parameters.nr; i++) {
+			const struct ast_node *param =
+				ast_list_node(tree, fun->u.func.parameters, i);
+			size_t next_node = add_label(labels,
+					xstrdup(ast_name(tree, param->u.var_decl.atom)));
 			char *parameter = xmkstr("parameter %zu", i);
 			print_arc_label(node, next_node, parameter);
 			free(parameter);
 		}
 	}
-	if (fun->body) {
-		size_t next_node = print_ast_statement(fun->body, labels);
+	if (fun->u.func.body) {
+		size_t next_node = print_ast_statement(tree,
+				ast_node(tree, fun->u.func.body), labels);
 		print_arc_label(node, next_node, "body");
 	}
 	return node;
 }
 
-static size_t print_ast_toplevel_item(struct ast_toplevel_item *item,
-				    struct label_list *labels)
+static size_t print_ast_toplevel_item(const struct ast_tree *tree,
+				      struct label_list *labels)
 {
-	switch (item->type) {
-	case TOPLEVEL_FUNC_DECL:
-		return print_ast_func_decl(item->u.func, labels);
-	case TOPLEVEL_VAR_DECL:
-		return print_ast_var_decl_list(item->u.var_list, VAR_GLOBAL, labels);
+	const struct ast_node *root = ast_node(tree, tree->root);
+	switch (root->type) {
+	case AST_FUNC_DECL:
+		return print_ast_func_decl(tree, root, labels);
+	case AST_ST_VAR_DECL:
+		return print_ast_var_decl_list(tree, root, VAR_GLOBAL, labels);
 	default:
-		BUG("unknown toplevel item '%s'", item->type);
+		BUG("unknown toplevel item '%d'", root->type);
 	}
 }
 
@@ -321,11 +392,10 @@ static void print_ast_program(struct ast_program *prog, struct label_list *label
 {
 	size_t node = add_label(labels, xstrdup("Program"));
 	for (size_t i = 0; i < prog->items.nr; i++) {
-		size_t next_node = print_ast_toplevel_item(prog->items.arr[i], labels);
+		size_t next_node = print_ast_toplevel_item(&prog->items.arr[i], labels);
 		print_arc(node, next_node);
 	}
 }
-
 void print_ast_in_dot(struct ast_program *prog)
 {
 	struct label_list labels = LABEL_LIST_INIT;
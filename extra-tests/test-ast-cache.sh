@@ -0,0 +1,129 @@
+#!/bin/bash
+
+set -e
+
+test_cc="$1"
+
+if test -z "$test_cc" || test "$1" = "-h" || test "$1" = "--help"
+then
+	echo "usage: $0 <cc path>"
+	exit 1
+fi
+
+cleanup() {
+	if test -n "$tmpdir"
+	then
+		rm -rf "$tmpdir"
+	fi
+}
+trap cleanup EXIT
+
+tmpdir="$(mktemp -d tmp-cc-test.XXXXXXXXXX)"
+
+cat >"$tmpdir"/prog.c <<-EOF
+int g = 3;
+int add(int a, int b);
+int add(int a, int b) { return a + b; }
+int main()
+{
+	int x = 0;
+	for (int i = 0; i < 10; i++) {
+		if (i % 2)
+			continue;
+		x += add(i, g) ? i : 0;
+	}
+	return x;
+}
+EOF
+
+cat >"$tmpdir"/undeclared.c <<-EOF
+int main()
+{
+	int a = 1;
+	return a + b;
+}
+EOF
+
+test_exit_code() {
+	local ret=0
+	"$1" || ret=$?
+	test $ret -eq "$2"
+}
+
+# The inode of the only cache entry. Entries are replaced by renaming, so
+# it only stays the same if the entry was reused instead of stored again.
+entry_inode() {
+	test $(ls cache | wc -l) -eq 1
+	stat -c %i cache/*
+}
+
+(
+	cd "$tmpdir"
+
+	"../$test_cc" -S -o expect.s prog.c
+	"../$test_cc" -t prog.c >expect.dot
+
+	# TEST: a miss stores the entry, and a hit reuses it
+	"../$test_cc" --ast-cache=cache -S -o miss.s prog.c
+	test -z "$(ls -A cache | grep -v '^[0-9a-f]\{40\}$')"
+	inode=$(entry_inode)
+	"../$test_cc" --ast-cache=cache -S -o hit.s prog.c
+	test $(entry_inode) -eq $inode
+	"../$test_cc" --ast-cache=cache -t prog.c >hit.dot
+	test $(entry_inode) -eq $inode
+	cmp expect.s miss.s
+	cmp expect.s hit.s
+	cmp expect.dot hit.dot
+	"../$test_cc" --ast-cache=cache -o prog prog.c
+	test_exit_code ./prog 20
+
+	# TEST: a changed source is a miss
+	sed 's/i % 2/i % 3/' prog.c >prog2.c
+	mv prog2.c prog.c
+	"../$test_cc" --ast-cache=cache -o prog prog.c
+	test_exit_code ./prog 18
+	test $(ls cache | wc -l) -eq 2
+	rm -rf cache
+
+	# TEST: errors after parsing still show the right source lines
+	! "../$test_cc" -S -o out.s undeclared.c 2>expect.err
+	! "../$test_cc" --ast-cache=cache -S -o out.s undeclared.c 2>miss.err
+	! "../$test_cc" --ast-cache=cache -S -o out.s undeclared.c 2>hit.err
+	grep -q "return a + b;" expect.err
+	cmp expect.err miss.err
+	cmp expect.err hit.err
+	rm -rf cache
+
+	# TEST: a corrupted entry is ignored and replaced
+	"../$test_cc" --ast-cache=cache -S -o out.s prog.c
+	entry="$(ls cache/*)"
+	cp "$entry" good-entry
+	head -c $(($(stat -c %s "$entry") / 2)) good-entry >"$entry"
+	"../$test_cc" --ast-cache=cache -S -o out.s prog.c 2>err
+	grep -q "ignoring corrupted AST cache entry" err
+	"../$test_cc" -S -o expect.s prog.c
+	cmp expect.s out.s
+	cmp good-entry "$entry"
+	rm -rf cache
+
+	# TEST: concurrent stores of the same entry
+	pids=
+	for i in $(seq 8)
+	do
+		"../$test_cc" --ast-cache=cache -S -o out$i.s prog.c &
+		pids="$pids $!"
+	done
+	for pid in $pids
+	do
+		wait $pid
+	done
+	test -z "$(ls -A cache | grep -v '^[0-9a-f]\{40\}$')"
+	inode=$(entry_inode)
+	"../$test_cc" --ast-cache=cache -S -o out.s prog.c
+	test $(entry_inode) -eq $inode
+	for i in $(seq 8)
+	do
+		cmp expect.s out$i.s
+	done
+	cmp expect.s out.s
+)
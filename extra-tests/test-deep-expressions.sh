@@ -0,0 +1,77 @@
+#!/bin/bash
+
+set -e
+
+test_cc="$1"
+
+if test -z "$test_cc" || test "$1" = "-h" || test "$1" = "--help"
+then
+	echo "usage: $0 <cc path>"
+	exit 1
+fi
+
+cleanup() {
+	if test -n "$tmpdir"
+	then
+		rm -rf "$tmpdir"
+	fi
+}
+trap cleanup EXIT
+
+tmpdir="$(mktemp -d tmp-cc-test.XXXXXXXXXX)"
+
+# Prints `$2` repeated `$1` times.
+repeat() {
+	awk -v n="$1" -v s="$2" 'BEGIN { for (i = 0; i < n; i++) printf "%s", s }'
+}
+
+# A main() returning an expression made of: `$2` repeated `$1` times, then
+# `$3`, then `$4` repeated `$1` times.
+gen_source() {
+	printf "int f(int x) { return x; }\n"
+	printf "int main() { int a = 1; return "
+	repeat "$1" "$2"
+	printf "%s" "$3"
+	repeat "$1" "$4"
+	printf "; }\n"
+}
+
+test_exit_code() {
+	local ret=0
+	"$1" || ret=$?
+	test $ret -eq "$2"
+}
+
+(
+	cd "$tmpdir"
+
+	# Deep expressions must not depend on the compiler's stack size. So
+	# we compile them with a stack much smaller than what one frame per
+	# nesting level would take.
+	ulimit -S -s 1024
+
+	# TEST: a 1,000,000-term expression
+	gen_source 999999 "a + " "a" "" >add.c
+	"../$test_cc" -S -o add.s add.c
+
+	# TEST: deeply nested expressions
+	gen_source 100000 "(" "a" ")" >parens.c
+	gen_source 100000 "-~" "a" "" >unary.c
+	gen_source 100000 "a = " "3" "" >assign.c
+	gen_source 100000 "a ? " "1" " : 0" >ternary.c
+	gen_source 100000 "f(" "a" ")" >call.c
+	for exp in parens unary assign ternary call
+	do
+		"../$test_cc" -S -o $exp.s $exp.c
+		"../$test_cc" -t $exp.c >$exp.dot
+	done
+
+	# TEST: deep expressions are still evaluated right
+	ulimit -S -s 8192
+	gen_source 9999 "a + " "a" "" >add-small.c
+	"../$test_cc" -o add-small add-small.c
+	test_exit_code ./add-small $((10000 % 256))
+	gen_source 9999 "f(a + " "a" ")" >call-small.c
+	"../$test_cc" -o call-small call-small.c
+	test_exit_code ./call-small $((10000 % 256))
+)
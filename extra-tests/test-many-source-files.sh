@@ -86,4 +86,29 @@ clean() {
 	! "../$test_cc" -o nope -S four.c two.c 2>err
 	grep -Fq "fatal: -S and -c can only be used with -o for a single source file" err
 	clean
+
+	# TEST: many source, with -j
+	"../$test_cc" -j 2 -o four four.c two.c
+	test_bin four
+	"../$test_cc" -j2 -c four.c two.c
+	test_obj four.o
+	test_obj two.o
+	"../$test_cc" -j2 -S four.c two.c
+	test_asm four.s
+	test_asm two.s
+	test -z "$(ls -A | grep '^\.tmp-')"
+	clean
+
+	# TEST: -j reports errors as compiling one by one would
+	echo 'int bad1() { return x; }' >bad1.c
+	echo 'int bad2( {' >bad2.c
+	for sources in "four.c bad1.c two.c bad2.c" "bad2.c two.c bad1.c"
+	do
+		! "../$test_cc" -o out $sources 2>expect-err
+		! "../$test_cc" -j 3 -o out $sources 2>err
+		cmp expect-err err
+		test -z "$(ls -A | grep '^\.tmp-')"
+	done
+	rm bad1.c bad2.c
+	clean
 )
@@ -0,0 +1,87 @@
+#!/bin/bash
+
+set -e
+
+test_cc="$1"
+
+if test -z "$test_cc" || test "$1" = "-h" || test "$1" = "--help"
+then
+	echo "usage: $0 <cc path>"
+	exit 1
+fi
+
+cleanup() {
+	if test -n "$tmpdir"
+	then
+		rm -rf "$tmpdir"
+	fi
+}
+trap cleanup EXIT
+
+tmpdir="$(mktemp -d tmp-cc-test.XXXXXXXXXX)"
+
+# Many functions using the same kinds of labels (including a user label with
+# the same name in all of them), global variables in between, and a function
+# that is declared without parameters first and redeclared with them later.
+gen_source() {
+	printf "int g();\n"
+	for i in $(seq 500)
+	do
+		printf "int v%d = %d;\n" $i $i
+		printf "int f%d(int a)\n{\n" $i
+		printf "\tint x = a && v%d || !a;\n" $i
+		printf "\twhile (a < 10) { if (a == 5) break; a++; }\n"
+		printf "\tfor (int i = 0; i < a; i++) x += i;\n"
+		printf "\tif (x > 100) goto out;\n\tx = g(x);\nout:\n"
+		printf "\treturn a ? x : -x;\n}\n"
+	done
+	printf "int g(int a)\n{\n\treturn a + 1;\n}\n"
+	printf "int u;\n"
+	printf "int main()\n{\n\treturn f3(2) + f1(1) + u;\n}\n"
+}
+
+test_exit_code() {
+	local ret=0
+	"$1" || ret=$?
+	test $ret -eq "$2"
+}
+
+(
+	cd "$tmpdir"
+	gen_source >big.c
+
+	# TEST: same output with and without --codegen-jobs
+	"../$test_cc" -S -o seq.s big.c
+	for jobs in 2 3 8
+	do
+		"../$test_cc" --codegen-jobs $jobs -S -o par.s big.c
+		cmp seq.s par.s
+	done
+	"../$test_cc" --codegen-jobs 4 -o big big.c
+	test_exit_code ./big 24
+
+	# TEST: declarations after a function are not visible in it
+	sed "s/x = g(x);/x = u;/" big.c >late.c
+	! "../$test_cc" -S -o seq.s late.c 2>seq.err
+	! "../$test_cc" --codegen-jobs 4 -S -o par.s late.c 2>par.err
+	grep -q "Undeclared variable 'u'" seq.err
+	grep -q "Undeclared variable 'u'" par.err
+
+	# TEST: same errors with and without --codegen-jobs
+	sed "s/return a + 1;/return b;/" big.c >bad.c
+	! "../$test_cc" -S -o seq.s bad.c 2>seq.err
+	! "../$test_cc" --codegen-jobs 4 -S -o par.s bad.c 2>par.err
+	grep -q "Undeclared variable 'b'" seq.err
+	cmp seq.err par.err
+
+	# TEST: symbol errors are found before generation, in source order
+	sed "s/x = g(x);/x = g(y);/" big.c >many.c
+	! "../$test_cc" -S -o seq.s many.c 2>seq.err
+	! "../$test_cc" --codegen-jobs 8 -S -o par.s many.c 2>par.err
+	grep -q "Undeclared variable 'y'" seq.err
+	cmp seq.err par.err
+
+	# TEST: --codegen-jobs requires a positive number
+	! "../$test_cc" --codegen-jobs 0 big.c 2>err
+	grep -q "requires a positive number" err
+)
@@ -0,0 +1,66 @@
+#!/bin/bash
+
+set -e
+
+test_cc="$1"
+
+if test -z "$test_cc" || test "$1" = "-h" || test "$1" = "--help"
+then
+	echo "usage: $0 <cc path>"
+	exit 1
+fi
+
+cleanup() {
+	if test -n "$tmpdir"
+	then
+		rm -rf "$tmpdir"
+	fi
+}
+trap cleanup EXIT
+
+tmpdir="$(mktemp -d tmp-cc-test.XXXXXXXXXX)"
+
+# A source of about 1MB, so that it is lexed with a few threads. It has block
+# comments spanning many lines, so some of them cross the thread boundaries.
+gen_source() {
+	for i in $(seq 2000)
+	do
+		printf "int f%d(int a)\n{\n\t/*\n" $i
+		for j in $(seq 12)
+		do
+			printf "\t * int not_code_%d_%d = 1; { ( /* // * /\n" $i $j
+		done
+		printf "\t */\n\treturn a + %d; // a */ comment\n}\n" $i
+	done
+	printf "int main()\n{\n\treturn f3(2) - f1(1);\n}\n"
+}
+
+test_exit_code() {
+	local ret=0
+	"$1" || ret=$?
+	test $ret -eq "$2"
+}
+
+(
+	cd "$tmpdir"
+	gen_source >big.c
+	test "$(wc -c <big.c)" -gt $((1024 * 1024))
+
+	# TEST: same output with and without --lex-jobs
+	"../$test_cc" -S -o seq.s big.c
+	"../$test_cc" --lex-jobs 4 -S -o par.s big.c
+	cmp seq.s par.s
+	"../$test_cc" --lex-jobs 4 -o big big.c
+	test_exit_code ./big 3
+
+	# TEST: same lexing errors with and without --lex-jobs
+	printf "int bad() { return @; }\n" >>big.c
+	! "../$test_cc" -S -o seq.s big.c 2>seq.err
+	! "../$test_cc" --lex-jobs 4 -S -o par.s big.c 2>par.err
+	grep -q "unknown token '@;'" seq.err
+	cmp seq.err par.err
+
+	# TEST: --lex-jobs requires a positive number
+	! "../$test_cc" --lex-jobs 0 big.c 2>err
+	grep -q "requires a positive number" err
+)
@@ -0,0 +1,124 @@
+#!/bin/bash
+
+set -e
+
+test_cc="$1"
+
+if test -z "$test_cc" || test "$1" = "-h" || test "$1" = "--help"
+then
+	echo "usage: $0 <cc path>"
+	exit 1
+fi
+
+cleanup() {
+	if test -n "$tmpdir"
+	then
+		rm -rf "$tmpdir"
+	fi
+}
+trap cleanup EXIT
+
+tmpdir="$(mktemp -d tmp-cc-test.XXXXXXXXXX)"
+
+cat >"$tmpdir"/four.c <<-EOF
+int two();
+int main()
+{
+	return two() + two();
+}
+EOF
+
+cat >"$tmpdir"/two.c <<-EOF
+int two()
+{
+	return 2;
+}
+EOF
+
+test_exit_code() {
+	local ret=0
+	"$1" || ret=$?
+	test $ret -eq "$2"
+}
+
+# Checks the hits, misses and number of entries of the cache at "cache".
+test_stats() {
+	cat >expect-stats <<-EOF
+	hits: $1
+	misses: $2
+	entries: $3
+	EOF
+	"../$test_cc" --cache=cache --cache-stats | grep -v "^size:" >stats
+	diff -u expect-stats stats
+}
+
+(
+	cd "$tmpdir"
+
+	"../$test_cc" -S -o expect.s two.c
+	"../$test_cc" -c -o expect.o two.c
+
+	# TEST: -S misses, then hits
+	"../$test_cc" --cache=cache -S -o miss.s two.c
+	test_stats 0 1 1
+	"../$test_cc" --cache=cache -S -o hit.s two.c
+	test_stats 1 1 1
+	cmp expect.s miss.s
+	cmp expect.s hit.s
+
+	# TEST: linking reuses the cached assembly
+	"../$test_cc" --cache=cache -o out four.c two.c
+	test_stats 2 2 2
+	test_exit_code ./out 4
+	rm out
+	"../$test_cc" --cache=cache -o out four.c two.c
+	test_stats 4 2 2
+	test_exit_code ./out 4
+
+	# TEST: -c caches the object file
+	"../$test_cc" --cache=cache -c -o miss.o two.c
+	test_stats 4 3 3
+	"../$test_cc" --cache=cache -c two.c
+	test_stats 5 3 3
+	cmp miss.o two.o
+	gcc -o out four.c two.o
+	test_exit_code ./out 4
+
+	# TEST: a changed source misses
+	sed 's/return 2/return 3/' two.c >three.c
+	"../$test_cc" --cache=cache -o out four.c three.c
+	test_stats 6 4 4
+	test_exit_code ./out 6
+
+	# TEST: a different compiler misses
+	cp "../$test_cc" cc-copy
+	echo >>cc-copy
+	./cc-copy --cache=cache -S -o other.s two.c
+	test_stats 6 5 5
+	cmp expect.s other.s
+
+	# TEST: failed compilations are not stored
+	echo 'int main() { return x; }' >bad.c
+	! "../$test_cc" --cache=cache -S -o bad.s bad.c 2>/dev/null
+	test_stats 6 5 5
+
+	# TEST: eviction of the least recently used entries
+	rm -rf cache
+	for i in $(seq 10)
+	do
+		printf 'int f%d() { return %d; }\n' $i $i >f$i.c
+		"../$test_cc" --cache=cache -S -o f$i.s f$i.c
+	done
+	size=$(stat -c %s f1.s)
+	# The entries are about the same size, so five would fit. But eviction
+	# goes down to 90% of the limit, keeping only four: f1, which is used
+	# again here, and the three newest ones.
+	"../$test_cc" --cache=cache --cache-size=$((size * 5 + size / 2)) \
+		-S -o f1.s f1.c
+	test_stats 1 10 4
+	for i in 1 8 9 10
+	do
+		"../$test_cc" --cache=cache -S -o f$i.s f$i.c
+	done
+	test_stats 5 10 4
+)
@@ -0,0 +1,98 @@
+#!/bin/bash
+
+set -e
+
+test_cc="$1"
+
+if test -z "$test_cc" || test "$1" = "-h" || test "$1" = "--help"
+then
+	echo "usage: $0 <cc path>"
+	exit 1
+fi
+
+cleanup() {
+	if test -n "$tmpdir"
+	then
+		rm -rf "$tmpdir"
+	fi
+}
+trap cleanup EXIT
+
+tmpdir="$(mktemp -d tmp-cc-test.XXXXXXXXXX)"
+
+cat >"$tmpdir"/four.c <<-EOF
+int two();
+int main()
+{
+	return two() + two();
+}
+EOF
+
+cat >"$tmpdir"/two.c <<-EOF
+int two()
+{
+	return 2;
+}
+EOF
+
+test_exit_code() {
+	local ret=0
+	"$1" || ret=$?
+	test $ret -eq "$2"
+}
+
+(
+	cd "$tmpdir"
+
+	# TEST: source from stdin
+	cat four.c two.c | "../$test_cc" -o out -
+	test_exit_code ./out 4
+	rm out
+
+	# TEST: stdin mixed with regular files
+	"../$test_cc" -o out four.c - <two.c
+	test_exit_code ./out 4
+	rm out
+
+	# TEST: -S and -c with stdin
+	"../$test_cc" -S -o out.s - <two.c
+	grep -q "two:" out.s
+	"../$test_cc" -c -o out.o - <two.c
+	test -s out.o
+	rm out.s out.o
+
+	# TEST: -S and -c with stdin require -o
+	! "../$test_cc" -S - <two.c 2>err
+	grep -q "require -o" err
+	! "../$test_cc" -c - <two.c 2>err
+	grep -q "require -o" err
+
+	# TEST: stdin can only be used once
+	! "../$test_cc" - - <two.c 2>err
+	grep -q "only be used once" err
+
+	# TEST: --lex from a pipe
+	echo "int x;" | "../$test_cc" -l - >out
+	grep -q "<identifier> 'x'" out
+
+	# TEST: regular files with sizes around the page size
+	pagesize="$(getconf PAGESIZE)"
+	for size in $((pagesize - 1)) $pagesize $((pagesize + 1)) $((2 * pagesize))
+	do
+		# A comment padding the file up to $size bytes, with a
+		# trailing "*/" so that the file ends right at the comment's
+		# end.
+		body="int main() { return 3; }
+/*"
+		pad=$((size - ${#body} - 2))
+		{
+			printf "%s" "$body"
+			head -c $pad /dev/zero | tr '\0' x
+			printf "*/"
+		} >page.c
+		test "$(wc -c <page.c)" -eq $size
+		"../$test_cc" -o out page.c
+		test_exit_code ./out 3
+		rm out
+	done
+)
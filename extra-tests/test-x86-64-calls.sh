@@ -58,3 +58,65 @@ gcc -c -o "$tmpdir"/gcc-sum.o "$tmpdir"/sum.c
 	diff reference-outcode test1-outcode
 	diff reference-outcode test2-outcode
 )
+
+# Check that the stack is 16-byte aligned at every call, as the ABI requires.
+# Then, with the return address and the saved rbp on it, the callee's frame
+# address is aligned too.
+cat >"$tmpdir"/misaligned.c <<-EOF
+static int misaligned_frame(void *frame)
+{
+	return (unsigned long)frame % 16 != 0;
+}
+int misaligned()
+{
+	return misaligned_frame(__builtin_frame_address(0));
+}
+int misaligned7(int a, int b, int c, int d, int e, int f, int g)
+{
+	return misaligned_frame(__builtin_frame_address(0)) +
+	       a + b + c + d + e + f + g;
+}
+int misaligned8(int a, int b, int c, int d, int e, int f, int g, int h)
+{
+	return misaligned_frame(__builtin_frame_address(0)) +
+	       a + b + c + d + e + f + g + h;
+}
+EOF
+
+cat >"$tmpdir"/calls.c <<-EOF
+int misaligned();
+int misaligned7(int a, int b, int c, int d, int e, int f, int g);
+int misaligned8(int a, int b, int c, int d, int e, int f, int g, int h);
+int f(int a)
+{
+	int b = misaligned();
+	return a + b + (1 + misaligned());
+}
+int main()
+{
+	int bad = misaligned();
+	{
+		int x = misaligned();
+		bad = bad + x + (1 + (2 + misaligned())) - 3;
+	}
+	bad = bad + misaligned7(0, 0, 0, 0, 0, 0, 0) +
+	      misaligned8(0, 0, 0, 0, 0, 0, 0, 0);
+	bad = bad + misaligned7(0, 0, 0, 0, 0, 0,
+				misaligned8(0, 0, 0, 0, 0, 0,
+					    misaligned(), f(0) - 1));
+	for (int i = 0; i < 3; i++) {
+		int y = i;
+		bad = bad + f(y) - y - 1;
+	}
+	return bad;
+}
+EOF
+
+gcc -c -o "$tmpdir"/gcc-misaligned.o "$tmpdir"/misaligned.c
+"$test_cc" -c -o "$tmpdir"/test_cc-calls.o "$tmpdir"/calls.c
+
+(
+	cd "$tmpdir"
+	gcc -o test3 test_cc-calls.o gcc-misaligned.o
+	./test3
+)
@@ -0,0 +1,74 @@
+#!/bin/bash
+
+# Times the compilation of many source files into one binary, with one job
+# and with -j. This is not run by "make extra-tests", as it only reports
+# the timings (but it does check that both binaries work).
+
+set -e
+
+test_cc="$1"
+nr_sources="${2:-64}"
+jobs="${3:-$(nproc)}"
+
+if test -z "$test_cc" || test "$1" = "-h" || test "$1" = "--help"
+then
+	echo "usage: $0 <cc path> [<nr sources> [<jobs>]]"
+	exit 1
+fi
+
+cleanup() {
+	if test -n "$tmpdir"
+	then
+		rm -rf "$tmpdir"
+	fi
+}
+trap cleanup EXIT
+
+tmpdir="$(mktemp -d tmp-cc-test.XXXXXXXXXX)"
+
+test_exit_code() {
+	local ret=0
+	"$1" || ret=$?
+	test $ret -eq "$2"
+}
+
+# Each source has a few functions with some code in them, so that compiling
+# it takes longer than just starting the compiler.
+for i in $(seq $nr_sources)
+do
+	for j in $(seq 50)
+	do
+		printf 'int f%d_%d(int a, int b)\n{\n' $i $j
+		printf '\tint x = a * %d + b;\n' $j
+		printf '\tfor (int k = 0; k < %d; k++)\n' $j
+		printf '\t\tx = (x ^ k) %% 1000 + (k > 2 ? k - 2 : b);\n'
+		printf '\treturn x - (a + b) * %d;\n}\n' $j
+	done >"$tmpdir"/f$i.c
+	printf 'int f%d_one(int a, int b) { return 1; }\n' $i >>"$tmpdir"/f$i.c
+done
+
+{
+	for i in $(seq $nr_sources)
+	do
+		printf 'int f%d_one(int a, int b);\n' $i
+	done
+	printf 'int main()\n{\n\tint sum = 0;\n'
+	for i in $(seq $nr_sources)
+	do
+		printf '\tsum = sum + f%d_one(0, 0);\n' $i
+	done
+	printf '\treturn sum;\n}\n'
+} >"$tmpdir"/main.c
+
+(
+	cd "$tmpdir"
+
+	echo "$nr_sources sources, one job:"
+	time "../$test_cc" -o seq main.c f*.c 2>/dev/null
+	echo
+	echo "$nr_sources sources, -j $jobs:"
+	time "../$test_cc" -j "$jobs" -o par main.c f*.c 2>/dev/null
+
+	test_exit_code ./seq $((nr_sources % 256))
+	test_exit_code ./par $((nr_sources % 256))
+)
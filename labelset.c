@@ -1,71 +1,86 @@
 #include "util.h"
+#include "lib/array.h"
 #include "labelset.h"
 #include "lexer.h"
 
-struct label_info {
-	enum { LABEL_REFERENCED, LABEL_DEFINED } status;
-	struct token *tok;
-};
-
 void labelset_init(struct labelset *set)
 {
-	strmap_init(&set->map, strmap_val_plain_copy);
+	memset(set, 0, sizeof(*set));
 }
 
-void labelset_put_reference(struct labelset *set, const char *label,
-			    struct token *tok)
+void labelset_clear(struct labelset *set)
 {
-	struct label_info *label_info = xmalloc(sizeof(*label_info));
-	label_info->status = LABEL_REFERENCED;
-	label_info->tok = tok;
-	if (!strmap_has(&set->map, label))
-		strmap_put(&set->map, label, label_info);
+	for (size_t i = 0; i < set->nr; i++)
+		set->index[set->labels[i].atom] = 0;
+	set->nr = 0;
 }
 
-void labelset_put_definition(struct labelset *set, const char *label,
-			     struct token *tok)
+void labelset_destroy(struct labelset *set)
 {
-	struct label_info *label_info;
-	if (strmap_find(&set->map, label, (void **)&label_info)) {
-		if (label_info->status == LABEL_DEFINED) {
-			die("generate x86: redefinition of label '%s'.\nFirst:\n%s\nThen:\n%s",
-			    label, show_token_on_source_line(label_info->tok),
-			    show_token_on_source_line(tok));
-		} else {
-			label_info->status = LABEL_DEFINED;
-			label_info->tok = tok;
-		}
-	} else {
-		label_info = xmalloc(sizeof(*label_info));
-		label_info->status = LABEL_DEFINED;
-		label_info->tok = tok;
-		strmap_put(&set->map, label, label_info);
-	}
+	free(set->labels);
+	free(set->index);
+	memset(set, 0, sizeof(*set));
+}
+
+static struct label_info *labelset_find(struct labelset *set, atom_t atom)
+{
+	if (atom < set->index_alloc && set->index[atom])
+		return &set->labels[set->index[atom] - 1];
+	return NULL;
 }
 
-static int check_label_info_defined(const char *label, void *val, void *_)
+static void labelset_add(struct labelset *set, atom_t atom, const char *label,
+			 int status, const struct token_loc *loc)
 {
-	struct label_info *label_info = val;
-	if (label_info->status != LABEL_DEFINED) {
-		die("generate x86: unknown label '%s'.\n%s", label,
-		    show_token_on_source_line(label_info->tok));
+	struct label_info *label_info;
+	if (atom >= set->index_alloc) {
+		size_t old_alloc = set->index_alloc;
+		ALLOC_GROW(set->index, atom + 1, set->index_alloc);
+		memset(set->index + old_alloc, 0,
+		       st_mult(sizeof(*set->index), set->index_alloc - old_alloc));
 	}
-	return 0;
+	ALLOC_GROW(set->labels, set->nr + 1, set->alloc);
+	label_info = &set->labels[set->nr];
+	label_info->atom = atom;
+	label_info->name = label;
+	label_info->status = status;
+	label_info->loc = *loc;
+	set->index[atom] = ++set->nr;
 }
 
-void labelset_check(struct labelset *set)
+void labelset_put_reference(struct labelset *set, atom_t atom,
+			    const char *label, const struct token_loc *loc)
 {
-	strmap_iterate(&set->map, check_label_info_defined, NULL);
+	if (!labelset_find(set, atom))
+		labelset_add(set, atom, label, LABEL_REFERENCED, loc);
 }
 
-static int free_label_info(const char *label, void *val, void *_)
+void labelset_put_definition(struct labelset *set, atom_t atom,
+			     const char *label, const struct token_loc *loc)
 {
-	free(val);
-	return 0;
+	struct label_info *label_info = labelset_find(set, atom);
+	if (label_info) {
+		if (label_info->status == LABEL_DEFINED) {
+			die("generate x86: redefinition of label '%s'.\nFirst:\n%s\nThen:\n%s",
+			    label, show_loc_on_source_line(&label_info->loc),
+			    show_loc_on_source_line(loc));
+		} else {
+			label_info->status = LABEL_DEFINED;
+			label_info->loc = *loc;
+		}
+	} else {
+		labelset_add(set, atom, label, LABEL_DEFINED, loc);
+	}
 }
 
-void labelset_destroy(struct labelset *set)
+void labelset_check(struct labelset *set)
 {
-	strmap_iterate(&set->map, free_label_info, NULL);
-	strmap_destroy(&set->map);
+	for (size_t i = 0; i < set->nr; i++) {
+		struct label_info *label_info = &set->labels[i];
+		if (label_info->status != LABEL_DEFINED) {
+			die("generate x86: unknown label '%s'.\n%s",
+			    label_info->name,
+			    show_loc_on_source_line(&label_info->loc));
+		}
+	}
 }
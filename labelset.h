@@ -1,21 +1,37 @@
 #ifndef _LABELSET_H
 #define _LABELSET_H
 
-#include "lib/strmap.h"
+#include "lib/atom.h"
+#include "lexer.h"
 
-struct token;
+struct label_info {
+	atom_t atom;
+	const char *name;
+	enum { LABEL_REFERENCED, LABEL_DEFINED } status;
+	struct token_loc loc;
+};
 
+/*
+ * The set of user labels in a function. It can be reused for the next
+ * function after labelset_clear(), which keeps the allocated memory.
+ */
 struct labelset {
-	struct strmap map;
+	/* In order of first appearance. */
+	struct label_info *labels;
+	size_t nr, alloc;
+	/* Maps atoms to indexes at labels[], plus one. */
+	size_t *index;
+	size_t index_alloc;
 };
 
 void labelset_init(struct labelset *set);
+void labelset_clear(struct labelset *set);
 void labelset_destroy(struct labelset *set);
 
-void labelset_put_reference(struct labelset *set, const char *label,
-			    struct token *tok);
-void labelset_put_definition(struct labelset *set, const char *label,
-			     struct token *tok);
+void labelset_put_reference(struct labelset *set, atom_t atom,
+			    const char *label, const struct token_loc *loc);
+void labelset_put_definition(struct labelset *set, atom_t atom,
+			     const char *label, const struct token_loc *loc);
 
 void labelset_check(struct labelset *set);
 
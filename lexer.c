@@ -1,59 +1,60 @@
+#include <limits.h>
+#include <pthread.h>
 #include "util.h"
 #include "lib/array.h"
+#include "lib/scan.h"
 #include "lexer.h"
 
-#define ALPHA "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"
-#define NUM "0123456789"
-#define WHITESPACE " \t\n"
-#define IDENTIFIER_HEAD (ALPHA "_")
-#define IDENTIFIER_TAIL (ALPHA NUM "_")
-
 /*
- * Do not use this function if you want to include '\0' in `list`. As soon as
- * it finds '\0', it terminates the search unsuccessfully.
+ * Character classes of the source bytes. Used to scan identifiers, numbers,
+ * and whitespaces with a single table lookup per byte.
  */
-static int char_in(char c, const char *list)
-{
-	for (; *list; list++)
-		if (c == *list)
-			return 1;
-	return 0;
-}
+enum {
+	CHAR_WHITESPACE = 1 << 0, /* ' ', '\t', and '\n' */
+	CHAR_IDENT_HEAD = 1 << 1, /* [a-zA-Z_] */
+	CHAR_IDENT_TAIL = 1 << 2, /* [a-zA-Z0-9_] */
+	CHAR_DIGIT = 1 << 3,      /* [0-9] */
+};
+
+static const unsigned char char_class[UCHAR_MAX + 1] = {
+	[' '] = CHAR_WHITESPACE,
+	['\t'] = CHAR_WHITESPACE,
+	['\n'] = CHAR_WHITESPACE,
+	['a' ... 'z'] = CHAR_IDENT_HEAD | CHAR_IDENT_TAIL,
+	['A' ... 'Z'] = CHAR_IDENT_HEAD | CHAR_IDENT_TAIL,
+	['_'] = CHAR_IDENT_HEAD | CHAR_IDENT_TAIL,
+	['0' ... '9'] = CHAR_IDENT_TAIL | CHAR_DIGIT,
+};
+
+#define char_is(c, class) (char_class[(unsigned char)(c)] & (class))
 
 /*
- * Stores in `skipped` a pointer to the first char at `str` that is not in
- * `list`. Returns 1 iff skipped was moved forward in `str`.
+ * Show the line starting at `line_start` with a marker at `col_no`. The line
+ * is only copied (and tab-expanded, to keep the marker aligned) here, when a
+ * diagnostic is actually being printed.
  */
-static int skip_chars(const char *str, const char *list, const char **skipped)
-{
-	for (*skipped = str; **skipped && char_in(**skipped, list); (*skipped)++)
-		;
-	return *skipped != str;
-}
-static int skip_one_char(const char *str, const char *list, const char **skipped)
-{
-	*skipped = str;
-	if (**skipped && char_in(**skipped, list))
-		(*skipped)++;
-	return *skipped != str;
-}
-
-static char *show_on_source_line(const char *line, size_t line_no, size_t col_no)
+static char *show_on_source_line(const char *line_start, size_t line_no,
+				 size_t col_no)
 {
 	/*
 	 * TODO: could probably use Git's strbuf API for this.
 	 * And a static buffer, so that the caller doesn't have to free it.
 	 */
+	char *line = tab2sp(getline_dup(line_start), 1);
 	char *prefix = xmkstr("On line %zu: ", line_no);
 	char *ret = xmkstr("%s%s\n%*c^", prefix, line,
 			   col_no + strlen(prefix), ' ');
 	free(prefix);
+	free(line);
 	return ret;
 }
 
-char *show_token_on_source_line(struct token *tok)
+char *show_loc_on_source_line(const struct token_loc *loc)
 {
-	return show_on_source_line(tok->line, tok->line_no, tok->col_no);
+	const struct token_source *src = loc->src;
+	assert(loc->line_no && loc->line_no <= src->nr_lines);
+	return show_on_source_line(src->buf + src->line_offsets[loc->line_no - 1],
+				   loc->line_no, loc->col_no);
 }
 
 const char *tt2str(enum token_type tt)
@@ -127,90 +128,245 @@ const char *tt2str(enum token_type tt)
 	}
 }
 
-char *tok2str(struct token *t)
+char *tok2str(const struct token *t)
 {
 	const char *type_str = tt2str(t->type);
 	switch(t->type) {
 	case TOK_IDENTIFIER:
-		return xmkstr("%s '%s'", type_str, (char *)t->value);
+		return xmkstr("%s '%s'", type_str, t->u.name);
 	case TOK_INTEGER:
-		return xmkstr("%s '%d'", type_str, *(int *)(t->value));
+		return xmkstr("%s '%d'", type_str, t->u.ival);
 	default:
 		return xstrdup(type_str);
 	}
 }
 
-void print_token(struct token *t)
+void print_token(const struct token *t)
 {
 	char *tok_str = tok2str(t);
 	printf("%s\n", tok_str);
 	free(tok_str);
 }
 
-void free_token(struct token *t)
+void token_array_get(const struct token_array *toks, size_t i,
+		     struct token *tok)
 {
-	t->type = TOK_NONE;
-	FREE_AND_NULL(t->value);
-	free((char *)t->line);
+	tok->type = toks->types[i];
+	tok->atom = ATOM_NONE;
+	if (tok->type == TOK_IDENTIFIER) {
+		tok->atom = toks->values[i].atom;
+		tok->u.name = atom_name(&toks->src->atoms, tok->atom);
+	} else {
+		tok->u.ival = toks->values[i].ival;
+	}
+	tok->loc.src = toks->src;
+	tok->loc.line_no = toks->pos[i].line_no;
+	tok->loc.col_no = toks->pos[i].col_no;
 }
 
 struct lex_ctx {
-	struct token *tokens;
-	size_t alloc, nr;
+	struct token_array *toks;
+	struct token_source *src;
 
 	const char *buf, *line_start;
 	size_t line_no, col_no;
+	int done; /* whether the TOK_NONE sentinels were added. */
+
+	/*
+	 * A speculative context doesn't die on errors, it sets `failed` and
+	 * stops instead. See lex_parallel().
+	 */
+	int speculative, failed;
 };
 
-#define LEX_CTX_INIT(buffer) \
-	{ .line_no = 1, .buf = (buffer), .line_start = (buffer) }
+static void add_line(struct token_source *src, size_t offset)
+{
+	ALLOC_GROW(src->line_offsets, src->nr_lines + 1, src->alloc_lines);
+	src->line_offsets[src->nr_lines++] = offset;
+}
 
-static void add_token_with_value(struct lex_ctx *ctx, enum token_type type,
-				 void *value)
+static void token_array_grow(struct token_array *toks, size_t nr)
 {
-	ALLOC_GROW(ctx->tokens, ctx->nr + 1, ctx->alloc);
-	struct token *tok = &ctx->tokens[ctx->nr++];
-	tok->type = type;
-	tok->value = value;
-	 /* TODO: it's wasteful to dup the line for evert token in it. */
-	tok->line = tab2sp(getline_dup(ctx->line_start), 1);
-	tok->line_no = ctx->line_no;
-	tok->col_no = ctx->col_no;
+	if (nr > toks->alloc) {
+		ALLOC_GROW(toks->types, nr, toks->alloc);
+		REALLOC_ARRAY(toks->values, toks->alloc);
+		REALLOC_ARRAY(toks->pos, toks->alloc);
+	}
 }
 
-#define add_token(ctx, type) add_token_with_value(ctx, type, NULL)
+static union token_value *add_token(struct lex_ctx *ctx, enum token_type type)
+{
+	struct token_array *toks = ctx->toks;
+	token_array_grow(toks, toks->nr + 1);
+	size_t i = toks->nr++;
+	toks->types[i] = type;
+	toks->values[i].atom = ATOM_NONE;
+	toks->pos[i].line_no = ctx->line_no;
+	toks->pos[i].col_no = ctx->col_no;
+	return &toks->values[i];
+}
 
-static int consume_str(struct lex_ctx *ctx, const char *needle, enum token_type type)
+static void add_identifier(struct lex_ctx *ctx, const char *name, size_t len)
 {
-	const char *aux;
-	if (skip_prefix(ctx->buf, needle, &aux)) {
-		add_token(ctx, type);
-		ctx->col_no += aux - ctx->buf;
-		ctx->buf = aux;
-		return 1;
-	}
-	return 0;
+	add_token(ctx, TOK_IDENTIFIER)->atom =
+		atom_intern(&ctx->src->atoms, name, len);
 }
 
-static int consume_char(struct lex_ctx *ctx, char needle, enum token_type type)
+struct token_rule {
+	const char *str;
+	enum token_type type;
+};
+
+#define RULES(...) ((const struct token_rule []){ __VA_ARGS__, { NULL } })
+
+/*
+ * Operators and separators indexed by their first byte. Each list goes from
+ * the longest to the shortest candidate, so the first match is always the
+ * longest possible token (e.g. "<<=" is tried before "<<" and "<").
+ */
+static const struct token_rule *punct_rules[UCHAR_MAX + 1] = {
+	['{'] = RULES({ "{", TOK_OPEN_BRACE }),
+	['}'] = RULES({ "}", TOK_CLOSE_BRACE }),
+	['('] = RULES({ "(", TOK_OPEN_PAR }),
+	[')'] = RULES({ ")", TOK_CLOSE_PAR }),
+	[';'] = RULES({ ";", TOK_SEMICOLON }),
+	[':'] = RULES({ ":", TOK_COLON }),
+	['?'] = RULES({ "?", TOK_QUESTION_MARK }),
+	[','] = RULES({ ",", TOK_COMMA }),
+	['~'] = RULES({ "~", TOK_TILDE }),
+
+	['+'] = RULES({ "+=", TOK_PLUS_ASSIGNMENT },
+		      { "++", TOK_PLUS_PLUS },
+		      { "+", TOK_PLUS }),
+	['-'] = RULES({ "-=", TOK_MINUS_ASSIGNMENT },
+		      { "--", TOK_MINUS_MINUS },
+		      { "-", TOK_MINUS }),
+	['*'] = RULES({ "*=", TOK_STAR_ASSIGNMENT },
+		      { "*", TOK_STAR }),
+	['/'] = RULES({ "/=", TOK_SLASH_ASSIGNMENT },
+		      { "/", TOK_F_SLASH }),
+	['%'] = RULES({ "%=", TOK_MODULO_ASSIGNMENT },
+		      { "%", TOK_MODULO }),
+	['^'] = RULES({ "^=", TOK_BITWISE_XOR_ASSIGNMENT },
+		      { "^", TOK_BITWISE_XOR }),
+	['&'] = RULES({ "&=", TOK_BITWISE_AND_ASSIGNMENT },
+		      { "&&", TOK_LOGIC_AND },
+		      { "&", TOK_BITWISE_AND }),
+	['|'] = RULES({ "|=", TOK_BITWISE_OR_ASSIGNMENT },
+		      { "||", TOK_LOGIC_OR },
+		      { "|", TOK_BITWISE_OR }),
+	['='] = RULES({ "==", TOK_EQUAL },
+		      { "=", TOK_ASSIGNMENT }),
+	['!'] = RULES({ "!=", TOK_NOT_EQUAL },
+		      { "!", TOK_LOGIC_NOT }),
+	['<'] = RULES({ "<<=", TOK_BITWISE_LEFT_SHIFT_ASSIGNMENT },
+		      { "<<", TOK_BITWISE_LEFT_SHIFT },
+		      { "<=", TOK_LE },
+		      { "<", TOK_LT }),
+	['>'] = RULES({ ">>=", TOK_BITWISE_RIGHT_SHIFT_ASSIGNMENT },
+		      { ">>", TOK_BITWISE_RIGHT_SHIFT },
+		      { ">=", TOK_GE },
+		      { ">", TOK_GT }),
+};
+
+/*
+ * Keywords are recognized with a perfect hash, in the style of gperf: an
+ * identifier is scanned only once and then compared against the single
+ * keyword that could live at its keyword_table[] slot.
+ *
+ * The hash combines the identifier length with the "associated values" of its
+ * first and last bytes. The values below were found by a brute-force search
+ * so that no two keywords share a slot. When adding a keyword, choose new
+ * values (and possibly a bigger table) with the same property, and update the
+ * slot indexes of keyword_table[]. lib-tests/test-lexer.sh checks that every
+ * keyword is still recognized.
+ */
+#define KEYWORD_TABLE_SIZE 16 /* must be a power of 2 */
+
+static const unsigned char keyword_asso_values[UCHAR_MAX + 1] = {
+	['b'] = 13, ['c'] = 5,  ['d'] = 7,  ['e'] = 14, ['f'] = 10,
+	['g'] = 4,  ['i'] = 14, ['k'] = 2,  ['n'] = 6,  ['o'] = 9,
+	['r'] = 0,  ['t'] = 14, ['v'] = 14, ['w'] = 0,
+};
+
+static const struct keyword {
+	const char *str;
+	size_t len;
+	enum token_type type;
+} keyword_table[KEYWORD_TABLE_SIZE] = {
+	[0] =  { "else", 4, TOK_ELSE_KW },
+	[1] =  { "goto", 4, TOK_GOTO_KW },
+	[2] =  { "do", 2, TOK_DO_KW },
+	[3] =  { "while", 5, TOK_WHILE_KW },
+	[4] =  { "break", 5, TOK_BREAK_KW },
+	[9] =  { "void", 4, TOK_VOID_KW },
+	[10] = { "if", 2, TOK_IF_KW },
+	[11] = { "continue", 8, TOK_CONTINUE_KW },
+	[12] = { "return", 6, TOK_RETURN_KW },
+	[13] = { "for", 3, TOK_FOR_KW },
+	[15] = { "int", 3, TOK_INT_KW },
+};
+
+static inline unsigned int keyword_hash(const char *str, size_t len)
 {
-	if (*ctx->buf == needle) {
-		add_token(ctx, type);
-		(ctx->col_no)++;
-		(ctx->buf)++;
-		return 1;
-	}
-	return 0;
+	return (len + keyword_asso_values[(unsigned char)str[0]] +
+		keyword_asso_values[(unsigned char)str[len - 1]]) &
+	       (KEYWORD_TABLE_SIZE - 1);
 }
 
-static int consume_keyword(struct lex_ctx *ctx, char *needle, enum token_type type)
+/* Returns the keyword token type for `str` or TOK_NONE if it is not one. */
+static enum token_type find_keyword(const char *str, size_t len)
 {
-	const char *aux;
-	if (skip_prefix(ctx->buf, needle, &aux) && !char_in(*aux, IDENTIFIER_TAIL)) {
-		add_token(ctx, type);
-		ctx->col_no += aux - ctx->buf;
-		ctx->buf = aux;
-		return 1;
+	const struct keyword *kw = &keyword_table[keyword_hash(str, len)];
+	if (kw->len == len && !memcmp(str, kw->str, len))
+		return kw->type;
+	return TOK_NONE;
+}
+
+/*
+ * The token family is selected by the first byte of the token. Bytes that
+ * cannot start a token map to LEX_INVALID.
+ */
+enum lex_family {
+	LEX_INVALID = 0,
+	LEX_WHITESPACE,
+	LEX_IDENTIFIER,
+	LEX_INTEGER,
+	LEX_PUNCT,
+};
+
+static const unsigned char lex_family[UCHAR_MAX + 1] = {
+	[' '] = LEX_WHITESPACE,
+	['\t'] = LEX_WHITESPACE,
+	['\n'] = LEX_WHITESPACE,
+	['a' ... 'z'] = LEX_IDENTIFIER,
+	['A' ... 'Z'] = LEX_IDENTIFIER,
+	['_'] = LEX_IDENTIFIER,
+	['0' ... '9'] = LEX_INTEGER,
+	['{'] = LEX_PUNCT, ['}'] = LEX_PUNCT, ['('] = LEX_PUNCT,
+	[')'] = LEX_PUNCT, [';'] = LEX_PUNCT, [':'] = LEX_PUNCT,
+	['?'] = LEX_PUNCT, [','] = LEX_PUNCT, ['~'] = LEX_PUNCT,
+	['+'] = LEX_PUNCT, ['-'] = LEX_PUNCT, ['*'] = LEX_PUNCT,
+	['/'] = LEX_PUNCT, ['%'] = LEX_PUNCT, ['^'] = LEX_PUNCT,
+	['&'] = LEX_PUNCT, ['|'] = LEX_PUNCT, ['='] = LEX_PUNCT,
+	['!'] = LEX_PUNCT, ['<'] = LEX_PUNCT, ['>'] = LEX_PUNCT,
+};
+
+static void consume_bytes(struct lex_ctx *ctx, size_t len)
+{
+	ctx->col_no += len;
+	ctx->buf += len;
+}
+
+static int consume_rule(struct lex_ctx *ctx, const struct token_rule *rules)
+{
+	for (; rules->str; rules++) {
+		const char *aux;
+		if (skip_prefix(ctx->buf, rules->str, &aux)) {
+			add_token(ctx, rules->type);
+			consume_bytes(ctx, aux - ctx->buf);
+			return 1;
+		}
 	}
 	return 0;
 }
@@ -220,23 +376,27 @@ static int consume_newline(struct lex_ctx *ctx)
 	if (*ctx->buf == '\n') {
 		ctx->line_start = ++(ctx->buf);
 		ctx->line_no++;
+		add_line(ctx->src, ctx->line_start - ctx->src->buf);
 		ctx->col_no = 0;
 		return 1;
 	}
 	return 0;
 }
 
+/* Advances the context up to `end`, which must be in the current line. */
+static void consume_until(struct lex_ctx *ctx, const char *end)
+{
+	ctx->col_no += end - ctx->buf;
+	ctx->buf = end;
+}
+
 static int consume_whitespaces(struct lex_ctx *ctx)
 {
 	int ret = 0;
-	while (char_in(*ctx->buf, WHITESPACE)) {
+	while (char_is(*ctx->buf, CHAR_WHITESPACE)) {
 		ret = 1;
-		if (consume_newline(ctx)) {
-			;
-		} else {
-			ctx->col_no++;
-			ctx->buf++;
-		}
+		if (!consume_newline(ctx))
+			consume_until(ctx, skip_blanks(ctx->buf));
 	}
 	return ret;
 }
@@ -245,12 +405,7 @@ static int consume_comments(struct lex_ctx *ctx)
 {
 	/* Single-line comments. */
 	if (*ctx->buf == '/' && *(ctx->buf + 1) == '/') {
-		ctx->buf += 2;
-		ctx->col_no += 2;
-		while (*ctx->buf && *ctx->buf != '\n') {
-			ctx->buf++;
-			ctx->col_no++;
-		}
+		consume_until(ctx, find_char2(ctx->buf + 2, '\n', '\n'));
 		return 1;
 	}
 
@@ -259,23 +414,25 @@ static int consume_comments(struct lex_ctx *ctx)
 		const char *comment_line_start = ctx->line_start;
 		size_t comment_line_no = ctx->line_no,
 		       comment_col_no = ctx->col_no;
-		ctx->buf += 2;
-		ctx->col_no += 2;
+		consume_until(ctx, ctx->buf + 2);
 		while (1) {
+			consume_until(ctx, find_char2(ctx->buf, '*', '\n'));
 			if (*ctx->buf == '*' && *(ctx->buf + 1) == '/') {
-				ctx->buf += 2;
-				ctx->col_no += 2;
+				consume_until(ctx, ctx->buf + 2);
 				break;
 			} else if (consume_newline(ctx)) {
 				continue;
 			} else if (!*ctx->buf) {
+				if (ctx->speculative) {
+					ctx->failed = 1;
+					break;
+				}
 				die("lexer error: runaway comment block.\n%s",
-				    show_on_source_line(
-					tab2sp(getline_dup(comment_line_start), 1),
-					comment_line_no, comment_col_no));
+				    show_on_source_line(comment_line_start,
+							comment_line_no,
+							comment_col_no));
 			} else {
-				ctx->buf++;
-				ctx->col_no++;
+				consume_until(ctx, ctx->buf + 1);
 			}
 		}
 		return 1;
@@ -284,166 +441,422 @@ static int consume_comments(struct lex_ctx *ctx)
 	return 0;
 }
 
-struct token *lex(const char *str)
+static int consume_identifier(struct lex_ctx *ctx)
 {
-	struct lex_ctx ctx = LEX_CTX_INIT(str);
+	const char *aux = ctx->buf;
+	enum token_type keyword;
+
+	if (!char_is(*aux, CHAR_IDENT_HEAD))
+		return 0;
+	while (char_is(*aux, CHAR_IDENT_TAIL))
+		aux++;
+
+	keyword = find_keyword(ctx->buf, aux - ctx->buf);
+	if (keyword)
+		add_token(ctx, keyword);
+	else
+		add_identifier(ctx, ctx->buf, aux - ctx->buf);
+	consume_bytes(ctx, aux - ctx->buf);
+	return 1;
+}
 
-	while (*ctx.buf) {
-		const char *aux;
+static int consume_integer(struct lex_ctx *ctx)
+{
+	const char *aux = ctx->buf;
+	while (char_is(*aux, CHAR_DIGIT))
+		aux++;
+	if (aux == ctx->buf || char_is(*aux, CHAR_IDENT_TAIL))
+		return 0;
+	add_token(ctx, TOK_INTEGER)->ival = strtol(ctx->buf, NULL, 10);
+	consume_bytes(ctx, aux - ctx->buf);
+	return 1;
+}
 
-		if (consume_whitespaces(&ctx))
-			;
-		else if (consume_comments(&ctx))
-			;
-
-		else if (consume_char(&ctx, '{', TOK_OPEN_BRACE))
-			;
-		else if (consume_char(&ctx, '}', TOK_CLOSE_BRACE))
-			;
-		else if (consume_char(&ctx, '(', TOK_OPEN_PAR))
-			;
-		else if (consume_char(&ctx, ')', TOK_CLOSE_PAR))
-			;
-		else if (consume_char(&ctx, ';', TOK_SEMICOLON))
-			;
-		else if (consume_char(&ctx, ':', TOK_COLON))
-			;
-		else if (consume_char(&ctx, '?', TOK_QUESTION_MARK))
-			;
-		else if (consume_char(&ctx, ',', TOK_COMMA))
-			;
-
-		else if (consume_str(&ctx, "+=", TOK_PLUS_ASSIGNMENT))
-			;
-		else if (consume_str(&ctx, "-=", TOK_MINUS_ASSIGNMENT))
-			;
-		else if (consume_str(&ctx, "/=", TOK_SLASH_ASSIGNMENT))
-			;
-		else if (consume_str(&ctx, "*=", TOK_STAR_ASSIGNMENT))
-			;
-		else if (consume_str(&ctx, "%=", TOK_MODULO_ASSIGNMENT))
-			;
-		else if (consume_str(&ctx, "&=", TOK_BITWISE_AND_ASSIGNMENT))
-			;
-		else if (consume_str(&ctx, "|=", TOK_BITWISE_OR_ASSIGNMENT))
-			;
-		else if (consume_str(&ctx, "^=", TOK_BITWISE_XOR_ASSIGNMENT))
-			;
-		else if (consume_str(&ctx, "<<=", TOK_BITWISE_LEFT_SHIFT_ASSIGNMENT))
-			;
-		else if (consume_str(&ctx, ">>=", TOK_BITWISE_RIGHT_SHIFT_ASSIGNMENT))
-			;
-
-		else if (consume_str(&ctx, "++", TOK_PLUS_PLUS))
-			;
-		else if (consume_str(&ctx, "--", TOK_MINUS_MINUS))
-			;
-
-		else if (consume_char(&ctx, '-', TOK_MINUS))
-			;
-		else if (consume_char(&ctx, '~', TOK_TILDE))
-			;
-		else if (consume_char(&ctx, '+', TOK_PLUS))
-			;
-		else if (consume_char(&ctx, '*', TOK_STAR))
-			;
-		else if (consume_char(&ctx, '/', TOK_F_SLASH))
-			;
-		else if (consume_char(&ctx, '%', TOK_MODULO))
-			;
-		else if (consume_char(&ctx, '^', TOK_BITWISE_XOR))
-			;
-
-		else if (consume_str(&ctx, "&&", TOK_LOGIC_AND))
-			;
-		else if (consume_str(&ctx, "||", TOK_LOGIC_OR))
-			;
-		else if (consume_str(&ctx, "==", TOK_EQUAL))
-			;
-		else if (consume_str(&ctx, "!=", TOK_NOT_EQUAL))
-			;
-		else if (consume_str(&ctx, "<=", TOK_LE))
-			;
-		else if (consume_str(&ctx, ">=", TOK_GE))
-			;
-
-		else if (consume_str(&ctx, "<<", TOK_BITWISE_LEFT_SHIFT))
-			;
-		else if (consume_str(&ctx, ">>", TOK_BITWISE_RIGHT_SHIFT))
-			;
-
-		/* These must come after ">*", "<*", and "*=*" tokens. */
-		else if (consume_char(&ctx, '>', TOK_GT))
-			;
-		else if (consume_char(&ctx, '<', TOK_LT))
-			;
-		else if (consume_char(&ctx, '!', TOK_LOGIC_NOT))
-			;
-		else if (consume_char(&ctx, '=', TOK_ASSIGNMENT))
-			;
-
-		/* These must come after "&*" and "|*" tokens. */
-		else if (consume_char(&ctx, '&', TOK_BITWISE_AND))
-			;
-		else if (consume_char(&ctx, '|', TOK_BITWISE_OR))
-			;
-
-		else if (consume_keyword(&ctx, "int", TOK_INT_KW))
-			;
-		else if (consume_keyword(&ctx, "void", TOK_VOID_KW))
-			;
-		else if (consume_keyword(&ctx, "return", TOK_RETURN_KW))
-			;
-		else if (consume_keyword(&ctx, "if", TOK_IF_KW))
-			;
-		else if (consume_keyword(&ctx, "else", TOK_ELSE_KW))
-			;
-		else if (consume_keyword(&ctx, "for", TOK_FOR_KW))
-			;
-		else if (consume_keyword(&ctx, "while", TOK_WHILE_KW))
-			;
-		else if (consume_keyword(&ctx, "do", TOK_DO_KW))
-			;
-		else if (consume_keyword(&ctx, "break", TOK_BREAK_KW))
-			;
-		else if (consume_keyword(&ctx, "continue", TOK_CONTINUE_KW))
-			;
-		else if (consume_keyword(&ctx, "goto", TOK_GOTO_KW))
-			;
-
-		else if (skip_one_char(ctx.buf, IDENTIFIER_HEAD, &aux) &&
-			   skip_chars(ctx.buf, IDENTIFIER_TAIL, &aux) &&
-			   !char_in(*aux, IDENTIFIER_TAIL)) {
-			add_token_with_value(&ctx, TOK_IDENTIFIER, xstrndup(ctx.buf, aux - ctx.buf));
-			ctx.col_no += aux - ctx.buf;
-			ctx.buf = aux;
-		}
+static int consume_punct(struct lex_ctx *ctx)
+{
+	if (*ctx->buf == '/' && consume_comments(ctx))
+		return 1;
+	return consume_rule(ctx, punct_rules[(unsigned char)*ctx->buf]);
+}
 
-		else if (skip_chars(ctx.buf, NUM, &aux) && !char_in(*aux, IDENTIFIER_TAIL)) {
-			int *val = xmalloc(sizeof(*val));
-			*val = strtol(ctx.buf, NULL, 10);
-			add_token_with_value(&ctx, TOK_INTEGER, val);
-			ctx.col_no += aux - ctx.buf;
-			ctx.buf = aux;
+static noreturn void die_unknown_token(struct lex_ctx *ctx)
+{
+	size_t i = 0;
+	while (ctx->buf[i] && !char_is(ctx->buf[i], CHAR_WHITESPACE))
+		i++;
+	die("lex error: unknown token '%s'\n%s", xstrndup(ctx->buf, i),
+	    show_on_source_line(ctx->line_start, ctx->line_no, ctx->col_no));
+}
+
+static void lex_ctx_init(struct lex_ctx *ctx, const char *str,
+			 struct token_array *toks)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->buf = ctx->line_start = str;
+	ctx->line_no = 1;
+	ctx->src = xcalloc(1, sizeof(*ctx->src));
+	ctx->src->buf = str;
+	atom_table_init(&ctx->src->atoms);
+	add_line(ctx->src, 0);
+	ctx->toks = toks;
+	toks->src = ctx->src;
+}
+
+/*
+ * Consume the next lexeme of a non-empty buffer. This adds at most one token,
+ * as whitespaces and comments don't produce any.
+ */
+static void lex_one(struct lex_ctx *ctx)
+{
+	int consumed;
+
+	switch (lex_family[(unsigned char)*ctx->buf]) {
+	case LEX_WHITESPACE:
+		consumed = consume_whitespaces(ctx);
+		break;
+	case LEX_IDENTIFIER:
+		consumed = consume_identifier(ctx);
+		break;
+	case LEX_INTEGER:
+		consumed = consume_integer(ctx);
+		break;
+	case LEX_PUNCT:
+		consumed = consume_punct(ctx);
+		break;
+	default:
+		consumed = 0;
+	}
+
+	if (!consumed) {
+		if (ctx->speculative)
+			ctx->failed = 1;
+		else
+			die_unknown_token(ctx);
+	}
+}
+
+static void add_sentinels(struct lex_ctx *ctx)
+{
+	for (int i = 0; i < TOKEN_LOOKAHEAD; i++)
+		add_token(ctx, TOK_NONE);
+	ctx->done = 1;
+}
+
+void lex(const char *str, struct token_array *toks)
+{
+	struct lex_ctx ctx;
+
+	memset(toks, 0, sizeof(*toks));
+	lex_ctx_init(&ctx, str, toks);
+	while (*ctx.buf)
+		lex_one(&ctx);
+	add_sentinels(&ctx);
+}
+
+/*
+ * Parallel lexing: the buffer is split into chunks, which are lexed
+ * concurrently by speculative contexts, each into its own token_array and
+ * token_source. The results are then appended, in order, to the final array.
+ *
+ * The only lexer state that crosses lines is being inside a block comment.
+ * So chunks start at the first non-whitespace byte after a newline, and
+ * workers assume that they start outside of a comment. This is checked as the
+ * chunks are appended: a chunk that failed (either because it actually
+ * started inside a comment, and thus hit the end of its buffer inside one,
+ * or because of a real error) is lexed again by the final context, which
+ * carries the right state. Since tokens end at a chunk boundary, unless a
+ * comment spans over it, the final context then gets back in sync with the
+ * chunks that follow.
+ *
+ * The result is exactly the same as lex()'s, including the order of atoms,
+ * and errors are reported as lex() would.
+ */
+struct lex_chunk {
+	const char *start, *end; /* in the original buffer */
+	size_t start_col;
+	char *copy; /* NUL-terminated copy of [start, end) for the worker. */
+	struct token_array toks;
+	struct lex_ctx ctx;
+	pthread_t thread;
+
+	/* Where the chunk goes in the final context, once accepted. */
+	struct lex_ctx *final;
+	size_t tok_dest, line_dest, line_base;
+	atom_t *atom_map;
+};
+
+/* A NUL-terminated copy that the scanners won't read out of bounds. */
+static char *copy_chunk(const char *start, size_t len)
+{
+	size_t alloc = (len + SCAN_ALIGNMENT) & ~(size_t)(SCAN_ALIGNMENT - 1);
+	void *copy;
+	if (posix_memalign(&copy, SCAN_ALIGNMENT, alloc))
+		die("posix_memalign failed");
+	memcpy(copy, start, len);
+	memset((char *)copy + len, 0, alloc - len);
+	return copy;
+}
+
+static void *lex_chunk_worker(void *data)
+{
+	struct lex_chunk *chunk = data;
+	struct lex_ctx *ctx = &chunk->ctx;
+
+	lex_ctx_init(ctx, chunk->copy, &chunk->toks);
+	ctx->col_no = chunk->start_col;
+	ctx->speculative = 1;
+	while (*ctx->buf && !ctx->failed)
+		lex_one(ctx);
+	return NULL;
+}
+
+static int is_blank_or_newline(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n';
+}
+
+/* Splits `str` in up to `nr` non-empty chunks. Returns how many there are. */
+static size_t split_in_chunks(const char *str, size_t len,
+			      struct lex_chunk *chunks, size_t nr)
+{
+	const char *start = str, *end = str + len;
+	size_t nr_chunks = 0;
+
+	for (size_t i = 1; i <= nr && start < end; i++) {
+		const char *next = i == nr ? end : str + len / nr * i;
+		if (next < start)
+			next = start;
+		next = memchr(next, '\n', end - next);
+		if (!next) {
+			next = end;
+		} else {
+			while (next < end && is_blank_or_newline(*next))
+				next++;
+		}
+		if (next == start)
+			continue;
+
+		struct lex_chunk *chunk = &chunks[nr_chunks++];
+		memset(chunk, 0, sizeof(*chunk));
+		chunk->start = start;
+		chunk->end = next;
+		while (start > str && start[-1] != '\n') {
+			start--;
+			chunk->start_col++;
 		}
+		start = next;
+	}
+	return nr_chunks;
+}
+
+/*
+ * Takes the tokens of a chunk lexed by lex_chunk_worker() as the next ones of
+ * `ctx`. This only reserves room for them, and for the chunk's lines, which
+ * are then filled by copy_chunk_worker().
+ */
+static void accept_chunk(struct lex_ctx *ctx, struct lex_chunk *chunk)
+{
+	struct token_array *toks = ctx->toks;
+	struct token_source *src = ctx->src, *csrc = chunk->ctx.src;
+	size_t nr_atoms = atom_table_size(&csrc->atoms);
+
+	/* Interning in order keeps the atoms numbered as lex() would. */
+	ALLOC_ARRAY(chunk->atom_map, nr_atoms);
+	for (atom_t atom = 1; atom < nr_atoms; atom++) {
+		const char *name = atom_name(&csrc->atoms, atom);
+		chunk->atom_map[atom] = atom_intern(&src->atoms, name,
+						    strlen(name));
+	}
+
+	chunk->final = ctx;
+	chunk->tok_dest = toks->nr;
+	token_array_grow(toks, toks->nr + chunk->toks.nr);
+	toks->nr += chunk->toks.nr;
+
+	/* The first line of the chunk was already added by `ctx`. */
+	chunk->line_dest = src->nr_lines;
+	chunk->line_base = ctx->line_no - 1;
+	ALLOC_GROW(src->line_offsets, src->nr_lines + csrc->nr_lines - 1,
+		   src->alloc_lines);
+	src->nr_lines += csrc->nr_lines - 1;
+
+	ctx->buf = chunk->end;
+	ctx->line_no = chunk->line_base + chunk->ctx.line_no;
+	if (csrc->nr_lines > 1)
+		ctx->line_start = chunk->start +
+				  csrc->line_offsets[csrc->nr_lines - 1];
+	ctx->col_no = chunk->ctx.col_no;
+}
+
+static void *copy_chunk_worker(void *data)
+{
+	struct lex_chunk *chunk = data;
+	struct token_array *toks = chunk->final->toks, *ctoks = &chunk->toks;
+	struct token_source *src = chunk->final->src, *csrc = chunk->ctx.src;
+	size_t offset = chunk->start - src->buf;
+
+	memcpy(toks->types + chunk->tok_dest, ctoks->types, ctoks->nr);
+	for (size_t i = 0; i < ctoks->nr; i++) {
+		size_t dest = chunk->tok_dest + i;
+		toks->values[dest] = ctoks->values[i];
+		if (ctoks->types[i] == TOK_IDENTIFIER)
+			toks->values[dest].atom =
+				chunk->atom_map[ctoks->values[i].atom];
+		toks->pos[dest].line_no = ctoks->pos[i].line_no + chunk->line_base;
+		toks->pos[dest].col_no = ctoks->pos[i].col_no;
+	}
+
+	for (size_t i = 1; i < csrc->nr_lines; i++)
+		src->line_offsets[chunk->line_dest + i - 1] =
+			csrc->line_offsets[i] + offset;
+	return NULL;
+}
+
+static void release_chunk(struct lex_chunk *chunk)
+{
+	free(chunk->copy);
+	free(chunk->atom_map);
+	if (chunk->ctx.src)
+		free_tokens(&chunk->toks);
+}
 
-		else {
-			size_t i = 0;
-			while (ctx.buf[i] && !char_in(ctx.buf[i], WHITESPACE))
-				i++;
-			die("lex error: unknown token '%s'\n%s", xstrndup(ctx.buf, i),
-			    show_on_source_line(tab2sp(getline_dup(ctx.line_start), 1),
-						ctx.line_no, ctx.col_no));
+static void start_thread(struct lex_chunk *chunk, void *(*fn)(void *))
+{
+	int ret = pthread_create(&chunk->thread, NULL, fn, chunk);
+	if (ret)
+		die("failed to create lexer thread: %s", strerror(ret));
+}
+
+static void join_thread(struct lex_chunk *chunk)
+{
+	int ret = pthread_join(chunk->thread, NULL);
+	if (ret)
+		die("failed to join lexer thread: %s", strerror(ret));
+}
+
+void lex_parallel(const char *str, struct token_array *toks, int nr_jobs)
+{
+	struct lex_chunk *chunks;
+	struct lex_ctx ctx;
+	size_t nr_chunks;
+
+	if (nr_jobs <= 1) {
+		lex(str, toks);
+		return;
+	}
+
+	CALLOC_ARRAY(chunks, nr_jobs);
+	nr_chunks = split_in_chunks(str, strlen(str), chunks, nr_jobs);
+
+	/* The first chunk is lexed by the final context itself. */
+	for (size_t i = 1; i < nr_chunks; i++) {
+		struct lex_chunk *chunk = &chunks[i];
+		chunk->copy = copy_chunk(chunk->start, chunk->end - chunk->start);
+		start_thread(chunk, lex_chunk_worker);
+	}
+
+	memset(toks, 0, sizeof(*toks));
+	lex_ctx_init(&ctx, str, toks);
+	for (size_t i = 0; i < nr_chunks; i++) {
+		struct lex_chunk *chunk = &chunks[i];
+		if (i)
+			join_thread(chunk);
+		if (i && ctx.buf == chunk->start && !chunk->ctx.failed) {
+			accept_chunk(&ctx, chunk);
+		} else {
+			while (*ctx.buf && ctx.buf < chunk->end)
+				lex_one(&ctx);
 		}
 	}
-	add_token(&ctx, TOK_NONE); /* sentinel */
-	REALLOC_ARRAY(ctx.tokens, ctx.nr); /* trim excess. */
-	return ctx.tokens;
+	add_sentinels(&ctx);
+
+	for (size_t i = 1; i < nr_chunks; i++)
+		if (chunks[i].final)
+			start_thread(&chunks[i], copy_chunk_worker);
+	for (size_t i = 0; i < nr_chunks; i++) {
+		if (chunks[i].final)
+			join_thread(&chunks[i]);
+		release_chunk(&chunks[i]);
+	}
+	free(chunks);
+}
+
+void free_token_source(struct token_source *src)
+{
+	free(src->line_offsets);
+	atom_table_destroy(&src->atoms);
+	free(src);
+}
+
+static void token_array_release(struct token_array *toks)
+{
+	free(toks->types);
+	free(toks->values);
+	free(toks->pos);
+	memset(toks, 0, sizeof(*toks));
+}
+
+void free_tokens(struct token_array *toks)
+{
+	free_token_source(toks->src);
+	token_array_release(toks);
+}
+
+/*
+ * How many tokens streams keep in memory. Each refill moves at most
+ * TOKEN_LOOKAHEAD tokens back to the start of the window and lexes enough to
+ * fill the rest of it.
+ */
+#define TOKEN_STREAM_WINDOW 512
+
+void token_stream_init(struct token_stream *ts, const char *str)
+{
+	memset(ts, 0, sizeof(*ts));
+	ts->lexer = xmalloc(sizeof(*ts->lexer));
+	lex_ctx_init(ts->lexer, str, &ts->toks);
+	ts->toks.alloc = TOKEN_STREAM_WINDOW;
+	ALLOC_ARRAY(ts->toks.types, ts->toks.alloc);
+	ALLOC_ARRAY(ts->toks.values, ts->toks.alloc);
+	ALLOC_ARRAY(ts->toks.pos, ts->toks.alloc);
+	token_stream_refill(ts);
+}
+
+#define MOVE_TO_FRONT(arr, from, nr) \
+	memmove((arr), (arr) + (from), st_mult(sizeof(*(arr)), (nr)))
+
+void token_stream_init_array(struct token_stream *ts,
+			     struct token_array *toks)
+{
+	memset(ts, 0, sizeof(*ts));
+	ts->toks = *toks;
+	memset(toks, 0, sizeof(*toks));
+}
+
+void token_stream_refill(struct token_stream *ts)
+{
+	struct token_array *toks = &ts->toks;
+	struct lex_ctx *ctx = ts->lexer;
+	size_t limit = toks->alloc - TOKEN_LOOKAHEAD;
+	size_t keep = toks->nr - ts->cur;
+
+	if (!ctx || ctx->done)
+		return; /* stream over an array, or we have hit the end. */
+
+	MOVE_TO_FRONT(toks->types, ts->cur, keep);
+	MOVE_TO_FRONT(toks->values, ts->cur, keep);
+	MOVE_TO_FRONT(toks->pos, ts->cur, keep);
+	toks->nr = keep;
+	ts->cur = 0;
+
+	while (toks->nr < limit && *ctx->buf)
+		lex_one(ctx);
+	if (!*ctx->buf)
+		add_sentinels(ctx);
 }
 
-void free_tokens(struct token *toks)
+void token_stream_release(struct token_stream *ts)
 {
-	for (struct token *tok = toks; !end_token(tok); tok++)
-		free_token(tok);
-	free(toks);
+	token_array_release(&ts->toks);
+	free(ts->lexer);
+	memset(ts, 0, sizeof(*ts));
 }
@@ -1,6 +1,9 @@
 #ifndef _LEXER_H
 #define _LEXER_H
 
+#include <stdint.h>
+#include "lib/atom.h"
+
 enum token_type {
 	TOK_NONE = 0,
 
@@ -69,32 +72,177 @@ enum token_type {
 	/* postfix and prefix incrementors/decrementors  */
 	TOK_PLUS_PLUS,
 	TOK_MINUS_MINUS,
+
+	/* Keep at the end. */
+	TOK_NR,
+};
+
+/*
+ * Data shared by all the tokens of a lexed buffer: where each of its lines
+ * starts and the interned identifier names. It is built by the lexer and
+ * released by free_tokens() or free_token_source().
+ */
+struct token_source {
+	const char *buf;
+	size_t *line_offsets; /* line_offsets[i] is where line i+1 starts. */
+	size_t nr_lines, alloc_lines;
+	struct atom_table atoms;
+};
+
+/* Token to source file mapping. */
+struct token_loc {
+	const struct token_source *src;
+	size_t line_no, col_no;
 };
 
+/*
+ * A single token, as handed out by token_array_get() and token_stream_get()
+ * for printing and diagnostics. This is not how tokens are stored, though.
+ * See struct token_array.
+ */
 struct token {
 	enum token_type type;
-	void *value;
+	atom_t atom; /* TOK_IDENTIFIER */
+	union {
+		int ival; /* TOK_INTEGER */
+		const char *name; /* TOK_IDENTIFIER, the same as atom_name(atom) */
+	} u;
+	struct token_loc loc;
+};
 
-	/* Token to source file mapping. */
-	const char *line;
+union token_value {
+	int ival; /* TOK_INTEGER */
+	atom_t atom; /* TOK_IDENTIFIER */
+};
+
+struct token_pos {
 	size_t line_no, col_no;
 };
 
-struct token *lex(const char *str);
-void print_token(struct token *t);
+/*
+ * Tokens stored as parallel arrays: types[i], values[i], and pos[i] describe
+ * the i-th token. The parser mostly matches token types, so keeping them in
+ * a dense byte array makes it touch one byte per token, instead of a whole
+ * struct token. Values and positions are only read when needed.
+ */
+struct token_array {
+	uint8_t *types; /* enum token_type */
+	union token_value *values;
+	struct token_pos *pos;
+	size_t nr, alloc;
+	struct token_source *src;
+};
+
+void token_array_get(const struct token_array *toks, size_t i,
+		     struct token *tok);
 
 /*
- * Note: tt2str returns a static non-thread-safe buffer; tok2str returns a
- * malloc'ed buffer, which must be free'd.
+ * How many tokens the parser may peek at, starting from the current one. Token
+ * arrays and streams are followed by this many TOK_NONE tokens.
  */
-const char *tt2str(enum token_type tt);
-char *tok2str(struct token *t);
+#define TOKEN_LOOKAHEAD 3
+
+/*
+ * Lex the whole `str` at once into `toks`, which is terminated by TOK_NONE.
+ *
+ * Note: the tokens refer back to `str` to show source lines on diagnostics,
+ * so it must not be free'd before the tokens are. Likewise, identifier names
+ * are owned by toks->src and are only valid until free_tokens().
+ */
+void lex(const char *str, struct token_array *toks);
+void free_tokens(struct token_array *toks);
+
+/*
+ * Like lex(), but splits `str` in `nr_jobs` chunks, at line boundaries, and
+ * lexes them concurrently. The result is the same as lex()'s. Since every
+ * chunk is copied, it only pays off for big buffers.
+ */
+void lex_parallel(const char *str, struct token_array *toks, int nr_jobs);
+
+/*
+ * Lexes a buffer on demand, for the parser, keeping only a small window of
+ * tokens in memory (so that memory usage doesn't depend on the input size).
+ * It can also go over an array of already lexed tokens.
+ *
+ * The token_stream_*() accessors take an offset `i` from the current token,
+ * which can go from -1 (the last popped token) up to TOKEN_LOOKAHEAD - 1.
+ * What they return is valid until the next call to token_stream_pop(), except
+ * for identifier names, which live as long as the token_source.
+ */
+struct lex_ctx;
+struct token_stream {
+	/*
+	 * The window of tokens. toks.src must be free'd by the caller with
+	 * free_token_source(), after the stream and after everything that
+	 * refers to the tokens' names and locations.
+	 */
+	struct token_array toks;
+	size_t cur;
+
+	/* Private. */
+	struct lex_ctx *lexer;
+};
 
-char *show_token_on_source_line(struct token *tok);
+void token_stream_init(struct token_stream *ts, const char *str);
+/* A stream over tokens from lex(), taking ownership of them. */
+void token_stream_init_array(struct token_stream *ts,
+			     struct token_array *toks);
+void token_stream_release(struct token_stream *ts);
+void free_token_source(struct token_source *src);
+
+/* Don't use this directly. */
+void token_stream_refill(struct token_stream *ts);
+
+/* Pops the current token, returning its type. */
+static inline enum token_type token_stream_pop(struct token_stream *ts)
+{
+	if (ts->cur + TOKEN_LOOKAHEAD + 1 > ts->toks.nr)
+		token_stream_refill(ts);
+	return ts->toks.types[ts->cur++];
+}
+
+static inline enum token_type token_stream_peek(const struct token_stream *ts,
+						int i)
+{
+	return ts->toks.types[ts->cur + i];
+}
+
+static inline union token_value token_stream_value(const struct token_stream *ts,
+						   int i)
+{
+	return ts->toks.values[ts->cur + i];
+}
+
+static inline const char *token_stream_name(const struct token_stream *ts, int i)
+{
+	return atom_name(&ts->toks.src->atoms, ts->toks.values[ts->cur + i].atom);
+}
+
+static inline struct token_loc token_stream_loc(const struct token_stream *ts,
+						int i)
+{
+	const struct token_pos *pos = &ts->toks.pos[ts->cur + i];
+	return (struct token_loc){ ts->toks.src, pos->line_no, pos->col_no };
+}
+
+static inline void token_stream_get(const struct token_stream *ts, int i,
+				    struct token *tok)
+{
+	token_array_get(&ts->toks, ts->cur + i, tok);
+}
+
+#define token_stream_end(ts) (token_stream_peek(ts, 0) == TOK_NONE)
+
+void print_token(const struct token *t);
 
-void free_tokens(struct token *toks);
-void free_token(struct token *t);
+/*
+ * Note: tt2str returns a string literal (so it is safe to use from multiple
+ * threads); tok2str returns a malloc'ed buffer, which must be free'd.
+ */
+const char *tt2str(enum token_type tt);
+char *tok2str(const struct token *t);
 
-#define end_token(tok) ((tok)->type == TOK_NONE)
+char *show_loc_on_source_line(const struct token_loc *loc);
+#define show_token_on_source_line(tok) show_loc_on_source_line(&(tok)->loc)
 
 #endif
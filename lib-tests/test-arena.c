@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "../util.h"
+#include "../lib/arena.h"
+
+static int is_aligned(const void *ptr)
+{
+	return !((uintptr_t)ptr % ARENA_ALIGNMENT);
+}
+
+/*
+ * Allocates `nr` objects of varying sizes, filling each with a different byte,
+ * and checks that none of them was overwritten by the others.
+ */
+static int check_many(struct arena *arena, size_t nr)
+{
+	unsigned char **objs = xmalloc(st_mult(nr, sizeof(*objs)));
+	int ret = 0;
+
+	for (size_t i = 0; i < nr; i++) {
+		objs[i] = arena_alloc(arena, i % 100 + 1);
+		if (!is_aligned(objs[i])) {
+			printf("unaligned object %zu\n", i);
+			ret = 1;
+		}
+		memset(objs[i], i % 256, i % 100 + 1);
+	}
+	for (size_t i = 0; i < nr && !ret; i++) {
+		for (size_t j = 0; j < i % 100 + 1; j++) {
+			if (objs[i][j] != i % 256) {
+				printf("object %zu was overwritten\n", i);
+				ret = 1;
+				break;
+			}
+		}
+	}
+	free(objs);
+	return ret;
+}
+
+/*
+ * Appends `nr` ints to an array with ARENA_ARRAY_APPEND(). If `interleave` is
+ * set, other allocations are made between appends, so the array can't always
+ * be extended in place. Returns how many times the array was moved.
+ */
+static size_t check_grow(struct arena *arena, size_t nr, int interleave,
+			 int *err)
+{
+	ARRAY(int) arr = ARRAY_STATIC_INIT;
+	size_t moves = 0;
+	int *prev = NULL;
+
+	for (size_t i = 0; i < nr; i++) {
+		ARENA_ARRAY_APPEND(arena, &arr, (int)i);
+		if (arr.arr != prev && prev)
+			moves++;
+		prev = arr.arr;
+		if (interleave)
+			memset(arena_alloc(arena, 8), 0xff, 8);
+	}
+	for (size_t i = 0; i < nr; i++) {
+		if (arr.arr[i] != (int)i) {
+			printf("array item %zu is %d\n", i, arr.arr[i]);
+			*err = 1;
+			break;
+		}
+	}
+	return moves;
+}
+
+static int print_grow(struct arena *arena, const char *name, const char *val,
+		      int interleave)
+{
+	int err = 0;
+	size_t moves = check_grow(arena, strtoul(val, NULL, 10), interleave,
+				  &err);
+	if (!err)
+		printf("%s '%s': %s\n", name, val, moves ? "moved" : "in place");
+	return err;
+}
+
+int main(int argc, char **argv)
+{
+	const char *val;
+	struct arena arena;
+
+	arena_init(&arena);
+
+	for (argv++; *argv; argv++) {
+		if (!strcmp(*argv, "-h") || !strcmp(*argv, "--help")) {
+			printf("Options:\n");
+			printf("    calloc=<size>\n");
+			printf("    many=<nr>\n");
+			printf("    grow=<nr>\n");
+			printf("    grow-interleaved=<nr>\n");
+			printf("    chunks\n");
+			printf("    reset\n");
+			return 0;
+		} else if (skip_prefix(*argv, "calloc=", &val)) {
+			size_t size = strtoul(val, NULL, 10), zeros = 0;
+			unsigned char *buf = arena_calloc(&arena, 1, size);
+			while (zeros < size && !buf[zeros])
+				zeros++;
+			printf("calloc '%s': %s, %zu zeros\n", val,
+			       is_aligned(buf) ? "aligned" : "unaligned", zeros);
+		} else if (skip_prefix(*argv, "many=", &val)) {
+			printf("many '%s'\n", val);
+			if (check_many(&arena, strtoul(val, NULL, 10)))
+				return 1;
+		} else if (skip_prefix(*argv, "grow=", &val)) {
+			if (print_grow(&arena, "grow", val, 0))
+				return 1;
+		} else if (skip_prefix(*argv, "grow-interleaved=", &val)) {
+			if (print_grow(&arena, "grow-interleaved", val, 1))
+				return 1;
+		} else if (!strcmp(*argv, "chunks")) {
+			printf("chunks: %zu\n", arena.chunks_nr);
+		} else if (!strcmp(*argv, "reset")) {
+			arena_destroy(&arena);
+			arena_init(&arena);
+		} else {
+			die("unknown option '%s'", *argv);
+		}
+	}
+
+	arena_destroy(&arena);
+	return 0;
+}
@@ -0,0 +1,51 @@
+#!/bin/bash
+
+
+tmpdir="$(mktemp -d test-tmp.XXXXXXXXXX)"
+cleanup () {
+	rm -rf "$tmpdir"
+}
+trap cleanup EXIT
+
+test -x ./test-arena || {
+	echo "./test-arena is missing or not executable"
+	exit 1
+}
+
+cat >$tmpdir/expect <<-EOF &&
+chunks: 0
+calloc '1': aligned, 1 zeros
+calloc '0': aligned, 0 zeros
+calloc '100': aligned, 100 zeros
+chunks: 1
+calloc '1000000': aligned, 1000000 zeros
+chunks: 2
+EOF
+
+echo "TEST: alloc" &&
+./test-arena chunks calloc=1 calloc=0 calloc=100 chunks calloc=1000000 \
+	chunks >$tmpdir/actual &&
+diff -u $tmpdir/expect $tmpdir/actual &&
+echo "OK" &&
+
+cat >$tmpdir/expect <<-EOF &&
+many '100000'
+many '100000'
+EOF
+
+echo "TEST: many objects" &&
+./test-arena many=100000 many=100000 >$tmpdir/actual &&
+diff -u $tmpdir/expect $tmpdir/actual &&
+echo "OK" &&
+
+cat >$tmpdir/expect <<-EOF &&
+grow '1000': in place
+grow-interleaved '1000': moved
+grow '1000000': moved
+EOF
+
+echo "TEST: grow arrays" &&
+./test-arena reset grow=1000 grow-interleaved=1000 reset grow=1000000 \
+	>$tmpdir/actual &&
+diff -u $tmpdir/expect $tmpdir/actual &&
+echo "OK"
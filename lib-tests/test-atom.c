@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../util.h"
+#include "../lib/atom.h"
+
+/* Interns `nr` generated names twice and checks that atoms are consistent. */
+static int check_many(struct atom_table *table, size_t nr)
+{
+	atom_t *atoms = xmalloc(st_mult(nr, sizeof(*atoms)));
+	char name[32];
+	int ret = 0;
+
+	for (size_t i = 0; i < nr; i++) {
+		size_t len = xsnprintf(name, sizeof(name), "name_%zu", i);
+		atoms[i] = atom_intern(table, name, len);
+	}
+	for (size_t i = 0; i < nr && !ret; i++) {
+		size_t len = xsnprintf(name, sizeof(name), "name_%zu", i);
+		if (atom_intern(table, name, len) != atoms[i] ||
+		    strcmp(atom_name(table, atoms[i]), name)) {
+			printf("mismatch on '%s'\n", name);
+			ret = 1;
+		}
+	}
+	free(atoms);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	const char *val;
+	struct atom_table table;
+
+	atom_table_init(&table);
+
+	for (argv++; *argv; argv++) {
+		if (!strcmp(*argv, "-h") || !strcmp(*argv, "--help")) {
+			printf("Options:\n");
+			printf("    intern=<str>\n");
+			printf("    intern-prefix=<str>,<len>\n");
+			printf("    many=<nr>\n");
+			printf("    size\n");
+			return 0;
+		} else if (skip_prefix(*argv, "intern=", &val)) {
+			atom_t atom = atom_intern(&table, val, strlen(val));
+			printf("intern '%s': %u '%s'\n", val, atom,
+			       atom_name(&table, atom));
+		} else if (skip_prefix(*argv, "intern-prefix=", &val)) {
+			const char *comma = strchr(val, ',');
+			if (!comma)
+				die("unknown option '%s'", *argv);
+			size_t len = atoi(comma + 1);
+			atom_t atom = atom_intern(&table, val, len);
+			printf("intern-prefix '%.*s': %u '%s'\n", (int)len, val,
+			       atom, atom_name(&table, atom));
+		} else if (skip_prefix(*argv, "many=", &val)) {
+			printf("many '%s'\n", val);
+			if (check_many(&table, strtoul(val, NULL, 10)))
+				return 1;
+		} else if (!strcmp(*argv, "size")) {
+			printf("size: %zu\n", atom_table_size(&table));
+		} else {
+			die("unknown option '%s'", *argv);
+		}
+	}
+
+	atom_table_destroy(&table);
+	return 0;
+}
@@ -0,0 +1,43 @@
+#!/bin/bash
+
+
+tmpdir="$(mktemp -d test-tmp.XXXXXXXXXX)"
+cleanup () {
+	rm -rf "$tmpdir"
+}
+trap cleanup EXIT
+
+test -x ./test-atom || {
+	echo "./test-atom is missing or not executable"
+	exit 1
+}
+
+cat >$tmpdir/expect <<-EOF &&
+size: 1
+intern 'a': 1 'a'
+intern 'abc': 2 'abc'
+intern 'a': 1 'a'
+intern-prefix 'ab': 3 'ab'
+intern-prefix 'abc': 2 'abc'
+intern '': 4 ''
+intern '': 4 ''
+size: 5
+EOF
+
+echo "TEST: intern" &&
+./test-atom size intern=a intern=abc intern=a intern-prefix=abcd,2 \
+	intern-prefix=abcd,3 intern= intern= size >$tmpdir/actual &&
+diff -u $tmpdir/expect $tmpdir/actual &&
+echo "OK" &&
+
+cat >$tmpdir/expect <<-EOF &&
+many '100000'
+size: 100001
+many '100000'
+size: 100001
+EOF
+
+echo "TEST: many atoms" &&
+./test-atom many=100000 size many=100000 size >$tmpdir/actual &&
+diff -u $tmpdir/expect $tmpdir/actual &&
+echo "OK"
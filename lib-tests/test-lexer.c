@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../util.h"
+#include "../lexer.h"
+#include "../lib/source-file.h"
+
+/*
+ * Keyword-heavy snippet for the benchmark. It also contains identifiers that
+ * share prefixes, suffixes, and lengths with the keywords.
+ */
+static const char bench_snippet[] =
+	"int void return if else for while do break continue goto\n"
+	"integer voids returned iff elsewhere fork whiled done breaks\n"
+	"continued gotos in vo re i el fo wh d br co go x _ int_ do1\n";
+
+static char *make_bench_source(size_t min_tokens, size_t *nr_tokens)
+{
+	size_t snippet_tokens = 0, copies, len = strlen(bench_snippet);
+	struct token_array toks;
+	char *buf;
+
+	lex(bench_snippet, &toks);
+	while (toks.types[snippet_tokens] != TOK_NONE)
+		snippet_tokens++;
+	free_tokens(&toks);
+
+	copies = (min_tokens + snippet_tokens - 1) / snippet_tokens;
+	buf = xmalloc(st_mult(copies, len) + 1);
+	for (size_t i = 0; i < copies; i++)
+		memcpy(buf + i * len, bench_snippet, len);
+	buf[copies * len] = '\0';
+	*nr_tokens = copies * snippet_tokens;
+	return buf;
+}
+
+static int same_token(const struct token *a, const struct token *b)
+{
+	if (a->type != b->type || a->loc.line_no != b->loc.line_no ||
+	    a->loc.col_no != b->loc.col_no)
+		return 0;
+	if (a->type == TOK_INTEGER)
+		return a->u.ival == b->u.ival;
+	if (a->type == TOK_IDENTIFIER)
+		return !strcmp(a->u.name, b->u.name);
+	return 1;
+}
+
+/*
+ * Check that a token stream yields the same tokens as lex(), also comparing
+ * the lookahead tokens at each position. Returns the number of tokens.
+ */
+static size_t check_stream(const char *buf)
+{
+	struct token_array toks;
+	struct token_stream ts;
+	struct token a, b;
+	size_t nr = 0;
+
+	lex(buf, &toks);
+	token_stream_init(&ts, buf);
+	while (1) {
+		for (int i = 0; i < TOKEN_LOOKAHEAD; i++) {
+			token_stream_get(&ts, i, &a);
+			token_array_get(&toks, nr + i, &b);
+			if (!same_token(&a, &b))
+				die("stream mismatch at token %zu + %d", nr, i);
+			if (b.type == TOK_NONE)
+				break;
+		}
+		if (token_stream_end(&ts))
+			break;
+		token_stream_pop(&ts);
+		nr++;
+	}
+	free_token_source(ts.toks.src);
+	token_stream_release(&ts);
+	free_tokens(&toks);
+	return nr;
+}
+
+/*
+ * Check that lex_parallel() gives the same tokens, lines, and atoms as lex().
+ * The former goes first, so that errors come from it.
+ */
+static void check_parallel(const char *path, int nr_jobs)
+{
+	struct source_file sf;
+	struct token_array par, seq;
+	struct token a, b;
+	size_t nr = 0;
+
+	load_source_file(&sf, path);
+	lex_parallel(sf.buf, &par, nr_jobs);
+	lex(sf.buf, &seq);
+
+	do {
+		token_array_get(&par, nr, &a);
+		token_array_get(&seq, nr, &b);
+		if (!same_token(&a, &b) || a.atom != b.atom)
+			die("parallel mismatch at token %zu", nr);
+	} while (a.type != TOK_NONE && ++nr);
+
+	if (par.src->nr_lines != seq.src->nr_lines ||
+	    memcmp(par.src->line_offsets, seq.src->line_offsets,
+		   st_mult(sizeof(size_t), seq.src->nr_lines)))
+		die("parallel mismatch at line offsets");
+	if (atom_table_size(&par.src->atoms) != atom_table_size(&seq.src->atoms))
+		die("parallel mismatch at atoms");
+
+	printf("compare: %zu tokens, %zu lines, %zu atoms\n", nr,
+	       seq.src->nr_lines, atom_table_size(&seq.src->atoms) - 1);
+	free_tokens(&par);
+	free_tokens(&seq);
+	release_source_file(&sf);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		die_errno("clock_gettime failed");
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	const char *val;
+	int nr_jobs = 1;
+
+	for (argv++; *argv; argv++) {
+		if (!strcmp(*argv, "-h") || !strcmp(*argv, "--help")) {
+			printf("Options:\n");
+			printf("    jobs=<n> (for the following lex= and bench=)\n");
+			printf("    lex=<str>\n");
+			printf("    bench=<nr_tokens>\n");
+			printf("    stream=<nr_tokens>\n");
+			printf("    compare=<file> (lex with jobs vs. without)\n");
+			return 0;
+		} else if (skip_prefix(*argv, "jobs=", &val)) {
+			nr_jobs = atoi(val);
+		} else if (skip_prefix(*argv, "lex=", &val)) {
+			struct token_array toks;
+			struct token tok;
+			lex_parallel(val, &toks, nr_jobs);
+			printf("lex '%s'\n", val);
+			for (size_t i = 0; toks.types[i] != TOK_NONE; i++) {
+				token_array_get(&toks, i, &tok);
+				printf(" ");
+				print_token(&tok);
+			}
+			free_tokens(&toks);
+		} else if (skip_prefix(*argv, "bench=", &val)) {
+			size_t nr_tokens;
+			char *buf = make_bench_source(strtoul(val, NULL, 10),
+						      &nr_tokens);
+			double start = now(), elapsed;
+			struct token_array toks;
+			lex_parallel(buf, &toks, nr_jobs);
+			elapsed = now() - start;
+			free_tokens(&toks);
+			free(buf);
+			printf("bench: %zu tokens in %.3fs (%.0f tokens/s)\n",
+			       nr_tokens, elapsed,
+			       elapsed > 0 ? nr_tokens / elapsed : 0);
+		} else if (skip_prefix(*argv, "stream=", &val)) {
+			size_t nr_tokens;
+			char *buf = make_bench_source(strtoul(val, NULL, 10),
+						      &nr_tokens);
+			printf("stream: %zu tokens\n", check_stream(buf));
+			free(buf);
+		} else if (skip_prefix(*argv, "compare=", &val)) {
+			check_parallel(val, nr_jobs);
+		} else {
+			die("unknown option '%s'", *argv);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,147 @@
+#!/bin/bash
+
+
+tmpdir="$(mktemp -d test-tmp.XXXXXXXXXX)"
+cleanup () {
+	rm -rf "$tmpdir"
+}
+trap cleanup EXIT
+
+test -x ./test-lexer || {
+	echo "./test-lexer is missing or not executable"
+	exit 1
+}
+
+cat >$tmpdir/expect <<-EOF &&
+lex 'int void return if else for while do break continue goto'
+ <int> keyword
+ <void> keyword
+ <return> keyword
+ <if> keyword
+ <else> keyword
+ <for> keyword
+ <while> keyword
+ <do> keyword
+ <break> keyword
+ <continue> keyword
+ <goto> keyword
+EOF
+
+echo "TEST: keywords" &&
+./test-lexer "lex=int void return if else for while do break continue goto" >$tmpdir/actual &&
+diff -u $tmpdir/expect $tmpdir/actual &&
+echo "OK" &&
+
+cat >$tmpdir/expect <<-EOF &&
+lex 'integer in i iff fi dob od voidint elsewhere _int gotoo continu e'
+ <identifier> 'integer'
+ <identifier> 'in'
+ <identifier> 'i'
+ <identifier> 'iff'
+ <identifier> 'fi'
+ <identifier> 'dob'
+ <identifier> 'od'
+ <identifier> 'voidint'
+ <identifier> 'elsewhere'
+ <identifier> '_int'
+ <identifier> 'gotoo'
+ <identifier> 'continu'
+ <identifier> 'e'
+EOF
+
+echo "TEST: identifiers similar to keywords" &&
+./test-lexer "lex=integer in i iff fi dob od voidint elsewhere _int gotoo continu e" >$tmpdir/actual &&
+diff -u $tmpdir/expect $tmpdir/actual &&
+echo "OK" &&
+
+cat >$tmpdir/expect <<-EOF &&
+lex 'if(do){int;}else+goto'
+ <if> keyword
+ (
+ <do> keyword
+ )
+ {
+ <int> keyword
+ ;
+ }
+ <else> keyword
+ +
+ <goto> keyword
+EOF
+
+echo "TEST: keywords next to punctuation" &&
+./test-lexer "lex=if(do){int;}else+goto" >$tmpdir/actual &&
+diff -u $tmpdir/expect $tmpdir/actual &&
+echo "OK" &&
+
+cat >$tmpdir/expect <<-EOF &&
+lex 'foo=2147483647-bar_1*0;'
+ <identifier> 'foo'
+ =
+ <integer> '2147483647'
+ -
+ <identifier> 'bar_1'
+ *
+ <integer> '0'
+ ;
+EOF
+
+echo "TEST: integer and identifier values" &&
+./test-lexer "lex=foo=2147483647-bar_1*0;" >$tmpdir/actual &&
+diff -u $tmpdir/expect $tmpdir/actual &&
+echo "OK" &&
+
+cat >$tmpdir/expect <<-EOF &&
+stream: 0 tokens
+stream: 37 tokens
+stream: 10027 tokens
+EOF
+
+echo "TEST: token stream" &&
+./test-lexer stream=0 stream=1 stream=10000 >$tmpdir/actual &&
+diff -u $tmpdir/expect $tmpdir/actual &&
+echo "OK" &&
+
+# Block comments spanning lines, in between lines with code and line comments,
+# so that some of them cross the boundaries between the chunks lexed by
+# different threads.
+for i in 1 2 3 4 5 6 7 8
+do
+	printf "int f$i(int a)\n{\n\t/* start $i\n"
+	printf "\t * x = y; { ( /* //\n\t */ return a+$i; // c */ y\n"
+	printf "  while (a) /* a\n */ a--; /**/\n}\n\n"
+done >$tmpdir/src.c &&
+
+cat >$tmpdir/expect <<-EOF &&
+compare: 160 tokens, 73 lines, 9 atoms
+compare: 160 tokens, 73 lines, 9 atoms
+compare: 160 tokens, 73 lines, 9 atoms
+compare: 160 tokens, 73 lines, 9 atoms
+compare: 160 tokens, 73 lines, 9 atoms
+EOF
+
+echo "TEST: parallel lexing" &&
+./test-lexer jobs=2 compare=$tmpdir/src.c jobs=3 compare=$tmpdir/src.c \
+	jobs=7 compare=$tmpdir/src.c jobs=16 compare=$tmpdir/src.c \
+	jobs=100 compare=$tmpdir/src.c >$tmpdir/actual &&
+diff -u $tmpdir/expect $tmpdir/actual &&
+echo "OK" &&
+
+echo "TEST: parallel lexing errors" &&
+sed "20s/\$/ @/" $tmpdir/src.c >$tmpdir/bad.c &&
+! ./test-lexer compare=$tmpdir/bad.c 2>$tmpdir/expect &&
+grep -q "unknown token '@'" $tmpdir/expect &&
+! ./test-lexer jobs=7 compare=$tmpdir/bad.c 2>$tmpdir/actual &&
+diff -u $tmpdir/expect $tmpdir/actual &&
+printf "/* runaway\n" >>$tmpdir/src.c &&
+! ./test-lexer compare=$tmpdir/src.c 2>$tmpdir/expect &&
+grep -q "runaway comment" $tmpdir/expect &&
+! ./test-lexer jobs=7 compare=$tmpdir/src.c 2>$tmpdir/actual &&
+diff -u $tmpdir/expect $tmpdir/actual &&
+echo "OK" &&
+
+echo "TEST: benchmark" &&
+./test-lexer bench=10000 jobs=4 bench=10000 >$tmpdir/actual &&
+test $(grep -c "^bench: [0-9]* tokens in .* tokens/s)$" $tmpdir/actual) = 2 &&
+cat $tmpdir/actual &&
+echo "OK"
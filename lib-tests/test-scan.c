@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "../util.h"
+#include "../lib/scan.h"
+
+#define BUF_SIZE 256
+
+static const char *scalar_skip_blanks(const char *str)
+{
+	while (*str == ' ' || *str == '\t')
+		str++;
+	return str;
+}
+
+static const char *scalar_find_char2(const char *str, char c1, char c2)
+{
+	while (*str && *str != c1 && *str != c2)
+		str++;
+	return str;
+}
+
+/*
+ * Checks the routines against the naive implementations above, for every
+ * starting offset in `buf` (which must be NUL-terminated).
+ */
+static int check_buf(const char *buf, size_t len)
+{
+	for (size_t i = 0; i <= len; i++) {
+		if (skip_blanks(buf + i) != scalar_skip_blanks(buf + i)) {
+			printf("skip_blanks failed at offset %zu\n", i);
+			return 1;
+		}
+		if (find_char2(buf + i, '*', '\n') !=
+		    scalar_find_char2(buf + i, '*', '\n')) {
+			printf("find_char2 failed at offset %zu\n", i);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void fill_random(char *buf, size_t len)
+{
+	static const char alphabet[] = "  \t\t\t\n**/a";
+	for (size_t i = 0; i < len; i++)
+		buf[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+	buf[len] = '\0';
+}
+
+static int check_random(int rounds)
+{
+	char *buf = xmalloc(BUF_SIZE + 1);
+	int ret = 0;
+	for (int i = 0; i < rounds && !ret; i++) {
+		size_t len = rand() % BUF_SIZE;
+		fill_random(buf, len);
+		ret = check_buf(buf, len);
+	}
+	free(buf);
+	return ret;
+}
+
+/*
+ * Place strings right at the end of a page followed by an inaccessible one,
+ * so that any read past the aligned block holding the NUL byte would crash.
+ */
+static int check_page_end(void)
+{
+	long pagesize = sysconf(_SC_PAGESIZE);
+	char *pages = mmap(NULL, 2 * pagesize, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	int ret = 0;
+
+	if (pages == MAP_FAILED)
+		die_errno("mmap failed");
+	if (mprotect(pages + pagesize, pagesize, PROT_NONE))
+		die_errno("mprotect failed");
+
+	for (size_t len = 0; len < BUF_SIZE && !ret; len++) {
+		char *buf = pages + pagesize - len - 1;
+		memset(buf, ' ', len);
+		buf[len] = '\0';
+		ret = check_buf(buf, len);
+	}
+
+	munmap(pages, 2 * pagesize);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	const char *val;
+	static const char *const impl_names[] = {
+		[SCAN_SCALAR] = "scalar",
+		[SCAN_SSE2] = "sse2",
+		[SCAN_AVX2] = "avx2",
+	};
+
+	for (argv++; *argv; argv++) {
+		if (!strcmp(*argv, "-h") || !strcmp(*argv, "--help")) {
+			printf("Options:\n");
+			printf("    impl=<scalar|sse2|avx2>\n");
+			printf("    random=<rounds>\n");
+			printf("    page-end\n");
+			return 0;
+		} else if (skip_prefix(*argv, "impl=", &val)) {
+			size_t i, nr = sizeof(impl_names) / sizeof(*impl_names);
+			for (i = 0; i < nr; i++)
+				if (!strcmp(val, impl_names[i]))
+					break;
+			if (i == nr)
+				die("unknown implementation '%s'", val);
+			if (scan_use_impl(i)) {
+				printf("impl '%s' unsupported\n", val);
+				return 0;
+			}
+			printf("impl '%s'\n", val);
+		} else if (skip_prefix(*argv, "random=", &val)) {
+			printf("random '%s'\n", val);
+			if (check_random(atoi(val)))
+				return 1;
+		} else if (!strcmp(*argv, "page-end")) {
+			printf("page-end\n");
+			if (check_page_end())
+				return 1;
+		} else {
+			die("unknown option '%s'", *argv);
+		}
+	}
+
+	return 0;
+}
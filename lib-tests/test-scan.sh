@@ -0,0 +1,13 @@
+#!/bin/bash
+
+test -x ./test-scan || {
+	echo "./test-scan is missing or not executable"
+	exit 1
+}
+
+for impl in scalar sse2 avx2
+do
+	echo "TEST: $impl" &&
+	./test-scan impl=$impl random=2000 page-end &&
+	echo "OK" || exit 1
+done
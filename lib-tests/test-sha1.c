@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../util.h"
+#include "../lib/sha1.h"
+
+/*
+ * Hashes `nr` copies of `str`, feeding sha1_update() `chunk` bytes at a time
+ * (or whole copies, if `chunk` is 0).
+ */
+static void print_sha1(const char *str, size_t nr, size_t chunk)
+{
+	struct sha1_ctx ctx;
+	unsigned char sha1[SHA1_RAWSZ];
+	char hex[SHA1_HEXSZ + 1];
+	size_t len = strlen(str);
+
+	sha1_init(&ctx);
+	for (size_t i = 0; i < nr; i++) {
+		if (!chunk) {
+			sha1_update(&ctx, str, len);
+			continue;
+		}
+		for (size_t j = 0; j < len; j += chunk)
+			sha1_update(&ctx, str + j, len - j < chunk ? len - j : chunk);
+	}
+	sha1_final(&ctx, sha1);
+	sha1_to_hex(sha1, hex);
+	printf("%s\n", hex);
+}
+
+int main(int argc, char **argv)
+{
+	const char *val;
+	size_t repeat = 1, chunk = 0;
+
+	for (argv++; *argv; argv++) {
+		if (!strcmp(*argv, "-h") || !strcmp(*argv, "--help")) {
+			printf("Options:\n");
+			printf("    repeat=<nr>   (for the next strings)\n");
+			printf("    chunk=<size>  (for the next strings)\n");
+			printf("    str=<string>\n");
+			return 0;
+		} else if (skip_prefix(*argv, "repeat=", &val)) {
+			repeat = strtoul(val, NULL, 10);
+		} else if (skip_prefix(*argv, "chunk=", &val)) {
+			chunk = strtoul(val, NULL, 10);
+		} else if (skip_prefix(*argv, "str=", &val)) {
+			print_sha1(val, repeat, chunk);
+		} else {
+			die("unknown option '%s'", *argv);
+		}
+	}
+	return 0;
+}
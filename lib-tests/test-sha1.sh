@@ -0,0 +1,51 @@
+#!/bin/bash
+
+
+tmpdir="$(mktemp -d test-tmp.XXXXXXXXXX)"
+cleanup () {
+	rm -rf "$tmpdir"
+}
+trap cleanup EXIT
+
+test -x ./test-sha1 || {
+	echo "./test-sha1 is missing or not executable"
+	exit 1
+}
+
+# The test vectors are from FIPS 180-2, plus a few lengths around the 56 and
+# 64 bytes boundaries of the padding.
+
+cat >$tmpdir/expect <<-EOF &&
+da39a3ee5e6b4b0d3255bfef95601890afd80709
+a9993e364706816aba3e25717850c26c9cd0d89d
+84983e441c3bd26ebaae4aa1f95129e5e54670f1
+EOF
+
+echo "TEST: test vectors" &&
+./test-sha1 str= str=abc \
+	str=abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq \
+	>$tmpdir/actual &&
+diff -u $tmpdir/expect $tmpdir/actual &&
+echo "OK" &&
+
+cat >$tmpdir/expect <<-EOF &&
+34aa973cd4c4daa4f61eeb2bdbad27316534016f
+34aa973cd4c4daa4f61eeb2bdbad27316534016f
+EOF
+
+echo "TEST: a million a's" &&
+./test-sha1 repeat=1000000 str=a repeat=1000 chunk=7 \
+	str="$(printf "%1000s" | tr " " a)" \
+	>$tmpdir/actual &&
+diff -u $tmpdir/expect $tmpdir/actual &&
+echo "OK" &&
+
+echo "TEST: lengths around the block boundaries" &&
+for len in 55 56 57 63 64 65
+do
+	str="$(printf "%${len}s" | tr ' ' x)" &&
+	printf "%s" "$str" | sha1sum | cut -d' ' -f1 >$tmpdir/expect &&
+	./test-sha1 chunk=1 str="$str" >$tmpdir/actual &&
+	diff -u $tmpdir/expect $tmpdir/actual || exit 1
+done &&
+echo "OK"
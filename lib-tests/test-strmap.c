@@ -1,5 +1,8 @@
+#define _GNU_SOURCE /* hsearch: *_r variants */
 #include <stdio.h>
 #include <stdlib.h>
+#include <search.h>
+#include <time.h>
 #include "../util.h"
 #include "../lib/array.h"
 #include "../lib/strmap.h"
@@ -18,6 +21,125 @@ static void strmap_addr_copy(void **ptr_dst, void **ptr_src)
 	*ptr_dst = *ptr_src;
 }
 
+static double now(void)
+{
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		die_errno("clock_gettime failed");
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * The previous strmap backend, for comparison: a glibc hsearch_r table,
+ * which can't grow, so it is rebuilt into a bigger one by finding each key
+ * again (kept in a separate array, also used for iteration).
+ */
+struct hsearch_map {
+	struct hsearch_data table;
+	const char **keys;
+	size_t nr, table_alloc, keys_alloc;
+};
+
+static void hsearch_map_init(struct hsearch_map *map, size_t size)
+{
+	memset(map, 0, sizeof(*map));
+	map->table_alloc = size;
+	if (!hcreate_r(size, &map->table))
+		die_errno("hcreate_r error");
+}
+
+static ENTRY *hsearch_map_find(struct hsearch_map *map, const char *str)
+{
+	ENTRY search = { .key = (char *)str }, *found;
+	return hsearch_r(search, FIND, &found, &map->table) ? found : NULL;
+}
+
+static void hsearch_map_put(struct hsearch_map *map, const char *str, void *val)
+{
+	ENTRY search = { .key = (char *)str, .data = val }, *found;
+	if ((found = hsearch_map_find(map, str))) {
+		found->data = val;
+		return;
+	}
+	if (map->nr + 1 > map->table_alloc) {
+		struct hsearch_data table = { 0 };
+		if (!hcreate_r(map->table_alloc * 2, &table))
+			die_errno("hcreate_r error");
+		for (size_t i = 0; i < map->nr; i++) {
+			ENTRY e = *hsearch_map_find(map, map->keys[i]);
+			if (!hsearch_r(e, ENTER, &found, &table))
+				die_errno("hsearch_r error");
+		}
+		hdestroy_r(&map->table);
+		map->table = table;
+		map->table_alloc *= 2;
+	}
+	if (!hsearch_r(search, ENTER, &found, &map->table))
+		die_errno("hsearch_r error");
+	ALLOC_GROW(map->keys, map->nr + 1, map->keys_alloc);
+	map->keys[map->nr++] = str;
+}
+
+static int sum_entry(const char *key, void *val, void *udata)
+{
+	*(intmax_t *)udata += (intmax_t)val;
+	return 0;
+}
+
+/*
+ * Times `nr` puts, then finding each key and `nr` missing ones, then
+ * iterating over all the entries, with strmap and with the hsearch_r backend.
+ */
+static void bench(size_t nr)
+{
+	char **keys = xmalloc(st_mult(2 * nr, sizeof(*keys)));
+	intmax_t sums[2] = { 0 };
+	double start, elapsed[2];
+	struct strmap map = { 0 };
+	struct hsearch_map hmap;
+
+	for (size_t i = 0; i < 2 * nr; i++)
+		keys[i] = xmkstr("key_%zu", i);
+
+	start = now();
+	strmap_init(&map, strmap_val_plain_copy);
+	for (size_t i = 0; i < nr; i++)
+		strmap_put(&map, keys[i], (void *)(intmax_t)i);
+	for (size_t i = 0; i < 2 * nr; i++) {
+		void *val;
+		if (strmap_find(&map, keys[i], &val))
+			sums[0] += (intmax_t)val;
+	}
+	strmap_iterate(&map, sum_entry, &sums[0]);
+	strmap_destroy(&map);
+	elapsed[0] = now() - start;
+
+	start = now();
+	hsearch_map_init(&hmap, INITIAL_TABLE_ALLOC);
+	for (size_t i = 0; i < nr; i++)
+		hsearch_map_put(&hmap, keys[i], (void *)(intmax_t)i);
+	for (size_t i = 0; i < 2 * nr; i++) {
+		ENTRY *found = hsearch_map_find(&hmap, keys[i]);
+		if (found)
+			sums[1] += (intmax_t)found->data;
+	}
+	for (size_t i = 0; i < hmap.nr; i++)
+		sum_entry(hmap.keys[i], hsearch_map_find(&hmap, hmap.keys[i])->data,
+			  &sums[1]);
+	hdestroy_r(&hmap.table);
+	free(hmap.keys);
+	elapsed[1] = now() - start;
+
+	if (sums[0] != sums[1])
+		die("bench: strmap and hsearch gave different results");
+	printf("bench: %zu keys, strmap: %.3fs, hsearch: %.3fs\n", nr,
+	       elapsed[0], elapsed[1]);
+
+	for (size_t i = 0; i < 2 * nr; i++)
+		free(keys[i]);
+	free(keys);
+}
+
 int main(int argc, char **argv)
 {
 	struct strmap map = { 0 }, map2 = { 0 };
@@ -37,8 +159,10 @@ int main(int argc, char **argv)
 			printf("    find=<str>\n");
 			printf("    has=<str>\n");
 			printf("    put=<str>,<off>\n");
+			printf("    remove=<str>\n");
 			printf("    list\n");
 			printf("    info\n");
+			printf("    bench=<nr_keys>\n");
 			return 0;
 		} else if (!strcmp(*argv, "init")) {
 			strmap_init(map_ptr, strmap_addr_copy);
@@ -79,6 +203,12 @@ int main(int argc, char **argv)
 
 			printf("put: '%s' -> %d\n", val, map_val);
 			strmap_put(map_ptr, val, (void *)(intmax_t)map_val);
+		} else if (skip_prefix(*argv, "remove=", &val)) {
+			void *vval;
+			if (strmap_remove(map_ptr, val, &vval))
+				printf("remove '%s': %d\n", val, (int)(intmax_t)vval);
+			else
+				printf("remove '%s': not-found\n", val);
 		} else if (!strcmp(*argv, "list")) {
 			printf("list\n");
 			strmap_iterate(map_ptr, print_strmap_entry, NULL);
@@ -86,7 +216,9 @@ int main(int argc, char **argv)
 			printf("info:\n");
 			printf("  nr:          %zu\n", map_ptr->nr);
 			printf("  table_alloc: %zu\n", map_ptr->table_alloc);
-			printf("  keys_alloc:  %zu\n", map_ptr->keys_alloc);
+			printf("  entries_nr:  %zu\n", map_ptr->entries_nr);
+		} else if (skip_prefix(*argv, "bench=", &val)) {
+			bench(strtoul(val, NULL, 10));
 		} else {
 			die("unknown option '%s'", *argv);
 		}
@@ -39,18 +39,18 @@ list
  a -> 3
 info:
   nr:          1
-  table_alloc: 2
-  keys_alloc:  24
+  table_alloc: 4
+  entries_nr:  1
 put: 'b' -> 3
 info:
   nr:          2
-  table_alloc: 2
-  keys_alloc:  24
+  table_alloc: 4
+  entries_nr:  2
 put: 'c' -> 4
 info:
   nr:          3
   table_alloc: 4
-  keys_alloc:  24
+  entries_nr:  3
 list
  a -> 3
  b -> 3
@@ -63,7 +63,7 @@ list
 info:
   nr:          3
   table_alloc: 4
-  keys_alloc:  24
+  entries_nr:  3
 copy
 list
  a -> 3
@@ -72,7 +72,7 @@ list
 info:
   nr:          3
   table_alloc: 4
-  keys_alloc:  24
+  entries_nr:  3
 destroy
 EOF
 
@@ -142,3 +142,57 @@ fi
 
 diff -u $tmpdir/expect $tmpdir/actual &&
 echo "OK"
+
+cat >$tmpdir/expect <<-EOF &&
+init 2
+put: 'a' -> 1
+put: 'b' -> 2
+put: 'c' -> 3
+remove 'b': 2
+remove 'b': not-found
+has 'b': 0
+find 'a': 1
+find 'c': 3
+list
+ a -> 1
+ c -> 3
+info:
+  nr:          2
+  table_alloc: 4
+  entries_nr:  3
+put: 'b' -> 4
+put: 'd' -> 5
+info:
+  nr:          4
+  table_alloc: 8
+  entries_nr:  4
+list
+ a -> 1
+ c -> 3
+ b -> 4
+ d -> 5
+copy
+remove 'a': 1
+list
+ c -> 3
+ b -> 4
+ d -> 5
+destroy
+EOF
+
+echo "TEST: remove and grow" &&
+./test-strmap init=2 put=a,1 put=b,2 put=c,3 remove=b remove=b has=b find=a find=c list info put=b,4 put=d,5 info list copy remove=a list destroy >$tmpdir/actual
+if test $? != 0
+then
+	cat $tmpdir/actual
+	exit 1
+fi
+
+diff -u $tmpdir/expect $tmpdir/actual &&
+echo "OK" &&
+
+echo "TEST: benchmark" &&
+./test-strmap bench=100000 >$tmpdir/actual &&
+test $(grep -c "^bench: [0-9]* keys, strmap: .*s, hsearch: .*s$" $tmpdir/actual) = 1 &&
+cat $tmpdir/actual &&
+echo "OK"
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/wait.h>
 #include "../util.h"
 #include "../lib/tempfile.h"
 
@@ -16,6 +17,7 @@ int main(int argc, char **argv)
 			printf("    create-path=<str>\n");
 			printf("    exit\n");
 			printf("    signal\n");
+			printf("    fork-exit\n");
 			printf("    remove\n");
 			printf("    rename=<str>\n");
 			printf("    commit\n");
@@ -56,6 +58,17 @@ int main(int argc, char **argv)
 			fflush(stdout);
 			raise(SIGINT);
 			return 0;
+		} else if (!strcmp(*argv, "fork-exit")) {
+			pid_t pid;
+			printf("fork-exit\n");
+			fflush(stdout);
+			pid = fork();
+			if (pid < 0)
+				die_errno("fork failed");
+			if (!pid)
+				exit(0);
+			if (waitpid(pid, NULL, 0) < 0)
+				die_errno("waitpid failed");
 		} else if (!strcmp(*argv, "remove")) {
 			printf("remove\n");
 			delete_tempfile(&t);
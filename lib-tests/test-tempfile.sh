@@ -65,6 +65,18 @@ echo "TEST: auto remove on signal" &&
 diff -u $tmpdir/expect $tmpdir/actual &&
 ! test -a $tmpdir/tmp &&
 
+cat >$tmpdir/expect <<-EOF &&
+create-path '$tmpdir/tmp'
+fork-exit
+commit
+EOF
+
+echo "TEST: no auto remove on exit of forked process" &&
+./test-tempfile create-path=$tmpdir/tmp fork-exit commit >$tmpdir/actual &&
+diff -u $tmpdir/expect $tmpdir/actual &&
+test -a $tmpdir/tmp &&
+rm $tmpdir/tmp &&
+
 cat >$tmpdir/expect <<-EOF &&
 create-path '$tmpdir/tmp'
 remove
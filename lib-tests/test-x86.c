@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include "../util.h"
+#include "../lexer.h"
+#include "../parser.h"
+#include "../x86.h"
+
+/*
+ * Program template for the tests. It uses every construct that needs
+ * generated labels, so that each item adds to all the label counters.
+ */
+static const char func_template[] =
+	"int g%zu = %zu;\n"
+	"int f%zu(int a, int b)\n"
+	"{\n"
+	"	int x = a && b || !a;\n"
+	"	x = a ? b : x;\n"
+	"	if (x) a++; else b--;\n"
+	"	while (a < 10) { if (a == 5) break; a++; }\n"
+	"	do { b++; } while (b < a);\n"
+	"	for (x = 0; x < b; x++) continue;\n"
+	"	for (int i = 0; i < a; i++) { x += i; }\n"
+	"	if (x) goto out;\n"
+	"	x = g%zu;\n"
+	"out:\n"
+	"	return x + a * b;\n"
+	"}\n";
+
+static char *make_source(size_t nr_funcs)
+{
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *fp = open_memstream(&buf, &len);
+	if (!fp)
+		die_errno("open_memstream failed");
+	for (size_t i = 0; i < nr_funcs; i++)
+		fprintf(fp, func_template, i, i, i, i);
+	fclose(fp);
+	return buf;
+}
+
+/*
+ * A function with `nr` blocks, either one after the other or each inside the
+ * previous one. Each block declares a variable, which shadows the previous
+ * one when nested.
+ */
+static char *make_blocks_source(size_t nr, int nested)
+{
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *fp = open_memstream(&buf, &len);
+	if (!fp)
+		die_errno("open_memstream failed");
+	fprintf(fp, "int f(int a)\n{\n");
+	for (size_t i = 0; i < nr; i++) {
+		fprintf(fp, "{ int a = %zu; ", i);
+		if (!nested)
+			fprintf(fp, "}\n");
+	}
+	if (nested)
+		for (size_t i = 0; i < nr; i++)
+			fprintf(fp, "}\n");
+	fprintf(fp, "return a;\n}\n");
+	fclose(fp);
+	return buf;
+}
+
+struct gen_job {
+	pthread_t thread;
+	struct ast_program *prog;
+	char *asm_buf;
+	size_t asm_len;
+};
+
+static void *generate(void *data)
+{
+	struct gen_job *job = data;
+	FILE *fp = open_memstream(&job->asm_buf, &job->asm_len);
+	if (!fp)
+		die_errno("open_memstream failed");
+	generate_x86_asm(job->prog, fp, 1);
+	fclose(fp);
+	return NULL;
+}
+
+/*
+ * Generates `nr_progs` programs of different sizes serially and then again
+ * on one thread each, checking that both runs give the same assembly.
+ */
+static void check_parallel(size_t nr_progs)
+{
+	struct gen_job *serial = xcalloc(nr_progs, sizeof(*serial));
+	struct gen_job *parallel = xcalloc(nr_progs, sizeof(*parallel));
+	struct token_source **srcs = xcalloc(nr_progs, sizeof(*srcs));
+
+	for (size_t i = 0; i < nr_progs; i++) {
+		char *buf = make_source(i + 1);
+		struct token_stream ts;
+		token_stream_init(&ts, buf);
+		serial[i].prog = parallel[i].prog = parse_program(&ts);
+		srcs[i] = ts.toks.src;
+		token_stream_release(&ts);
+		free(buf);
+	}
+
+	for (size_t i = 0; i < nr_progs; i++)
+		generate(&serial[i]);
+	for (size_t i = 0; i < nr_progs; i++) {
+		int ret = pthread_create(&parallel[i].thread, NULL, generate,
+					 &parallel[i]);
+		if (ret)
+			die("pthread_create failed: %s", strerror(ret));
+	}
+	for (size_t i = 0; i < nr_progs; i++) {
+		int ret = pthread_join(parallel[i].thread, NULL);
+		if (ret)
+			die("pthread_join failed: %s", strerror(ret));
+	}
+
+	for (size_t i = 0; i < nr_progs; i++) {
+		if (serial[i].asm_len != parallel[i].asm_len ||
+		    memcmp(serial[i].asm_buf, parallel[i].asm_buf,
+			   serial[i].asm_len))
+			die("parallel mismatch at program %zu", i);
+		free(serial[i].asm_buf);
+		free(parallel[i].asm_buf);
+		free_ast(serial[i].prog);
+		free_token_source(srcs[i]);
+	}
+
+	printf("compare: %zu programs, same output\n", nr_progs);
+	free(serial);
+	free(parallel);
+	free(srcs);
+}
+
+/* Generates the same program twice in a row, checking the outputs match. */
+static void check_repeat(size_t nr_funcs)
+{
+	struct gen_job jobs[2] = { 0 };
+	char *buf = make_source(nr_funcs);
+	struct token_stream ts;
+
+	token_stream_init(&ts, buf);
+	jobs[0].prog = jobs[1].prog = parse_program(&ts);
+	generate(&jobs[0]);
+	generate(&jobs[1]);
+
+	if (jobs[0].asm_len != jobs[1].asm_len ||
+	    memcmp(jobs[0].asm_buf, jobs[1].asm_buf, jobs[0].asm_len))
+		die("repeated generation gave different output");
+	printf("repeat: %zu functions, same output\n", nr_funcs);
+
+	free(jobs[0].asm_buf);
+	free(jobs[1].asm_buf);
+	free_ast(jobs[0].prog);
+	free_token_source(ts.toks.src);
+	token_stream_release(&ts);
+	free(buf);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		die_errno("clock_gettime failed");
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_blocks(size_t nr, int nested)
+{
+	struct gen_job job = { 0 };
+	char *buf = make_blocks_source(nr, nested);
+	struct token_stream ts;
+	double start, elapsed;
+
+	token_stream_init(&ts, buf);
+	job.prog = parse_program(&ts);
+	start = now();
+	generate(&job);
+	elapsed = now() - start;
+	printf("bench: %zu %s blocks in %.3fs\n", nr,
+	       nested ? "nested" : "sibling", elapsed);
+
+	free(job.asm_buf);
+	free_ast(job.prog);
+	free_token_source(ts.toks.src);
+	token_stream_release(&ts);
+	free(buf);
+}
+
+int main(int argc, char **argv)
+{
+	const char *val;
+
+	for (argv++; *argv; argv++) {
+		if (!strcmp(*argv, "-h") || !strcmp(*argv, "--help")) {
+			printf("Options:\n");
+			printf("    repeat=<nr_functions>\n");
+			printf("    compare=<nr_programs> (serial vs. threads)\n");
+			printf("    bench-siblings=<nr_blocks>\n");
+			printf("    bench-nested=<nr_blocks>\n");
+			return 0;
+		} else if (skip_prefix(*argv, "repeat=", &val)) {
+			check_repeat(strtoul(val, NULL, 10));
+		} else if (skip_prefix(*argv, "compare=", &val)) {
+			check_parallel(strtoul(val, NULL, 10));
+		} else if (skip_prefix(*argv, "bench-siblings=", &val)) {
+			bench_blocks(strtoul(val, NULL, 10), 0);
+		} else if (skip_prefix(*argv, "bench-nested=", &val)) {
+			bench_blocks(strtoul(val, NULL, 10), 1);
+		} else {
+			die("unknown option '%s'", *argv);
+		}
+	}
+
+	return 0;
+}
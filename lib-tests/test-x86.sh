@@ -0,0 +1,40 @@
+#!/bin/bash
+
+
+tmpdir="$(mktemp -d test-tmp.XXXXXXXXXX)"
+cleanup () {
+	rm -rf "$tmpdir"
+}
+trap cleanup EXIT
+
+test -x ./test-x86 || {
+	echo "./test-x86 is missing or not executable"
+	exit 1
+}
+
+cat >$tmpdir/expect <<-EOF &&
+repeat: 1 functions, same output
+repeat: 20 functions, same output
+EOF
+
+echo "TEST: repeated generation" &&
+./test-x86 repeat=1 repeat=20 >$tmpdir/actual &&
+diff -u $tmpdir/expect $tmpdir/actual &&
+echo "OK" &&
+
+cat >$tmpdir/expect <<-EOF &&
+compare: 1 programs, same output
+compare: 8 programs, same output
+compare: 32 programs, same output
+EOF
+
+echo "TEST: parallel generation" &&
+./test-x86 compare=1 compare=8 compare=32 >$tmpdir/actual &&
+diff -u $tmpdir/expect $tmpdir/actual &&
+echo "OK" &&
+
+echo "TEST: scope benchmark" &&
+./test-x86 bench-siblings=10000 bench-nested=1000 >$tmpdir/actual &&
+test $(grep -c "^bench: [0-9]* [a-z]* blocks in .*s$" $tmpdir/actual) = 2 &&
+cat $tmpdir/actual &&
+echo "OK"
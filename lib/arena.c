@@ -0,0 +1,89 @@
+#include <stdint.h>
+#include "error.h"
+#include "wrappers.h"
+#include "array.h"
+#include "arena.h"
+
+/*
+ * Chunks double in size, from the min to the max size, so that small arenas
+ * stay small and big ones don't need too many chunks.
+ */
+#define MIN_CHUNK_SIZE (64 * 1024)
+#define MAX_CHUNK_SIZE (16 * 1024 * 1024)
+
+void arena_init(struct arena *arena)
+{
+	memset(arena, 0, sizeof(*arena));
+}
+
+void arena_destroy(struct arena *arena)
+{
+	for (size_t i = 0; i < arena->chunks_nr; i++)
+		free(arena->chunks[i]);
+	free(arena->chunks);
+	memset(arena, 0, sizeof(*arena));
+}
+
+static inline size_t align_size(size_t size)
+{
+	if (size > SIZE_MAX - ARENA_ALIGNMENT)
+		die("arena: allocation of %zu bytes is too big", size);
+	return (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+}
+
+/* Makes room for at least `size` (aligned) bytes at the current chunk. */
+static void new_chunk(struct arena *arena, size_t size)
+{
+	size_t chunk_size = arena->chunk_size * 2;
+	if (chunk_size < MIN_CHUNK_SIZE)
+		chunk_size = MIN_CHUNK_SIZE;
+	else if (chunk_size > MAX_CHUNK_SIZE)
+		chunk_size = MAX_CHUNK_SIZE;
+	if (chunk_size < size)
+		chunk_size = size;
+
+	ALLOC_GROW(arena->chunks, arena->chunks_nr + 1, arena->chunks_alloc);
+	/* malloc()'s memory is suitably aligned for ARENA_ALIGNMENT. */
+	arena->next = arena->chunks[arena->chunks_nr++] = xmalloc(chunk_size);
+	arena->end = arena->next + chunk_size;
+	arena->chunk_size = chunk_size;
+	arena->last = NULL;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	/* Even empty allocations get a distinct, non-NULL address. */
+	size = align_size(size ? size : 1);
+	if (size > (size_t)(arena->end - arena->next))
+		new_chunk(arena, size);
+	arena->last = arena->next;
+	arena->next += size;
+	return arena->last;
+}
+
+void *arena_calloc(struct arena *arena, size_t nmemb, size_t size)
+{
+	size_t total = st_mult(nmemb, size);
+	void *ret = arena_alloc(arena, total);
+	memset(ret, 0, total);
+	return ret;
+}
+
+void *arena_realloc(struct arena *arena, void *ptr, size_t old_size,
+		    size_t new_size)
+{
+	void *ret;
+
+	if (ptr && ptr == arena->last) {
+		new_size = align_size(new_size);
+		if (new_size <= (size_t)(arena->end - arena->last)) {
+			arena->next = arena->last + new_size;
+			return ptr;
+		}
+	}
+
+	ret = arena_alloc(arena, new_size);
+	if (ptr)
+		memcpy(ret, ptr, old_size < new_size ? old_size : new_size);
+	return ret;
+}
@@ -0,0 +1,63 @@
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+#include "array.h"
+
+/*
+ * A bump allocator: memory is handed out sequentially from big chunks, and it
+ * is only given back all at once, by arena_destroy(). So allocating is mostly
+ * a pointer increment, objects allocated one after the other are contiguous,
+ * and freeing a whole data structure costs one free() per chunk.
+ *
+ * All allocations are aligned to ARENA_ALIGNMENT.
+ */
+
+#define ARENA_ALIGNMENT _Alignof(max_align_t)
+
+struct arena {
+	char **chunks;
+	size_t chunks_nr, chunks_alloc;
+	size_t chunk_size; /* Of the last allocated chunk. */
+	char *next, *end; /* Free space at the current chunk. */
+	char *last; /* The last allocation, which arena_realloc() can extend. */
+};
+
+void arena_init(struct arena *arena);
+void arena_destroy(struct arena *arena);
+
+void *arena_alloc(struct arena *arena, size_t size);
+void *arena_calloc(struct arena *arena, size_t nmemb, size_t size);
+
+/*
+ * Resizes `ptr`, which was allocated from `arena` with `old_size` bytes (or is
+ * NULL). It is extended in place if it is the last allocation and there is
+ * room for it in the chunk; otherwise it is copied, and the old memory is
+ * only released with the arena.
+ */
+void *arena_realloc(struct arena *arena, void *ptr, size_t old_size,
+		    size_t new_size);
+
+/* Like ALLOC_GROW(), but for arrays allocated from `arena`. */
+#define ARENA_ALLOC_GROW(arena, x, nr, alloc) \
+	do { \
+		if ((nr) > alloc) { \
+			size_t old_alloc_ = alloc; \
+			if (alloc_nr(alloc) < (nr)) \
+				alloc = (nr); \
+			else \
+				alloc = alloc_nr(alloc); \
+			(x) = arena_realloc(arena, x, \
+					    st_mult(sizeof(*(x)), old_alloc_), \
+					    st_mult(sizeof(*(x)), alloc)); \
+		} \
+	} while (0)
+
+/* Like ARRAY_APPEND(), but for arrays allocated from `arena`. */
+#define ARENA_ARRAY_APPEND(arena, array, val) \
+	do { \
+		ARENA_ALLOC_GROW(arena, (array)->arr, (array)->nr + 1, (array)->alloc); \
+		(array)->arr[(array)->nr++] = (val); \
+	} while (0)
+
+#endif
@@ -0,0 +1,105 @@
+#include "error.h"
+#include "wrappers.h"
+#include "array.h"
+#include "atom.h"
+
+#define INITIAL_SLOTS_ALLOC 256
+#define MIN_CHUNK_SIZE (64 * 1024)
+
+void atom_table_init(struct atom_table *table)
+{
+	memset(table, 0, sizeof(*table));
+	table->slots_alloc = INITIAL_SLOTS_ALLOC;
+	CALLOC_ARRAY(table->slots, table->slots_alloc);
+	/* Reserve ATOM_NONE. */
+	ALLOC_GROW(table->names, 1, table->alloc);
+	REALLOC_ARRAY(table->hashes, table->alloc);
+	table->names[ATOM_NONE] = NULL;
+	table->hashes[ATOM_NONE] = 0;
+	table->nr = 1;
+}
+
+void atom_table_destroy(struct atom_table *table)
+{
+	for (size_t i = 0; i < table->chunks_nr; i++)
+		free(table->chunks[i]);
+	free(table->chunks);
+	free(table->names);
+	free(table->hashes);
+	free(table->slots);
+	memset(table, 0, sizeof(*table));
+}
+
+/* FNV-1a */
+static uint32_t hash_str(const char *str, size_t len)
+{
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (unsigned char)str[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static void grow_slots(struct atom_table *table)
+{
+	size_t mask;
+
+	free(table->slots);
+	table->slots_alloc *= 2;
+	mask = table->slots_alloc - 1;
+	CALLOC_ARRAY(table->slots, table->slots_alloc);
+	for (atom_t atom = 1; atom < table->nr; atom++) {
+		size_t i = table->hashes[atom] & mask;
+		while (table->slots[i])
+			i = (i + 1) & mask;
+		table->slots[i] = atom;
+	}
+}
+
+static const char *copy_name(struct atom_table *table, const char *str,
+			     size_t len)
+{
+	char *ret;
+	if (!table->chunks_nr || table->chunk_used + len + 1 > table->chunk_size) {
+		table->chunk_size = len + 1 > MIN_CHUNK_SIZE ? len + 1 : MIN_CHUNK_SIZE;
+		ALLOC_GROW(table->chunks, table->chunks_nr + 1, table->chunks_alloc);
+		table->chunks[table->chunks_nr++] = xmalloc(table->chunk_size);
+		table->chunk_used = 0;
+	}
+	ret = table->chunks[table->chunks_nr - 1] + table->chunk_used;
+	memcpy(ret, str, len);
+	ret[len] = '\0';
+	table->chunk_used += len + 1;
+	return ret;
+}
+
+atom_t atom_intern(struct atom_table *table, const char *str, size_t len)
+{
+	uint32_t hash = hash_str(str, len);
+	size_t mask = table->slots_alloc - 1, i;
+	atom_t atom;
+
+	for (i = hash & mask; (atom = table->slots[i]); i = (i + 1) & mask) {
+		const char *name = table->names[atom];
+		if (table->hashes[atom] == hash && !strncmp(name, str, len) &&
+		    !name[len])
+			return atom;
+	}
+
+	if (table->nr > UINT32_MAX - 1)
+		die("atom table: too many atoms");
+	atom = table->nr++;
+	if (table->nr > table->alloc) {
+		ALLOC_GROW(table->names, table->nr, table->alloc);
+		REALLOC_ARRAY(table->hashes, table->alloc);
+	}
+	table->names[atom] = copy_name(table, str, len);
+	table->hashes[atom] = hash;
+	table->slots[i] = atom;
+
+	/* Keep the load factor at most 1/2. */
+	if (2 * (table->nr - 1) > table->slots_alloc)
+		grow_slots(table);
+	return atom;
+}
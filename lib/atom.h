@@ -0,0 +1,58 @@
+#ifndef _ATOM_H
+#define _ATOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * An atom table interns strings: each distinct string gets a small integer ID
+ * (an atom) and a single NUL-terminated copy, whose address is stable for the
+ * lifetime of the table. So two interned strings are equal iff their atoms
+ * (or their name pointers) are, and atoms can be used as direct indexes for
+ * dense arrays.
+ *
+ * Atoms are assigned sequentially, starting at 1. The atom 0 (ATOM_NONE) is
+ * never used for a string.
+ *
+ * Note: the table is not thread-safe. Concurrent readers are fine as long as
+ * there are no concurrent calls to atom_intern().
+ */
+
+typedef uint32_t atom_t;
+#define ATOM_NONE 0
+
+struct atom_table {
+	/* Open addressing hashtable of atoms, with a power of 2 size. */
+	atom_t *slots;
+	size_t slots_alloc;
+
+	/* names[atom] and hashes[atom] for each interned atom. */
+	const char **names;
+	uint32_t *hashes;
+	size_t nr, alloc; /* nr-1 atoms interned, as names[0] is unused. */
+
+	/* Chunks of memory holding the interned strings. */
+	char **chunks;
+	size_t chunks_nr, chunks_alloc;
+	size_t chunk_used, chunk_size;
+};
+
+void atom_table_init(struct atom_table *table);
+void atom_table_destroy(struct atom_table *table);
+
+/* Returns the atom for the first `len` bytes of `str`, interning it if needed. */
+atom_t atom_intern(struct atom_table *table, const char *str, size_t len);
+
+/* The interned name of `atom`. */
+static inline const char *atom_name(const struct atom_table *table, atom_t atom)
+{
+	return table->names[atom];
+}
+
+/* One more than the biggest atom in the table. */
+static inline size_t atom_table_size(const struct atom_table *table)
+{
+	return table->nr;
+}
+
+#endif
@@ -0,0 +1,37 @@
+#include <unistd.h>
+#include <errno.h>
+#include "copy.h"
+
+#define COPY_BUF_SIZE (64 * 1024)
+
+static int write_in_full(int fd, const char *buf, size_t len)
+{
+	while (len) {
+		ssize_t ret = write(fd, buf, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+int copy_fd(int ifd, int ofd)
+{
+	char buf[COPY_BUF_SIZE];
+	while (1) {
+		ssize_t len = read(ifd, buf, sizeof(buf));
+		if (!len)
+			return 0;
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (write_in_full(ofd, buf, len))
+			return -1;
+	}
+}
@@ -0,0 +1,10 @@
+#ifndef _COPY_H
+#define _COPY_H
+
+/*
+ * Copies everything from `ifd`, starting at its current offset, to `ofd`.
+ * Returns 0 on success. On failure, returns -1, with errno set.
+ */
+int copy_fd(int ifd, int ofd);
+
+#endif
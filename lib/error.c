@@ -27,13 +27,23 @@
  * [1]: https://github.com/git/git
  */
 
+#include <pthread.h>
 #include "error.h"
 
 static at_die_fn at_die;
 
+/*
+ * Only one thread may die: the others block on die_lock (which is never
+ * released) until the process exits, so that their messages don't get mixed
+ * up and the at_die routine runs once.
+ */
+static pthread_mutex_t die_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static int die_is_recursing(void)
 {
-	static int dying;
+	static __thread int dying;
+	if (!dying)
+		pthread_mutex_lock(&die_lock);
 	return dying++;
 }
 
@@ -0,0 +1,174 @@
+#include <stdint.h>
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+static const char *skip_blanks_scalar(const char *str)
+{
+	while (*str == ' ' || *str == '\t')
+		str++;
+	return str;
+}
+
+static const char *find_char2_scalar(const char *str, char c1, char c2)
+{
+	while (*str && *str != c1 && *str != c2)
+		str++;
+	return str;
+}
+
+#ifdef HAVE_X86_SIMD
+
+/*
+ * All the vectorized routines below follow the same pattern: the first load is
+ * done at `str` rounded down to the vector alignment, and the matches on the
+ * bytes before `str` are masked out. From there on, all loads are aligned, so
+ * we can safely read up to the end of the block holding the NUL byte.
+ */
+
+__attribute__((target("sse2")))
+static const char *skip_blanks_sse2(const char *str)
+{
+	const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t');
+	unsigned int offset = (uintptr_t)str & 15;
+	const __m128i *p = (const __m128i *)(str - offset);
+	unsigned int stop = (0xFFFFu << offset) & 0xFFFFu;
+
+	while (1) {
+		__m128i chunk = _mm_load_si128(p);
+		unsigned int blanks = _mm_movemask_epi8(
+			_mm_or_si128(_mm_cmpeq_epi8(chunk, space),
+				     _mm_cmpeq_epi8(chunk, tab)));
+		stop &= ~blanks;
+		if (stop)
+			return (const char *)p + __builtin_ctz(stop);
+		stop = 0xFFFFu;
+		p++;
+	}
+}
+
+__attribute__((target("sse2")))
+static const char *find_char2_sse2(const char *str, char c1, char c2)
+{
+	const __m128i v1 = _mm_set1_epi8(c1), v2 = _mm_set1_epi8(c2),
+		      zero = _mm_setzero_si128();
+	unsigned int offset = (uintptr_t)str & 15;
+	const __m128i *p = (const __m128i *)(str - offset);
+	unsigned int keep = 0xFFFFu << offset;
+
+	while (1) {
+		__m128i chunk = _mm_load_si128(p);
+		__m128i eq = _mm_or_si128(_mm_cmpeq_epi8(chunk, v1),
+					  _mm_cmpeq_epi8(chunk, v2));
+		eq = _mm_or_si128(eq, _mm_cmpeq_epi8(chunk, zero));
+		unsigned int found = _mm_movemask_epi8(eq) & keep;
+		if (found)
+			return (const char *)p + __builtin_ctz(found);
+		keep = 0xFFFFu;
+		p++;
+	}
+}
+
+__attribute__((target("avx2")))
+static const char *skip_blanks_avx2(const char *str)
+{
+	const __m256i space = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t');
+	unsigned int offset = (uintptr_t)str & 31;
+	const __m256i *p = (const __m256i *)(str - offset);
+	uint32_t stop = UINT32_MAX << offset;
+
+	while (1) {
+		__m256i chunk = _mm256_load_si256(p);
+		uint32_t blanks = _mm256_movemask_epi8(
+			_mm256_or_si256(_mm256_cmpeq_epi8(chunk, space),
+					_mm256_cmpeq_epi8(chunk, tab)));
+		stop &= ~blanks;
+		if (stop)
+			return (const char *)p + __builtin_ctz(stop);
+		stop = UINT32_MAX;
+		p++;
+	}
+}
+
+__attribute__((target("avx2")))
+static const char *find_char2_avx2(const char *str, char c1, char c2)
+{
+	const __m256i v1 = _mm256_set1_epi8(c1), v2 = _mm256_set1_epi8(c2),
+		      zero = _mm256_setzero_si256();
+	unsigned int offset = (uintptr_t)str & 31;
+	const __m256i *p = (const __m256i *)(str - offset);
+	uint32_t keep = UINT32_MAX << offset;
+
+	while (1) {
+		__m256i chunk = _mm256_load_si256(p);
+		__m256i eq = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, v1),
+					     _mm256_cmpeq_epi8(chunk, v2));
+		eq = _mm256_or_si256(eq, _mm256_cmpeq_epi8(chunk, zero));
+		uint32_t found = _mm256_movemask_epi8(eq) & keep;
+		if (found)
+			return (const char *)p + __builtin_ctz(found);
+		keep = UINT32_MAX;
+		p++;
+	}
+}
+
+#endif /* HAVE_X86_SIMD */
+
+static struct {
+	const char *(*skip_blanks)(const char *str);
+	const char *(*find_char2)(const char *str, char c1, char c2);
+} scan_fns = { skip_blanks_scalar, find_char2_scalar };
+
+int scan_use_impl(enum scan_impl impl)
+{
+	switch (impl) {
+	case SCAN_SCALAR:
+		scan_fns.skip_blanks = skip_blanks_scalar;
+		scan_fns.find_char2 = find_char2_scalar;
+		return 0;
+#ifdef HAVE_X86_SIMD
+	case SCAN_SSE2:
+		if (!__builtin_cpu_supports("sse2"))
+			return -1;
+		scan_fns.skip_blanks = skip_blanks_sse2;
+		scan_fns.find_char2 = find_char2_sse2;
+		return 0;
+	case SCAN_AVX2:
+		if (!__builtin_cpu_supports("avx2"))
+			return -1;
+		scan_fns.skip_blanks = skip_blanks_avx2;
+		scan_fns.find_char2 = find_char2_avx2;
+		return 0;
+#endif
+	default:
+		return -1;
+	}
+}
+
+/*
+ * Pick the best implementation before main() runs, so that the selection
+ * doesn't race with (or cost anything to) the callers.
+ */
+__attribute__((constructor))
+static void select_scan_impl(void)
+{
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (!scan_use_impl(SCAN_AVX2) || !scan_use_impl(SCAN_SSE2))
+		return;
+#endif
+	scan_use_impl(SCAN_SCALAR);
+}
+
+const char *skip_blanks(const char *str)
+{
+	return scan_fns.skip_blanks(str);
+}
+
+const char *find_char2(const char *str, char c1, char c2)
+{
+	return scan_fns.find_char2(str, c1, c2);
+}
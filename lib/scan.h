@@ -0,0 +1,37 @@
+#ifndef _SCAN_H
+#define _SCAN_H
+
+/*
+ * Routines to quickly scan NUL-terminated buffers, used by the lexer to skip
+ * whitespaces and comments. They have SSE2 and AVX2 implementations, besides
+ * a scalar fallback, and the best one supported by the CPU is selected at
+ * startup.
+ *
+ * Note: the vectorized versions use aligned loads, which might read (but
+ * never use) bytes after the terminating NUL, up to the end of its aligned
+ * 16 or 32-byte block. Such reads never cross a page boundary. Buffers that
+ * start at a SCAN_ALIGNMENT boundary and whose size is a multiple of it are
+ * never read out of bounds.
+ */
+
+#define SCAN_ALIGNMENT 32
+
+/* Returns a pointer to the first char at `str` that is not ' ' nor '\t'. */
+const char *skip_blanks(const char *str);
+
+/* Returns a pointer to the first occurrence of `c1`, `c2`, or '\0' at `str`. */
+const char *find_char2(const char *str, char c1, char c2);
+
+enum scan_impl {
+	SCAN_SCALAR,
+	SCAN_SSE2,
+	SCAN_AVX2,
+};
+
+/*
+ * Overrides the automatic selection of the implementation. Returns 0 on
+ * success or -1 if the CPU doesn't support `impl`. Mostly useful for tests.
+ */
+int scan_use_impl(enum scan_impl impl);
+
+#endif
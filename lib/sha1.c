@@ -0,0 +1,129 @@
+#include <string.h>
+#include "sha1.h"
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static uint32_t get_be32(const unsigned char *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+	       (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+static void put_be32(unsigned char *p, uint32_t val)
+{
+	p[0] = val >> 24;
+	p[1] = val >> 16;
+	p[2] = val >> 8;
+	p[3] = val;
+}
+
+/*
+ * The message schedule is kept in a 16-word circular buffer, and each group
+ * of 20 rounds has its own loop, so there are no branches in the rounds.
+ */
+#define W(i) w[(i) & 15]
+#define SCHEDULE(i) (W(i) = ROL(W((i) + 13) ^ W((i) + 8) ^ W((i) + 2) ^ W(i), 1))
+/* For the rounds 15 to 19, where the schedule starts. */
+#define W_OR_SCHEDULE(i) ((i) < 16 ? W(i) : SCHEDULE(i))
+
+#define ROUND(a, b, c, d, e, f, k, wi) do { \
+	(e) += ROL(a, 5) + (f) + (k) + (wi); \
+	(b) = ROL(b, 30); \
+} while (0)
+
+#define F1(b, c, d) ((d) ^ ((b) & ((c) ^ (d))))
+#define F2(b, c, d) ((b) ^ (c) ^ (d))
+#define F3(b, c, d) (((b) & (c)) | ((d) & ((b) | (c))))
+
+/* Five rounds, rotating the roles of the variables instead of moving them. */
+#define FIVE_ROUNDS(i, f, k, wi) do { \
+	ROUND(a, b, c, d, e, f(b, c, d), k, wi(i)); \
+	ROUND(e, a, b, c, d, f(a, b, c), k, wi((i) + 1)); \
+	ROUND(d, e, a, b, c, f(e, a, b), k, wi((i) + 2)); \
+	ROUND(c, d, e, a, b, f(d, e, a), k, wi((i) + 3)); \
+	ROUND(b, c, d, e, a, f(c, d, e), k, wi((i) + 4)); \
+} while (0)
+
+static void sha1_block(uint32_t h[5], const unsigned char *block)
+{
+	uint32_t w[16], a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = get_be32(block + 4 * i);
+
+	for (i = 0; i < 15; i += 5)
+		FIVE_ROUNDS(i, F1, 0x5a827999, W);
+	FIVE_ROUNDS(15, F1, 0x5a827999, W_OR_SCHEDULE);
+	for (i = 20; i < 40; i += 5)
+		FIVE_ROUNDS(i, F2, 0x6ed9eba1, SCHEDULE);
+	for (i = 40; i < 60; i += 5)
+		FIVE_ROUNDS(i, F3, 0x8f1bbcdc, SCHEDULE);
+	for (i = 60; i < 80; i += 5)
+		FIVE_ROUNDS(i, F2, 0xca62c1d6, SCHEDULE);
+
+	h[0] += a;
+	h[1] += b;
+	h[2] += c;
+	h[3] += d;
+	h[4] += e;
+}
+
+void sha1_init(struct sha1_ctx *ctx)
+{
+	ctx->h[0] = 0x67452301;
+	ctx->h[1] = 0xefcdab89;
+	ctx->h[2] = 0x98badcfe;
+	ctx->h[3] = 0x10325476;
+	ctx->h[4] = 0xc3d2e1f0;
+	ctx->len = 0;
+}
+
+void sha1_update(struct sha1_ctx *ctx, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	size_t used = ctx->len % 64;
+
+	ctx->len += len;
+
+	if (used) {
+		size_t n = 64 - used < len ? 64 - used : len;
+		memcpy(ctx->block + used, p, n);
+		p += n;
+		len -= n;
+		if (used + n < 64)
+			return;
+		sha1_block(ctx->h, ctx->block);
+	}
+	for (; len >= 64; p += 64, len -= 64)
+		sha1_block(ctx->h, p);
+	memcpy(ctx->block, p, len);
+}
+
+void sha1_final(struct sha1_ctx *ctx, unsigned char out[SHA1_RAWSZ])
+{
+	static const unsigned char pad[64] = { 0x80 };
+	unsigned char len_be[8];
+	uint64_t bits = ctx->len * 8;
+
+	for (int i = 0; i < 8; i++)
+		len_be[i] = bits >> (56 - 8 * i);
+
+	/* Pad to 56 bytes mod 64, leaving room for the length. */
+	sha1_update(ctx, pad, 1 + (119 - ctx->len % 64) % 64);
+	sha1_update(ctx, len_be, 8);
+
+	for (int i = 0; i < 5; i++)
+		put_be32(out + 4 * i, ctx->h[i]);
+}
+
+void sha1_to_hex(const unsigned char sha1[SHA1_RAWSZ],
+		 char hex[SHA1_HEXSZ + 1])
+{
+	static const char digits[] = "0123456789abcdef";
+	for (int i = 0; i < SHA1_RAWSZ; i++) {
+		hex[2 * i] = digits[sha1[i] >> 4];
+		hex[2 * i + 1] = digits[sha1[i] & 0xf];
+	}
+	hex[SHA1_HEXSZ] = '\0';
+}
@@ -0,0 +1,32 @@
+#ifndef _SHA1_H
+#define _SHA1_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * SHA-1, used to name cache entries after their contents. (Not for anything
+ * security related: SHA-1 is broken for that.)
+ *
+ * Calling sequence: sha1_init(), sha1_update() any number of times, then
+ * sha1_final().
+ */
+
+#define SHA1_RAWSZ 20
+#define SHA1_HEXSZ (2 * SHA1_RAWSZ)
+
+struct sha1_ctx {
+	uint32_t h[5];
+	uint64_t len; /* total bytes hashed so far. */
+	unsigned char block[64];
+};
+
+void sha1_init(struct sha1_ctx *ctx);
+void sha1_update(struct sha1_ctx *ctx, const void *data, size_t len);
+void sha1_final(struct sha1_ctx *ctx, unsigned char out[SHA1_RAWSZ]);
+
+/* Writes the hex representation of `sha1`, NUL-terminated, to `hex`. */
+void sha1_to_hex(const unsigned char sha1[SHA1_RAWSZ],
+		 char hex[SHA1_HEXSZ + 1]);
+
+#endif
@@ -0,0 +1,95 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "error.h"
+#include "wrappers.h"
+#include "array.h"
+#include "source-file.h"
+
+#define READ_CHUNK_SIZE (64 * 1024)
+
+static void map_regular_file(struct source_file *sf, int fd, size_t len,
+			     const char *path)
+{
+	size_t pagesize = sysconf(_SC_PAGESIZE);
+	char *map;
+
+	/*
+	 * Reserve the file size plus at least one byte, rounded up to whole
+	 * pages, with an anonymous (thus zeroed) mapping. Then map the file
+	 * over its beginning. Whatever follows the file contents is zero, so
+	 * we always have the NUL terminator, even if the file size is a
+	 * multiple of the page size. This also makes it safe for the lexer to
+	 * read a few bytes past the terminator, as long as it doesn't cross
+	 * to the next page.
+	 */
+	if (len > SIZE_MAX - pagesize)
+		die("'%s' is too big", path);
+	sf->map_len = (len + pagesize) & ~(pagesize - 1);
+	map = mmap(NULL, sf->map_len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+		   -1, 0);
+	if (map == MAP_FAILED)
+		die_errno("failed to reserve memory for '%s'", path);
+	if (len && mmap(map, len, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) ==
+		   MAP_FAILED)
+		die_errno("failed to mmap '%s'", path);
+	sf->buf = map;
+	sf->len = len;
+}
+
+static void read_stream(struct source_file *sf, int fd, const char *path)
+{
+	char *buf = NULL;
+	size_t len = 0, alloc = 0;
+
+	while (1) {
+		ssize_t ret;
+		ALLOC_GROW(buf, len + READ_CHUNK_SIZE + 1, alloc);
+		ret = read(fd, buf + len, alloc - len - 1);
+		if (ret < 0)
+			die_errno("failed to read '%s'", path);
+		if (!ret)
+			break;
+		len += ret;
+	}
+	buf[len] = '\0';
+	sf->buf = buf;
+	sf->len = len;
+	sf->map_len = 0;
+}
+
+void load_source_file(struct source_file *sf, const char *path)
+{
+	struct stat st;
+	int fd;
+
+	if (!strcmp(path, "-")) {
+		fd = STDIN_FILENO;
+		path = "<stdin>";
+	} else {
+		fd = open(path, O_RDONLY);
+		if (fd < 0)
+			die_errno("failed to open '%s'", path);
+	}
+
+	if (fstat(fd, &st))
+		die_errno("fstat failed");
+
+	if (S_ISREG(st.st_mode))
+		map_regular_file(sf, fd, st.st_size, path);
+	else
+		read_stream(sf, fd, path);
+
+	if (fd != STDIN_FILENO)
+		close(fd);
+}
+
+void release_source_file(struct source_file *sf)
+{
+	if (sf->map_len)
+		munmap((void *)sf->buf, sf->map_len);
+	else
+		free((void *)sf->buf);
+	memset(sf, 0, sizeof(*sf));
+}
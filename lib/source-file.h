@@ -0,0 +1,25 @@
+#ifndef _SOURCE_FILE_H
+#define _SOURCE_FILE_H
+
+#include <stddef.h>
+
+/*
+ * The contents of a source file, loaded in memory and NUL-terminated.
+ *
+ * Regular files are mmap'ed, followed by at least one zeroed page which holds
+ * the NUL terminator. Other files (e.g. pipes and stdin, given as "-") are
+ * read in chunks into a malloc'ed buffer.
+ */
+struct source_file {
+	const char *buf;
+	size_t len;
+
+	/* Private. */
+	size_t map_len; /* 0 if buf was malloc'ed. */
+};
+
+/* Dies on error. */
+void load_source_file(struct source_file *sf, const char *path);
+void release_source_file(struct source_file *sf);
+
+#endif
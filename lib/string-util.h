@@ -14,7 +14,9 @@ static char *getline_dup(const char *str)
 		return xstrdup(str);
 	size_t size = newline - str;
 	char *line = xmalloc(size + 1);
-	return strncpy(line, str, size);
+	memcpy(line, str, size);
+	line[size] = '\0';
+	return line;
 }
 
 static char *tab2sp(char *str, int width)
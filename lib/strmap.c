@@ -1,111 +1,230 @@
-#define _GNU_SOURCE /* hsearch: *_r variants */ 
-#include <search.h>
-#include <assert.h>
+#include <sys/types.h>
 #include "error.h"
 #include "wrappers.h"
 #include "array.h"
 #include "strmap.h"
 
-void strmap_init_size(struct strmap *map, strmap_val_cpy_fn val_cpy_fn, size_t size)
+/*
+ * The table grows when more than 7/8 of its slots would be used. Rounding
+ * down leaves at least one slot empty, which ends every probe sequence.
+ */
+#define table_capacity(alloc) ((alloc) * 7 / 8)
+
+/* FNV-1a */
+static uint32_t hash_str(const char *str)
 {
-	if (map->table)
-		die("BUG: called strmap_init with already initialized table");
-	map->table = xcalloc(1, sizeof(*(map->table)));
-	map->nr = 0;
-	map->keys = NULL;
-	map->table_alloc = size;
-	map->val_cpy_fn = val_cpy_fn;
-	if (!hcreate_r(map->table_alloc, map->table))
-		die_errno("hcreate_r error");
+	uint32_t hash = 2166136261u;
+	for (; *str; str++) {
+		hash ^= (unsigned char)*str;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/* How far the slot at `i`, with hash `hash`, is from its ideal position. */
+static inline size_t probe_distance(struct strmap *map, size_t i, uint32_t hash)
+{
+	return (i - hash) & (map->table_alloc - 1);
+}
+
+/*
+ * Robin Hood insertion: an entry that is further from its ideal slot takes
+ * the place of one that is closer to its own, which then moves on. This
+ * keeps the probe sequences short and lets lookups of missing keys stop
+ * early. The key must not be in the table yet.
+ */
+static void table_insert(struct strmap *map, struct strmap_slot slot)
+{
+	size_t mask = map->table_alloc - 1;
+	size_t i = slot.hash & mask, dist = 0;
+
+	while (map->table[i].entry) {
+		size_t other_dist = probe_distance(map, i, map->table[i].hash);
+		if (other_dist < dist) {
+			struct strmap_slot tmp = map->table[i];
+			map->table[i] = slot;
+			slot = tmp;
+			dist = other_dist;
+		}
+		i = (i + 1) & mask;
+		dist++;
+	}
+	map->table[i] = slot;
+}
+
+/* Returns the slot of `str`, or -1 if it is not in the table. */
+static ssize_t table_find(struct strmap *map, const char *str, uint32_t hash)
+{
+	size_t mask = map->table_alloc - 1;
+	size_t i = hash & mask;
+
+	for (size_t dist = 0; map->table[i].entry; dist++) {
+		struct strmap_slot *slot = &map->table[i];
+		if (probe_distance(map, i, slot->hash) < dist)
+			break;
+		if (slot->hash == hash &&
+		    !strcmp(map->entries[slot->entry - 1].key, str))
+			return i;
+		i = (i + 1) & mask;
+	}
+	return -1;
+}
+
+/*
+ * Backward shift deletion: the following entries that are not at their ideal
+ * slots are moved one slot back, so that no tombstones are needed.
+ */
+static void table_remove(struct strmap *map, size_t i)
+{
+	size_t mask = map->table_alloc - 1;
+	size_t next = (i + 1) & mask;
+
+	while (map->table[next].entry &&
+	       probe_distance(map, next, map->table[next].hash)) {
+		map->table[i] = map->table[next];
+		i = next;
+		next = (next + 1) & mask;
+	}
+	map->table[i].entry = 0;
 }
 
-static void copy_hsearch_data(struct hsearch_data *src, struct hsearch_data *dst,
-			      const char **keys, size_t nr,
-			      strmap_val_cpy_fn cpy_fn)
+/*
+ * Drops the removed entries and refills the table, with `table_alloc` slots,
+ * from the cached hashes. No keys are hashed or compared.
+ */
+static void rehash(struct strmap *map, size_t table_alloc)
 {
-	for (size_t i = 0; i < nr; i++) {
-		ENTRY search, *found;
-		search.key = (char *)keys[i];
-		if (!hsearch_r(search, FIND, &found, src))
-			die_errno("BUG: key '%s' should be in hsearch map but it is not", keys[i]);
-		cpy_fn(&search.data, &found->data);
-		if (!hsearch_r(search, ENTER, &found, dst))
-			die_errno("BUG: hsearch_r fail to enter key on copy_hsearch_data");
+	size_t nr = 0;
+
+	for (size_t i = 0; i < map->entries_nr; i++)
+		if (map->entries[i].key)
+			map->entries[nr++] = map->entries[i];
+	map->entries_nr = nr;
+
+	if (table_alloc != map->table_alloc) {
+		free(map->table);
+		map->table_alloc = table_alloc;
+		CALLOC_ARRAY(map->table, map->table_alloc);
+	} else {
+		memset(map->table, 0, st_mult(sizeof(*map->table), table_alloc));
+	}
+	for (size_t i = 0; i < map->entries_nr; i++) {
+		struct strmap_slot slot = {
+			.hash = map->entries[i].hash,
+			.entry = i + 1,
+		};
+		table_insert(map, slot);
 	}
 }
 
+void strmap_init_size(struct strmap *map, strmap_val_cpy_fn val_cpy_fn, size_t size)
+{
+	size_t table_alloc = 1;
+	if (map->table)
+		die("BUG: called strmap_init with already initialized table");
+	while (table_capacity(table_alloc) < size)
+		table_alloc *= 2;
+	map->table_alloc = table_alloc;
+	CALLOC_ARRAY(map->table, map->table_alloc);
+	map->entries = NULL;
+	map->nr = map->entries_nr = map->entries_alloc = 0;
+	map->val_cpy_fn = val_cpy_fn;
+}
+
 void strmap_cpy(struct strmap *dst, struct strmap *src)
 {
 	if (!src->table || dst->table)
 		die("BUG: strman_cpy needs initialized src and uninitialized dst");
-	strmap_init_size(dst, src->val_cpy_fn, src->table_alloc);
-	copy_hsearch_data(src->table, dst->table, src->keys, src->nr, src->val_cpy_fn);
-	dst->nr = src->nr;
-	dst->keys_alloc = src->keys_alloc;
-	dst->keys = xmalloc(dst->keys_alloc * sizeof(*(dst->keys)));
-	for (size_t i = 0; i < dst->nr; i++)
-		dst->keys[i] = src->keys[i];
+	*dst = *src;
+	ALLOC_ARRAY(dst->table, dst->table_alloc);
+	memcpy(dst->table, src->table,
+	       st_mult(sizeof(*dst->table), dst->table_alloc));
+	dst->entries = NULL;
+	if (dst->entries_alloc) {
+		ALLOC_ARRAY(dst->entries, dst->entries_alloc);
+		memcpy(dst->entries, src->entries,
+		       st_mult(sizeof(*dst->entries), dst->entries_nr));
+	}
+	for (size_t i = 0; i < dst->entries_nr; i++)
+		if (dst->entries[i].key)
+			dst->val_cpy_fn(&dst->entries[i].val, &src->entries[i].val);
 }
 
 int strmap_find(struct strmap *map, const char *str, void **val)
 {
-	int ret;
-	ENTRY search, *found;
-	search.key = (char *)str;
+	ssize_t i;
 	if (!map->table)
 		die("BUG: strmap_find called with uninitialized map");
-	ret = hsearch_r(search, FIND, &found, map->table);
-	if (ret && val)
-		*val = found->data;
-	return ret;
+	i = table_find(map, str, hash_str(str));
+	if (i >= 0 && val)
+		*val = map->entries[map->table[i].entry - 1].val;
+	return i >= 0;
 }
 
 void *strmap_put(struct strmap *map, const char *str, void *val)
 {
-	ENTRY search, *found;
-	search.key = (char *)str;
-	void *old = NULL;
+	uint32_t hash;
+	ssize_t i;
+	struct strmap_slot slot;
 	if (!map->table)
 		die("BUG: strmap_put called with uninitialized map");
-	if (hsearch_r(search, FIND, &found, map->table)) {
-		old = found->data;
-		found->data = val;
-	} else {
-		/* key not found */
-		if (map->nr + 1 > map->table_alloc) {
-			/* resize */
-			size_t new_size = map->table_alloc * 2;
-			struct hsearch_data *table = xcalloc(1, sizeof(*table));
-			if (!hcreate_r(new_size, table))
-				die_errno("hcreate_r error when resizing table");
-			copy_hsearch_data(map->table, table, map->keys, map->nr,
-					  map->val_cpy_fn);
-			hdestroy_r(map->table);
-			free(map->table);
-			map->table = table;
-			map->table_alloc = new_size;
-		}
-		search.data = val;
-		if (!hsearch_r(search, ENTER, &found, map->table))
-			die_errno("BUG? hsearsh_r failed after resize (%zu entries out of %zu slots)",
-				  map->nr, map->table_alloc);
-		ALLOC_GROW(map->keys, map->nr + 1, map->keys_alloc);
-		map->keys[map->nr] = str;
-		map->nr++;
+
+	hash = hash_str(str);
+	i = table_find(map, str, hash);
+	if (i >= 0) {
+		struct strmap_entry *entry = &map->entries[map->table[i].entry - 1];
+		void *old = entry->val;
+		entry->val = val;
+		return old;
 	}
-	return old;
+
+	/* key not found */
+	if (map->nr + 1 > table_capacity(map->table_alloc))
+		rehash(map, map->table_alloc * 2);
+	else if (map->entries_nr == map->entries_alloc &&
+		 map->entries_nr - map->nr > map->nr)
+		rehash(map, map->table_alloc); /* Mostly removed entries. */
+
+	if (map->entries_nr >= UINT32_MAX)
+		die("strmap: too many entries");
+	ALLOC_GROW(map->entries, map->entries_nr + 1, map->entries_alloc);
+	map->entries[map->entries_nr].key = str;
+	map->entries[map->entries_nr].val = val;
+	map->entries[map->entries_nr].hash = hash;
+	slot.hash = hash;
+	slot.entry = ++map->entries_nr;
+	table_insert(map, slot);
+	map->nr++;
+	return NULL;
+}
+
+int strmap_remove(struct strmap *map, const char *str, void **val)
+{
+	struct strmap_entry *entry;
+	ssize_t i;
+	if (!map->table)
+		die("BUG: strmap_remove called with uninitialized map");
+
+	i = table_find(map, str, hash_str(str));
+	if (i < 0)
+		return 0;
+	entry = &map->entries[map->table[i].entry - 1];
+	if (val)
+		*val = entry->val;
+	entry->key = NULL;
+	entry->val = NULL;
+	table_remove(map, i);
+	map->nr--;
+	return 1;
 }
 
 void strmap_iterate(struct strmap *map, strmap_iter_callback_fn fn, void *udata)
 {
 	if (!map->table)
 		die("BUG: strmap_iterate called with uninitialized map");
-	for (size_t i = 0; i < map->nr; i++) {
-		ENTRY search, *found;
-		search.key = (char *)map->keys[i];
-		if (!hsearch_r(search, FIND, &found, map->table))
-			die_errno("BUG: key '%s' should be in hsearch table but it is not", map->keys[i]);
-		if (fn(map->keys[i], found->data, udata))
+	for (size_t i = 0; i < map->entries_nr; i++) {
+		struct strmap_entry *entry = &map->entries[i];
+		if (entry->key && fn(entry->key, entry->val, udata))
 			break;
 	}
 }
@@ -114,8 +233,7 @@ void strmap_destroy(struct strmap *map)
 {
 	if (!map->table)
 		die("BUG: strmap_destroy called with uninitialized map");
-	hdestroy_r(map->table);
 	free(map->table);
-	free(map->keys);
+	free(map->entries);
 	memset(map, 0, sizeof(*map));
 }
@@ -1,6 +1,9 @@
 #ifndef _STRMAP_H
 #define _STRMAP_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 /*
  * A generic hashtable with strings as keys.
  *
@@ -12,15 +15,32 @@
  * the user. We will neither copy them nor free. Make sure the data
  * stays valid while using the strmap API and do not forget to free it
  * later.
+ *
+ * The entries are kept in insertion order at entries[], which is also the
+ * iteration order, with their hashes, so that the keys are only hashed once.
+ * The table itself is a Robin Hood open addressing one, with a power of 2
+ * number of slots, each pointing to an entry.
  */
 
-struct hsearch_data;
 typedef void (*strmap_val_cpy_fn)(void **dst, void **src);
 
+struct strmap_entry {
+	const char *key; /* NULL for removed entries. */
+	void *val;
+	uint32_t hash;
+};
+
+struct strmap_slot {
+	uint32_t hash;
+	uint32_t entry; /* Index at entries[], plus one. 0 for empty slots. */
+};
+
 struct strmap {
-	struct hsearch_data *table;
-	const char **keys;
-	size_t nr, table_alloc, keys_alloc;
+	struct strmap_slot *table;
+	size_t table_alloc;
+	struct strmap_entry *entries;
+	size_t nr; /* The number of keys in the map. */
+	size_t entries_nr, entries_alloc; /* Including removed entries. */
 	strmap_val_cpy_fn val_cpy_fn;
 };
 
@@ -30,6 +50,7 @@ static void strmap_val_plain_copy(void **dst, void **src)
 	*dst = *src;
 }
 
+/* The initial size is the number of keys the map can hold before growing. */
 #define INITIAL_TABLE_ALLOC 20
 void strmap_init_size(struct strmap *map, strmap_val_cpy_fn val_cpy_fn,
 		      size_t size);
@@ -49,6 +70,9 @@ static inline int strmap_has(struct strmap *map, const char *key)
 /* Return the previous value or NULL. */
 void *strmap_put(struct strmap *map, const char *str, void *val);
 
+/* Returns 1 and saves the removed value in val iff str was in map. */
+int strmap_remove(struct strmap *map, const char *str, void **val);
+
 typedef int (*strmap_iter_callback_fn)(const char *key, void *val, void *udata);
 void strmap_iterate(struct strmap *map, strmap_iter_callback_fn fn, void *udata);
 
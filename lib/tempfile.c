@@ -98,7 +98,8 @@ static void remove_tempfiles(int in_signal_handler)
 	for (int i = 0; i < tempfile_list.nr; i++) {
 		struct tempfile *p = tempfile_list.arr[i];
 
-		if (!is_tempfile_active(p))
+		/* Forked processes must not remove their parent's files. */
+		if (!is_tempfile_active(p) || p->owner != getpid())
 			continue;
 
 		if (p->fd >= 0)
@@ -166,6 +167,7 @@ static void activate_tempfile(struct tempfile *tempfile)
 	}
 
 	ARRAY_APPEND(&tempfile_list, tempfile);
+	tempfile->owner = getpid();
 	tempfile->active = 1;
 }
 
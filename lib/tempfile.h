@@ -32,6 +32,7 @@
 #define TEMPFILE_H
 
 #include <signal.h>
+#include <sys/types.h>
 
 /*
  * Handle temporary files.
@@ -104,6 +105,7 @@
 
 struct tempfile {
 	sig_atomic_t active;
+	pid_t owner;
 	char *filename;
 	int fd;
 	FILE *fp;
@@ -1,18 +1,107 @@
+#include <sys/mman.h>
 #include "util.h"
 #include "lexer.h"
 #include "parser.h"
 #include "lib/array.h"
+#include "lib/arena.h"
 
 /*******************************************************************************
  *				Parsing
 *******************************************************************************/
 
-static struct ast_expression *parse_exp(struct token **tok_ptr);
-static struct ast_expression *parse_exp_no_comma(struct token **tok_ptr);
-static struct ast_statement *parse_statement(struct token **tok_ptr);
-static struct ast_statement *parse_statement_1(struct token **tok_ptr,
-					       int allow_declaration);
-static void free_ast_var_decl_list(struct ast_var_decl_list *decl_list);
+struct parser {
+	struct token_stream *ts;
+	struct arena *arena; /* Where the finished trees are stored. */
+
+	/*
+	 * The nodes and lists of the toplevel item being parsed. When it is
+	 * done, they are copied to the arena, and these are reused for the
+	 * next item.
+	 */
+	ARRAY(struct ast_node) nodes;
+	ARRAY(ast_ref) extra;
+	/* The items of the lists being parsed, which may be nested. */
+	ARRAY(ast_ref) list_items;
+	/* The stack of parse_exp_1(). */
+	ARRAY(struct exp_frame) exp_frames;
+};
+
+/*
+ * Note: the nodes move around as new ones are added, so the pointer returned
+ * by NODE() must not be held across calls that may add nodes (i.e. the
+ * parse_*() functions and new_node()).
+ */
+#define NODE(p, ref) (&(p)->nodes.arr[ref])
+
+static ast_ref new_node(struct parser *p, enum ast_node_type type,
+			struct token_loc loc)
+{
+	struct ast_node *node;
+	if (p->nodes.nr == UINT32_MAX)
+		die("parser: too many AST nodes in a single toplevel item");
+	ALLOC_GROW(p->nodes.arr, p->nodes.nr + 1, p->nodes.alloc);
+	node = &p->nodes.arr[p->nodes.nr];
+	memset(node, 0, sizeof(*node));
+	node->type = type;
+	node->line_no = loc.line_no;
+	node->col_no = loc.col_no;
+	return p->nodes.nr++;
+}
+
+/*
+ * A list is built by taking its start with list_start(), pushing its items
+ * with list_push(), and then calling list_finish(), which moves them to the
+ * tree. Lists can be nested, as long as the inner ones are finished first.
+ */
+static inline size_t list_start(struct parser *p)
+{
+	return p->list_items.nr;
+}
+
+static inline void list_push(struct parser *p, ast_ref ref)
+{
+	ALLOC_GROW(p->list_items.arr, p->list_items.nr + 1, p->list_items.alloc);
+	p->list_items.arr[p->list_items.nr++] = ref;
+}
+
+static struct ast_list list_finish(struct parser *p, size_t start)
+{
+	struct ast_list list = { p->extra.nr, p->list_items.nr - start };
+	ALLOC_GROW(p->extra.arr, p->extra.nr + list.nr, p->extra.alloc);
+	memcpy(p->extra.arr + p->extra.nr, p->list_items.arr + start,
+	       st_mult(sizeof(ast_ref), list.nr));
+	p->extra.nr += list.nr;
+	p->list_items.nr = start;
+	return list;
+}
+
+static ast_ref parse_exp(struct parser *p);
+static ast_ref parse_exp_no_comma(struct parser *p);
+static ast_ref parse_statement(struct parser *p);
+static ast_ref parse_statement_1(struct parser *p, int allow_declaration);
+
+/*
+ * A set of token types, as a bitmask. TOKSET() builds it out of up to 10
+ * types, at compile time, so that checking the current token against a
+ * number of alternatives is a single AND.
+ */
+typedef uint64_t token_set;
+_Static_assert(TOK_NR <= 64, "token types don't fit in a token_set");
+
+#define TOKBIT(tt) ((tt) == TOK_NONE ? (token_set)0 : (token_set)1 << (tt))
+#define TOKSET(...) \
+	TOKSET_1(__VA_ARGS__, TOK_NONE, TOK_NONE, TOK_NONE, TOK_NONE, TOK_NONE, \
+		 TOK_NONE, TOK_NONE, TOK_NONE, TOK_NONE, TOK_NONE)
+/* The 11th type must be a padding TOK_NONE, or the set would be truncated. */
+#define TOKSET_1(t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, ...) \
+	(TOKBIT(t1) | TOKBIT(t2) | TOKBIT(t3) | TOKBIT(t4) | TOKBIT(t5) | \
+	 TOKBIT(t6) | TOKBIT(t7) | TOKBIT(t8) | TOKBIT(t9) | TOKBIT(t10) | \
+	 0 * sizeof(char[(t11) == TOK_NONE ? 1 : -1]))
+
+static inline int tokset_has(token_set set, enum token_type tt)
+{
+	return (set >> tt) & 1;
+}
 
 static char *str_join_token_types(const char *clause, va_list tt_list)
 {
@@ -40,38 +129,37 @@ static char *str_join_token_types(const char *clause, va_list tt_list)
 	return joined;
 }
 
-/* Don't use this directly, use check_and_pop() instead. */
-static enum token_type check_and_pop_1(struct token **tok_ptr, int abort_on_miss, ...)
+/*
+ * Don't use this directly, it is the failure path of check_and_pop(). Takes
+ * the expected types, terminated by TOK_NONE, just for the error message.
+ */
+static noreturn enum token_type die_expecting(struct token_stream *ts, ...)
 {
+	struct token tok;
 	va_list args;
-	va_start(args, abort_on_miss);
-	for (enum token_type etype = va_arg(args, enum token_type);
-	     etype != TOK_NONE;
-	     etype = va_arg(args, enum token_type)) {
-		if ((*tok_ptr)->type == etype) {
-			va_end(args);
-			(*tok_ptr)++;
-			return etype;
-		}
-	}
-	va_end(args);
-
-	if (abort_on_miss) {
-		va_start(args, abort_on_miss);
-		die("parser: expecting %s got %s\n%s", \
-		    str_join_token_types("or", args), tok2str(*tok_ptr), \
-				    show_token_on_source_line(*tok_ptr)); \
-		va_end(args);
-	}
 
-	return 0; /* TOK_NONE */
+	token_stream_get(ts, 0, &tok);
+	va_start(args, ts);
+	die("parser: expecting %s got %s\n%s",
+	    str_join_token_types("or", args), tok2str(&tok),
+	    show_token_on_source_line(&tok));
 }
 
-#define check_and_pop(tok_ptr, ...) \
-	check_and_pop_1(tok_ptr, 1, __VA_ARGS__, TOK_NONE)
+/*
+ * Pop the current token if it is of any of the given types, and return its
+ * type. The popped token can be further inspected with the token_stream_*()
+ * accessors at offset -1. On a mismatch, check_and_pop() dies with an error
+ * message, and check_and_pop_gently() returns TOK_NONE.
+ *
+ * Note: `ts` is evaluated more than once.
+ */
+#define check_and_pop(ts, ...) \
+	(tokset_has(TOKSET(__VA_ARGS__), token_stream_peek(ts, 0)) ? \
+	 token_stream_pop(ts) : die_expecting(ts, __VA_ARGS__, TOK_NONE))
 
-#define check_and_pop_gently(tok_ptr, ...) \
-	check_and_pop_1(tok_ptr, 0, __VA_ARGS__, TOK_NONE)
+#define check_and_pop_gently(ts, ...) \
+	(tokset_has(TOKSET(__VA_ARGS__), token_stream_peek(ts, 0)) ? \
+	 token_stream_pop(ts) : TOK_NONE)
 
 static enum un_op_type tt2un_op_type(enum token_type type)
 {
@@ -83,80 +171,6 @@ static enum un_op_type tt2un_op_type(enum token_type type)
 	}
 }
 
-static struct ast_expression *parse_exp_atom(struct token **tok_ptr)
-{
-	struct ast_expression *exp;
-	struct token *tok = *tok_ptr;
-
-	check_and_pop(&tok, TOK_INTEGER, TOK_OPEN_PAR, TOK_MINUS, TOK_TILDE,
-		      TOK_LOGIC_NOT, TOK_PLUS, TOK_IDENTIFIER,
-		      TOK_PLUS_PLUS, TOK_MINUS_MINUS);
-
-	if (tok[-1].type == TOK_INTEGER) {
-		exp = xmalloc(sizeof(*exp));
-		exp->type = AST_EXP_CONSTANT_INT;
-		exp->u.ival = *((int *)tok[-1].value);
-	} else if (tok[-1].type == TOK_OPEN_PAR) {
-		exp = parse_exp(&tok);
-		check_and_pop(&tok, TOK_CLOSE_PAR);
-	} else if (tok[-1].type == TOK_IDENTIFIER && check_and_pop_gently(&tok, TOK_OPEN_PAR)) {
-		exp = xmalloc(sizeof(*exp));
-		exp->type = AST_EXP_FUNC_CALL;
-		exp->u.call.name = xstrdup((char *)tok[-2].value);
-		exp->u.call.tok = &tok[-2];
-		ARRAY_INIT(&exp->u.call.args);
-		int is_first_parameter = 1;
-		while (tok->type != TOK_CLOSE_PAR) {
-			if (!is_first_parameter)
-				check_and_pop(&tok, TOK_COMMA);
-			ARRAY_APPEND(&exp->u.call.args, parse_exp_no_comma(&tok));
-			is_first_parameter = 0;
-		}
-		check_and_pop(&tok, TOK_CLOSE_PAR);
-	} else if (tok[-1].type == TOK_IDENTIFIER) {
-		exp = xmalloc(sizeof(*exp));
-		exp->type = AST_EXP_VAR;
-		exp->u.var.name = xstrdup((char *)tok[-1].value);
-		exp->u.var.tok = &tok[-1];
-	} else if (tok[-1].type == TOK_PLUS) {
-		/* This unary operator does nothing, so we just remove it. */
-		exp = parse_exp_atom(&tok);
-	} else if (tok[-1].type == TOK_PLUS_PLUS || tok[-1].type == TOK_MINUS_MINUS) {
-		struct token *op_tok = &tok[-1];
-		exp = xmalloc(sizeof(*exp));
-		exp->type = AST_EXP_UNARY_OP;
-		exp->u.un_op.exp = parse_exp(&tok);
-		if (exp->u.un_op.exp->type != AST_EXP_VAR)
-			die("parser: preffix inc/dec operators require an lvalue on the right.\n%s",
-			    show_token_on_source_line(op_tok));
-		exp->u.un_op.type = op_tok->type == TOK_PLUS_PLUS ?
-			EXP_OP_PREFIX_INC : EXP_OP_PREFIX_DEC;
-	} else {
-		exp = xmalloc(sizeof(*exp));
-		exp->type = AST_EXP_UNARY_OP;
-		exp->u.un_op.type = tt2un_op_type(tok[-1].type);
-		exp->u.un_op.exp = parse_exp_atom(&tok);
-	}
-
-	enum token_type suffix =
-		check_and_pop_gently(&tok, TOK_PLUS_PLUS, TOK_MINUS_MINUS);
-	if (suffix) {
-		struct token *op_tok = &tok[-1];
-		if (exp->type != AST_EXP_VAR)
-			die("parser: suffix inc/dec operators require an lvalue on the left.\n%s",
-			    show_token_on_source_line(op_tok));
-		struct ast_expression *suffix_exp = xmalloc(sizeof(*suffix_exp));
-		suffix_exp->type = AST_EXP_UNARY_OP;
-		suffix_exp->u.un_op.exp = exp;
-		suffix_exp->u.un_op.type = op_tok->type == TOK_PLUS_PLUS ?
-			EXP_OP_SUFFIX_INC : EXP_OP_SUFFIX_DEC;
-		exp = suffix_exp;
-	}
-
-	*tok_ptr = tok;
-	return exp;
-}
-
 struct bin_op_info {
 	enum associativity { ASSOC_UNKNOWN=0, ASSOC_LEFT, ASSOC_RIGHT } assoc;
 	unsigned int precedence;
@@ -290,592 +304,692 @@ static enum associativity bin_op_associativity(enum bin_op_type type)
 	return bin_op_info[type].assoc;
 }
 
-struct ast_expression *ast_expression_var_dup(struct ast_expression *vexp)
+static ast_ref ast_expression_var_dup(struct parser *p, ast_ref vexp)
 {
-	assert(vexp->type == AST_EXP_VAR);
-	struct ast_expression *cpy = xmalloc(sizeof(*cpy));
-	cpy->type = AST_EXP_VAR;
-	cpy->u.var.name = xstrdup(vexp->u.var.name);
-	cpy->u.var.tok = vexp->u.var.tok;
+	assert(NODE(p, vexp)->type == AST_EXP_VAR);
+	ast_ref cpy = new_node(p, AST_EXP_VAR, (struct token_loc){ 0 });
+	*NODE(p, cpy) = *NODE(p, vexp);
 	return cpy;
 }
 
 #define is_ternary_op_tok(tt) ((tt) == TOK_QUESTION_MARK)
 
-/* 
+/*
+ * Machine-generated sources may have very deep expressions, like long chains
+ * of assignments or thousands of nested parentheses, so we parse expressions
+ * iteratively, with an explicit stack of what is waiting for the
+ * subexpression being parsed.
+ */
+struct exp_frame {
+	enum exp_frame_type {
+		/* A precedence climbing loop, waiting for an operand. */
+		FRAME_EXP,
+		/* The operand of unary operators. */
+		FRAME_UNARY_PLUS,
+		FRAME_UNARY,
+		FRAME_PREFIX_INC_DEC,
+		/* Expressions inside atoms. */
+		FRAME_PARENS,
+		FRAME_CALL,
+	} type;
+
+	/* FRAME_EXP */
+	enum {
+		EXP_WANT_LHS,
+		EXP_WANT_RHS,
+		EXP_WANT_TERNARY_IF,
+		EXP_WANT_TERNARY_ELSE,
+	} want;
+	int allow_comma;
+	unsigned int min_prec;
+	enum token_type op_type;
+	struct token_loc op_loc;
+
+	/*
+	 * FRAME_EXP: the left operand, or the ternary node. Others: the node
+	 * waiting for the subexpression, if any.
+	 */
+	ast_ref exp;
+	size_t args; /* FRAME_CALL */
+};
+
+static struct exp_frame *push_exp_frame(struct parser *p,
+					enum exp_frame_type type)
+{
+	ALLOC_GROW(p->exp_frames.arr, p->exp_frames.nr + 1,
+		   p->exp_frames.alloc);
+	struct exp_frame *f = &p->exp_frames.arr[p->exp_frames.nr++];
+	f->type = type;
+	return f;
+}
+
+#define top_exp_frame(p) (&(p)->exp_frames.arr[(p)->exp_frames.nr - 1])
+
+/*
  * Parse expression using precedence climbing.
  * See: https://eli.thegreenplace.net/2012/08/02/parsing-expressions-by-precedence-climbing.
+ *
+ * What would be recursive calls (for the operands, and the subexpressions of
+ * atoms) are done by pushing a frame and jumping to start_exp or start_atom.
+ * A finished atom goes to atom_done, and a finished expression goes to
+ * exp_done. Both hand it to the frame on the top of the stack.
  */
-static struct ast_expression *parse_exp_1(struct token **tok_ptr,
-					  int allow_comma, int min_prec)
-{
-	struct token *op_tok, *tok = *tok_ptr;
-	struct ast_expression *exp = parse_exp_atom(&tok);
+static ast_ref parse_exp_1(struct parser *p, int allow_comma,
+			   unsigned int min_prec)
+{
+	struct token_stream *ts = p->ts;
+	size_t base = p->exp_frames.nr;
+	enum token_type type;
+	struct token_loc loc;
+	struct exp_frame *f;
+	struct ast_node *node;
+	ast_ref exp;
+
+start_exp:
+	f = push_exp_frame(p, FRAME_EXP);
+	f->want = EXP_WANT_LHS;
+	f->allow_comma = allow_comma;
+	f->min_prec = min_prec;
+
+start_atom:
+	type = check_and_pop(ts, TOK_INTEGER, TOK_OPEN_PAR, TOK_MINUS, TOK_TILDE,
+			     TOK_LOGIC_NOT, TOK_PLUS, TOK_IDENTIFIER,
+			     TOK_PLUS_PLUS, TOK_MINUS_MINUS);
+	/* Save the location, as we will pop more tokens before using it. */
+	loc = token_stream_loc(ts, -1);
+
+	if (type == TOK_INTEGER) {
+		exp = new_node(p, AST_EXP_CONSTANT_INT, loc);
+		NODE(p, exp)->u.ival = token_stream_value(ts, -1).ival;
+		goto atom_done;
+	} else if (type == TOK_OPEN_PAR) {
+		push_exp_frame(p, FRAME_PARENS);
+		allow_comma = 1;
+		min_prec = 1;
+		goto start_exp;
+	} else if (type == TOK_IDENTIFIER && token_stream_peek(ts, 0) == TOK_OPEN_PAR) {
+		f = push_exp_frame(p, FRAME_CALL);
+		f->args = list_start(p);
+		f->exp = new_node(p, AST_EXP_FUNC_CALL, loc);
+		NODE(p, f->exp)->u.call.atom = token_stream_value(ts, -1).atom;
+		token_stream_pop(ts);
+		if (token_stream_peek(ts, 0) != TOK_CLOSE_PAR) {
+			allow_comma = 0;
+			min_prec = 1;
+			goto start_exp;
+		}
+		goto call_done;
+	} else if (type == TOK_IDENTIFIER) {
+		exp = new_node(p, AST_EXP_VAR, loc);
+		NODE(p, exp)->u.var.atom = token_stream_value(ts, -1).atom;
+		goto atom_done;
+	} else if (type == TOK_PLUS) {
+		/* This unary operator does nothing, so we just remove it. */
+		push_exp_frame(p, FRAME_UNARY_PLUS);
+		goto start_atom;
+	} else if (type == TOK_PLUS_PLUS || type == TOK_MINUS_MINUS) {
+		exp = new_node(p, AST_EXP_UNARY_OP, loc);
+		f = push_exp_frame(p, FRAME_PREFIX_INC_DEC);
+		f->exp = exp;
+		f->op_type = type;
+		f->op_loc = loc;
+		allow_comma = 1;
+		min_prec = 1;
+		goto start_exp;
+	} else {
+		exp = new_node(p, AST_EXP_UNARY_OP, loc);
+		NODE(p, exp)->op = tt2un_op_type(type);
+		f = push_exp_frame(p, FRAME_UNARY);
+		f->exp = exp;
+		goto start_atom;
+	}
 
-	while (is_bin_op_tok(tok->type) || is_ternary_op_tok(tok->type)) {
+call_done:
+	f = top_exp_frame(p);
+	check_and_pop(ts, TOK_CLOSE_PAR);
+	NODE(p, f->exp)->u.call.args = list_finish(p, f->args);
+	exp = f->exp;
+	p->exp_frames.nr--;
+
+atom_done:
+	type = check_and_pop_gently(ts, TOK_PLUS_PLUS, TOK_MINUS_MINUS);
+	if (type) {
+		loc = token_stream_loc(ts, -1);
+		if (NODE(p, exp)->type != AST_EXP_VAR)
+			die("parser: suffix inc/dec operators require an lvalue on the left.\n%s",
+			    show_loc_on_source_line(&loc));
+		ast_ref suffix_exp = new_node(p, AST_EXP_UNARY_OP, loc);
+		NODE(p, suffix_exp)->u.un_op.exp = exp;
+		NODE(p, suffix_exp)->op = type == TOK_PLUS_PLUS ?
+			EXP_OP_SUFFIX_INC : EXP_OP_SUFFIX_DEC;
+		exp = suffix_exp;
+	}
+
+	f = top_exp_frame(p);
+	switch (f->type) {
+	case FRAME_UNARY_PLUS:
+		p->exp_frames.nr--;
+		goto atom_done;
+	case FRAME_UNARY:
+		NODE(p, f->exp)->u.un_op.exp = exp;
+		exp = f->exp;
+		p->exp_frames.nr--;
+		goto atom_done;
+	case FRAME_EXP:
+		/* The left operand of the first operator, if any. */
+		break;
+	default:
+		BUG("unexpected frame %d after atom", f->type);
+	}
+
+climb:
+	/* `f` is the FRAME_EXP on the top, and `exp` its current left operand. */
+	while (is_bin_op_tok(token_stream_peek(ts, 0)) ||
+	       is_ternary_op_tok(token_stream_peek(ts, 0))) {
+		struct token_loc op_loc = token_stream_loc(ts, 0);
 
-		if (is_ternary_op_tok(tok->type)) {
-			const int ternary_prec = 3;
-			const enum associativity ternary_assoc = ASSOC_RIGHT;
+		if (is_ternary_op_tok(token_stream_peek(ts, 0))) {
+			const unsigned int ternary_prec = 3;
 
-			if (ternary_prec < min_prec)
+			if (ternary_prec < f->min_prec)
 				break;
-			tok++;
-
-			struct ast_expression *condition = exp;
-			exp = xmalloc(sizeof(*exp));
-			exp->type = AST_EXP_TERNARY;
-			exp->u.ternary.condition = condition;
-			exp->u.ternary.if_exp = allow_comma ? parse_exp(&tok) :
-						parse_exp_no_comma(&tok);
-			check_and_pop(&tok, TOK_COLON);
-			exp->u.ternary.else_exp = parse_exp_1(&tok, allow_comma,
-					ternary_assoc == ASSOC_LEFT ?
-					ternary_prec + 1 : ternary_prec);
-			continue;
+			token_stream_pop(ts);
+
+			ast_ref condition = exp;
+			f->exp = new_node(p, AST_EXP_TERNARY, op_loc);
+			NODE(p, f->exp)->u.ternary.condition = condition;
+			f->want = EXP_WANT_TERNARY_IF;
+			allow_comma = f->allow_comma;
+			min_prec = 1;
+			goto start_exp;
 		}
 
-		enum bin_op_type compound_op;
-		enum bin_op_type bin_op_type = tt2bin_op_type(tok->type);
-		int prec = bin_op_precedence(bin_op_type);
+		enum bin_op_type bin_op_type = tt2bin_op_type(token_stream_peek(ts, 0));
+		unsigned int prec = bin_op_precedence(bin_op_type);
 
-		if (!allow_comma && bin_op_type == EXP_OP_COMMA)
+		if (!f->allow_comma && bin_op_type == EXP_OP_COMMA)
 			break;
 
-		if (bin_op_type == EXP_OP_ASSIGNMENT && exp->type != AST_EXP_VAR)
+		if (bin_op_type == EXP_OP_ASSIGNMENT &&
+		    NODE(p, exp)->type != AST_EXP_VAR)
 			die("parser: assignment operator requires lvalue on left side.\n%s",
-			    show_token_on_source_line(tok));
+			    show_loc_on_source_line(&op_loc));
 
-		if (prec < min_prec)
+		if (prec < f->min_prec)
 			break;
-		op_tok = tok;
-		tok++;
-
-		enum associativity assoc = bin_op_associativity(bin_op_type);
-
-		struct ast_expression *lexp = exp;
-		struct ast_expression *rexp =
-			parse_exp_1(&tok, allow_comma,
-				    assoc == ASSOC_LEFT ? prec + 1 : prec);
-
-		exp = xmalloc(sizeof(*exp));
-		exp->type = AST_EXP_BINARY_OP;
-		exp->u.bin_op.type = bin_op_type;
-		exp->u.bin_op.lexp = lexp;
+		f->op_type = token_stream_pop(ts);
+		f->op_loc = op_loc;
+		f->exp = exp;
+		f->want = EXP_WANT_RHS;
+		allow_comma = f->allow_comma;
+		min_prec = bin_op_associativity(bin_op_type) == ASSOC_LEFT ?
+			   prec + 1 : prec;
+		goto start_exp;
+	}
 
-		if (is_compound_assign(op_tok->type, &compound_op)) {
-			struct ast_expression *compound_exp = xmalloc(sizeof(*compound_exp));
-			compound_exp->type = AST_EXP_BINARY_OP;
-			compound_exp->u.bin_op.type = compound_op;
-			compound_exp->u.bin_op.lexp = ast_expression_var_dup(lexp);
-			compound_exp->u.bin_op.rexp = rexp;
+	/* exp_done: */
+	p->exp_frames.nr--;
+	if (p->exp_frames.nr == base)
+		return exp;
+
+	f = top_exp_frame(p);
+	switch (f->type) {
+	case FRAME_EXP:
+		switch (f->want) {
+		case EXP_WANT_RHS: {
+			enum bin_op_type compound_op;
+			ast_ref lexp = f->exp, rexp = exp;
+
+			exp = new_node(p, AST_EXP_BINARY_OP, f->op_loc);
+
+			if (is_compound_assign(f->op_type, &compound_op)) {
+				ast_ref compound_exp = new_node(p, AST_EXP_BINARY_OP,
+								f->op_loc);
+				ast_ref var = ast_expression_var_dup(p, lexp);
+				node = NODE(p, compound_exp);
+				node->op = compound_op;
+				node->u.bin_op.lexp = var;
+				node->u.bin_op.rexp = rexp;
+				rexp = compound_exp;
+			}
 
-			exp->u.bin_op.rexp = compound_exp;
-		} else {
-			exp->u.bin_op.rexp = rexp;
+			node = NODE(p, exp);
+			node->op = tt2bin_op_type(f->op_type);
+			node->u.bin_op.lexp = lexp;
+			node->u.bin_op.rexp = rexp;
+			goto climb;
 		}
+		case EXP_WANT_TERNARY_IF:
+			NODE(p, f->exp)->u.ternary.if_exp = exp;
+			check_and_pop(ts, TOK_COLON);
+			/* The ternary operator is right associative. */
+			f->want = EXP_WANT_TERNARY_ELSE;
+			allow_comma = f->allow_comma;
+			min_prec = 3;
+			goto start_exp;
+		case EXP_WANT_TERNARY_ELSE:
+			NODE(p, f->exp)->u.ternary.else_exp = exp;
+			exp = f->exp;
+			goto climb;
+		default:
+			BUG("unexpected end of expression %d", f->want);
+		}
+	case FRAME_PARENS:
+		check_and_pop(ts, TOK_CLOSE_PAR);
+		p->exp_frames.nr--;
+		goto atom_done;
+	case FRAME_CALL:
+		list_push(p, exp);
+		if (token_stream_peek(ts, 0) != TOK_CLOSE_PAR) {
+			check_and_pop(ts, TOK_COMMA);
+			allow_comma = 0;
+			min_prec = 1;
+			goto start_exp;
+		}
+		goto call_done;
+	case FRAME_PREFIX_INC_DEC:
+		if (NODE(p, exp)->type != AST_EXP_VAR)
+			die("parser: preffix inc/dec operators require an lvalue on the right.\n%s",
+			    show_loc_on_source_line(&f->op_loc));
+		node = NODE(p, f->exp);
+		node->u.un_op.exp = exp;
+		node->op = f->op_type == TOK_PLUS_PLUS ?
+			EXP_OP_PREFIX_INC : EXP_OP_PREFIX_DEC;
+		exp = f->exp;
+		p->exp_frames.nr--;
+		goto atom_done;
+	default:
+		BUG("unexpected frame %d after expression", f->type);
 	}
-
-	*tok_ptr = tok;
-	return exp;
 }
 
-static struct ast_expression *parse_exp(struct token **tok_ptr)
+static ast_ref parse_exp(struct parser *p)
 {
-	return parse_exp_1(tok_ptr, 1, 1);
+	return parse_exp_1(p, 1, 1);
 }
 
-static struct ast_expression *parse_exp_no_comma(struct token **tok_ptr)
+static ast_ref parse_exp_no_comma(struct parser *p)
 {
-	return parse_exp_1(tok_ptr, 0, 1);
+	return parse_exp_1(p, 0, 1);
 }
 
-static struct ast_var_decl_list *parse_var_decl_list(struct token **tok_ptr)
+static ast_ref parse_var_decl_list(struct parser *p)
 {
-	struct ast_var_decl_list *decl_list = xcalloc(1, sizeof(*decl_list));
-	struct token *tok = *tok_ptr;
+	struct token_stream *ts = p->ts;
+	size_t decls = list_start(p);
+	ast_ref decl_list = new_node(p, AST_ST_VAR_DECL, token_stream_loc(ts, 0));
 
-	check_and_pop(&tok, TOK_INT_KW);
+	check_and_pop(ts, TOK_INT_KW);
 	do {
-		struct ast_var_decl *decl = xcalloc(1, sizeof(*decl));
-		check_and_pop(&tok, TOK_IDENTIFIER);
-		decl->name = xstrdup((char *)tok[-1].value);
-		decl->tok = &tok[-1];
-		if (check_and_pop_gently(&tok, TOK_ASSIGNMENT))
-			decl->value = parse_exp_no_comma(&tok);
-		ARRAY_APPEND(decl_list, decl);
-	} while (check_and_pop_gently(&tok, TOK_COMMA));
-
-	*tok_ptr = tok;
+		check_and_pop(ts, TOK_IDENTIFIER);
+		ast_ref decl = new_node(p, AST_VAR_DECL, token_stream_loc(ts, -1));
+		NODE(p, decl)->u.var_decl.atom = token_stream_value(ts, -1).atom;
+		if (check_and_pop_gently(ts, TOK_ASSIGNMENT)) {
+			ast_ref value = parse_exp_no_comma(p);
+			NODE(p, decl)->u.var_decl.value = value;
+		}
+		list_push(p, decl);
+	} while (check_and_pop_gently(ts, TOK_COMMA));
+
+	NODE(p, decl_list)->u.decl_list = list_finish(p, decls);
 	return decl_list;
 }
 
-static struct ast_statement *parse_statement_block(struct token **tok_ptr)
+static ast_ref parse_statement_block(struct parser *p)
 {
-	struct ast_statement *st = xcalloc(1, sizeof(*st));
-	struct token *tok = *tok_ptr;
-	struct block *blk = &(st->u.block);
+	struct token_stream *ts = p->ts;
+	size_t items = list_start(p);
+	ast_ref st = new_node(p, AST_ST_BLOCK, token_stream_loc(ts, 0));
 
-	check_and_pop(&tok, TOK_OPEN_BRACE);
-	st->type = AST_ST_BLOCK;
-	while (!end_token(tok) && tok->type != TOK_CLOSE_BRACE) {
-		ALLOC_GROW(blk->items, blk->nr + 1, blk->alloc);
-		blk->items[blk->nr++] = parse_statement(&tok);
-	}
-	check_and_pop(&tok, TOK_CLOSE_BRACE);
+	check_and_pop(ts, TOK_OPEN_BRACE);
+	while (!token_stream_end(ts) && token_stream_peek(ts, 0) != TOK_CLOSE_BRACE)
+		list_push(p, parse_statement(p));
+	check_and_pop(ts, TOK_CLOSE_BRACE);
 
-	*tok_ptr = tok;
+	NODE(p, st)->u.block = list_finish(p, items);
 	return st;
 }
 
-static struct ast_expression *gen_true_exp(void)
+static ast_ref gen_true_exp(struct parser *p, struct token_loc loc)
 {
-	struct ast_expression *exp = xmalloc(sizeof(*exp));
-	exp->type = AST_EXP_CONSTANT_INT;
-	exp->u.ival = 1;
+	ast_ref exp = new_node(p, AST_EXP_CONSTANT_INT, loc);
+	NODE(p, exp)->u.ival = 1;
 	return exp;
 }
 
-static struct ast_statement *parse_for_statement(struct token **tok_ptr)
+static ast_ref parse_for_statement(struct parser *p)
 {
-	struct token *tok = *tok_ptr;
-	struct ast_statement *st = xmalloc(sizeof(*st));
+	struct token_stream *ts = p->ts;
+	ast_ref st = new_node(p, AST_ST_FOR, token_stream_loc(ts, 0));
+	ast_ref prologue = AST_NULL, condition, epilogue = AST_NULL, body;
+	struct ast_node *node;
 
-	check_and_pop(&tok, TOK_FOR_KW);
-	check_and_pop(&tok, TOK_OPEN_PAR);
-	if (tok->type == TOK_INT_KW) {
-		st->type = AST_ST_FOR_DECL;
-		st->u.for_decl.decl_list = parse_var_decl_list(&tok);
-		check_and_pop(&tok, TOK_SEMICOLON);
-		if (check_and_pop_gently(&tok, TOK_SEMICOLON)) {
-			st->u.for_decl.condition = gen_true_exp();
-		} else {
-			st->u.for_decl.condition = parse_exp(&tok);
-			check_and_pop(&tok, TOK_SEMICOLON);
-		}
-		if (check_and_pop_gently(&tok, TOK_CLOSE_PAR)) {
-			st->u.for_decl.epilogue.exp = NULL;
-		} else {
-			st->u.for_decl.epilogue.exp = parse_exp(&tok);
-			check_and_pop(&tok, TOK_CLOSE_PAR);
-		}
-		st->u.for_decl.body = parse_statement_1(&tok, 0);
+	check_and_pop(ts, TOK_FOR_KW);
+	check_and_pop(ts, TOK_OPEN_PAR);
+	if (token_stream_peek(ts, 0) == TOK_INT_KW) {
+		NODE(p, st)->type = AST_ST_FOR_DECL;
+		prologue = parse_var_decl_list(p);
+		check_and_pop(ts, TOK_SEMICOLON);
+	} else if (!check_and_pop_gently(ts, TOK_SEMICOLON)) {
+		prologue = parse_exp(p);
+		check_and_pop(ts, TOK_SEMICOLON);
+	}
+	if (check_and_pop_gently(ts, TOK_SEMICOLON)) {
+		condition = gen_true_exp(p, token_stream_loc(ts, -1));
 	} else {
-		st->type = AST_ST_FOR;
-		if (check_and_pop_gently(&tok, TOK_SEMICOLON)) {
-			st->u._for.prologue.exp = NULL;
-		} else {
-			st->u._for.prologue.exp = parse_exp(&tok);
-			check_and_pop(&tok, TOK_SEMICOLON);
-		}
-		if (check_and_pop_gently(&tok, TOK_SEMICOLON)) {
-			st->u._for.condition = gen_true_exp();
-		} else {
-			st->u._for.condition = parse_exp(&tok);
-			check_and_pop(&tok, TOK_SEMICOLON);
-		}
-		if (check_and_pop_gently(&tok, TOK_CLOSE_PAR)) {
-			st->u._for.epilogue.exp = NULL;
-		} else {
-			st->u._for.epilogue.exp = parse_exp(&tok);
-			check_and_pop(&tok, TOK_CLOSE_PAR);
-		}
-		st->u._for.body = parse_statement_1(&tok, 0);
+		condition = parse_exp(p);
+		check_and_pop(ts, TOK_SEMICOLON);
+	}
+	if (!check_and_pop_gently(ts, TOK_CLOSE_PAR)) {
+		epilogue = parse_exp(p);
+		check_and_pop(ts, TOK_CLOSE_PAR);
 	}
+	body = parse_statement_1(p, 0);
 
-	*tok_ptr = tok;
+	node = NODE(p, st);
+	node->u._for.prologue = prologue;
+	node->u._for.condition = condition;
+	node->u._for.epilogue = epilogue;
+	node->u._for.body = body;
 	return st;
 }
 
-static struct ast_statement *parse_statement_1(struct token **tok_ptr,
-					       int allow_declaration)
+static ast_ref parse_statement_1(struct parser *p, int allow_declaration)
 {
-	struct ast_statement *st;
-	struct token *tok = *tok_ptr;
+	struct token_stream *ts = p->ts;
+	struct token_loc loc = token_stream_loc(ts, 0);
+	struct ast_node *node;
+	ast_ref st, child;
 
-	if (tok->type == TOK_OPEN_BRACE) {
-		st = parse_statement_block(&tok);
+	if (token_stream_peek(ts, 0) == TOK_OPEN_BRACE) {
+		st = parse_statement_block(p);
 		goto out;
 	}
 
-	if (tok->type == TOK_FOR_KW) {
-		st = parse_for_statement(&tok);
+	if (token_stream_peek(ts, 0) == TOK_FOR_KW) {
+		st = parse_for_statement(p);
 		goto out;
 	}
 
-	st = xmalloc(sizeof(*st));
-
-	if (check_and_pop_gently(&tok, TOK_RETURN_KW)) {
-		st->type = AST_ST_RETURN;
-		st->u._return.tok = &tok[-1];
-		if (check_and_pop_gently(&tok, TOK_SEMICOLON)) {
-			st->u._return.opt_exp.exp = NULL;
-		} else {
-			st->u._return.opt_exp.exp = parse_exp(&tok);
-			check_and_pop(&tok, TOK_SEMICOLON);
+	if (check_and_pop_gently(ts, TOK_RETURN_KW)) {
+		st = new_node(p, AST_ST_RETURN, loc);
+		if (!check_and_pop_gently(ts, TOK_SEMICOLON)) {
+			child = parse_exp(p);
+			NODE(p, st)->u.opt_exp.exp = child;
+			check_and_pop(ts, TOK_SEMICOLON);
 		}
 
-	} else if (check_and_pop_gently(&tok, TOK_IF_KW)) {
-		st->type = AST_ST_IF_ELSE;
-		check_and_pop(&tok, TOK_OPEN_PAR);
-		st->u.if_else.condition = parse_exp(&tok);
-		check_and_pop(&tok, TOK_CLOSE_PAR);
+	} else if (check_and_pop_gently(ts, TOK_IF_KW)) {
+		st = new_node(p, AST_ST_IF_ELSE, loc);
+		check_and_pop(ts, TOK_OPEN_PAR);
+		ast_ref condition = parse_exp(p);
+		check_and_pop(ts, TOK_CLOSE_PAR);
 		/*
 		 * NEEDSWORK: hacky, should probably introduce the
 		 * struct ast_block_item type, which can be either a statement
 		 * or a variable declaration, and leave declaration outside
 		 * of the struct ast_statement definition.
 		 */
-		st->u.if_else.if_st = parse_statement_1(&tok, 0);
-		if (check_and_pop_gently(&tok, TOK_ELSE_KW))
-			st->u.if_else.else_st = parse_statement_1(&tok, 0);
-		else
-			st->u.if_else.else_st = NULL;
-
-	} else if (allow_declaration && tok->type == TOK_INT_KW) {
-		st->type = AST_ST_VAR_DECL;
-		st->u.decl_list = parse_var_decl_list(&tok);
-		check_and_pop(&tok, TOK_SEMICOLON);
-
-	} else if (check_and_pop_gently(&tok, TOK_WHILE_KW)) {
-		st->type = AST_ST_WHILE;
-		check_and_pop(&tok, TOK_OPEN_PAR);
-		st->u._while.condition = parse_exp(&tok);
-		check_and_pop(&tok, TOK_CLOSE_PAR);
-		st->u._while.body = parse_statement_1(&tok, 0);
-
-	} else if (check_and_pop_gently(&tok, TOK_DO_KW)) {
-		st->type = AST_ST_DO;
-		st->u._do.body = parse_statement_1(&tok, 0);
-		check_and_pop(&tok, TOK_WHILE_KW);
-		check_and_pop(&tok, TOK_OPEN_PAR);
-		st->u._do.condition = parse_exp(&tok);
-		check_and_pop(&tok, TOK_CLOSE_PAR);
-		check_and_pop(&tok, TOK_SEMICOLON);
-
-	} else if (check_and_pop_gently(&tok, TOK_BREAK_KW)) {
-		st->type = AST_ST_BREAK;
-		st->u.break_tok = &tok[-1];
-		check_and_pop(&tok, TOK_SEMICOLON);
-
-	} else if (check_and_pop_gently(&tok, TOK_CONTINUE_KW)) {
-		st->type = AST_ST_CONTINUE;
-		st->u.continue_tok = &tok[-1];
-		check_and_pop(&tok, TOK_SEMICOLON);
-
-	} else if (check_and_pop_gently(&tok, TOK_GOTO_KW)) {
-		st->type = AST_ST_GOTO;
-		check_and_pop(&tok, TOK_IDENTIFIER);
-		st->u._goto.label_tok = &tok[-1];
-		st->u._goto.label = (const char *)tok[-1].value;
-		check_and_pop(&tok, TOK_SEMICOLON);
-
-	} else if (tok[0].type == TOK_IDENTIFIER && tok[1].type == TOK_COLON) {
-		tok += 2;
-		st->type = AST_ST_LABELED_STATEMENT;
-		st->u.labeled_st.label = (const char *)tok[-2].value;
-		st->u.labeled_st.label_tok = &tok[-2];
-		st->u.labeled_st.st = parse_statement(&tok);
-
-	} else if (check_and_pop_gently(&tok, TOK_SEMICOLON)) {
-		st->type = AST_ST_EXPRESSION;
-		st->u.opt_exp.exp = NULL;
+		ast_ref if_st = parse_statement_1(p, 0);
+		ast_ref else_st = AST_NULL;
+		if (check_and_pop_gently(ts, TOK_ELSE_KW))
+			else_st = parse_statement_1(p, 0);
+		node = NODE(p, st);
+		node->u.if_else.condition = condition;
+		node->u.if_else.if_st = if_st;
+		node->u.if_else.else_st = else_st;
+
+	} else if (allow_declaration && token_stream_peek(ts, 0) == TOK_INT_KW) {
+		st = parse_var_decl_list(p);
+		check_and_pop(ts, TOK_SEMICOLON);
+
+	} else if (check_and_pop_gently(ts, TOK_WHILE_KW)) {
+		st = new_node(p, AST_ST_WHILE, loc);
+		check_and_pop(ts, TOK_OPEN_PAR);
+		ast_ref condition = parse_exp(p);
+		check_and_pop(ts, TOK_CLOSE_PAR);
+		ast_ref body = parse_statement_1(p, 0);
+		node = NODE(p, st);
+		node->u._while.condition = condition;
+		node->u._while.body = body;
+
+	} else if (check_and_pop_gently(ts, TOK_DO_KW)) {
+		st = new_node(p, AST_ST_DO, loc);
+		ast_ref body = parse_statement_1(p, 0);
+		check_and_pop(ts, TOK_WHILE_KW);
+		check_and_pop(ts, TOK_OPEN_PAR);
+		ast_ref condition = parse_exp(p);
+		check_and_pop(ts, TOK_CLOSE_PAR);
+		check_and_pop(ts, TOK_SEMICOLON);
+		node = NODE(p, st);
+		node->u._do.body = body;
+		node->u._do.condition = condition;
+
+	} else if (check_and_pop_gently(ts, TOK_BREAK_KW)) {
+		st = new_node(p, AST_ST_BREAK, loc);
+		check_and_pop(ts, TOK_SEMICOLON);
+
+	} else if (check_and_pop_gently(ts, TOK_CONTINUE_KW)) {
+		st = new_node(p, AST_ST_CONTINUE, loc);
+		check_and_pop(ts, TOK_SEMICOLON);
+
+	} else if (check_and_pop_gently(ts, TOK_GOTO_KW)) {
+		check_and_pop(ts, TOK_IDENTIFIER);
+		/* The location of a goto is that of its label. */
+		st = new_node(p, AST_ST_GOTO, token_stream_loc(ts, -1));
+		NODE(p, st)->u._goto.label_atom = token_stream_value(ts, -1).atom;
+		check_and_pop(ts, TOK_SEMICOLON);
+
+	} else if (token_stream_peek(ts, 0) == TOK_IDENTIFIER &&
+		   token_stream_peek(ts, 1) == TOK_COLON) {
+		st = new_node(p, AST_ST_LABELED_STATEMENT, loc);
+		NODE(p, st)->u.labeled_st.label_atom = token_stream_value(ts, 0).atom;
+		token_stream_pop(ts);
+		token_stream_pop(ts);
+		child = parse_statement(p);
+		NODE(p, st)->u.labeled_st.st = child;
+
+	} else if (check_and_pop_gently(ts, TOK_SEMICOLON)) {
+		st = new_node(p, AST_ST_EXPRESSION, loc);
 
 	} else {
 		/* must be an expression */
-		st->type = AST_ST_EXPRESSION;
-		st->u.opt_exp.exp = parse_exp(&tok);
-		check_and_pop(&tok, TOK_SEMICOLON);
+		st = new_node(p, AST_ST_EXPRESSION, loc);
+		child = parse_exp(p);
+		NODE(p, st)->u.opt_exp.exp = child;
+		check_and_pop(ts, TOK_SEMICOLON);
 	}
 
 out:
-	*tok_ptr = tok;
 	return st;
 }
 
-static struct ast_statement *parse_statement(struct token **tok_ptr)
+static ast_ref parse_statement(struct parser *p)
 {
-	return parse_statement_1(tok_ptr, 1);
+	return parse_statement_1(p, 1);
 }
 
-static struct ast_func_decl *parse_func_decl(struct token **tok_ptr)
+/*
+ * Parses the rest of a function declaration, whose return type and name (the
+ * previous token) were already popped.
+ */
+static ast_ref parse_func_decl(struct parser *p, enum return_type return_type)
 {
-	struct ast_func_decl *fun = xmalloc(sizeof(*fun));
-	struct token *tok = *tok_ptr;
+	struct token_stream *ts = p->ts;
+	int empty_parameter_declaration = 0;
+	size_t params = list_start(p);
+	ast_ref fun, body;
 
-	switch (check_and_pop(&tok, TOK_INT_KW, TOK_VOID_KW)) {
-	case TOK_INT_KW: fun->return_type = RET_INT; break;
-	case TOK_VOID_KW: fun->return_type = RET_VOID; break;
-	default: BUG("unexpected token type");
-	}
-
-	check_and_pop(&tok, TOK_IDENTIFIER);
-	fun->name = xstrdup((char *)tok[-1].value);
-	fun->tok = &tok[-1];
-	ARRAY_INIT(&fun->parameters);
+	fun = new_node(p, AST_FUNC_DECL, token_stream_loc(ts, -1));
+	NODE(p, fun)->op = return_type;
+	NODE(p, fun)->u.func.atom = token_stream_value(ts, -1).atom;
 
-	check_and_pop(&tok, TOK_OPEN_PAR);
+	check_and_pop(ts, TOK_OPEN_PAR);
 
-	fun->empty_parameter_declaration = 0;
-	if (check_and_pop_gently(&tok, TOK_VOID_KW)) {
-		check_and_pop(&tok, TOK_CLOSE_PAR);
+	if (check_and_pop_gently(ts, TOK_VOID_KW)) {
+		check_and_pop(ts, TOK_CLOSE_PAR);
 	} else {
 		int is_first_parameter = 1;
-		while (tok->type != TOK_CLOSE_PAR) {
+		while (token_stream_peek(ts, 0) != TOK_CLOSE_PAR) {
 			if (!is_first_parameter)
-				check_and_pop(&tok, TOK_COMMA);
-			check_and_pop(&tok, TOK_INT_KW);
-			check_and_pop(&tok, TOK_IDENTIFIER);
-			struct ast_var_decl *decl = xcalloc(1, sizeof(*decl));
-			decl->name = xstrdup((char *)tok[-1].value);
-			decl->tok = &tok[-1];
-			ARRAY_APPEND(&fun->parameters, decl);
+				check_and_pop(ts, TOK_COMMA);
+			check_and_pop(ts, TOK_INT_KW);
+			check_and_pop(ts, TOK_IDENTIFIER);
+			ast_ref decl = new_node(p, AST_VAR_DECL,
+						token_stream_loc(ts, -1));
+			NODE(p, decl)->u.var_decl.atom = token_stream_value(ts, -1).atom;
+			list_push(p, decl);
 			is_first_parameter = 0;
 		}
-		check_and_pop(&tok, TOK_CLOSE_PAR);
+		check_and_pop(ts, TOK_CLOSE_PAR);
 		if (is_first_parameter)
-			fun->empty_parameter_declaration = 1;
+			empty_parameter_declaration = 1;
 	}
+	NODE(p, fun)->empty_parameter_declaration = empty_parameter_declaration;
+	NODE(p, fun)->u.func.parameters = list_finish(p, params);
 
-	if (check_and_pop_gently(&tok, TOK_SEMICOLON))
-		fun->body = NULL;
+	if (check_and_pop_gently(ts, TOK_SEMICOLON))
+		body = AST_NULL;
 	else
-		fun->body = parse_statement_block(&tok);
+		body = parse_statement_block(p);
+	NODE(p, fun)->u.func.body = body;
 
-	*tok_ptr = tok;
 	return fun;
 }
 
-static struct ast_var_decl_list *maybe_parse_global_var_list(struct token **tok_ptr)
-{
-	struct ast_var_decl_list *decl_list = xcalloc(1, sizeof(*decl_list));
-	struct token *tok = *tok_ptr;
-	/*
-	 * Tells at which point we consider the token sequence a variable
-	 * declaration and, thus, we no longer bail if something odd is found.
-	 */
-	int can_bail = 1;
-
-	if (!check_and_pop_gently(&tok, TOK_INT_KW))
-		goto bail;
-
-	while (1) {
-		if (can_bail) {
-			if (!check_and_pop_gently(&tok, TOK_IDENTIFIER))
-				goto bail;
-		} else {
-			check_and_pop(&tok, TOK_IDENTIFIER);
-		}
-		struct ast_var_decl *decl = xcalloc(1, sizeof(*decl));
-		decl->name = xstrdup((char *)tok[-1].value);
-		decl->tok = &tok[-1];
-		if (check_and_pop_gently(&tok, TOK_ASSIGNMENT)) {
-			can_bail = 0;
-			struct token *assign_tok = &tok[-1];
-			decl->value = parse_exp_no_comma(&tok);
-			if (decl->value->type != AST_EXP_CONSTANT_INT) {
+/*
+ * Parses the rest of a global variable declaration list, whose "int" (at
+ * `loc`) and first variable name (the previous token) were already popped.
+ */
+static ast_ref parse_global_var_list(struct parser *p, struct token_loc loc)
+{
+	struct token_stream *ts = p->ts;
+	size_t decls = list_start(p);
+	ast_ref decl_list = new_node(p, AST_ST_VAR_DECL, loc);
+
+	for (;;) {
+		ast_ref decl = new_node(p, AST_VAR_DECL, token_stream_loc(ts, -1));
+		NODE(p, decl)->u.var_decl.atom = token_stream_value(ts, -1).atom;
+		if (check_and_pop_gently(ts, TOK_ASSIGNMENT)) {
+			struct token_loc assign_loc = token_stream_loc(ts, -1);
+			ast_ref value = parse_exp_no_comma(p);
+			if (NODE(p, value)->type != AST_EXP_CONSTANT_INT) {
 				/*
 				 * NEEDSWORK: we should also allow expressions that can
 				 * evaluate to a constant int at compile time. For
 				 * example: "2 + 2", and "~3".
 				 */
 				die("static initialization requires a constant value\n%s",
-				    show_token_on_source_line(assign_tok));
+				    show_loc_on_source_line(&assign_loc));
 			}
+			NODE(p, decl)->u.var_decl.value = value;
 		}
-		ARRAY_APPEND(decl_list, decl);
-		if (check_and_pop_gently(&tok, TOK_COMMA))
-			can_bail = 0;
-		else
+		list_push(p, decl);
+		if (!check_and_pop_gently(ts, TOK_COMMA))
 			break;
+		check_and_pop(ts, TOK_IDENTIFIER);
 	}
 
-	if (can_bail) {
-		if (!check_and_pop_gently(&tok, TOK_SEMICOLON))
-			goto bail;
-	} else {
-		check_and_pop(&tok, TOK_SEMICOLON);
-	}
-
-	*tok_ptr = tok;
+	check_and_pop(ts, TOK_SEMICOLON);
+	NODE(p, decl_list)->u.decl_list = list_finish(p, decls);
 	return decl_list;
-
-bail:
-	free_ast_var_decl_list(decl_list);
-	return NULL;
 }
 
-struct ast_program *parse_program(struct token *toks)
+/*
+ * Both kinds of toplevel items start with a type and a name, so we parse those
+ * once and decide by the next token: "int <identifier>" followed by '=', ','
+ * or ';' starts a variable declaration list, and anything else must be a
+ * function declaration.
+ */
+static ast_ref parse_toplevel_item(struct parser *p)
 {
-	struct ast_program *prog = xmalloc(sizeof(*prog));
-	ARRAY_INIT(&prog->items);
+	struct token_stream *ts = p->ts;
+	struct token_loc loc = token_stream_loc(ts, 0);
+	enum return_type return_type;
 
-	while (!end_token(toks)) {
-		struct ast_toplevel_item *item = xmalloc(sizeof(*item));
-		struct ast_var_decl_list *var_list = maybe_parse_global_var_list(&toks);
-		if (var_list) {
-			item->type = TOPLEVEL_VAR_DECL;
-			item->u.var_list = var_list;
-		} else {
-			item->type = TOPLEVEL_FUNC_DECL;
-			item->u.func = parse_func_decl(&toks);
-		}
-		ARRAY_APPEND(&prog->items, item);
+	switch (check_and_pop(ts, TOK_INT_KW, TOK_VOID_KW)) {
+	case TOK_INT_KW: return_type = RET_INT; break;
+	case TOK_VOID_KW: return_type = RET_VOID; break;
+	default: BUG("unexpected token type");
 	}
-
-	return prog;
-}
-
-/*******************************************************************************
- *			     Memory Freeing
-*******************************************************************************/
-
-
-static void free_ast_expression(struct ast_expression *exp)
-{
-	switch (exp->type) {
-	case AST_EXP_BINARY_OP:
-		free_ast_expression(exp->u.bin_op.lexp);
-		free_ast_expression(exp->u.bin_op.rexp);
-		break;
-	case AST_EXP_TERNARY:
-		free_ast_expression(exp->u.ternary.condition);
-		free_ast_expression(exp->u.ternary.if_exp);
-		free_ast_expression(exp->u.ternary.else_exp);
-		break;
-	case AST_EXP_UNARY_OP:
-		free_ast_expression(exp->u.un_op.exp);
-		break;
-	case AST_EXP_CONSTANT_INT:
-		break;
-	case AST_EXP_VAR:
-		free((char *)exp->u.var.name);
-		break;
-	case AST_EXP_FUNC_CALL:
-		free((char *)exp->u.call.name);
-		for (size_t i = 0; i < exp->u.call.args.nr; i++)
-			free_ast_expression(exp->u.call.args.arr[i]);
-		FREE_ARRAY(&exp->u.call.args);
-		break;
-	default:
-		die("BUG: unknown ast expression type: %d", exp->type);
+	check_and_pop(ts, TOK_IDENTIFIER);
+
+	if (return_type == RET_INT) {
+		switch (token_stream_peek(ts, 0)) {
+		case TOK_ASSIGNMENT:
+		case TOK_COMMA:
+		case TOK_SEMICOLON:
+			return parse_global_var_list(p, loc);
+		default:
+			break;
+		}
 	}
-	free(exp);
+	return parse_func_decl(p, return_type);
 }
 
-static void free_ast_var_decl(struct ast_var_decl *decl)
+/* Moves the nodes parsed so far to `tree`, at the arena. */
+static void finish_tree(struct parser *p, ast_ref root, struct ast_tree *tree)
 {
-	free((char *)decl->name);
-	if (decl->value)
-		free_ast_expression(decl->value);
-	free(decl);
-}
+	tree->src = p->ts->toks.src;
+	tree->root = root;
+	tree->nr_nodes = p->nodes.nr;
+	tree->nr_extra = p->extra.nr;
+	tree->nodes = arena_alloc(p->arena, st_mult(sizeof(*tree->nodes),
+						    tree->nr_nodes));
+	memcpy(tree->nodes, p->nodes.arr,
+	       st_mult(sizeof(*tree->nodes), tree->nr_nodes));
+	tree->extra = arena_alloc(p->arena, st_mult(sizeof(*tree->extra),
+						    tree->nr_extra));
+	memcpy(tree->extra, p->extra.arr,
+	       st_mult(sizeof(*tree->extra), tree->nr_extra));
 
-static void free_ast_var_decl_list(struct ast_var_decl_list *decl_list)
-{
-	for (size_t i = 0; i < decl_list->nr; i++) {
-		free_ast_var_decl(decl_list->arr[i]);
-	}
-	FREE_ARRAY(decl_list);
-	free(decl_list);
+	/* Keep the AST_NULL node for the next tree. */
+	p->nodes.nr = 1;
+	p->extra.nr = 0;
 }
 
-static void free_ast_opt_expression(struct ast_opt_expression opt_exp)
+struct ast_program *parse_program(struct token_stream *ts)
 {
-	if (opt_exp.exp)
-		free_ast_expression(opt_exp.exp);
-}
+	struct ast_program *prog = xmalloc(sizeof(*prog));
+	struct parser p = { .ts = ts, .arena = &prog->arena };
 
-static void free_ast_statement(struct ast_statement *st)
-{
-	switch (st->type) {
-	case AST_ST_RETURN:
-		free_ast_opt_expression(st->u._return.opt_exp);
-		break;
-	case AST_ST_VAR_DECL:
-		free_ast_var_decl_list(st->u.decl_list);
-		break;
-	case AST_ST_EXPRESSION:
-		free_ast_opt_expression(st->u.opt_exp);
-		break;
-	case AST_ST_IF_ELSE:
-		free_ast_expression(st->u.if_else.condition);
-		free_ast_statement(st->u.if_else.if_st);
-		if (st->u.if_else.else_st)
-			free_ast_statement(st->u.if_else.else_st);
-		break;
-	case AST_ST_BLOCK:
-		for (size_t i = 0; i < st->u.block.nr; i++)
-			free_ast_statement(st->u.block.items[i]);
-		free(st->u.block.items);
-		break;
-	case AST_ST_FOR:
-		free_ast_opt_expression(st->u._for.prologue);
-		free_ast_expression(st->u._for.condition);
-		free_ast_opt_expression(st->u._for.epilogue);
-		free_ast_statement(st->u._for.body);
-		break;
-	case AST_ST_FOR_DECL:
-		free_ast_var_decl_list(st->u.for_decl.decl_list);
-		free_ast_expression(st->u.for_decl.condition);
-		free_ast_opt_expression(st->u.for_decl.epilogue);
-		free_ast_statement(st->u.for_decl.body);
-		break;
-	case AST_ST_WHILE:
-		free_ast_expression(st->u._while.condition);
-		free_ast_statement(st->u._while.body);
-		break;
-	case AST_ST_DO:
-		free_ast_statement(st->u._do.body);
-		free_ast_expression(st->u._do.condition);
-		break;
-	case AST_ST_LABELED_STATEMENT:
-		free_ast_statement(st->u.labeled_st.st);
-		break;
-	case AST_ST_BREAK:
-	case AST_ST_CONTINUE:
-	case AST_ST_GOTO:
-		break;
-	default:
-		die("BUG: unknown ast statement type: %d", st->type);
+	arena_init(&prog->arena);
+	ARRAY_INIT(&prog->items);
+	prog->map = NULL;
+	prog->map_len = 0;
+	if (new_node(&p, AST_NONE, (struct token_loc){ 0 }) != AST_NULL)
+		BUG("the first node is not AST_NULL");
+
+	while (!token_stream_end(ts)) {
+		ast_ref root = parse_toplevel_item(&p);
+		ARENA_ALLOC_GROW(p.arena, prog->items.arr, prog->items.nr + 1,
+				 prog->items.alloc);
+		finish_tree(&p, root, &prog->items.arr[prog->items.nr++]);
 	}
-	free(st);
-}
 
-static void free_ast_func_decl(struct ast_func_decl *fun)
-{
-	if (fun->body)
-		free_ast_statement(fun->body);
-	free((char *)fun->name);
-	for (size_t i = 0; i < fun->parameters.nr; i++)
-		free_ast_var_decl(fun->parameters.arr[i]);
-	FREE_ARRAY(&fun->parameters);
-	free(fun);
+	free(p.nodes.arr);
+	free(p.extra.arr);
+	free(p.list_items.arr);
+	free(p.exp_frames.arr);
+	return prog;
 }
 
-static void free_ast_toplevel_item(struct ast_toplevel_item *item)
+char *show_node_on_source_line(const struct ast_tree *tree,
+			       const struct ast_node *node)
 {
-	switch (item->type) {
-	case TOPLEVEL_FUNC_DECL:
-		free_ast_func_decl(item->u.func);
-		break;
-	case TOPLEVEL_VAR_DECL:
-		free_ast_var_decl_list(item->u.var_list);
-		break;
-	default:
-		BUG("unknown toplevel item '%s'", item->type);
-	}
+	struct token_loc loc = ast_loc(tree, node);
+	return show_loc_on_source_line(&loc);
 }
 
-static void free_ast_program(struct ast_program *prog)
-{
-	for (size_t i = 0; i < prog->items.nr; i++)
-		free_ast_toplevel_item(prog->items.arr[i]);
-	FREE_ARRAY(&prog->items);
-	free(prog);
-}
+/*******************************************************************************
+ *			     Memory Freeing
+*******************************************************************************/
 
 void free_ast(struct ast_program *prog)
 {
-	free_ast_program(prog);
+	/* All the items, and their nodes, live in the arena or the map. */
+	arena_destroy(&prog->arena);
+	if (prog->map && munmap(prog->map, prog->map_len))
+		error_errno("failed to munmap AST cache entry");
+	free(prog);
 }
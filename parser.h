@@ -1,244 +1,267 @@
 #ifndef _PARSER_H
 #define _PARSER_H
 
+#include <stdint.h>
 #include "lib/array.h"
-
-struct token;
+#include "lib/arena.h"
+#include "lib/atom.h"
+#include "lexer.h"
 
 /*
-TODO: can we possibly simplify/unify the functions using some generic node
-structure? Perhaps:
+ * The AST is stored flat: all the nodes of a toplevel item (a function or a
+ * global variable declaration list) live in a single array, in the order they
+ * were parsed, and refer to their children by index in that array. Compared
+ * to a tree of individually allocated nodes, this is about half the memory,
+ * and walking over a function touches contiguous memory.
+ */
+
+/* Index of a node at its ast_tree. */
+typedef uint32_t ast_ref;
+
+/* The index 0 is reserved, so that it can be used for missing children. */
+#define AST_NULL 0
+
+/* A list of `nr` children, at tree->extra[start] to tree->extra[start+nr-1]. */
+struct ast_list {
+	uint32_t start, nr;
+};
 
 enum ast_node_type {
 	AST_NONE = 0,
-	AST_PROGRAM,
+
+	AST_EXP_CONSTANT_INT,
+	AST_EXP_UNARY_OP,
+	AST_EXP_BINARY_OP,
+	AST_EXP_VAR,
+	AST_EXP_TERNARY,
+	AST_EXP_FUNC_CALL,
+
+	AST_ST_RETURN,
+	/*
+	 * TODO: this should probably not be a statement. See
+	 * parser.c:parse_statement_1() for more info.
+	 */
+	AST_ST_VAR_DECL,
+	AST_ST_EXPRESSION,
+	AST_ST_IF_ELSE,
+	AST_ST_BLOCK,
+	AST_ST_FOR,
+	AST_ST_FOR_DECL,
+	AST_ST_WHILE,
+	AST_ST_DO,
+	AST_ST_BREAK,
+	AST_ST_CONTINUE,
+	AST_ST_GOTO,
+	AST_ST_LABELED_STATEMENT,
+
+	AST_VAR_DECL, /* An item of AST_ST_VAR_DECL, or a function parameter. */
 	AST_FUNC_DECL,
-	AST_STATEMENT,
-	AST_EXPRESSION,
 };
 
-struct ast_node {
-	enum ast_node_type type;
-	union {
-		struct ast_expression *exp;
-		struct ast_statement *st;
-		struct ast_func_decl *fun;
-		struct ast_program *prog;
-	} u;
+enum un_op_type {
+	EXP_OP_NEGATION,
+	EXP_OP_BIT_COMPLEMENT,
+	EXP_OP_LOGIC_NEGATION,
+	EXP_OP_PREFIX_INC,
+	EXP_OP_SUFFIX_INC,
+	EXP_OP_PREFIX_DEC,
+	EXP_OP_SUFFIX_DEC,
 };
-*/
-
-struct ast_expression {
-	enum {
-		AST_EXP_CONSTANT_INT,
-		AST_EXP_UNARY_OP,
-		AST_EXP_BINARY_OP,
-		AST_EXP_VAR,
-		AST_EXP_TERNARY,
-		AST_EXP_FUNC_CALL,
-	} type;
+
+enum bin_op_type {
+	EXP_OP_ADDITION = 0,
+	EXP_OP_SUBTRACTION,
+	EXP_OP_DIVISION,
+	EXP_OP_MULTIPLICATION,
+	EXP_OP_MODULO,
+
+	EXP_OP_LOGIC_AND,
+	EXP_OP_LOGIC_OR,
+	EXP_OP_EQUAL,
+	EXP_OP_NOT_EQUAL,
+	EXP_OP_LT,
+	EXP_OP_LE,
+	EXP_OP_GT,
+	EXP_OP_GE,
+
+	EXP_OP_BITWISE_AND,
+	EXP_OP_BITWISE_OR,
+	EXP_OP_BITWISE_XOR,
+	EXP_OP_BITWISE_LEFT_SHIFT,
+	EXP_OP_BITWISE_RIGHT_SHIFT,
+
+	EXP_OP_COMMA,
+
+	/*
+	 * Note: although this is listed as a binary operator (and it indeed
+	 * inceeds upon two args), it is different than the other operators in
+	 * the sense that its left exp MUST be of type AST_EXP_VAR. We don't
+	 * enforce this here, in the struct definition, but we don in the
+	 * parser.
+	 */
+	EXP_OP_ASSIGNMENT,
+
+	/* Keep at the end. */
+	EXP_BIN_OP_NR,
+};
+
+enum return_type {
+	RET_INT,
+	RET_VOID,
+};
+
+struct ast_node {
+	uint8_t type; /* enum ast_node_type */
+	/* enum un_op_type, enum bin_op_type, or (for functions) return_type */
+	uint8_t op;
+	/* AST_FUNC_DECL: true if declared as `func()`. But not `func(void)`! */
+	uint8_t empty_parameter_declaration;
+
+	/* Where the node starts (or its operator, for operations). */
+	uint32_t line_no, col_no;
 
 	union {
 		int ival;
+
 		struct {
-			enum un_op_type {
-				EXP_OP_NEGATION,
-				EXP_OP_BIT_COMPLEMENT,
-				EXP_OP_LOGIC_NEGATION,
-				EXP_OP_PREFIX_INC,
-				EXP_OP_SUFFIX_INC,
-				EXP_OP_PREFIX_DEC,
-				EXP_OP_SUFFIX_DEC,
-			} type;
-			struct ast_expression *exp;
+			ast_ref exp;
 		} un_op;
+
 		struct {
-			enum bin_op_type {
-				EXP_OP_ADDITION = 0,
-				EXP_OP_SUBTRACTION,
-				EXP_OP_DIVISION,
-				EXP_OP_MULTIPLICATION,
-				EXP_OP_MODULO,
-
-				EXP_OP_LOGIC_AND,
-				EXP_OP_LOGIC_OR,
-				EXP_OP_EQUAL,
-				EXP_OP_NOT_EQUAL,
-				EXP_OP_LT,
-				EXP_OP_LE,
-				EXP_OP_GT,
-				EXP_OP_GE,
-
-				EXP_OP_BITWISE_AND,
-				EXP_OP_BITWISE_OR,
-				EXP_OP_BITWISE_XOR,
-				EXP_OP_BITWISE_LEFT_SHIFT,
-				EXP_OP_BITWISE_RIGHT_SHIFT,
-
-				EXP_OP_COMMA,
-
-				/*
-				 * Note: although this is listed as a binary
-				 * operator (and it indeed inceeds upon two
-				 * args), it is different than the other
-				 * operators in the sense that its left exp
-				 * MUST be of type AST_EXP_VAR. We don't
-				 * enforce this here, in the struct definition,
-				 * but we don in the parser.
-				 */
-				EXP_OP_ASSIGNMENT,
-
-				/* Keep at the end. */
-				EXP_BIN_OP_NR,
-			} type;
-			struct ast_expression *lexp, *rexp;
+			ast_ref lexp, rexp;
 		} bin_op;
 
-		struct var_ref {
-			const char *name;
-			struct token *tok;
+		struct {
+			atom_t atom;
 		} var;
 
 		struct {
-			struct ast_expression *condition,
-					      *if_exp,
-					      *else_exp;
+			ast_ref condition, if_exp, else_exp;
 		} ternary;
 
-		struct func_call {
-			const char *name;
-			ARRAY(struct ast_expression *) args;
-			struct token *tok;
+		struct {
+			atom_t atom;
+			struct ast_list args;
 		} call;
-	} u;
-};
-
-/* A possibly null expression. */
-struct ast_opt_expression {
-	struct ast_expression *exp;
-};
 
-struct ast_var_decl {
-	const char *name;
-	struct token *tok;
-	struct ast_expression *value; /* optional */
-};
+		/* AST_ST_RETURN and AST_ST_EXPRESSION. Optional. */
+		struct {
+			ast_ref exp;
+		} opt_exp;
 
-NAMED_ARRAY(struct ast_var_decl *, ast_var_decl_list);
+		struct ast_list decl_list; /* of AST_VAR_DECL */
 
-struct ast_statement {
-	enum {
-		AST_ST_RETURN,
-		/*
-		 * TODO: this should probably not be at ast_statement. See
-		 * parser.c:parse_statement_1() for more info.
-		 */
-		AST_ST_VAR_DECL,
-		AST_ST_EXPRESSION,
-		AST_ST_IF_ELSE,
-		AST_ST_BLOCK,
-		AST_ST_FOR,
-		AST_ST_FOR_DECL,
-		AST_ST_WHILE,
-		AST_ST_DO,
-		AST_ST_BREAK,
-		AST_ST_CONTINUE,
-		AST_ST_GOTO,
-		AST_ST_LABELED_STATEMENT,
-	} type;
+		struct {
+			atom_t atom;
+			ast_ref value; /* optional */
+		} var_decl;
 
-	union {
 		struct {
-			struct token *tok;
-			struct ast_opt_expression opt_exp;
-		} _return;
-
-		struct ast_opt_expression opt_exp;
-		struct ast_var_decl_list *decl_list;
-		struct if_else {
-			struct ast_expression *condition;
-			struct ast_statement *if_st, *else_st; /* else is optional */
+			ast_ref condition;
+			ast_ref if_st, else_st; /* else is optional */
 		} if_else;
 
-		struct block {
-			struct ast_statement **items;
-			size_t alloc, nr;
-		} block;
+		struct ast_list block;
 
+		/*
+		 * AST_ST_FOR and AST_ST_FOR_DECL. The later's prologue is an
+		 * AST_ST_VAR_DECL.
+		 */
 		struct {
-			struct ast_opt_expression prologue;
-			struct ast_expression *condition; /* must default to true when empty */
-			struct ast_opt_expression epilogue;
-			struct ast_statement *body;
+			ast_ref prologue; /* optional */
+			ast_ref condition; /* must default to true when empty */
+			ast_ref epilogue; /* optional */
+			ast_ref body;
 		} _for;
 
 		struct {
-			struct ast_var_decl_list *decl_list;
-			struct ast_expression *condition; /* must default to true when empty */
-			struct ast_opt_expression epilogue;
-			struct ast_statement *body;
-		} for_decl;
-
-		struct {
-			struct ast_expression *condition;
-			struct ast_statement *body;
+			ast_ref condition;
+			ast_ref body;
 		} _while;
 
 		struct {
-			struct ast_statement *body;
-			struct ast_expression *condition;
+			ast_ref body;
+			ast_ref condition;
 		} _do;
 
-		struct token *continue_tok,
-			     *break_tok;
-
 		struct {
-			const char *label;
-			struct token *label_tok;
+			atom_t label_atom;
 		} _goto;
 
 		struct {
-			const char *label;
-			struct token *label_tok;
-			struct ast_statement *st;
+			atom_t label_atom;
+			ast_ref st;
 		} labeled_st;
+
+		struct {
+			atom_t atom;
+			struct ast_list parameters; /* of AST_VAR_DECL */
+			/*
+			 * Optional. If present, must be of type AST_ST_BLOCK.
+			 * (Enforced by parser.c)
+			 */
+			ast_ref body;
+		} func;
 	} u;
 };
 
-struct ast_func_decl {
-	const char *name;
-	struct token *tok;
-	/* True if func was declared as `func()`. But not `func(void)`! */
-	int empty_parameter_declaration:1;
-	ARRAY(struct ast_var_decl *) parameters;
-	/*
-	 * Optional. If present, must be of type AST_ST_BLOCK.
-	 * (Enforced by parser.c)
-	 */
-	struct ast_statement *body;
-	enum return_type {
-		RET_INT,
-		RET_VOID,
-	} return_type;
+/* The nodes of a toplevel item. */
+struct ast_tree {
+	/* For identifier names and locations. */
+	const struct token_source *src;
+	struct ast_node *nodes;
+	ast_ref *extra; /* Where the children in struct ast_list are. */
+	size_t nr_nodes, nr_extra;
+	ast_ref root; /* An AST_FUNC_DECL or AST_ST_VAR_DECL. */
 };
 
-struct ast_toplevel_item {
-	enum {
-		TOPLEVEL_VAR_DECL,
-		TOPLEVEL_FUNC_DECL,
-	} type;
-
-	union {
-		struct ast_var_decl_list *var_list;
-		struct ast_func_decl *func;
-	} u;
-};
+static inline const struct ast_node *ast_node(const struct ast_tree *tree,
+					      ast_ref ref)
+{
+	return &tree->nodes[ref];
+}
+
+/* The i-th node of `list`. */
+static inline const struct ast_node *ast_list_node(const struct ast_tree *tree,
+						   struct ast_list list,
+						   size_t i)
+{
+	return &tree->nodes[tree->extra[list.start + i]];
+}
+
+static inline const char *ast_name(const struct ast_tree *tree, atom_t atom)
+{
+	return atom_name(&tree->src->atoms, atom);
+}
+
+static inline struct token_loc ast_loc(const struct ast_tree *tree,
+				       const struct ast_node *node)
+{
+	return (struct token_loc){ tree->src, node->line_no, node->col_no };
+}
+
+/* Like show_loc_on_source_line(), for the location of `node`. */
+char *show_node_on_source_line(const struct ast_tree *tree,
+			       const struct ast_node *node);
 
 struct ast_program {
-	ARRAY(struct ast_toplevel_item *) items;
+	ARRAY(struct ast_tree) items;
+	/* Owns the items, and their nodes. */
+	struct arena arena;
+	/*
+	 * For programs loaded from the AST cache, the mapped cache entry,
+	 * which holds the nodes instead of the arena. See ast-cache.h.
+	 */
+	void *map;
+	size_t map_len;
 };
 
-struct ast_program *parse_program(struct token *toks);
+/*
+ * Note: the AST borrows identifier names (and, for diagnostics, the source
+ * lines) from the token_source of `ts`, so it must only be free'd after the
+ * AST.
+ */
+struct ast_program *parse_program(struct token_stream *ts);
 void free_ast(struct ast_program *prog);
 
 #endif
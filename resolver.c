@@ -0,0 +1,336 @@
+#include <assert.h>
+#include "util.h"
+#include "lib/array.h"
+#include "resolver.h"
+#include "symtable.h"
+#include "lexer.h"
+
+/* All our variables are ints. */
+#define VAR_SIZE 4
+#define VAR_ALIGN 4
+
+struct resolver {
+	struct resolution *res;
+	struct symtable symtable;
+	/* The toplevel item being resolved, and its res->nodes[] array. */
+	const struct ast_tree *tree;
+	uint32_t *nodes;
+	unsigned int scope;
+	/* The most bytes taken by the current function's variables so far. */
+	size_t frame_bytes;
+	ARRAY(const struct ast_node *) exp_stack; /* See resolve_expression(). */
+};
+
+#define NODE(r, ref) ast_node((r)->tree, ref)
+#define REF(r, node) ((ast_ref)((node) - (r)->tree->nodes))
+
+static inline const char *sym_name(const struct sym_data *sym)
+{
+	return atom_name(&sym->loc.src->atoms, sym->atom);
+}
+
+/*
+ * Returns the index of the symbol for `sym` at res->symbols[], plus one,
+ * adding it there the first time. Functions and global variables declared
+ * more than once keep the same entry at the symtable, and thus the same
+ * symbol.
+ */
+static uint32_t symbol_of(struct resolver *r, struct sym_data *sym)
+{
+	struct resolution *res = r->res;
+	struct symbol *symbol;
+
+	if (sym->symbol)
+		return sym->symbol;
+	if (res->symbols.nr >= UINT32_MAX)
+		die("resolver: too many symbols");
+	ALLOC_GROW(res->symbols.arr, res->symbols.nr + 1, res->symbols.alloc);
+	symbol = &res->symbols.arr[res->symbols.nr++];
+	switch (sym->type) {
+	case SYM_LOCAL_VAR:
+		symbol->type = SYMBOL_LOCAL_VAR;
+		symbol->u.stack_index = sym->u.stack_index;
+		break;
+	case SYM_GLOBAL_VAR:
+		symbol->type = SYMBOL_GLOBAL_VAR;
+		symbol->u.name = sym_name(sym);
+		break;
+	case SYM_FUNC:
+		symbol->type = SYMBOL_FUNC;
+		symbol->u.func = sym->u.func;
+		break;
+	default:
+		BUG("resolver: unknown symbol type %d", sym->type);
+	}
+	sym->symbol = res->symbols.nr;
+	return sym->symbol;
+}
+
+static void resolve_var(struct resolver *r, const struct ast_node *var)
+{
+	struct sym_data *sym = symtable_var_ref(&r->symtable, r->tree, var);
+	r->nodes[REF(r, var)] = symbol_of(r, sym);
+}
+
+static void push_exp(struct resolver *r, ast_ref ref)
+{
+	ALLOC_GROW(r->exp_stack.arr, r->exp_stack.nr + 1, r->exp_stack.alloc);
+	r->exp_stack.arr[r->exp_stack.nr++] = NODE(r, ref);
+}
+
+/*
+ * Like in the code generator, expressions are walked iteratively, as they
+ * may be nested very deeply. The subexpressions are visited in the same
+ * order they are generated, so that the first error found in an expression
+ * is the one that used to be reported.
+ */
+static void resolve_expression(struct resolver *r, ast_ref ref)
+{
+	size_t base = r->exp_stack.nr;
+
+	push_exp(r, ref);
+	while (r->exp_stack.nr > base) {
+		const struct ast_node *exp = r->exp_stack.arr[--r->exp_stack.nr];
+		struct sym_data *sym;
+
+		switch (exp->type) {
+		case AST_EXP_BINARY_OP:
+			if (exp->op == EXP_OP_ASSIGNMENT) {
+				const struct ast_node *lexp =
+					NODE(r, exp->u.bin_op.lexp);
+				assert(lexp->type == AST_EXP_VAR);
+				resolve_var(r, lexp);
+				push_exp(r, exp->u.bin_op.rexp);
+			} else if (exp->op == EXP_OP_COMMA ||
+				   exp->op == EXP_OP_LOGIC_AND ||
+				   exp->op == EXP_OP_LOGIC_OR) {
+				push_exp(r, exp->u.bin_op.rexp);
+				push_exp(r, exp->u.bin_op.lexp);
+			} else {
+				/* rexp is generated first. */
+				push_exp(r, exp->u.bin_op.lexp);
+				push_exp(r, exp->u.bin_op.rexp);
+			}
+			break;
+		case AST_EXP_TERNARY:
+			push_exp(r, exp->u.ternary.else_exp);
+			push_exp(r, exp->u.ternary.if_exp);
+			push_exp(r, exp->u.ternary.condition);
+			break;
+		case AST_EXP_UNARY_OP:
+			push_exp(r, exp->u.un_op.exp);
+			break;
+		case AST_EXP_CONSTANT_INT:
+			break;
+		case AST_EXP_VAR:
+			resolve_var(r, exp);
+			break;
+		case AST_EXP_FUNC_CALL:
+			sym = symtable_func_call(&r->symtable, r->tree, exp);
+			r->nodes[REF(r, exp)] = symbol_of(r, sym);
+			/* From the last argument to the first. */
+			for (size_t i = 0; i < exp->u.call.args.nr; i++)
+				push_exp(r, r->tree->extra[exp->u.call.args.start + i]);
+			break;
+		default:
+			die("resolver: unknown expression type %d", exp->type);
+		}
+	}
+}
+
+static void resolve_opt_expression(struct resolver *r, ast_ref opt_exp)
+{
+	if (opt_exp)
+		resolve_expression(r, opt_exp);
+}
+
+static void resolve_statement(struct resolver *r, const struct ast_node *st);
+
+static void resolve_new_scope(struct resolver *r, const struct ast_node *st,
+		void (*resolver)(struct resolver *r, const struct ast_node *st, void *data),
+		void *data)
+{
+	unsigned int saved_scope = r->scope++;
+
+	symtable_enter_scope(&r->symtable);
+	resolver(r, st, data);
+	symtable_leave_scope(&r->symtable);
+	r->scope = saved_scope;
+}
+
+static void block_statement_resolver(struct resolver *r,
+				     const struct ast_node *st, void *unused)
+{
+	assert(st->type == AST_ST_BLOCK);
+	for (size_t i = 0; i < st->u.block.nr; i++)
+		resolve_statement(r, ast_list_node(r->tree, st->u.block, i));
+}
+
+static void resolve_lvar(struct resolver *r, const struct ast_node *decl)
+{
+	struct sym_data *sym = symtable_put_lvar(&r->symtable, r->tree, decl,
+						 VAR_SIZE, VAR_ALIGN, r->scope);
+	r->nodes[REF(r, decl)] = symbol_of(r, sym);
+	if (r->symtable.frame_bytes > r->frame_bytes)
+		r->frame_bytes = r->symtable.frame_bytes;
+}
+
+static void resolve_var_decl_list(struct resolver *r, const struct ast_node *st)
+{
+	assert(st->type == AST_ST_VAR_DECL);
+	for (size_t i = 0; i < st->u.decl_list.nr; i++) {
+		const struct ast_node *decl =
+			ast_list_node(r->tree, st->u.decl_list, i);
+		/* Declared before its value, as in "int v = v = 2;". */
+		resolve_lvar(r, decl);
+		resolve_opt_expression(r, decl->u.var_decl.value);
+	}
+}
+
+static void for_decl_resolver(struct resolver *r, const struct ast_node *st,
+			      void *unused)
+{
+	assert(st->type == AST_ST_FOR_DECL);
+	resolve_var_decl_list(r, NODE(r, st->u._for.prologue));
+	resolve_expression(r, st->u._for.condition);
+	resolve_statement(r, NODE(r, st->u._for.body));
+	resolve_opt_expression(r, st->u._for.epilogue);
+}
+
+static void resolve_statement(struct resolver *r, const struct ast_node *st)
+{
+	switch(st->type) {
+	case AST_ST_RETURN:
+	case AST_ST_EXPRESSION:
+		resolve_opt_expression(r, st->u.opt_exp.exp);
+		break;
+	case AST_ST_VAR_DECL:
+		resolve_var_decl_list(r, st);
+		break;
+	case AST_ST_IF_ELSE:
+		resolve_expression(r, st->u.if_else.condition);
+		resolve_statement(r, NODE(r, st->u.if_else.if_st));
+		if (st->u.if_else.else_st)
+			resolve_statement(r, NODE(r, st->u.if_else.else_st));
+		break;
+	case AST_ST_BLOCK:
+		resolve_new_scope(r, st, block_statement_resolver, NULL);
+		break;
+	case AST_ST_WHILE:
+		resolve_expression(r, st->u._while.condition);
+		resolve_statement(r, NODE(r, st->u._while.body));
+		break;
+	case AST_ST_DO:
+		resolve_statement(r, NODE(r, st->u._do.body));
+		resolve_expression(r, st->u._do.condition);
+		break;
+	case AST_ST_FOR:
+		resolve_opt_expression(r, st->u._for.prologue);
+		resolve_expression(r, st->u._for.condition);
+		resolve_statement(r, NODE(r, st->u._for.body));
+		resolve_opt_expression(r, st->u._for.epilogue);
+		break;
+	case AST_ST_FOR_DECL:
+		resolve_new_scope(r, st, for_decl_resolver, NULL);
+		break;
+	case AST_ST_LABELED_STATEMENT:
+		resolve_statement(r, NODE(r, st->u.labeled_st.st));
+		break;
+	case AST_ST_BREAK:
+	case AST_ST_CONTINUE:
+	case AST_ST_GOTO:
+		break;
+	default:
+		die("resolver: unknown statement type %d", st->type);
+	}
+}
+
+/* The parameters are in the same scope as the body's outermost variables. */
+static void func_body_resolver(struct resolver *r, const struct ast_node *st,
+			       void *data)
+{
+	const struct ast_list *parameters = data;
+	for (size_t i = 0; i < parameters->nr; i++)
+		resolve_lvar(r, ast_list_node(r->tree, *parameters, i));
+	block_statement_resolver(r, st, NULL);
+}
+
+static void resolve_func_decl(struct resolver *r, const struct ast_node *fun)
+{
+	struct sym_data *sym = symtable_put_func(&r->symtable, r->tree, fun,
+						 r->scope);
+	symbol_of(r, sym);
+	if (fun->u.func.body) {
+		r->frame_bytes = 0;
+		resolve_new_scope(r, NODE(r, fun->u.func.body), func_body_resolver,
+				  (void *)&fun->u.func.parameters);
+		if (r->frame_bytes > UINT32_MAX)
+			die("resolver: too many local variables in '%s'\n%s",
+			    ast_name(r->tree, fun->u.func.atom),
+			    show_node_on_source_line(r->tree, fun));
+		r->nodes[REF(r, fun)] = r->frame_bytes;
+	}
+}
+
+static void resolve_global_var_decl_list(struct resolver *r,
+					 const struct ast_node *st)
+{
+	assert(st->type == AST_ST_VAR_DECL);
+	for (size_t i = 0; i < st->u.decl_list.nr; i++) {
+		const struct ast_node *decl =
+			ast_list_node(r->tree, st->u.decl_list, i);
+		struct sym_data *sym = symtable_put_gvar(&r->symtable, r->tree,
+							 decl);
+		r->nodes[REF(r, decl)] = symbol_of(r, sym);
+	}
+}
+
+static void add_uninitialized_gvar(struct sym_data *sym, void *data)
+{
+	struct resolution *res = data;
+	ALLOC_GROW(res->uninitialized_gvars.arr, res->uninitialized_gvars.nr + 1,
+		   res->uninitialized_gvars.alloc);
+	res->uninitialized_gvars.arr[res->uninitialized_gvars.nr++] = sym_name(sym);
+}
+
+void resolve_program(struct ast_program *prog, struct resolution *res)
+{
+	struct resolver r = { .res = res };
+
+	memset(res, 0, sizeof(*res));
+	symtable_init(&r.symtable);
+	res->nr_items = prog->items.nr;
+	CALLOC_ARRAY(res->nodes, res->nr_items);
+
+	for (size_t i = 0; i < prog->items.nr; i++) {
+		const struct ast_node *root;
+		r.tree = &prog->items.arr[i];
+		CALLOC_ARRAY(res->nodes[i], r.tree->nr_nodes);
+		r.nodes = res->nodes[i];
+		root = NODE(&r, r.tree->root);
+		switch (root->type) {
+		case AST_FUNC_DECL:
+			resolve_func_decl(&r, root);
+			break;
+		case AST_ST_VAR_DECL:
+			resolve_global_var_decl_list(&r, root);
+			break;
+		default:
+			BUG("resolver: unknown toplevel item '%d'", root->type);
+		}
+	}
+	foreach_uninitialized_gvar(&r.symtable, add_uninitialized_gvar, res);
+
+	symtable_destroy(&r.symtable);
+	free(r.exp_stack.arr);
+}
+
+void resolution_release(struct resolution *res)
+{
+	for (size_t i = 0; i < res->nr_items; i++)
+		free(res->nodes[i]);
+	free(res->nodes);
+	free(res->symbols.arr);
+	free(res->uninitialized_gvars.arr);
+	memset(res, 0, sizeof(*res));
+}
@@ -0,0 +1,64 @@
+#ifndef _RESOLVER_H
+#define _RESOLVER_H
+
+#include <stdint.h>
+#include "lib/array.h"
+#include "parser.h"
+
+/*
+ * The resolution pass binds every variable reference and function call of a
+ * program to the symbol it names, and gives each local variable its place on
+ * the stack frame. It runs once, on the whole program, before the code is
+ * generated, so the generator needs no symbol table: it only looks the
+ * results up, by node, at the arrays below.
+ */
+
+struct symbol {
+	enum {
+		SYMBOL_LOCAL_VAR,
+		SYMBOL_GLOBAL_VAR,
+		SYMBOL_FUNC,
+	} type;
+	union {
+		size_t stack_index; /* SYMBOL_LOCAL_VAR: at -stack_index(%rbp) */
+		const char *name; /* SYMBOL_GLOBAL_VAR */
+		const struct ast_node *func; /* SYMBOL_FUNC, an AST_FUNC_DECL */
+	} u;
+};
+
+struct resolution {
+	ARRAY(struct symbol) symbols;
+	/*
+	 * For each toplevel item, one value per node, indexed by ast_ref.
+	 * AST_EXP_VAR, AST_EXP_FUNC_CALL and AST_VAR_DECL nodes have the
+	 * index of their symbol at symbols[], plus one. AST_FUNC_DECL nodes
+	 * with a body have the size of the function's local variables: the
+	 * most bytes they take at once, as the variables of scopes that are
+	 * not open at the same time share the same space. Other nodes have 0.
+	 */
+	uint32_t **nodes;
+	size_t nr_items;
+	/* The names of the global variables never given a value. */
+	ARRAY(const char *) uninitialized_gvars;
+};
+
+/*
+ * Dies on the first error found, like undeclared or redefined symbols. The
+ * program must outlive `res`.
+ */
+void resolve_program(struct ast_program *prog, struct resolution *res);
+void resolution_release(struct resolution *res);
+
+static inline const struct symbol *
+resolved_symbol(const struct resolution *res, size_t item, ast_ref ref)
+{
+	return &res->symbols.arr[res->nodes[item][ref] - 1];
+}
+
+static inline size_t resolved_frame_bytes(const struct resolution *res,
+					  size_t item, ast_ref ref)
+{
+	return res->nodes[item][ref];
+}
+
+#endif
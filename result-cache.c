@@ -0,0 +1,336 @@
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "util.h"
+#include "result-cache.h"
+#include "lib/array.h"
+#include "lib/copy.h"
+#include "lib/sha1.h"
+#include "lib/tempfile.h"
+
+#define RESULT_CACHE_MAGIC "cc-result"
+
+struct result_cache {
+	const char *dir;
+	size_t max_size;
+	unsigned char compiler_sha1[SHA1_RAWSZ];
+	/* By this process. Added to the stats file at release. */
+	size_t hits, misses, stored_bytes;
+};
+
+struct cache_stats {
+	size_t hits, misses, size;
+};
+
+static const char *kind_suffix(enum result_kind kind)
+{
+	switch (kind) {
+	case RESULT_ASM: return "s";
+	case RESULT_OBJ: return "o";
+	}
+	BUG("unknown result kind %d", kind);
+}
+
+static int hash_file(const char *path, unsigned char sha1[SHA1_RAWSZ])
+{
+	struct sha1_ctx ctx;
+	char buf[64 * 1024];
+	ssize_t len;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return -1;
+	sha1_init(&ctx);
+	while ((len = read(fd, buf, sizeof(buf))) > 0)
+		sha1_update(&ctx, buf, len);
+	close(fd);
+	if (len < 0)
+		return -1;
+	sha1_final(&ctx, sha1);
+	return 0;
+}
+
+struct result_cache *result_cache_new(const char *dir, size_t max_size)
+{
+	struct result_cache *cache = xcalloc(1, sizeof(*cache));
+
+	if (hash_file("/proc/self/exe", cache->compiler_sha1)) {
+		warning("not using the result cache: failed to hash the compiler executable: %s",
+			strerror(errno));
+		free(cache);
+		return NULL;
+	}
+	if (mkdir(dir, 0777) && errno != EEXIST) {
+		warning("not using the result cache: failed to create '%s': %s",
+			dir, strerror(errno));
+		free(cache);
+		return NULL;
+	}
+	cache->dir = dir;
+	cache->max_size = max_size;
+	return cache;
+}
+
+static char *entry_path(struct result_cache *cache,
+			const struct source_file *sf, enum result_kind kind)
+{
+	struct sha1_ctx ctx;
+	unsigned char sha1[SHA1_RAWSZ];
+	char hex[SHA1_HEXSZ + 1];
+	const char *suffix = kind_suffix(kind);
+
+	sha1_init(&ctx);
+	sha1_update(&ctx, RESULT_CACHE_MAGIC, sizeof(RESULT_CACHE_MAGIC));
+	sha1_update(&ctx, cache->compiler_sha1, SHA1_RAWSZ);
+	sha1_update(&ctx, suffix, strlen(suffix) + 1);
+	sha1_update(&ctx, sf->buf, sf->len);
+	sha1_final(&ctx, sha1);
+	sha1_to_hex(sha1, hex);
+	return xmkstr("%s/%s.%s", cache->dir, hex, suffix);
+}
+
+int result_cache_open(struct result_cache *cache, const struct source_file *sf,
+		      enum result_kind kind)
+{
+	char *path = entry_path(cache, sf, kind);
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		if (errno != ENOENT)
+			warning("failed to open result cache entry '%s': %s",
+				path, strerror(errno));
+		cache->misses++;
+	} else {
+		cache->hits++;
+		/* Entries are evicted in least recently used order. */
+		futimens(fd, NULL);
+	}
+	free(path);
+	return fd;
+}
+
+void result_cache_put(struct result_cache *cache, const struct source_file *sf,
+		      enum result_kind kind, const char *path)
+{
+	char *entry = entry_path(cache, sf, kind);
+	char *tmp_template = xmkstr("%s/.tmp-result-XXXXXX", cache->dir);
+	struct tempfile *tmp = NULL;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		warning("failed to read '%s' for the result cache: %s", path,
+			strerror(errno));
+		goto out;
+	}
+	tmp = mktempfile(tmp_template);
+	if (!tmp) {
+		warning("failed to create temporary result cache entry '%s': %s",
+			tmp_template, strerror(errno));
+		goto out;
+	}
+	if (copy_fd(fd, get_tempfile_fd(tmp)) || close_tempfile_gently(tmp)) {
+		warning("failed to write result cache entry '%s': %s",
+			get_tempfile_path(tmp), strerror(errno));
+		delete_tempfile(&tmp);
+		goto out;
+	}
+	/*
+	 * Concurrent compilations of the same source may race here, but
+	 * they all write the same contents, so it doesn't matter who wins.
+	 */
+	if (rename_tempfile(&tmp, entry)) {
+		warning("failed to rename result cache entry to '%s': %s",
+			entry, strerror(errno));
+		goto out;
+	}
+	cache->stored_bytes += st.st_size;
+out:
+	if (fd >= 0)
+		close(fd);
+	free(tmp_template);
+	free(entry);
+}
+
+/*******************************************************************************
+ *			      Stats and eviction
+*******************************************************************************/
+
+struct cache_entry {
+	char *name;
+	size_t size;
+	struct timespec mtime;
+};
+
+NAMED_ARRAY(struct cache_entry, cache_entry_array);
+
+static int is_entry_name(const char *name)
+{
+	size_t i;
+	for (i = 0; i < SHA1_HEXSZ; i++)
+		if (!name[i] || !strchr("0123456789abcdef", name[i]))
+			return 0;
+	return !strcmp(name + i, ".s") || !strcmp(name + i, ".o");
+}
+
+/* Lists the entries at `dir`, returning their total size. */
+static size_t list_entries(const char *dir, struct cache_entry_array *entries)
+{
+	DIR *d = opendir(dir);
+	struct dirent *ent;
+	size_t total = 0;
+
+	if (!d) {
+		warning("failed to open '%s': %s", dir, strerror(errno));
+		return 0;
+	}
+	while ((ent = readdir(d))) {
+		struct stat st;
+		if (!is_entry_name(ent->d_name) ||
+		    fstatat(dirfd(d), ent->d_name, &st, 0))
+			continue;
+		ARRAY_APPEND(entries, ((struct cache_entry){
+			.name = xstrdup(ent->d_name),
+			.size = st.st_size,
+			.mtime = st.st_mtim,
+		}));
+		total += st.st_size;
+	}
+	closedir(d);
+	return total;
+}
+
+static void free_entries(struct cache_entry_array *entries)
+{
+	for (size_t i = 0; i < entries->nr; i++)
+		free(entries->arr[i].name);
+	free(entries->arr);
+}
+
+static int cmp_mtime(const void *va, const void *vb)
+{
+	const struct cache_entry *a = va, *b = vb;
+	if (a->mtime.tv_sec != b->mtime.tv_sec)
+		return a->mtime.tv_sec < b->mtime.tv_sec ? -1 : 1;
+	if (a->mtime.tv_nsec != b->mtime.tv_nsec)
+		return a->mtime.tv_nsec < b->mtime.tv_nsec ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Removes the least recently used entries until they take at most 90% of
+ * `max_size`, so that we don't have to evict again on the next store. Returns
+ * the size of the remaining entries.
+ */
+static size_t evict(const char *dir, size_t max_size)
+{
+	struct cache_entry_array entries = ARRAY_STATIC_INIT;
+	size_t total = list_entries(dir, &entries);
+
+	qsort(entries.arr, entries.nr, sizeof(*entries.arr), cmp_mtime);
+	for (size_t i = 0; i < entries.nr && total > max_size / 10 * 9; i++) {
+		char *path = xmkstr("%s/%s", dir, entries.arr[i].name);
+		if (unlink(path) && errno != ENOENT)
+			warning("failed to evict '%s': %s", path, strerror(errno));
+		else
+			total -= entries.arr[i].size;
+		free(path);
+	}
+	free_entries(&entries);
+	return total;
+}
+
+/*
+ * Opens and locks the stats file. Concurrent compilations are serialized
+ * here, but only once per process, and for a very short time.
+ */
+static int lock_stats(const char *dir, int operation)
+{
+	char *path = xmkstr("%s/stats", dir);
+	int fd = open(path, O_RDWR | O_CREAT, 0666);
+
+	if (fd < 0)
+		warning("failed to open '%s': %s", path, strerror(errno));
+	else if (flock(fd, operation)) {
+		warning("failed to lock '%s': %s", path, strerror(errno));
+		close(fd);
+		fd = -1;
+	}
+	free(path);
+	return fd;
+}
+
+static void read_stats(int fd, struct cache_stats *stats)
+{
+	char buf[256];
+	ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+
+	memset(stats, 0, sizeof(*stats));
+	if (len <= 0)
+		return;
+	buf[len] = '\0';
+	if (sscanf(buf, "hits %zu\nmisses %zu\nsize %zu\n", &stats->hits,
+		   &stats->misses, &stats->size) != 3) {
+		warning("ignoring invalid result cache stats");
+		memset(stats, 0, sizeof(*stats));
+	}
+}
+
+static void write_stats(int fd, const struct cache_stats *stats)
+{
+	char buf[256];
+	int len = xsnprintf(buf, sizeof(buf), "hits %zu\nmisses %zu\nsize %zu\n",
+			    stats->hits, stats->misses, stats->size);
+	if (ftruncate(fd, 0) || pwrite(fd, buf, len, 0) != len)
+		warning("failed to write result cache stats: %s",
+			strerror(errno));
+}
+
+void result_cache_release(struct result_cache *cache)
+{
+	struct cache_stats stats;
+	int fd;
+
+	if (!cache->hits && !cache->misses && !cache->stored_bytes)
+		goto out;
+
+	fd = lock_stats(cache->dir, LOCK_EX);
+	if (fd < 0)
+		goto out;
+	read_stats(fd, &stats);
+	stats.hits += cache->hits;
+	stats.misses += cache->misses;
+	stats.size += cache->stored_bytes;
+	/*
+	 * The size may be off, e.g. if concurrent compilations stored the
+	 * same entry. But evicting lists the actual entries, which fixes it.
+	 */
+	if (stats.size > cache->max_size)
+		stats.size = evict(cache->dir, cache->max_size);
+	write_stats(fd, &stats);
+	close(fd);
+out:
+	free(cache);
+}
+
+void result_cache_print_stats(const char *dir, FILE *out)
+{
+	struct cache_entry_array entries = ARRAY_STATIC_INIT;
+	struct cache_stats stats = { 0 };
+	size_t size = 0;
+	int fd = lock_stats(dir, LOCK_SH);
+
+	if (fd >= 0) {
+		read_stats(fd, &stats);
+		size = list_entries(dir, &entries);
+		close(fd);
+	}
+	fprintf(out, "hits: %zu\n", stats.hits);
+	fprintf(out, "misses: %zu\n", stats.misses);
+	fprintf(out, "entries: %zu\n", entries.nr);
+	fprintf(out, "size: %zu bytes\n", size);
+	free_entries(&entries);
+}
@@ -0,0 +1,63 @@
+#ifndef _RESULT_CACHE_H
+#define _RESULT_CACHE_H
+
+#include <stdio.h>
+#include "lib/source-file.h"
+
+/*
+ * A cache of compilation results, so that compiling an unchanged source again
+ * can just copy the previous output, without lexing, parsing, generating code
+ * or (for objects) calling the assembler.
+ *
+ * Each entry is a file in the cache directory, named after the SHA-1 of the
+ * source contents, the kind of output, and the compiler itself (the contents
+ * of its executable, as anything in it may change the output). The output
+ * name is not part of the key, as it doesn't affect the output contents.
+ *
+ * Entries are written to a temporary file and then renamed into place, so
+ * concurrent compilations never see a partial entry. The hit and miss counts
+ * and the total size of the entries are kept at the "stats" file in the cache
+ * directory. When the size goes over the limit, the least recently used
+ * entries are evicted.
+ */
+
+enum result_kind {
+	RESULT_ASM, /* .s */
+	RESULT_OBJ, /* .o */
+};
+
+#define RESULT_CACHE_DEFAULT_MAX_SIZE (256 * 1024 * 1024)
+
+struct result_cache;
+
+/*
+ * Returns NULL if the cache can't be used (after warning about why), in which
+ * case compilations should just go on without it.
+ */
+struct result_cache *result_cache_new(const char *dir, size_t max_size);
+
+/*
+ * Returns a file descriptor to read the cached `kind` output for `sf` from, or
+ * -1 on a miss. The caller must close it.
+ */
+int result_cache_open(struct result_cache *cache, const struct source_file *sf,
+		      enum result_kind kind);
+
+/*
+ * Stores the file at `path` as the `kind` output for `sf`. Failures are only
+ * warned about, as the cache is just an optimization.
+ */
+void result_cache_put(struct result_cache *cache, const struct source_file *sf,
+		      enum result_kind kind, const char *path);
+
+/*
+ * Adds this process's hits, misses and stored entries to the stats, evicting
+ * entries if needed, and frees `cache`. (So compilations that die are not
+ * counted.)
+ */
+void result_cache_release(struct result_cache *cache);
+
+/* Prints the stats of the cache at `dir`. */
+void result_cache_print_stats(const char *dir, FILE *out);
+
+#endif
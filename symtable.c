@@ -1,212 +1,244 @@
 #include "util.h"
-#include "lib/strmap.h"
 #include "lib/array.h"
 #include "symtable.h"
 #include "parser.h"
 #include "lexer.h"
 
-static void sym_data_cpy(struct sym_data *dst, struct sym_data *src)
+static inline const char *sym_name(const struct sym_data *sym)
 {
-	/* We can do a shallow copy for now. */
-	*dst = *src;
+	return atom_name(&sym->loc.src->atoms, sym->atom);
 }
 
 void symtable_init(struct symtable *tab)
 {
 	memset(tab, 0, sizeof(*tab));
-	strmap_init(&tab->syms, strmap_val_plain_copy);
+}
+
+void symtable_destroy(struct symtable *tab)
+{
+	FREE_AND_NULL(tab->index);
+	FREE_AND_NULL(tab->data);
+	FREE_AND_NULL(tab->undo);
+	FREE_AND_NULL(tab->scopes);
+	tab->index_alloc = 0;
 	tab->nr = tab->alloc = 0;
-	tab->data = NULL;
+	tab->undo_nr = tab->undo_alloc = 0;
+	tab->scopes_nr = tab->scopes_alloc = 0;
+	tab->frame_bytes = 0;
 }
 
-void symtable_cpy(struct symtable *dst, struct symtable *src)
+void symtable_enter_scope(struct symtable *tab)
 {
-	memset(dst, 0, sizeof(*dst));
-	strmap_cpy(&dst->syms, &src->syms);
-	dst->nr = src->nr;
-	dst->alloc = 0;
-	ALLOC_GROW(dst->data, dst->nr, dst->alloc);
-	for (size_t i = 0; i < dst->nr; i++)
-		sym_data_cpy(&dst->data[i], &src->data[i]);
+	ALLOC_GROW(tab->scopes, tab->scopes_nr + 1, tab->scopes_alloc);
+	tab->scopes[tab->scopes_nr].data_nr = tab->nr;
+	tab->scopes[tab->scopes_nr].undo_nr = tab->undo_nr;
+	tab->scopes[tab->scopes_nr].frame_bytes = tab->frame_bytes;
+	tab->scopes_nr++;
 }
 
-void symtable_destroy(struct symtable *tab)
+void symtable_leave_scope(struct symtable *tab)
 {
-	strmap_destroy(&tab->syms);
-	FREE_AND_NULL(tab->data);
+	struct sym_scope *scope;
+	if (!tab->scopes_nr)
+		BUG("symtable: leaving scope, but none is open");
+	scope = &tab->scopes[--tab->scopes_nr];
+	while (tab->undo_nr > scope->undo_nr) {
+		struct sym_undo *undo = &tab->undo[--tab->undo_nr];
+		tab->index[undo->atom] = undo->index;
+	}
+	tab->nr = scope->data_nr;
+	tab->frame_bytes = scope->frame_bytes;
 }
 
-struct sym_data *symtable_find(struct symtable *tab, const char *symname)
+struct sym_data *symtable_find(struct symtable *tab, atom_t sym)
 {
-	void *ret;
-	if (strmap_find(&tab->syms, symname, &ret))
-		return &tab->data[(size_t)ret];
+	if (sym < tab->index_alloc && tab->index[sym])
+		return &tab->data[tab->index[sym] - 1];
 	return NULL;
 }
 
-int symtable_has(struct symtable *tab, const char *symname)
+int symtable_has(struct symtable *tab, atom_t sym)
+{
+	return !!symtable_find(tab, sym);
+}
+
+static struct sym_data *symtable_add(struct symtable *tab, atom_t sym)
 {
-	return strmap_has(&tab->syms, symname);
+	if (sym >= tab->index_alloc) {
+		size_t old_alloc = tab->index_alloc;
+		ALLOC_GROW(tab->index, sym + 1, tab->index_alloc);
+		memset(tab->index + old_alloc, 0,
+		       st_mult(sizeof(*tab->index), tab->index_alloc - old_alloc));
+	}
+	if (tab->scopes_nr) {
+		ALLOC_GROW(tab->undo, tab->undo_nr + 1, tab->undo_alloc);
+		tab->undo[tab->undo_nr].atom = sym;
+		tab->undo[tab->undo_nr].index = tab->index[sym];
+		tab->undo_nr++;
+	}
+	ALLOC_GROW(tab->data, tab->nr + 1, tab->alloc);
+	memset(&tab->data[tab->nr], 0, sizeof(*tab->data));
+	tab->index[sym] = ++tab->nr;
+	return &tab->data[tab->nr - 1];
 }
 
-void symtable_put_lvar(struct symtable *tab, struct ast_var_decl *decl,
-		       size_t stack_index, unsigned int scope)
+struct sym_data *symtable_put_lvar(struct symtable *tab,
+				   const struct ast_tree *tree,
+				   const struct ast_node *decl,
+				   size_t size, size_t align,
+				   unsigned int scope)
 {
-	struct sym_data *sym = symtable_find(tab, decl->name);
+	struct sym_data *sym = symtable_find(tab, decl->u.var_decl.atom);
+	size_t stack_index;
 	if (sym && sym->scope == scope) {
 		die("redefinition of symbol '%s'. First:\n%s\nThen:\n%s",
-		    decl->name, show_token_on_source_line(sym->tok),
-		    show_token_on_source_line(decl->tok));
-	} else if (!sym) {
-		ALLOC_GROW(tab->data, tab->nr + 1, tab->alloc);
-		sym = &tab->data[tab->nr];
-		strmap_put(&tab->syms, decl->name, (void *)tab->nr);
-		tab->nr++;
+		    sym_name(sym), show_loc_on_source_line(&sym->loc),
+		    show_node_on_source_line(tree, decl));
 	}
+	if (!tab->scopes_nr)
+		BUG("symtable: local variable outside of any scope");
+	stack_index = (tab->frame_bytes + size + align - 1) & ~(align - 1);
+	tab->frame_bytes = stack_index;
+
+	sym = symtable_add(tab, decl->u.var_decl.atom);
 	sym->type = SYM_LOCAL_VAR;
 	sym->u.stack_index = stack_index;
-	sym->tok = decl->tok;
+	sym->atom = decl->u.var_decl.atom;
+	sym->loc = ast_loc(tree, decl);
 	sym->scope = scope;
+	return sym;
 }
 
-char *symtable_var_ref(struct symtable *tab, struct var_ref *v)
+struct sym_data *symtable_var_ref(struct symtable *tab,
+				  const struct ast_tree *tree,
+				  const struct ast_node *var)
 {
-	struct sym_data *sdata = symtable_find(tab, v->name);
+	struct sym_data *sdata = symtable_find(tab, var->u.var.atom);
 	if (!sdata)
-		die("Undeclared variable '%s'\n%s", v->name,
-		    show_token_on_source_line(v->tok));
-	switch (sdata->type) {
-	case SYM_LOCAL_VAR:
-		return xmkstr("-%zu(%%rbp)", sdata->u.stack_index);
-	case SYM_GLOBAL_VAR:
-		return xmkstr("_var_%s(%%rip)", v->name);
-	default:
-		die("'%s' is not a variable\n%s", v->name,
-		    show_token_on_source_line(v->tok));
-	}
+		die("Undeclared variable '%s'\n%s",
+		    ast_name(tree, var->u.var.atom),
+		    show_node_on_source_line(tree, var));
+	if (sdata->type != SYM_LOCAL_VAR && sdata->type != SYM_GLOBAL_VAR)
+		die("'%s' is not a variable\n%s", sym_name(sdata),
+		    show_node_on_source_line(tree, var));
+	return sdata;
 }
 
-size_t symtable_bytes_in_scope(struct symtable *tab, unsigned int scope)
+struct sym_data *symtable_put_func(struct symtable *tab,
+				   const struct ast_tree *tree,
+				   const struct ast_node *decl,
+				   unsigned int scope)
 {
-	size_t ret = 0;
-	for (size_t i = 0; i < tab->nr; i++)
-		if (tab->data[i].scope == scope)
-			ret += 4; /* for now, all variables on the stack have size 4. */
-	return ret;
-}
-
-void symtable_put_func(struct symtable *tab, struct ast_func_decl *decl,
-		       unsigned int scope)
-{
-	struct sym_data *sym = symtable_find(tab, decl->name);
+	const char *name = ast_name(tree, decl->u.func.atom);
+	struct sym_data *sym = symtable_find(tab, decl->u.func.atom);
 	if (sym && sym->type == SYM_FUNC) {
+		const struct ast_node *prev = sym->u.func;
 		/* All functions should be declared on scope 0. */
 		assert(!sym->scope && !scope);
-		if (sym->u.func->body && decl->body) {
+		if (prev->u.func.body && decl->u.func.body) {
 			die("redefinition of function '%s'.\nFirst:\n%s\nThen:\n%s",
-			    decl->name, show_token_on_source_line(sym->tok),
-			    show_token_on_source_line(decl->tok));
+			    name, show_loc_on_source_line(&sym->loc),
+			    show_node_on_source_line(tree, decl));
 		}
-		if ((sym->u.func->return_type != decl->return_type) ||
-		    (!sym->u.func->empty_parameter_declaration &&
+		if ((prev->op != decl->op) ||
+		    (!prev->empty_parameter_declaration &&
 		     !decl->empty_parameter_declaration &&
-		     (sym->u.func->parameters.nr != decl->parameters.nr))) {
+		     (prev->u.func.parameters.nr != decl->u.func.parameters.nr))) {
 			/*
 			 * NOTE: we can only do this direct comparison because
 			 * all our parameters are int, and thus, same-sized.
 			 */
 			die("redeclaration of function '%s' with different signature.\nFirst:\n%s\nThen:\n%s",
-			    decl->name, show_token_on_source_line(sym->tok),
-			    show_token_on_source_line(decl->tok));
+			    name, show_loc_on_source_line(&sym->loc),
+			    show_node_on_source_line(tree, decl));
 		}
 		/*
 		 * If we have a function with body already, keep that.
 		 * But if the definition has an empty parameter declaration,
 		 * the prototype must have too.
 		 */
-		if (sym->u.func->body) {
-			if (sym->u.func->empty_parameter_declaration &&
+		if (prev->u.func.body) {
+			if (prev->empty_parameter_declaration &&
 			    !decl->empty_parameter_declaration) {
 				die("redeclaration of function '%s' with different signature.\nFirst:\n%s\nThen:\n%s",
-				    decl->name, show_token_on_source_line(sym->tok),
-				    show_token_on_source_line(decl->tok));
+				    name, show_loc_on_source_line(&sym->loc),
+				    show_node_on_source_line(tree, decl));
 			}
-			return;
+			return sym;
 		}
 	} else if (sym && sym->scope == scope) {
 		die("redefinition of symbol '%s'.\nFirst:\n%s\nThen:\n%s",
-		    decl->name, show_token_on_source_line(sym->tok),
-		    show_token_on_source_line(decl->tok));
+		    name, show_loc_on_source_line(&sym->loc),
+		    show_node_on_source_line(tree, decl));
 	} else if (!sym) {
-		ALLOC_GROW(tab->data, tab->nr + 1, tab->alloc);
-		sym = &tab->data[tab->nr];
-		strmap_put(&tab->syms, decl->name, (void *)tab->nr);
-		tab->nr++;
+		sym = symtable_add(tab, decl->u.func.atom);
 	}
 	sym->type = SYM_FUNC;
 	sym->u.func = decl;
-	sym->tok = decl->tok;
+	sym->atom = decl->u.func.atom;
+	sym->loc = ast_loc(tree, decl);
 	sym->scope = scope;
+	return sym;
 }
 
-struct ast_func_decl *symtable_func_call(struct symtable *tab,
-					 struct func_call *call)
+struct sym_data *symtable_func_call(struct symtable *tab,
+				    const struct ast_tree *tree,
+				    const struct ast_node *call)
 {
-	struct sym_data *sdata = symtable_find(tab, call->name);
+	const char *name = ast_name(tree, call->u.call.atom);
+	struct sym_data *sdata = symtable_find(tab, call->u.call.atom);
 	if (!sdata)
-		die("call to undeclared function '%s'\n%s", call->name,
-		    show_token_on_source_line(call->tok));
+		die("call to undeclared function '%s'\n%s", name,
+		    show_node_on_source_line(tree, call));
 	if (sdata->type != SYM_FUNC)
 		die("cannot call '%s': it is not a function\n%s\nDefined here:\n%s",
-		    call->name, show_token_on_source_line(call->tok),
-		    show_token_on_source_line(sdata->tok));
+		    name, show_node_on_source_line(tree, call),
+		    show_loc_on_source_line(&sdata->loc));
 	if (!sdata->u.func->empty_parameter_declaration &&
-	    (sdata->u.func->parameters.nr != call->args.nr))
+	    (sdata->u.func->u.func.parameters.nr != call->u.call.args.nr))
 		die("parameter mismatch on call to '%s'\n%s\nDefined here:\n%s",
-		    call->name, show_token_on_source_line(call->tok),
-		    show_token_on_source_line(sdata->tok));
-	return sdata->u.func;
+		    name, show_node_on_source_line(tree, call),
+		    show_loc_on_source_line(&sdata->loc));
+	return sdata;
 }
 
-char *symtable_put_gvar(struct symtable *tab, struct ast_var_decl *decl)
+struct sym_data *symtable_put_gvar(struct symtable *tab,
+				   const struct ast_tree *tree,
+				   const struct ast_node *decl)
 {
-	struct sym_data *sym = symtable_find(tab, decl->name);
+	const char *name = ast_name(tree, decl->u.var_decl.atom);
+	struct sym_data *sym = symtable_find(tab, decl->u.var_decl.atom);
 	if (sym) {
 		if (sym->scope)
 			BUG("symtable: found symbol with non-zero scope"
 			    " while adding global var");
 
-		if (sym->type != SYM_GLOBAL_VAR || (decl->value && sym->u.gvar->value))
+		if (sym->type != SYM_GLOBAL_VAR ||
+		    (decl->u.var_decl.value && sym->u.gvar->u.var_decl.value))
 			die("redefinition of symbol '%s'. First:\n%s\nThen:\n%s",
-			    decl->name, show_token_on_source_line(sym->tok),
-			    show_token_on_source_line(decl->tok));
+			    name, show_loc_on_source_line(&sym->loc),
+			    show_node_on_source_line(tree, decl));
 
-		if (sym->u.gvar->value || !decl->value)
-			goto out;
+		if (sym->u.gvar->u.var_decl.value || !decl->u.var_decl.value)
+			return sym;
 	} else {
-		ALLOC_GROW(tab->data, tab->nr + 1, tab->alloc);
-		sym = &tab->data[tab->nr];
-		strmap_put(&tab->syms, decl->name, (void *)tab->nr);
-		tab->nr++;
+		sym = symtable_add(tab, decl->u.var_decl.atom);
 	}
 	sym->type = SYM_GLOBAL_VAR;
 	sym->u.gvar = decl;
-	sym->tok = decl->tok;
+	sym->atom = decl->u.var_decl.atom;
+	sym->loc = ast_loc(tree, decl);
 	sym->scope = 0;
-out:
-	return xmkstr("_var_%s", decl->name);
+	return sym;
 }
 
 void foreach_uninitialized_gvar(struct symtable *tab,
-				void (*fn)(char *, void *), void *data) {
+				void (*fn)(struct sym_data *, void *),
+				void *data) {
 	for (size_t i = 0; i < tab->nr; i++) {
 		if (tab->data[i].type != SYM_GLOBAL_VAR)
 			continue;
-		struct ast_var_decl *var = tab->data[i].u.gvar;
-		if (!var->value) {
-			char *var_label = xmkstr("_var_%s", var->name);
-			fn(var_label, data);
-			free(var_label);
-		}
+		if (!tab->data[i].u.gvar->u.var_decl.value)
+			fn(&tab->data[i], data);
 	}
 }
@@ -1,58 +1,116 @@
 #ifndef _SYMTABLE_H
 #define _SYMTABLE_H
 
-#include "lib/strmap.h"
+#include "lib/atom.h"
 #include "parser.h"
 
-struct token;
-
 struct sym_data {
 	enum {
 		SYM_LOCAL_VAR,
 		SYM_GLOBAL_VAR,
 		SYM_FUNC,
 	} type;
+	atom_t atom; /* Its name is at loc.src->atoms. */
 	union {
-		size_t stack_index; /* SYM_LOCAL_VAR */
-		struct ast_var_decl *gvar; /* SYM_GLOBAL_VAR */
-		struct ast_func_decl *func; /* SYM_FUNC */
+		size_t stack_index; /* SYM_LOCAL_VAR, at -stack_index(%rbp) */
+		const struct ast_node *gvar; /* SYM_GLOBAL_VAR, an AST_VAR_DECL */
+		const struct ast_node *func; /* SYM_FUNC, an AST_FUNC_DECL */
 	} u;
-	struct token *tok;
+	struct token_loc loc;
 	unsigned int scope;
+	/* For the user's own bookkeeping. Starts as 0. See resolver.c. */
+	uint32_t symbol;
 };
 
+/*
+ * The symbols of all open scopes are in a single table, where inner ones
+ * shadow outer ones. Each scope's symbols are at the end of data[], after the
+ * outer scopes' ones, and the index entries they replaced are saved at
+ * undo[], so that leaving a scope only has to restore those and drop its
+ * symbols. Both entering and leaving a scope are thus independent of how many
+ * symbols the outer scopes have.
+ */
 struct symtable {
-	/* This maps 'char *'s to size_t's, which are indexes at data[]. */
-	struct strmap syms;
+	/*
+	 * Maps atoms to indexes at data[], plus one. Atoms beyond
+	 * index_alloc and entries with 0 are not in the table.
+	 */
+	size_t *index;
+	size_t index_alloc;
 	struct sym_data *data;
 	size_t nr, alloc;
+
+	struct sym_undo {
+		atom_t atom;
+		size_t index; /* The previous index[atom]. */
+	} *undo;
+	size_t undo_nr, undo_alloc;
+
+	/*
+	 * Where each open scope starts at data[] and undo[], and at the
+	 * stack frame.
+	 */
+	struct sym_scope {
+		size_t data_nr, undo_nr, frame_bytes;
+	} *scopes;
+	size_t scopes_nr, scopes_alloc;
+
+	/*
+	 * The bytes of the stack frame taken by the local variables of the
+	 * open scopes, including alignment padding. Each new variable goes
+	 * right below them, and a scope's space is reused by the next one
+	 * once it is left.
+	 */
+	size_t frame_bytes;
 };
 
 void symtable_init(struct symtable *tab);
-void symtable_cpy(struct symtable *dst, struct symtable *src);
 void symtable_destroy(struct symtable *tab);
-struct sym_data *symtable_find(struct symtable *tab, const char *symname);
-int symtable_has(struct symtable *tab, const char *symname);
 
-void symtable_put_lvar(struct symtable *tab, struct ast_var_decl *decl,
-		       size_t stack_index, unsigned int scope);
-char *symtable_var_ref(struct symtable *tab, struct var_ref *v);
-
-void symtable_put_func(struct symtable *tab, struct ast_func_decl *decl,
-		       unsigned int scope);
-struct ast_func_decl *symtable_func_call(struct symtable *tab,
-					 struct func_call *call);
+/*
+ * Local variables are put in the innermost open scope, and dropped when it is
+ * left. Scopes must be left in the reverse order they were entered.
+ */
+void symtable_enter_scope(struct symtable *tab);
+void symtable_leave_scope(struct symtable *tab);
 
-char *symtable_put_gvar(struct symtable *tab, struct ast_var_decl *decl);
+struct sym_data *symtable_find(struct symtable *tab, atom_t sym);
+int symtable_has(struct symtable *tab, atom_t sym);
 
-/* 
- * How many bytes were allocated at a given scope. Note that due to variable
- * shadowing, the return value is only guaranteed to be accurated when `scope`
- * is the current scope (i.e. scope >= max{tab.data[*].scope}).
+/*
+ * The nodes given to the functions below must be from `tree`, which is used
+ * to get their names and locations. They die on redefinitions and on
+ * references to undeclared (or the wrong kind of) symbols. The put functions
+ * return the symbol's entry, which may be an earlier one for functions and
+ * global variables declared more than once.
+ */
+/*
+ * Local variables get `size` bytes of the stack frame, at a stack_index
+ * multiple of `align`, which must be a power of 2.
  */
-size_t symtable_bytes_in_scope(struct symtable *tab, unsigned int scope);
+struct sym_data *symtable_put_lvar(struct symtable *tab,
+				   const struct ast_tree *tree,
+				   const struct ast_node *decl,
+				   size_t size, size_t align,
+				   unsigned int scope);
+struct sym_data *symtable_var_ref(struct symtable *tab,
+				  const struct ast_tree *tree,
+				  const struct ast_node *var);
+
+struct sym_data *symtable_put_func(struct symtable *tab,
+				   const struct ast_tree *tree,
+				   const struct ast_node *decl,
+				   unsigned int scope);
+struct sym_data *symtable_func_call(struct symtable *tab,
+				    const struct ast_tree *tree,
+				    const struct ast_node *call);
+
+struct sym_data *symtable_put_gvar(struct symtable *tab,
+				   const struct ast_tree *tree,
+				   const struct ast_node *decl);
 
 void foreach_uninitialized_gvar(struct symtable *tab,
-				void (*fn)(char *, void *), void *data);
+				void (*fn)(struct sym_data *, void *),
+				void *data);
 
 #endif
@@ -11,4 +11,7 @@
 /* CAREFUL: evaluates a and b twice! */
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
+/* The smallest multiple of n not less than x. CAREFUL: evaluates n twice! */
+#define ROUND_UP(x, n) (((x) + (n) - 1) / (n) * (n))
+
 #endif
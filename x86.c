@@ -1,11 +1,11 @@
 #include <stdio.h>
 #include <assert.h>
+#include <pthread.h>
 #include "parser.h"
 #include "util.h"
-#include "symtable.h"
+#include "resolver.h"
 #include "lexer.h"
 #include "lib/stack.h"
-#include "lib/strmap.h"
 #include "labelset.h"
 
 /* 
@@ -15,28 +15,47 @@
 const char *func_call_regs[] = { "rdi", "rsi", "rdx", "rcx", "r8", "r9" };
 #define NR_CALL_REGS (sizeof(func_call_regs) / sizeof(*func_call_regs))
 
+/* %rsp must be a multiple of this at every call instruction. */
+#define STACK_ALIGNMENT 16
+
 struct x86_ctx {
 	FILE *out;
-	struct symtable *symtable;
+	const struct resolution *res;
 	/*
 	 * Local variables are stored in the stack with a position relative to
-	 * %rbp. The stack_index helps to keep track of local variables
-	 * allocations (for this reason, it is *only* valid inside function
-	 * generation). This variable stores the offset of %rsp relative to
-	 * %rsp. So, at any given moment, "-{stack_index}(%rbp)" will be the
-	 * same as "(%rsp)" (if I don't forget to update the variable when
-	 * altering the stack). To allocate a new local variable, the code
-	 * must increment stack_index with the variable's size and them push
-	 * the variable onto the stack (the order is not really important).
+	 * %rbp, given by the resolver, and all of a function's ones are
+	 * allocated at once, by its prologue. Below them go the values pushed
+	 * while evaluating expressions. The stack_index keeps track of all
+	 * that (for this reason, it is *only* valid inside function
+	 * generation): it stores the offset of %rsp relative to %rbp. So, at
+	 * any given moment, "-{stack_index}(%rbp)" will be the same as
+	 * "(%rsp)" (if I don't forget to update the variable when altering
+	 * the stack). It is used to keep the stack aligned at calls.
 	 */
 	size_t stack_index;
-	unsigned long scope;
 	struct stack continue_labels,
 		     break_labels;
 
-	struct ast_func_decl *cur_func;
+	/* The toplevel item being generated, and its function, if any. */
+	size_t item;
+	const struct ast_tree *tree;
+	const struct ast_node *cur_func;
+	const char *func_name;
 
 	struct labelset user_labels;
+	ARRAY(struct exp_frame) exp_frames; /* See generate_expression(). */
+
+	/*
+	 * Numbers for the next label of each kind in the current function, to
+	 * make them unique. They are kept here, instead of in static
+	 * variables, so that programs can be generated concurrently. See
+	 * func_label() for why they restart at each function.
+	 */
+	struct {
+		unsigned long or_skip_2nd_clause, and_skip_2nd_clause,
+			      ternary_else, ternary_end, if_else_else,
+			      if_else_end, _while, _do, _for, for_decl;
+	} label_nr;
 };
 
 #define emit(ctx, ...) \
@@ -45,122 +64,190 @@ struct x86_ctx {
 			die_errno("fprintf error"); \
 	} while (0)
 
-static void generate_expression(struct ast_expression *exp, struct x86_ctx *ctx,
-				int require_value);
-static void generate_statement(struct ast_statement *st, struct x86_ctx *ctx);
-
-static char *label_or_skip_2nd_clause(void)
+/* The node `ref` of the current tree. */
+#define NODE(ctx, ref) ast_node((ctx)->tree, ref)
+/* What the resolver found for `node`, of the current tree. See resolver.h. */
+#define SYMBOL(ctx, node) \
+	resolved_symbol((ctx)->res, (ctx)->item, (node) - (ctx)->tree->nodes)
+#define FRAME_BYTES(ctx, fun) \
+	resolved_frame_bytes((ctx)->res, (ctx)->item, (fun) - (ctx)->tree->nodes)
+
+/* Emits the operand of the variable `var` between `before` and `after`. */
+static void emit_var(struct x86_ctx *ctx, const char *before,
+		     const struct ast_node *var, const char *after)
 {
-	static unsigned long counter = 0;
-	return xmkstr("_or_skip_2nd_clause_%lu", counter++);
+	const struct symbol *sym = SYMBOL(ctx, var);
+	if (sym->type == SYMBOL_LOCAL_VAR)
+		emit(ctx, "%s-%zu(%%rbp)%s", before, sym->u.stack_index, after);
+	else
+		emit(ctx, "%s_var_%s(%%rip)%s", before, sym->u.name, after);
 }
 
-static void generate_logic_or(struct ast_expression *exp, struct x86_ctx *ctx)
-{
-	assert(exp->type == AST_EXP_BINARY_OP &&
-	       exp->u.bin_op.type == EXP_OP_LOGIC_OR);
+static void generate_statement(const struct ast_node *st, struct x86_ctx *ctx);
 
-	char *label_skip_2nd_clause = label_or_skip_2nd_clause();
+/*
+ * Labels are prefixed with the name of their function, which can't have dots,
+ * so that each function's labels are unique by themselves. This way, the
+ * functions can be generated separately, even in parallel (see
+ * generate_prog_parallel()), and still give the same output.
+ */
+#define func_label(ctx, fmt, ...) \
+	xmkstr("%s." fmt, (ctx)->func_name, __VA_ARGS__)
 
-	generate_expression(exp->u.bin_op.lexp, ctx, 1);
-	emit(ctx, " cmp	$0, %%eax\n");
-	emit(ctx, " jne	%s\n", label_skip_2nd_clause);
-	generate_expression(exp->u.bin_op.rexp, ctx, 1);
-	emit(ctx, " cmp	$0, %%eax\n");
-	emit(ctx, "%s:\n", label_skip_2nd_clause);
-	emit(ctx, " mov	$0, %%eax\n");
-	emit(ctx, " setne	%%al\n");
-	free(label_skip_2nd_clause);
+static char *label_or_skip_2nd_clause(struct x86_ctx *ctx)
+{
+	return func_label(ctx, "_or_skip_2nd_clause_%lu",
+			  ctx->label_nr.or_skip_2nd_clause++);
 }
 
-static char *label_and_skip_2nd_clause(void)
+static char *label_and_skip_2nd_clause(struct x86_ctx *ctx)
 {
-	static unsigned long counter = 0;
-	return xmkstr("_and_skip_2nd_clause_%lu", counter++);
+	return func_label(ctx, "_and_skip_2nd_clause_%lu",
+			  ctx->label_nr.and_skip_2nd_clause++);
 }
 
-static void generate_logic_and(struct ast_expression *exp, struct x86_ctx *ctx)
+static char *label_ternary_else(struct x86_ctx *ctx)
 {
-	assert(exp->type == AST_EXP_BINARY_OP &&
-	       exp->u.bin_op.type == EXP_OP_LOGIC_AND);
-
-	char *label_skip_2nd_clause = label_and_skip_2nd_clause();
-
-	generate_expression(exp->u.bin_op.lexp, ctx, 1);
-	emit(ctx, " cmp	$0, %%eax\n");
-	emit(ctx, " je	%s\n", label_skip_2nd_clause);
-	generate_expression(exp->u.bin_op.rexp, ctx, 1);
-	emit(ctx, " cmp	$0, %%eax\n");
-	emit(ctx, "%s:\n", label_skip_2nd_clause);
-	emit(ctx, " mov	$0, %%eax\n");
-	emit(ctx, " setne	%%al\n");
-	free(label_skip_2nd_clause);
+	return func_label(ctx, "_ternary_else_%lu",
+			  ctx->label_nr.ternary_else++);
 }
 
-static char *label_ternary_else(void)
+static char *label_ternary_end(struct x86_ctx *ctx)
 {
-	static unsigned long counter = 0;
-	return xmkstr("_ternary_else_%lu", counter++);
+	return func_label(ctx, "_ternary_end_%lu", ctx->label_nr.ternary_end++);
 }
 
-static char *label_ternary_end(void)
+/*
+ * Expressions may be nested very deeply (e.g. a machine-generated chain of
+ * thousands of "a + a + ..."), so they are generated iteratively, with an
+ * explicit stack of frames. Each expression is generated in steps by one of
+ * the *_step() functions below: they emit the code for the current step
+ * of `f->exp` and return the subexpression that has to be generated before
+ * the next step (setting `*require_value` for it), or NULL when the
+ * expression is done.
+ */
+struct exp_frame {
+	const struct ast_node *exp;
+	int require_value;
+	unsigned int step;
+	char *labels[2];
+	size_t padding; /* For calls, see func_call_step(). */
+};
+
+static const struct ast_node *logic_or_step(struct exp_frame *f,
+					    struct x86_ctx *ctx,
+					    int *require_value)
 {
-	static unsigned long counter = 0;
-	return xmkstr("_ternary_end_%lu", counter++);
+	const struct ast_node *exp = f->exp;
+	*require_value = 1;
+	switch (f->step++) {
+	case 0:
+		f->labels[0] = label_or_skip_2nd_clause(ctx);
+		return NODE(ctx, exp->u.bin_op.lexp);
+	case 1:
+		emit(ctx, " cmp	$0, %%eax\n");
+		emit(ctx, " jne	%s\n", f->labels[0]);
+		return NODE(ctx, exp->u.bin_op.rexp);
+	default:
+		emit(ctx, " cmp	$0, %%eax\n");
+		emit(ctx, "%s:\n", f->labels[0]);
+		emit(ctx, " mov	$0, %%eax\n");
+		emit(ctx, " setne	%%al\n");
+		return NULL;
+	}
 }
 
-static void generate_ternary(struct ast_expression *exp, struct x86_ctx *ctx,
-			     int require_value)
+static const struct ast_node *logic_and_step(struct exp_frame *f,
+					     struct x86_ctx *ctx,
+					     int *require_value)
 {
-	assert(exp->type == AST_EXP_TERNARY);
-	char *label_else = label_ternary_else();
-	char *label_end = label_ternary_end();
-
-	generate_expression(exp->u.ternary.condition, ctx, 1);
-	emit(ctx, " cmp	$0, %%eax\n");
-	emit(ctx, " je	%s\n", label_else);
-	generate_expression(exp->u.ternary.if_exp, ctx, require_value);
-	emit(ctx, " jmp %s\n", label_end);
-	emit(ctx, "%s:\n", label_else);
-	generate_expression(exp->u.ternary.else_exp, ctx, require_value);
-	emit(ctx, "%s:\n", label_end);
+	const struct ast_node *exp = f->exp;
+	*require_value = 1;
+	switch (f->step++) {
+	case 0:
+		f->labels[0] = label_and_skip_2nd_clause(ctx);
+		return NODE(ctx, exp->u.bin_op.lexp);
+	case 1:
+		emit(ctx, " cmp	$0, %%eax\n");
+		emit(ctx, " je	%s\n", f->labels[0]);
+		return NODE(ctx, exp->u.bin_op.rexp);
+	default:
+		emit(ctx, " cmp	$0, %%eax\n");
+		emit(ctx, "%s:\n", f->labels[0]);
+		emit(ctx, " mov	$0, %%eax\n");
+		emit(ctx, " setne	%%al\n");
+		return NULL;
+	}
+}
 
-	free(label_else);
-	free(label_end);
+static const struct ast_node *ternary_step(struct exp_frame *f,
+					   struct x86_ctx *ctx,
+					   int *require_value)
+{
+	const struct ast_node *exp = f->exp;
+	switch (f->step++) {
+	case 0:
+		f->labels[0] = label_ternary_else(ctx);
+		f->labels[1] = label_ternary_end(ctx);
+		*require_value = 1;
+		return NODE(ctx, exp->u.ternary.condition);
+	case 1:
+		emit(ctx, " cmp	$0, %%eax\n");
+		emit(ctx, " je	%s\n", f->labels[0]);
+		*require_value = f->require_value;
+		return NODE(ctx, exp->u.ternary.if_exp);
+	case 2:
+		emit(ctx, " jmp %s\n", f->labels[1]);
+		emit(ctx, "%s:\n", f->labels[0]);
+		*require_value = f->require_value;
+		return NODE(ctx, exp->u.ternary.else_exp);
+	default:
+		emit(ctx, "%s:\n", f->labels[1]);
+		return NULL;
+	}
 }
 
-/* Convention: generate_expression should put the result in eax. */
-static void generate_expression(struct ast_expression *exp, struct x86_ctx *ctx,
-				int require_value)
+static const struct ast_node *binary_op_step(struct exp_frame *f,
+					     struct x86_ctx *ctx,
+					     int *require_value)
 {
-	char *var_ref = NULL;
-	switch (exp->type) {
-	case AST_EXP_BINARY_OP:
-		enum bin_op_type bin_op_type = exp->u.bin_op.type;
+	const struct ast_node *exp = f->exp;
+	enum bin_op_type bin_op_type = exp->op;
 
-		/*
-		 * We check these first because they have their own semantics
-		 * regarding the calculation (or not) of the expresions.
-		 */
-		if (bin_op_type == EXP_OP_COMMA) {
-			generate_expression(exp->u.bin_op.lexp, ctx, 0);
-			generate_expression(exp->u.bin_op.rexp, ctx, 1);
-			goto out;
-		} else if (bin_op_type == EXP_OP_LOGIC_AND) {
-			generate_logic_and(exp, ctx);
-			goto out;
-		} else if (bin_op_type == EXP_OP_LOGIC_OR) {
-			generate_logic_or(exp, ctx);
-			goto out;
-		} else if (bin_op_type == EXP_OP_ASSIGNMENT) {
-			struct ast_expression *lexp = exp->u.bin_op.lexp;
+	/*
+	 * We check these first because they have their own semantics
+	 * regarding the calculation (or not) of the expresions.
+	 */
+	if (bin_op_type == EXP_OP_COMMA) {
+		switch (f->step++) {
+		case 0:
+			*require_value = 0;
+			return NODE(ctx, exp->u.bin_op.lexp);
+		case 1:
+			*require_value = 1;
+			return NODE(ctx, exp->u.bin_op.rexp);
+		default:
+			return NULL;
+		}
+	} else if (bin_op_type == EXP_OP_LOGIC_AND) {
+		return logic_and_step(f, ctx, require_value);
+	} else if (bin_op_type == EXP_OP_LOGIC_OR) {
+		return logic_or_step(f, ctx, require_value);
+	} else if (bin_op_type == EXP_OP_ASSIGNMENT) {
+		const struct ast_node *lexp = NODE(ctx, exp->u.bin_op.lexp);
+		switch (f->step++) {
+		case 0:
 			assert(lexp->type == AST_EXP_VAR);
-			var_ref = symtable_var_ref(ctx->symtable, &lexp->u.var);
-			generate_expression(exp->u.bin_op.rexp, ctx, 1);
-			emit(ctx, " movl	%%eax, %s\n", var_ref);
-			goto out;
+			*require_value = 1;
+			return NODE(ctx, exp->u.bin_op.rexp);
+		default:
+			emit_var(ctx, " movl	%eax, ", lexp, "\n");
+			return NULL;
 		}
+	}
 
+	switch (f->step++) {
+	case 0:
 		/*
 		 * "sub ecx eax" does "eax = eax - ecx". We calculate
 		 * rexp first so that its value ends up in ecx and lexp
@@ -169,7 +256,9 @@ static void generate_expression(struct ast_expression *exp, struct x86_ctx *ctx,
 		 * sub-expression is calculated, but it is easier to do it this
 		 * way.
 		 */
-		generate_expression(exp->u.bin_op.rexp, ctx, 1);
+		*require_value = 1;
+		return NODE(ctx, exp->u.bin_op.rexp);
+	case 1:
 		/*
 		 * Saving this in a register would be faster, but we don't know
 		 * how many sub-expressions there is and register allocation is
@@ -178,190 +267,258 @@ static void generate_expression(struct ast_expression *exp, struct x86_ctx *ctx,
 		 */
 		emit(ctx, " push	%%rax\n");
 		ctx->stack_index += 8;
-		generate_expression(exp->u.bin_op.lexp, ctx, 1);
-		emit(ctx, " pop	%%rcx\n");
-		ctx->stack_index -= 8;
-
-		switch (bin_op_type) {
-		case EXP_OP_ADDITION:
-			emit(ctx, " add	%%ecx, %%eax\n");
-			break;
-		case EXP_OP_SUBTRACTION:
-			emit(ctx, " sub	%%ecx, %%eax\n");
-			break;
-		case EXP_OP_MULTIPLICATION:
-			emit(ctx, " imul	%%ecx, %%eax\n");
-			break;
-		case EXP_OP_DIVISION:
-			/*
-			 * "idiv %ecx" does "eax = edx:eax // ecx". But edx
-			 * might already have some data, and we wouldn't want
-			 * to use random bits in our division. At first, it
-			 * seems that zeroing it would do the trick, but that
-			 * would break negative division, since '0*64:eax'
-			 * would represent a different number than 'eax' when
-			 * eax is negative. So we use cdq, which does a sign
-			 * extension of eax into edx:eax.
-			 */
-			emit(ctx, " cdq\n");
-			emit(ctx, " idiv	%%ecx\n");
-			break;
-		case EXP_OP_MODULO:
-			emit(ctx, " cdq\n");
-			emit(ctx, " idiv	%%ecx\n");
-			/* idiv stores the remainder in edx. */
-			emit(ctx, " mov	%%edx, %%eax\n");
-			break;
-		case EXP_OP_EQUAL:
-			emit(ctx, " cmp	%%ecx, %%eax\n");
-			emit(ctx, " mov	$0, %%eax\n");
-			emit(ctx, " sete	%%al\n");
-			break;
-		case EXP_OP_NOT_EQUAL:
-			emit(ctx, " cmp	%%ecx, %%eax\n");
-			emit(ctx, " mov	$0, %%eax\n");
-			emit(ctx, " setne	%%al\n");
-			break;
-		case EXP_OP_LT:
-			emit(ctx, " cmp	%%ecx, %%eax\n");
-			emit(ctx, " mov	$0, %%eax\n");
-			emit(ctx, " setl	%%al\n");
-			break;
-		case EXP_OP_LE:
-			emit(ctx, " cmp	%%ecx, %%eax\n");
-			emit(ctx, " mov	$0, %%eax\n");
-			emit(ctx, " setle	%%al\n");
-			break;
-		case EXP_OP_GT:
-			emit(ctx, " cmp	%%ecx, %%eax\n");
-			emit(ctx, " mov	$0, %%eax\n");
-			emit(ctx, " setg	%%al\n");
-			break;
-		case EXP_OP_GE:
-			emit(ctx, " cmp	%%ecx, %%eax\n");
-			emit(ctx, " mov	$0, %%eax\n");
-			emit(ctx, " setge	%%al\n");
-			break;
+		*require_value = 1;
+		return NODE(ctx, exp->u.bin_op.lexp);
+	}
 
-		case EXP_OP_BITWISE_AND:
-			emit(ctx, " and	%%ecx, %%eax\n");
-			break;
-		case EXP_OP_BITWISE_OR:
-			emit(ctx, " or	%%ecx, %%eax\n");
-			break;
-		case EXP_OP_BITWISE_XOR:
-			emit(ctx, " xor	%%ecx, %%eax\n");
-			break;
-		case EXP_OP_BITWISE_LEFT_SHIFT:
-			emit(ctx, " shl	%%ecx, %%eax\n");
-			break;
-		case EXP_OP_BITWISE_RIGHT_SHIFT:
-			emit(ctx, " shr	%%ecx, %%eax\n");
-			break;
+	emit(ctx, " pop	%%rcx\n");
+	ctx->stack_index -= 8;
 
-		default:
-			die("generate x86: unknown binary op: %d", bin_op_type);
-		}
+	switch (bin_op_type) {
+	case EXP_OP_ADDITION:
+		emit(ctx, " add	%%ecx, %%eax\n");
+		break;
+	case EXP_OP_SUBTRACTION:
+		emit(ctx, " sub	%%ecx, %%eax\n");
+		break;
+	case EXP_OP_MULTIPLICATION:
+		emit(ctx, " imul	%%ecx, %%eax\n");
+		break;
+	case EXP_OP_DIVISION:
+		/*
+		 * "idiv %ecx" does "eax = edx:eax // ecx". But edx
+		 * might already have some data, and we wouldn't want
+		 * to use random bits in our division. At first, it
+		 * seems that zeroing it would do the trick, but that
+		 * would break negative division, since '0*64:eax'
+		 * would represent a different number than 'eax' when
+		 * eax is negative. So we use cdq, which does a sign
+		 * extension of eax into edx:eax.
+		 */
+		emit(ctx, " cdq\n");
+		emit(ctx, " idiv	%%ecx\n");
+		break;
+	case EXP_OP_MODULO:
+		emit(ctx, " cdq\n");
+		emit(ctx, " idiv	%%ecx\n");
+		/* idiv stores the remainder in edx. */
+		emit(ctx, " mov	%%edx, %%eax\n");
+		break;
+	case EXP_OP_EQUAL:
+		emit(ctx, " cmp	%%ecx, %%eax\n");
+		emit(ctx, " mov	$0, %%eax\n");
+		emit(ctx, " sete	%%al\n");
+		break;
+	case EXP_OP_NOT_EQUAL:
+		emit(ctx, " cmp	%%ecx, %%eax\n");
+		emit(ctx, " mov	$0, %%eax\n");
+		emit(ctx, " setne	%%al\n");
+		break;
+	case EXP_OP_LT:
+		emit(ctx, " cmp	%%ecx, %%eax\n");
+		emit(ctx, " mov	$0, %%eax\n");
+		emit(ctx, " setl	%%al\n");
+		break;
+	case EXP_OP_LE:
+		emit(ctx, " cmp	%%ecx, %%eax\n");
+		emit(ctx, " mov	$0, %%eax\n");
+		emit(ctx, " setle	%%al\n");
+		break;
+	case EXP_OP_GT:
+		emit(ctx, " cmp	%%ecx, %%eax\n");
+		emit(ctx, " mov	$0, %%eax\n");
+		emit(ctx, " setg	%%al\n");
+		break;
+	case EXP_OP_GE:
+		emit(ctx, " cmp	%%ecx, %%eax\n");
+		emit(ctx, " mov	$0, %%eax\n");
+		emit(ctx, " setge	%%al\n");
 		break;
 
-	case AST_EXP_TERNARY:
-		generate_ternary(exp, ctx, require_value);
+	case EXP_OP_BITWISE_AND:
+		emit(ctx, " and	%%ecx, %%eax\n");
+		break;
+	case EXP_OP_BITWISE_OR:
+		emit(ctx, " or	%%ecx, %%eax\n");
+		break;
+	case EXP_OP_BITWISE_XOR:
+		emit(ctx, " xor	%%ecx, %%eax\n");
+		break;
+	case EXP_OP_BITWISE_LEFT_SHIFT:
+		emit(ctx, " shl	%%ecx, %%eax\n");
+		break;
+	case EXP_OP_BITWISE_RIGHT_SHIFT:
+		emit(ctx, " shr	%%ecx, %%eax\n");
 		break;
 
-	case AST_EXP_UNARY_OP:
-		struct ast_expression *un_op_val = exp->u.un_op.exp;
-		generate_expression(un_op_val, ctx, 1);
-		switch (exp->u.un_op.type) {
-		case EXP_OP_NEGATION:
-			emit(ctx, " neg	%%eax\n");
-			break;
-		case EXP_OP_BIT_COMPLEMENT:
-			emit(ctx, " not	%%eax\n");
-			break;
-		case EXP_OP_LOGIC_NEGATION:
-			emit(ctx, " cmp	$0, %%eax\n");
-			emit(ctx, " mov	$0, %%eax\n");
-			emit(ctx, " sete	%%al\n");
-			break;
-		case EXP_OP_PREFIX_INC:
-			assert(un_op_val->type == AST_EXP_VAR);
-			var_ref = symtable_var_ref(ctx->symtable, &un_op_val->u.var);
-			emit(ctx, " add	$1, %%eax\n");
-			emit(ctx, " movl	%%eax, %s\n", var_ref);
-			break;
-		case EXP_OP_PREFIX_DEC:
-			assert(un_op_val->type == AST_EXP_VAR);
-			var_ref = symtable_var_ref(ctx->symtable, &un_op_val->u.var);
-			emit(ctx, " sub	$1, %%eax\n");
-			emit(ctx, " movl	%%eax, %s\n", var_ref);
-			break;
-		case EXP_OP_SUFFIX_INC:
-			assert(un_op_val->type == AST_EXP_VAR);
-			var_ref = symtable_var_ref(ctx->symtable, &un_op_val->u.var);
-			emit(ctx, " addl	$1, %s\n", var_ref);
-			break;
-		case EXP_OP_SUFFIX_DEC:
-			assert(un_op_val->type == AST_EXP_VAR);
-			var_ref = symtable_var_ref(ctx->symtable, &un_op_val->u.var);
-			emit(ctx, " subl	$1, %s\n", var_ref);
-			break;
-		default:
-			die("generate x86: unknown unary op: %d", exp->u.un_op.type);
-		}
+	default:
+		die("generate x86: unknown binary op: %d", bin_op_type);
+	}
+	return NULL;
+}
+
+static const struct ast_node *unary_op_step(struct exp_frame *f,
+					    struct x86_ctx *ctx,
+					    int *require_value)
+{
+	const struct ast_node *exp = f->exp;
+	const struct ast_node *operand = NODE(ctx, exp->u.un_op.exp);
+
+	if (f->step++ == 0) {
+		*require_value = 1;
+		return operand;
+	}
+
+	switch (exp->op) {
+	case EXP_OP_NEGATION:
+		emit(ctx, " neg	%%eax\n");
 		break;
-	case AST_EXP_CONSTANT_INT:
-		emit(ctx, " mov	$%d, %%eax\n", exp->u.ival);
+	case EXP_OP_BIT_COMPLEMENT:
+		emit(ctx, " not	%%eax\n");
 		break;
-	case AST_EXP_VAR:
-		var_ref = symtable_var_ref(ctx->symtable, &exp->u.var);
-		emit(ctx, " movl	%s, %%eax\n", var_ref);
+	case EXP_OP_LOGIC_NEGATION:
+		emit(ctx, " cmp	$0, %%eax\n");
+		emit(ctx, " mov	$0, %%eax\n");
+		emit(ctx, " sete	%%al\n");
 		break;
-	case AST_EXP_FUNC_CALL:
-		/*
-		 * We first push all arguments into the stack and then move the
-		 * register ones out. This is to avoid putting an argument in
-		 * a register which may end up getting used by the next
-		 * generate_expression() call.
-		 *
-		 * Note the ssize_t usage to avoid an unsigned overflow with
-		 * i-- when i is 0.
-		 */
-		struct ast_func_decl *decl =
-				symtable_func_call(ctx->symtable, &exp->u.call);
+	case EXP_OP_PREFIX_INC:
+		assert(operand->type == AST_EXP_VAR);
+		emit(ctx, " add	$1, %%eax\n");
+		emit_var(ctx, " movl	%eax, ", operand, "\n");
+		break;
+	case EXP_OP_PREFIX_DEC:
+		assert(operand->type == AST_EXP_VAR);
+		emit(ctx, " sub	$1, %%eax\n");
+		emit_var(ctx, " movl	%eax, ", operand, "\n");
+		break;
+	case EXP_OP_SUFFIX_INC:
+		assert(operand->type == AST_EXP_VAR);
+		emit_var(ctx, " addl	$1, ", operand, "\n");
+		break;
+	case EXP_OP_SUFFIX_DEC:
+		assert(operand->type == AST_EXP_VAR);
+		emit_var(ctx, " subl	$1, ", operand, "\n");
+		break;
+	default:
+		die("generate x86: unknown unary op: %d", exp->op);
+	}
+	return NULL;
+}
 
-		if (require_value && decl->return_type == RET_VOID)
-			die("void not ignored as it ought to be\n%s",
-			    show_token_on_source_line(exp->u.call.tok));
+static const struct ast_node *func_call_step(struct exp_frame *f,
+					     struct x86_ctx *ctx,
+					     int *require_value)
+{
+	const struct ast_node *exp = f->exp;
+	size_t nr_args = exp->u.call.args.nr;
+	size_t stack_args = nr_args > NR_CALL_REGS ? nr_args - NR_CALL_REGS : 0;
 
-		for (ssize_t i = exp->u.call.args.nr - 1; i >= 0; i--) {
-			generate_expression(exp->u.call.args.arr[i], ctx, 1);
-			emit(ctx, " push	%%rax\n");
-			ctx->stack_index += 8;
-		}
-		for (size_t i = 0; i < MIN(NR_CALL_REGS, exp->u.call.args.nr); i++) {
-			emit(ctx, " pop	%%%s\n", func_call_regs[i]);
-			ctx->stack_index -= 8;
-		}
-		/* 
-		 * No need to save any register as we hold all variables at
-		 * the stack. So the callee can use all registers as it wants.
-		 *
-		 * TODO: check if we should align the stack before call.
+	/*
+	 * We first push all arguments into the stack and then move the
+	 * register ones out. This is to avoid putting an argument in
+	 * a register which may end up getting used by the next
+	 * argument's code.
+	 */
+	if (f->step == 0) {
+		const struct ast_node *decl = SYMBOL(ctx, exp)->u.func;
+
+		if (f->require_value && decl->op == RET_VOID)
+			die("void not ignored as it ought to be\n%s",
+			    show_node_on_source_line(ctx->tree, exp));
+		/*
+		 * The stack must be aligned at the call, with the stack
+		 * arguments right at its top. So, if they would leave it
+		 * misaligned, the padding goes before them.
 		 */
-		emit(ctx, " call	%s\n", exp->u.call.name);
-		/* Remove the stack arguments. */
-		size_t stack_args = exp->u.call.args.nr > NR_CALL_REGS ?
-				    exp->u.call.args.nr - NR_CALL_REGS : 0;
-		if (stack_args) {
-			emit(ctx, " add	$%zu, %%rsp\n", stack_args * 4);
-			ctx->stack_index -= (stack_args * 4);
+		f->padding = (ctx->stack_index + stack_args * 8) %
+			     STACK_ALIGNMENT;
+		if (f->padding) {
+			f->padding = STACK_ALIGNMENT - f->padding;
+			emit(ctx, " sub	$%zu, %%rsp\n", f->padding);
+			ctx->stack_index += f->padding;
 		}
-		break;
+	} else {
+		emit(ctx, " push	%%rax\n");
+		ctx->stack_index += 8;
+	}
+	if (f->step < nr_args) {
+		/* From the last argument to the first. */
+		*require_value = 1;
+		return ast_list_node(ctx->tree, exp->u.call.args,
+				     nr_args - 1 - f->step++);
+	}
+
+	for (size_t i = 0; i < MIN(NR_CALL_REGS, nr_args); i++) {
+		emit(ctx, " pop	%%%s\n", func_call_regs[i]);
+		ctx->stack_index -= 8;
+	}
+	/* 
+	 * No need to save any register as we hold all variables at
+	 * the stack. So the callee can use all registers as it wants.
+	 */
+	assert(ctx->stack_index % STACK_ALIGNMENT == 0);
+	emit(ctx, " call	%s\n", ast_name(ctx->tree, exp->u.call.atom));
+	/* Remove the stack arguments (8 bytes each) and the padding. */
+	if (stack_args || f->padding) {
+		emit(ctx, " add	$%zu, %%rsp\n", stack_args * 8 + f->padding);
+		ctx->stack_index -= stack_args * 8 + f->padding;
+	}
+	return NULL;
+}
+
+static const struct ast_node *exp_step(struct exp_frame *f,
+				       struct x86_ctx *ctx, int *require_value)
+{
+	const struct ast_node *exp = f->exp;
+	switch (exp->type) {
+	case AST_EXP_BINARY_OP:
+		return binary_op_step(f, ctx, require_value);
+	case AST_EXP_TERNARY:
+		return ternary_step(f, ctx, require_value);
+	case AST_EXP_UNARY_OP:
+		return unary_op_step(f, ctx, require_value);
+	case AST_EXP_CONSTANT_INT:
+		emit(ctx, " mov	$%d, %%eax\n", exp->u.ival);
+		return NULL;
+	case AST_EXP_VAR:
+		emit_var(ctx, " movl	", exp, ", %eax\n");
+		return NULL;
+	case AST_EXP_FUNC_CALL:
+		return func_call_step(f, ctx, require_value);
 	default:
 		die("generate x86: unknown expression type %d", exp->type);
 	}
-out:
-	free(var_ref);
+}
+
+static void push_exp_frame(struct x86_ctx *ctx, const struct ast_node *exp,
+			   int require_value)
+{
+	ALLOC_GROW(ctx->exp_frames.arr, ctx->exp_frames.nr + 1,
+		   ctx->exp_frames.alloc);
+	ctx->exp_frames.arr[ctx->exp_frames.nr++] = (struct exp_frame){
+		.exp = exp,
+		.require_value = require_value,
+	};
+}
+
+/* Convention: generate_expression should put the result in eax. */
+static void generate_expression(const struct ast_node *exp, struct x86_ctx *ctx,
+				int require_value)
+{
+	size_t base = ctx->exp_frames.nr;
+
+	push_exp_frame(ctx, exp, require_value);
+	while (ctx->exp_frames.nr > base) {
+		struct exp_frame *f = &ctx->exp_frames.arr[ctx->exp_frames.nr - 1];
+		const struct ast_node *sub = exp_step(f, ctx, &require_value);
+		if (sub) {
+			push_exp_frame(ctx, sub, require_value);
+		} else {
+			free(f->labels[0]);
+			free(f->labels[1]);
+			ctx->exp_frames.nr--;
+		}
+	}
 }
 
 static void generate_func_epilogue_and_ret(struct x86_ctx *ctx)
@@ -372,99 +529,68 @@ static void generate_func_epilogue_and_ret(struct x86_ctx *ctx)
 	emit(ctx, " ret\n");
 }
 
-static char *label_if_else_else(void)
+static char *label_if_else_else(struct x86_ctx *ctx)
 {
-	static unsigned long counter = 0;
-	return xmkstr("_else_%lu", counter++);
+	return func_label(ctx, "_else_%lu", ctx->label_nr.if_else_else++);
 }
 
-static char *label_if_else_end(void)
+static char *label_if_else_end(struct x86_ctx *ctx)
 {
-	static unsigned long counter = 0;
-	return xmkstr("_if_else_end_%lu", counter++);
+	return func_label(ctx, "_if_else_end_%lu", ctx->label_nr.if_else_end++);
 }
 
-static void generate_if_else(struct if_else *ie, struct x86_ctx *ctx)
+static void generate_if_else(const struct ast_node *st, struct x86_ctx *ctx)
 {
-	char *label_end = label_if_else_end();
+	char *label_end = label_if_else_end(ctx);
 
-	if (ie->else_st) {
-		char *label_else = label_if_else_else();
-		generate_expression(ie->condition, ctx, 1);
+	if (st->u.if_else.else_st) {
+		char *label_else = label_if_else_else(ctx);
+		generate_expression(NODE(ctx, st->u.if_else.condition), ctx, 1);
 		emit(ctx, " cmp	$0, %%eax\n");
 		emit(ctx, " je	%s\n", label_else);
-		generate_statement(ie->if_st, ctx);
+		generate_statement(NODE(ctx, st->u.if_else.if_st), ctx);
 		emit(ctx, " jmp %s\n", label_end);
 		emit(ctx, "%s:\n", label_else);
-		generate_statement(ie->else_st, ctx);
+		generate_statement(NODE(ctx, st->u.if_else.else_st), ctx);
 		emit(ctx, "%s:\n", label_end);
 		free(label_else);
 	} else {
-		generate_expression(ie->condition, ctx, 1);
+		generate_expression(NODE(ctx, st->u.if_else.condition), ctx, 1);
 		emit(ctx, " cmp	$0, %%eax\n");
 		emit(ctx, " je	%s\n", label_end);
-		generate_statement(ie->if_st, ctx);
+		generate_statement(NODE(ctx, st->u.if_else.if_st), ctx);
 		emit(ctx, "%s:\n", label_end);
 	}
 
 	free(label_end);
 }
 
-static void generate_new_scope(struct ast_statement *st, struct x86_ctx *ctx,
-		void (*generator)(struct ast_statement *st, struct x86_ctx *ctx, void *data),
-		void *data)
-{
-	struct symtable *cpy, *saved_symtable;
-	unsigned int saved_scope = ctx->scope++;
-	size_t saved_stack_index = ctx->stack_index;
-
-	cpy = xmalloc(sizeof(*cpy));
-	symtable_cpy(cpy, ctx->symtable);
-	saved_symtable = ctx->symtable;
-	ctx->symtable = cpy;
-
-	generator(st, ctx, data);
-
-	/* 
-	 * Deallocate block variables. Alternatively, we could do:
-	 * rsp = rbp - saved_stack_index;
-	 */
-	emit(ctx, " add	$%zu, %%rsp\n",
-		symtable_bytes_in_scope(ctx->symtable, ctx->scope));
-
-	ctx->scope = saved_scope;
-	ctx->symtable = saved_symtable;
-	ctx->stack_index = saved_stack_index;
-	symtable_destroy(cpy);
-	free(cpy);
-}
-
-static void block_statement_generator(struct ast_statement *st,
-				      struct x86_ctx *ctx,
-				      void *unused)
+/*
+ * The block's variables are in the function's stack frame, so there is
+ * nothing to allocate or free here.
+ */
+static void generate_statement_block(const struct ast_node *st,
+				     struct x86_ctx *ctx)
 {
 	assert(st->type == AST_ST_BLOCK);
 	for (size_t i = 0; i < st->u.block.nr; i++)
-		generate_statement(st->u.block.items[i], ctx);
+		generate_statement(ast_list_node(ctx->tree, st->u.block, i), ctx);
 }
-#define generate_statement_block(st, ctx) \
-	generate_new_scope(st, ctx, block_statement_generator, NULL)
 
-static void generate_while(struct ast_statement *st, struct x86_ctx *ctx)
+static void generate_while(const struct ast_node *st, struct x86_ctx *ctx)
 {
-	static unsigned long counter = 0;
-	char *label_start = xmkstr("_while_start_%lu", counter);
-	char *label_end = xmkstr("_while_end_%lu", counter);
-	counter++;
+	unsigned long nr = ctx->label_nr._while++;
+	char *label_start = func_label(ctx, "_while_start_%lu", nr);
+	char *label_end = func_label(ctx, "_while_end_%lu", nr);
 	stack_push(&ctx->break_labels, label_end);
 	stack_push(&ctx->continue_labels, label_start);
 
 	assert(st->type == AST_ST_WHILE);
 	emit(ctx, "%s:\n", label_start);
-	generate_expression(st->u._while.condition, ctx, 1);
+	generate_expression(NODE(ctx, st->u._while.condition), ctx, 1);
 	emit(ctx, " cmp	$0, %%eax\n");
 	emit(ctx, " je	%s\n", label_end);
-	generate_statement(st->u._while.body, ctx);
+	generate_statement(NODE(ctx, st->u._while.body), ctx);
 	emit(ctx, " jmp %s\n", label_start);
 	emit(ctx, "%s:\n", label_end);
 
@@ -474,21 +600,20 @@ static void generate_while(struct ast_statement *st, struct x86_ctx *ctx)
 	free(label_end);
 }
 
-static void generate_do(struct ast_statement *st, struct x86_ctx *ctx)
+static void generate_do(const struct ast_node *st, struct x86_ctx *ctx)
 {
-	static unsigned long counter = 0;
-	char *label_start = xmkstr("_do_start_%lu", counter);
-	char *label_end = xmkstr("_do_end_%lu", counter);
-	char *label_condition = xmkstr("_do_condition_%lu", counter);
-	counter++;
+	unsigned long nr = ctx->label_nr._do++;
+	char *label_start = func_label(ctx, "_do_start_%lu", nr);
+	char *label_end = func_label(ctx, "_do_end_%lu", nr);
+	char *label_condition = func_label(ctx, "_do_condition_%lu", nr);
 	stack_push(&ctx->break_labels, label_end);
 	stack_push(&ctx->continue_labels, label_condition);
 
 	assert(st->type == AST_ST_DO);
 	emit(ctx, "%s:\n", label_start);
-	generate_statement(st->u._do.body, ctx);
+	generate_statement(NODE(ctx, st->u._do.body), ctx);
 	emit(ctx, "%s:\n", label_condition);
-	generate_expression(st->u._do.condition, ctx, 1);
+	generate_expression(NODE(ctx, st->u._do.condition), ctx, 1);
 	emit(ctx, " cmp	$0, %%eax\n");
 	emit(ctx, " jne	%s\n", label_start);
 	emit(ctx, "%s:\n", label_end);
@@ -500,31 +625,29 @@ static void generate_do(struct ast_statement *st, struct x86_ctx *ctx)
 	free(label_condition);
 }
 
-static void generate_opt_expression(struct ast_opt_expression opt_exp,
-				    struct x86_ctx *ctx,
+static void generate_opt_expression(ast_ref opt_exp, struct x86_ctx *ctx,
 				    int require_value)
 {
-	if (opt_exp.exp)
-		generate_expression(opt_exp.exp, ctx, require_value);
+	if (opt_exp)
+		generate_expression(NODE(ctx, opt_exp), ctx, require_value);
 }
 
-static void generate_for(struct ast_statement *st, struct x86_ctx *ctx)
+static void generate_for(const struct ast_node *st, struct x86_ctx *ctx)
 {
-	static unsigned long counter = 0;
-	char *label_condition = xmkstr("_for_condition_%lu", counter);
-	char *label_end = xmkstr("_for_end_%lu", counter);
-	char *label_epilogue = xmkstr("_for_epilogue_%lu", counter);
-	counter++;
+	unsigned long nr = ctx->label_nr._for++;
+	char *label_condition = func_label(ctx, "_for_condition_%lu", nr);
+	char *label_end = func_label(ctx, "_for_end_%lu", nr);
+	char *label_epilogue = func_label(ctx, "_for_epilogue_%lu", nr);
 	stack_push(&ctx->break_labels, label_end);
 	stack_push(&ctx->continue_labels, label_epilogue);
 
 	assert(st->type == AST_ST_FOR);
 	generate_opt_expression(st->u._for.prologue, ctx, 0);
 	emit(ctx, "%s:\n", label_condition);
-	generate_expression(st->u._for.condition, ctx, 1);
+	generate_expression(NODE(ctx, st->u._for.condition), ctx, 1);
 	emit(ctx, " cmp	$0, %%eax\n");
 	emit(ctx, " je	%s\n", label_end);
-	generate_statement(st->u._for.body, ctx);
+	generate_statement(NODE(ctx, st->u._for.body), ctx);
 	emit(ctx, "%s:\n", label_epilogue);
 	generate_opt_expression(st->u._for.epilogue, ctx, 0);
 	emit(ctx, " jmp	%s\n", label_condition);
@@ -537,52 +660,43 @@ static void generate_for(struct ast_statement *st, struct x86_ctx *ctx)
 	free(label_epilogue);
 }
 
-static void generate_var_decl(struct ast_var_decl *decl, struct x86_ctx *ctx)
+/* The variable's space was already allocated by the function prologue. */
+static void generate_var_decl(const struct ast_node *decl, struct x86_ctx *ctx)
 {
-	/*
-	 * Put the varname on the symbol table before generating the
-	 * code for rexp due to the weird case of declaration with
-	 * assignment to itself:
-	 *		int v = v = 2;
-	 */
-	size_t var_stack_index = ctx->stack_index += 4;
-	symtable_put_lvar(ctx->symtable, decl, ctx->stack_index, ctx->scope);
-	emit(ctx, " sub	$4, %%rsp\n");
-
-	if (decl->value) {
-		generate_expression(decl->value, ctx, 1);
+	if (decl->u.var_decl.value) {
+		generate_expression(NODE(ctx, decl->u.var_decl.value), ctx, 1);
 	} else {
 		/* We don't really need to initialize it, but... */
 		emit(ctx, " mov	$0, %%eax\n");
 	}
-	emit(ctx, " movl	%%eax, -%zu(%%rbp)\n", var_stack_index);
+	emit(ctx, " movl	%%eax, -%zu(%%rbp)\n",
+	     SYMBOL(ctx, decl)->u.stack_index);
 }
 
-static void generate_var_decl_list(struct ast_var_decl_list *decl_list,
+static void generate_var_decl_list(const struct ast_node *st,
 				   struct x86_ctx *ctx)
 {
-	for (size_t i = 0; i < decl_list->nr; i++)
-		generate_var_decl(decl_list->arr[i], ctx);
+	assert(st->type == AST_ST_VAR_DECL);
+	for (size_t i = 0; i < st->u.decl_list.nr; i++)
+		generate_var_decl(ast_list_node(ctx->tree, st->u.decl_list, i), ctx);
 }
 
-static void for_decl_generator(struct ast_statement *st, struct x86_ctx *ctx,
-			       void *unused)
+static void generate_for_decl(const struct ast_node *st, struct x86_ctx *ctx)
 {
-	static unsigned long counter = 0;
-	char *label_condition = xmkstr("_for_decl_condition_%lu", counter);
-	char *label_end = xmkstr("_for_decl_end_%lu", counter);
-	char *label_epilogue = xmkstr("_for_decl_epilogue_%lu", counter);
-	counter++;
+	unsigned long nr = ctx->label_nr.for_decl++;
+	char *label_condition = func_label(ctx, "_for_decl_condition_%lu", nr);
+	char *label_end = func_label(ctx, "_for_decl_end_%lu", nr);
+	char *label_epilogue = func_label(ctx, "_for_decl_epilogue_%lu", nr);
 	stack_push(&ctx->break_labels, label_end);
 	stack_push(&ctx->continue_labels, label_epilogue);
 
 	assert(st->type == AST_ST_FOR_DECL);
-	generate_var_decl_list(st->u.for_decl.decl_list, ctx);
+	generate_var_decl_list(NODE(ctx, st->u._for.prologue), ctx);
 	emit(ctx, "%s:\n", label_condition);
-	generate_expression(st->u._for.condition, ctx, 1);
+	generate_expression(NODE(ctx, st->u._for.condition), ctx, 1);
 	emit(ctx, " cmp	$0, %%eax\n");
 	emit(ctx, " je	%s\n", label_end);
-	generate_statement(st->u._for.body, ctx);
+	generate_statement(NODE(ctx, st->u._for.body), ctx);
 	emit(ctx, "%s:\n", label_epilogue);
 	generate_opt_expression(st->u._for.epilogue, ctx, 0);
 	emit(ctx, " jmp	%s\n", label_condition);
@@ -594,37 +708,35 @@ static void for_decl_generator(struct ast_statement *st, struct x86_ctx *ctx,
 	free(label_end);
 	free(label_epilogue);
 }
-#define generate_for_decl(st, ctx) \
-	generate_new_scope(st, ctx, for_decl_generator, NULL)
 
-static void generate_statement(struct ast_statement *st, struct x86_ctx *ctx)
+static void generate_statement(const struct ast_node *st, struct x86_ctx *ctx)
 {
 	const char *label;
-	struct token *tok;
+	struct token_loc loc;
 	switch(st->type) {
 	case AST_ST_RETURN:
-		if (st->u._return.opt_exp.exp) {
-			if (ctx->cur_func->return_type != RET_INT) {
+		if (st->u.opt_exp.exp) {
+			if (ctx->cur_func->op != RET_INT) {
 				die("trying to return value from void function\n%s\nFunction declared at:\n%s",
-				    show_token_on_source_line(st->u._return.tok),
-				    show_token_on_source_line(ctx->cur_func->tok));
+				    show_node_on_source_line(ctx->tree, st),
+				    show_node_on_source_line(ctx->tree, ctx->cur_func));
 			}
-			generate_expression(st->u._return.opt_exp.exp, ctx, 1);
-		} else if (ctx->cur_func->return_type != RET_VOID) {
+			generate_expression(NODE(ctx, st->u.opt_exp.exp), ctx, 1);
+		} else if (ctx->cur_func->op != RET_VOID) {
 			die("missing return value on non-void function\n%s\nFunction declared at:\n%s",
-			    show_token_on_source_line(st->u._return.tok),
-			    show_token_on_source_line(ctx->cur_func->tok));
+			    show_node_on_source_line(ctx->tree, st),
+			    show_node_on_source_line(ctx->tree, ctx->cur_func));
 		}
 		generate_func_epilogue_and_ret(ctx);
 		break;
 	case AST_ST_VAR_DECL:
-		generate_var_decl_list(st->u.decl_list, ctx);
+		generate_var_decl_list(st, ctx);
 		break;
 	case AST_ST_EXPRESSION:
-		generate_opt_expression(st->u.opt_exp, ctx, 0);
+		generate_opt_expression(st->u.opt_exp.exp, ctx, 0);
 		break;
 	case AST_ST_IF_ELSE:
-		generate_if_else(&st->u.if_else, ctx);
+		generate_if_else(st, ctx);
 		break;
 	case AST_ST_BLOCK:
 		generate_statement_block(st, ctx);
@@ -644,27 +756,29 @@ static void generate_statement(struct ast_statement *st, struct x86_ctx *ctx)
 	case AST_ST_BREAK:
 		if (stack_empty(&ctx->break_labels))
 			die("generate x86: nothing to break from.\n%s",
-			    show_token_on_source_line(st->u.break_tok));
+			    show_node_on_source_line(ctx->tree, st));
 		emit(ctx, " jmp  %s\n", (char *)stack_peek(&ctx->break_labels));
 		break;
 	case AST_ST_CONTINUE:
 		if (stack_empty(&ctx->continue_labels))
 			die("generate x86: nothing to continue to.\n%s",
-			    show_token_on_source_line(st->u.continue_tok));
+			    show_node_on_source_line(ctx->tree, st));
 		emit(ctx, " jmp  %s\n", (char *)stack_peek(&ctx->continue_labels));
 		break;
 	case AST_ST_LABELED_STATEMENT:
-		label = st->u.labeled_st.label;
-		tok = st->u.labeled_st.label_tok;
-		labelset_put_definition(&ctx->user_labels, label, tok);
-		emit(ctx, "_label_%s:\n", label);
-		generate_statement(st->u.labeled_st.st, ctx);
+		label = ast_name(ctx->tree, st->u.labeled_st.label_atom);
+		loc = ast_loc(ctx->tree, st);
+		labelset_put_definition(&ctx->user_labels,
+					st->u.labeled_st.label_atom, label, &loc);
+		emit(ctx, "%s._label_%s:\n", ctx->func_name, label);
+		generate_statement(NODE(ctx, st->u.labeled_st.st), ctx);
 		break;
 	case AST_ST_GOTO:
-		label = st->u._goto.label;
-		tok = st->u._goto.label_tok;
-		labelset_put_reference(&ctx->user_labels, label, tok);
-		emit(ctx, " jmp _label_%s\n", label);
+		label = ast_name(ctx->tree, st->u._goto.label_atom);
+		loc = ast_loc(ctx->tree, st);
+		labelset_put_reference(&ctx->user_labels,
+				       st->u._goto.label_atom, label, &loc);
+		emit(ctx, " jmp %s._label_%s\n", ctx->func_name, label);
 		break;
 
 	default:
@@ -672,13 +786,14 @@ static void generate_statement(struct ast_statement *st, struct x86_ctx *ctx)
 	}
 }
 
-static void func_body_generator(struct ast_statement *st,
-				struct x86_ctx *ctx,
-				void *data)
+static void generate_func_body(const struct ast_node *fun,
+			       struct x86_ctx *ctx)
 {
-	ARRAY(struct ast_var_decl *) *parameters = data;
+	const struct ast_list *parameters = &fun->u.func.parameters;
 	/* First we save the arguments. */
 	for (size_t i = 0; i < parameters->nr; i++) {
+		const struct ast_node *param =
+			ast_list_node(ctx->tree, *parameters, i);
 		if (i < NR_CALL_REGS) {
 			/* 
 			 * TODO: there is no need for using rax as a temporary
@@ -686,8 +801,6 @@ static void func_body_generator(struct ast_statement *st,
 			 * func_call_regs[i].
 			 */
 			emit(ctx, " mov	%%%s, %%rax\n", func_call_regs[i]);
-			emit(ctx, " sub	$4, %%rsp\n");
-			emit(ctx, " movl	%%eax, (%%rsp)\n");
 		} else {
 			/*
 			 * The NR_CALL_REGS-th argument is 16 positions above
@@ -698,42 +811,40 @@ static void func_body_generator(struct ast_statement *st,
 			 */
 			emit(ctx, " mov	%zu(%%rbp), %%rax\n",
 			     16 + (i - NR_CALL_REGS) * 8);
-			emit(ctx, " sub	$4, %%rsp\n");
-			emit(ctx, " movl	%%eax, (%%rsp)\n");
 		}
-		ctx->stack_index += 4;
-		symtable_put_lvar(ctx->symtable, parameters->arr[i],
-				  ctx->stack_index, ctx->scope);
+		emit(ctx, " movl	%%eax, -%zu(%%rbp)\n",
+		     SYMBOL(ctx, param)->u.stack_index);
 	}
 
 	/* Then we generate the body. */
-	assert(st->type == AST_ST_BLOCK);
-	for (size_t i = 0; i < st->u.block.nr; i++)
-		generate_statement(st->u.block.items[i], ctx);
+	generate_statement_block(NODE(ctx, fun->u.func.body), ctx);
 }
-#define generate_func_body(func, ctx) \
-	generate_new_scope((func)->body, ctx, func_body_generator, &(func)->parameters)
 
-static void generate_func_decl(struct ast_func_decl *fun, struct x86_ctx *ctx)
+/* Generates a function with body. */
+static void generate_func(const struct ast_node *fun, struct x86_ctx *ctx)
 {
-	symtable_put_func(ctx->symtable, fun, ctx->scope);
-	if (!fun->body)
-		return;
+	const char *name = ast_name(ctx->tree, fun->u.func.atom);
 
 	ctx->cur_func = fun;
-	labelset_init(&ctx->user_labels);
+	ctx->func_name = name;
+	memset(&ctx->label_nr, 0, sizeof(ctx->label_nr));
 	emit(ctx, " .text\n");
-	emit(ctx, " .globl %s\n", fun->name);
-	emit(ctx, "%s:\n", fun->name);
+	emit(ctx, " .globl %s\n", name);
+	emit(ctx, "%s:\n", name);
 
 	/*
-	 * prologue: save previous rbp and create an empty stack frame.
+	 * prologue: save previous rbp and allocate the stack frame for all
+	 * the local variables. The call pushed the return address on an
+	 * aligned stack, so after pushing rbp, it is aligned again, and stays
+	 * so if the frame's size is a multiple of STACK_ALIGNMENT.
 	 * Note: callee should also save and restore RBX and R12-R15, but we
 	 * never use these registers, so there is no need to save them. 
 	 */
 	emit(ctx, " push	%%rbp\n");
 	emit(ctx, " mov	%%rsp, %%rbp\n");
-	ctx->stack_index = 0;
+	ctx->stack_index = ROUND_UP(FRAME_BYTES(ctx, fun), STACK_ALIGNMENT);
+	if (ctx->stack_index)
+		emit(ctx, " sub	$%zu, %%rsp\n", ctx->stack_index);
 
 	generate_func_body(fun, ctx);
 	/*
@@ -747,7 +858,7 @@ static void generate_func_decl(struct ast_func_decl *fun, struct x86_ctx *ctx)
 	 * branches have return statements, so we accept the
 	 * redundancy.
 	 */
-	if (!strcmp(fun->name, "main") || fun->return_type != RET_VOID)
+	if (!strcmp(name, "main") || fun->op != RET_VOID)
 		emit(ctx, " mov	$0, %%eax\n");
 	generate_func_epilogue_and_ret(ctx);
 
@@ -757,78 +868,219 @@ static void generate_func_decl(struct ast_func_decl *fun, struct x86_ctx *ctx)
 
 	/* Check if all refered labels were defined. */
 	labelset_check(&ctx->user_labels);
-	labelset_destroy(&ctx->user_labels);
+	labelset_clear(&ctx->user_labels);
 	ctx->cur_func = NULL;
+	ctx->func_name = NULL;
 }
 
-static void generate_global_var_decl(struct ast_var_decl *var,
+static void generate_global_var_decl(const struct ast_node *var,
 				     struct x86_ctx *ctx)
 {
-	char *var_label = symtable_put_gvar(ctx->symtable, var);
-	if (var->value) {
+	const char *name = ast_name(ctx->tree, var->u.var_decl.atom);
+	if (var->u.var_decl.value) {
+		const struct ast_node *value = NODE(ctx, var->u.var_decl.value);
 		/*
 		 * The parser should have already verified this and warned the
 		 * user.
 		 */
-		assert(var->value->type == AST_EXP_CONSTANT_INT);
+		assert(value->type == AST_EXP_CONSTANT_INT);
 		emit(ctx, " .data\n");
-		emit(ctx, " .globl %s\n", var_label);
+		emit(ctx, " .globl _var_%s\n", name);
 		emit(ctx, " .align 4\n");
-		emit(ctx, "%s:\n", var_label);
-		emit(ctx, " .long %d\n", var->value->u.ival);
+		emit(ctx, "_var_%s:\n", name);
+		emit(ctx, " .long %d\n", value->u.ival);
 	} else {
 		/* Uninitialized global vars will be generated at the end */
 	}
-	free(var_label);
 }
 
-static void generate_global_var_decl_list(struct ast_var_decl_list *decl_list,
+static void generate_global_var_decl_list(const struct ast_node *st,
 					  struct x86_ctx *ctx)
 {
-	for (size_t i = 0; i < decl_list->nr; i++)
-		generate_global_var_decl(decl_list->arr[i], ctx);
+	assert(st->type == AST_ST_VAR_DECL);
+	for (size_t i = 0; i < st->u.decl_list.nr; i++)
+		generate_global_var_decl(ast_list_node(ctx->tree, st->u.decl_list, i),
+					 ctx);
 }
 
-static void generate_uninitialized_gvar(char *var_label, void *data)
+static void generate_uninitialized_gvars(struct x86_ctx *ctx)
 {
-	struct x86_ctx *ctx = data;
-	emit(ctx, " .bss\n");
-	emit(ctx, " .globl %s\n", var_label);
-	emit(ctx, " .align 4\n");
-	emit(ctx, "%s:\n", var_label);
-	emit(ctx, " .zero 4\n");
+	for (size_t i = 0; i < ctx->res->uninitialized_gvars.nr; i++) {
+		const char *name = ctx->res->uninitialized_gvars.arr[i];
+		emit(ctx, " .bss\n");
+		emit(ctx, " .globl _var_%s\n", name);
+		emit(ctx, " .align 4\n");
+		emit(ctx, "_var_%s:\n", name);
+		emit(ctx, " .zero 4\n");
+	}
 }
-#define generate_uninitialized_gvars(ctx) \
-	foreach_uninitialized_gvar(ctx->symtable, generate_uninitialized_gvar, ctx);
 
 static void generate_prog(struct ast_program *prog, struct x86_ctx *ctx)
 {
 	for (size_t i = 0; i < prog->items.nr; i++) {
-		struct ast_toplevel_item *item = prog->items.arr[i];
-		switch (item->type) {
-		case TOPLEVEL_FUNC_DECL:
-			generate_func_decl(item->u.func, ctx);
+		const struct ast_node *root;
+		ctx->item = i;
+		ctx->tree = &prog->items.arr[i];
+		root = NODE(ctx, ctx->tree->root);
+		switch (root->type) {
+		case AST_FUNC_DECL:
+			if (root->u.func.body)
+				generate_func(root, ctx);
 			break;
-		case TOPLEVEL_VAR_DECL:
-			generate_global_var_decl_list(item->u.var_list, ctx);
+		case AST_ST_VAR_DECL:
+			generate_global_var_decl_list(root, ctx);
 			break;
 		default:
-			BUG("x86: unknown toplevel item '%s'", item->type);
+			BUG("x86: unknown toplevel item '%d'", root->type);
 		}
 	}
+	ctx->tree = NULL;
+	generate_uninitialized_gvars(ctx);
+}
+
+/*
+ * Each thread should get at least this many functions to generate, so that
+ * small programs don't spawn threads for nothing.
+ */
+#define MIN_FUNCS_PER_JOB 8
+
+struct codegen_pool {
+	struct ast_program *prog;
+	const struct resolution *res;
+	struct {
+		char *buf;
+		size_t len;
+	} *outputs; /* The assembly of each toplevel item. */
+	size_t *funcs; /* The items with function bodies, in source order. */
+	size_t nr_funcs, next_func;
+};
+
+static FILE *open_item_output(struct codegen_pool *pool, size_t item)
+{
+	FILE *fp = open_memstream(&pool->outputs[item].buf,
+				  &pool->outputs[item].len);
+	if (!fp)
+		die_errno("open_memstream failed");
+	return fp;
+}
+
+static void close_item_output(FILE *fp)
+{
+	if (fclose(fp))
+		die_errno("failed to write assembly");
+}
+
+/*
+ * Generates the functions at pool->funcs[] until there are no more left. The
+ * resolution is only read, so it is shared by all workers.
+ */
+static void *codegen_worker(void *data)
+{
+	struct codegen_pool *pool = data;
+	struct x86_ctx ctx = { .res = pool->res };
+	size_t i;
+
+	labelset_init(&ctx.user_labels);
+	while ((i = __atomic_fetch_add(&pool->next_func, 1, __ATOMIC_RELAXED)) <
+	       pool->nr_funcs) {
+		ctx.item = pool->funcs[i];
+		ctx.tree = &pool->prog->items.arr[ctx.item];
+		ctx.out = open_item_output(pool, ctx.item);
+		generate_func(NODE(&ctx, ctx.tree->root), &ctx);
+		close_item_output(ctx.out);
+	}
+	labelset_destroy(&ctx.user_labels);
+	free(ctx.exp_frames.arr);
+	return NULL;
+}
+
+/*
+ * Like generate_prog(), but the function bodies are generated by up to `jobs`
+ * threads, each into its own buffer. The buffers are then written out in
+ * source order, so the output is the same as generate_prog()'s. Symbol errors
+ * are all found by the resolver, before this, but if more than one function
+ * has other errors (like a misplaced break), which one is reported may vary.
+ */
+static void generate_prog_parallel(struct ast_program *prog,
+				   struct x86_ctx *ctx, int jobs)
+{
+	struct codegen_pool pool = { .prog = prog, .res = ctx->res };
+	pthread_t *threads;
+	FILE *out = ctx->out;
+
+	CALLOC_ARRAY(pool.outputs, prog->items.nr);
+	ALLOC_ARRAY(pool.funcs, prog->items.nr);
+
+	for (size_t i = 0; i < prog->items.nr; i++) {
+		const struct ast_node *root;
+		ctx->item = i;
+		ctx->tree = &prog->items.arr[i];
+		root = NODE(ctx, ctx->tree->root);
+		switch (root->type) {
+		case AST_FUNC_DECL:
+			if (root->u.func.body)
+				pool.funcs[pool.nr_funcs++] = i;
+			break;
+		case AST_ST_VAR_DECL:
+			ctx->out = open_item_output(&pool, i);
+			generate_global_var_decl_list(root, ctx);
+			close_item_output(ctx->out);
+			break;
+		default:
+			BUG("x86: unknown toplevel item '%d'", root->type);
+		}
+	}
+	ctx->tree = NULL;
+	ctx->out = out;
+
+	if ((size_t)jobs > pool.nr_funcs / MIN_FUNCS_PER_JOB)
+		jobs = pool.nr_funcs / MIN_FUNCS_PER_JOB;
+	if (jobs < 1)
+		jobs = 1;
+
+	/* The calling thread is a worker too. */
+	CALLOC_ARRAY(threads, jobs);
+	for (int i = 1; i < jobs; i++) {
+		int ret = pthread_create(&threads[i], NULL, codegen_worker, &pool);
+		if (ret)
+			die("failed to create codegen thread: %s", strerror(ret));
+	}
+	codegen_worker(&pool);
+	for (int i = 1; i < jobs; i++) {
+		int ret = pthread_join(threads[i], NULL);
+		if (ret)
+			die("failed to join codegen thread: %s", strerror(ret));
+	}
+	free(threads);
+
+	for (size_t i = 0; i < prog->items.nr; i++) {
+		if (pool.outputs[i].len &&
+		    fwrite(pool.outputs[i].buf, pool.outputs[i].len, 1, out) != 1)
+			die_errno("fwrite error");
+		free(pool.outputs[i].buf);
+	}
+	free(pool.outputs);
+	free(pool.funcs);
+
 	generate_uninitialized_gvars(ctx);
 }
 
-void generate_x86_asm(struct ast_program *prog, FILE *out)
+void generate_x86_asm(struct ast_program *prog, FILE *out, int jobs)
 {
 	struct x86_ctx ctx = { 0 };
-	struct symtable symtable;
+	struct resolution res;
 
-	symtable_init(&symtable);
-	ctx.symtable = &symtable;
+	resolve_program(prog, &res);
+	ctx.res = &res;
 	ctx.out = out;
-	generate_prog(prog, &ctx);
+	labelset_init(&ctx.user_labels);
+	if (jobs > 1)
+		generate_prog_parallel(prog, &ctx, jobs);
+	else
+		generate_prog(prog, &ctx);
 	fflush(out);
 
-	symtable_destroy(&symtable);
+	labelset_destroy(&ctx.user_labels);
+	free(ctx.exp_frames.arr);
+	resolution_release(&res);
 }
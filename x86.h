@@ -1,6 +1,10 @@
 #ifndef _X86_H
 #define _X86_H
 
-void generate_x86_asm(struct ast_program *prog, FILE *out);
+/*
+ * With jobs > 1, the functions are generated by up to that many threads. The
+ * output is the same either way.
+ */
+void generate_x86_asm(struct ast_program *prog, FILE *out, int jobs);
 
 #endif